@@ -0,0 +1,41 @@
+# Renders a small scene with a coordinator and two local workers and checks
+# that the merged image matches a single-process rendering of the scene.
+#
+# Usage: cmake -DPBRT=<pbrt> -DIMGTOOL=<imgtool> -DWORK_DIR=<dir> -P distributed-test.cmake
+
+file (REMOVE_RECURSE ${WORK_DIR})
+file (MAKE_DIRECTORY ${WORK_DIR})
+
+# BDPT splats to pixels outside of the work unit being rendered, so this
+# also covers sending the workers' final film state to the coordinator.
+file (WRITE ${WORK_DIR}/scene.pbrt "
+LookAt 0 3 -6  0 0.5 0  0 1 0
+Camera \"perspective\" \"float fov\" 45
+Sampler \"halton\" \"integer pixelsamples\" 8
+Film \"rgb\" \"integer xresolution\" 40 \"integer yresolution\" 30
+Integrator \"bdpt\" \"integer maxdepth\" 4
+WorldBegin
+LightSource \"point\" \"rgb I\" [10 10 10] \"point3 from\" [-2 4 -2]
+Material \"diffuse\" \"rgb reflectance\" [0.5 0.4 0.3]
+Shape \"trianglemesh\" \"point3 P\" [-5 0 -5 5 0 -5 5 0 5 -5 0 5]
+    \"integer indices\" [0 1 2 0 2 3]
+Translate 0 1 0
+Shape \"sphere\" \"float radius\" 1
+")
+
+function (run_checked)
+  execute_process (COMMAND ${ARGN} WORKING_DIRECTORY ${WORK_DIR}
+                   RESULT_VARIABLE result)
+  if (NOT result EQUAL 0)
+    message (FATAL_ERROR "\"${ARGN}\" failed: ${result}")
+  endif ()
+endfunction ()
+
+run_checked (${PBRT} --quiet --outfile single.pfm scene.pbrt)
+run_checked (${PBRT} --quiet --workers 2 --outfile distributed.pfm scene.pbrt)
+
+# Splats from different workers may be summed in a different order than
+# in a single process, so allow for floating-point rounding.
+run_checked (${IMGTOOL} diff --difftol 0.001 --reference single.pfm distributed.pfm)
+
+file (REMOVE_RECURSE ${WORK_DIR})
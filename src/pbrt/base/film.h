@@ -42,9 +42,16 @@ class FilmHandle : public TaggedPointer<RGBFilm, GBufferFilm> {
 
     PBRT_CPU_GPU
     RGB GetPixelRGB(const Point2i &p, Float splatScale = 1) const;
+    PBRT_CPU_GPU inline Float GetPixelRelativeError(const Point2i &p) const;
     void WriteImage(ImageMetadata metadata, Float splatScale = 1);
     Image GetImage(ImageMetadata *metadata, Float splatScale = 1);
 
+    // Film state, for checkpointing and distributed rendering
+    std::string SaveState(const Bounds2i &bounds);
+    bool RestoreState(const std::string &state);
+    bool MergeState(const std::string &state);
+    void ClearState(const Bounds2i &bounds);
+
     using TaggedPointer::TaggedPointer;
 
     static FilmHandle Create(const std::string &name,
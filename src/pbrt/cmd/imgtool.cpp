@@ -20,6 +20,7 @@
 #include <pbrt/util/sampling.h>
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/string.h>
+#include <pbrt/util/texturecache.h>
 #include <pbrt/util/vecmath.h>
 
 extern "C" {
@@ -156,6 +157,20 @@ static std::map<std::string, CommandUsage> commandUsage = {
     --outfile <name>   Filename to store environment map in.
     --turbidity <t>    Atmospheric turbidity (range 1.7-10). Default: 3
     --resolution <r>   Resolution of generated environment map. Default: 2048
+)")}},
+    {"maketx", {"maketx [options] <filename>", std::string(R"(
+    --encoding <name>  Color encoding of 8-bit images, e.g. "linear", "sRGB", or
+                       "gamma 2.2". Default: "sRGB" for PNG files, "linear"
+                       otherwise, as for image textures.
+    --half             Store texels as 16-bit floats. Default: 8-bit images keep
+                       their 8-bit texels; others use 32-bit floats.
+    --outfile <name>   Filename of tiled texture file. Default: input filename
+                       with a ".tex" extension.
+    --tilesize <n>     Width and height of tiles in texels. Default: 64
+    --wrap <mode>      Wrap mode used to filter the MIP map levels; this should
+                       match the wrap mode of the textures that use the file.
+                       (Options: "repeat", "clamp", "black",
+                       "octahedralsphere".) Default: "repeat"
 )")}},
     {"whitebalance", {"whitebalance [options] <filename>", std::string(R"(
     --illuminant <n>   Apply white balance for the given standard illuminant
@@ -793,6 +808,7 @@ int error(int argc, char *argv[]) {
 int diff(int argc, char *argv[]) {
     std::string outFile, imageFile, referenceFile, metric = "MSE";
     std::array<int, 4> cropWindow = {-1, 0, -1, 0};
+    Float diffTol = 0;
 
     while (*argv != nullptr) {
         auto onError = [](const std::string &err) {
@@ -803,6 +819,7 @@ int diff(int argc, char *argv[]) {
         if (ParseArg(&argv, "outfile", &outFile, onError) ||
             ParseArg(&argv, "reference", &referenceFile, onError) ||
             ParseArg(&argv, "metric", &metric, onError) ||
+            ParseArg(&argv, "difftol", &diffTol, onError) ||
             ParseArg(&argv, "crop", pstd::MakeSpan(cropWindow), onError)) {
             // success
         } else if (argv[0][0] == '-') {
@@ -918,6 +935,8 @@ int diff(int argc, char *argv[]) {
     Float imageAverage = image.Average(image.AllChannelsDesc()).Average();
 
     float delta = 100.f * (imageAverage - refAverage) / refAverage;
+    if (diffTol > 0 && std::abs(delta) <= diffTol)
+        return 0;
     std::string deltaString = StringPrintf("%f%% delta", delta);
     if (std::abs(delta) > 0.1)
         deltaString = Red(deltaString);
@@ -1236,6 +1255,19 @@ int falsecolor(int argc, char *argv[]) {
 int info(int argc, char *argv[]) {
     int err = 0;
     for (int i = 0; i < argc; ++i) {
+        if (HasExtension(argv[i], "tex")) {
+            std::unique_ptr<TiledTextureFile> file = TiledTextureFile::Open(argv[i]);
+            if (!file) {
+                fprintf(stderr, "%s: unable to read tiled texture file\n", argv[i]);
+                err = 1;
+                continue;
+            }
+            printf("%s\n", file->ToString().c_str());
+            for (int level = 0; level < file->Levels(); ++level)
+                printf("\tlevel %d: %d x %d\n", level, file->LevelResolution(level).x,
+                       file->LevelResolution(level).y);
+            continue;
+        }
         ImageAndMetadata im = Image::Read(argv[i]);
         printImageStats(argv[i], im.image, im.metadata);
     }
@@ -1697,6 +1729,69 @@ int whitebalance(int argc, char *argv[]) {
     return 0;
 }
 
+int maketx(int argc, char *argv[]) {
+    std::string inFilename, outFilename, encodingName, wrapName = "repeat";
+    bool half = false;
+    int tileSize = 64;
+
+    auto onError = [](const std::string &err) {
+        usage("maketx", "%s", err.c_str());
+        exit(1);
+    };
+    while (*argv != nullptr) {
+        if (ParseArg(&argv, "encoding", &encodingName, onError) ||
+            ParseArg(&argv, "half", &half, onError) ||
+            ParseArg(&argv, "outfile", &outFilename, onError) ||
+            ParseArg(&argv, "tilesize", &tileSize, onError) ||
+            ParseArg(&argv, "wrap", &wrapName, onError)) {
+            // success
+        } else if (argv[0][0] == '-')
+            usage("maketx", "%s: unknown command flag", *argv);
+        else if (inFilename.empty()) {
+            inFilename = *argv;
+            ++argv;
+        } else
+            usage("maketx", "multiple input filenames provided.");
+    }
+    if (inFilename.empty())
+        usage("maketx", "input image filename must be provided.");
+    if (outFilename.empty())
+        outFilename = RemoveExtension(inFilename) + ".tex";
+    if (HasExtension(inFilename, "tex"))
+        usage("maketx", "%s: input is already a tiled texture file.",
+              inFilename.c_str());
+    if (tileSize <= 0)
+        usage("maketx", "--tilesize must be positive.");
+    pstd::optional<WrapMode> wrapMode = ParseWrapMode(wrapName.c_str());
+    if (!wrapMode)
+        usage("maketx", "%s: wrap mode unknown.", wrapName.c_str());
+    if (encodingName.empty())
+        encodingName = HasExtension(inFilename, "png") ? "sRGB" : "linear";
+
+    // Read image and select the channels that MIPMap uses
+    ImageAndMetadata im =
+        Image::Read(inFilename, {}, ColorEncodingHandle::Get(encodingName));
+    Image &image = im.image;
+    if (image.NChannels() != 1) {
+        ImageChannelDesc rgbDesc = image.GetChannelDesc({"R", "G", "B"});
+        if (!rgbDesc) {
+            fprintf(stderr, "%s: didn't find R, G, and B channels\n",
+                    inFilename.c_str());
+            return 1;
+        }
+        image = image.SelectChannels(rgbDesc);
+    }
+
+    PixelFormat format = half                                     ? PixelFormat::Half
+                         : image.Format() == PixelFormat::U256 ? PixelFormat::U256
+                                                               : PixelFormat::Float;
+    pstd::vector<Image> pyramid = Image::GenerateMIPMap(std::move(image), *wrapMode);
+    if (!WriteTiledTexture(outFilename, pyramid, im.metadata.GetColorSpace(), *wrapMode,
+                           format, tileSize))
+        return 1;
+    return 0;
+}
+
 int makeemitters(int argc, char *argv[]) {
     const char *filename = nullptr;
     int downsampleRate = 1;
@@ -2281,6 +2376,8 @@ int main(int argc, char *argv[]) {
         return makeemitters(argc - 2, argv + 2);
     else if (strcmp(argv[1], "makesky") == 0)
         return makesky(argc - 2, argv + 2);
+    else if (strcmp(argv[1], "maketx") == 0)
+        return maketx(argc - 2, argv + 2);
     else if (strcmp(argv[1], "whitebalance") == 0)
         return whitebalance(argc - 2, argv + 2);
     else if (strcmp(argv[1], "noisybit") == 0) {
@@ -4,6 +4,7 @@
 
 #include <pbrt/pbrt.h>
 
+#include <pbrt/cpu/distributed.h>
 #include <pbrt/cpu/render.h>
 #include <pbrt/options.h>
 #include <pbrt/parsedscene.h>
@@ -17,6 +18,7 @@
 #include <pbrt/util/print.h>
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/string.h>
+#include <pbrt/util/trace.h>
 
 #ifdef NVTX
 #include <sys/syscall.h>
@@ -45,6 +47,14 @@ static void usage(const std::string &msg = {}) {
             R"(usage: pbrt [<options>] <filename.pbrt...>
 
 Rendering options:
+  --bvh-cache <dir>            Cache BVHs in the given directory and reuse them when
+                               the scene geometry is unchanged.
+  --checkpoint <filename>      Periodically save the state of the film to the given
+                               file between sample waves.
+  --checkpoint-interval <s>    Minimum number of seconds between checkpoints.
+                               (Default: 300)
+  --coordinator <host:port>    Render work units for the distributed rendering
+                               coordinator at the given address.
   --cropwindow <x0,x1,y0,y1>   Specify an image crop window w.r.t. [0,1]^2
   --debugstart <values>        Inform the Integrator where to start rendering for
                                faster debugging. (<values> are Integrator-specific
@@ -61,10 +71,16 @@ Rendering options:
 #endif
             R"(
   --help                       Print this help text.
+  --listen <port>              Also accept distributed rendering workers from other
+                               machines on the given port (0: any free port).
   --mse-reference-image        Filename for reference image to use for MSE computation.
   --mse-reference-out          File to write MSE error vs spp results.
   --nthreads <num>             Use specified number of threads for rendering.
+  --numa-replicate             Keep a copy of the BVH nodes in each NUMA node's
+                               memory. Implies --pin-threads.
   --outfile <filename>         Write the final image to the given filename.
+  --pin-threads                Pin each thread to a core, spreading threads evenly
+                               over the NUMA nodes, and report the NUMA topology.
   --pixel <x,y>                Render just the specified pixel.
   --pixelbounds <x0,x1,y0,y1>  Specify an image crop window w.r.t. pixel coordinates.
   --pixelstats                 Record per-pixel statistics and write additional images
@@ -72,11 +88,24 @@ Rendering options:
   --quick                      Automatically reduce a number of quality settings
                                to render more quickly.
   --quiet                      Suppress all text output other than error messages.
+  --resume                     Continue rendering from the file given with
+                               --checkpoint, if it exists.
   --render-coord-sys <name>    Coordinate system to use for the scene when rendering,
                                where name is "camera", "cameraworld", or "world".
   --seed <n>                   Set random number generator seed. Default: 0.
   --spp <n>                    Override number of pixel samples specified in scene
                                description file.
+  --stats-file <filename>      Write the statistics to the given file in JSON format,
+                               even if --quiet is given.
+  --texture-cache <MB>         Store image texture MIP maps on disk and keep at most
+                               the given number of megabytes of their tiles in memory.
+  --time-budget <s>            Stop rendering after the last complete sample wave that
+                               fits in the given number of seconds since pbrt started,
+                               including scene parsing and setup.
+  --trace <filename>           Write a Chrome JSON trace of the rendering phases and
+                               parallel work, viewable in Perfetto.
+  --workers <n>                Split rendering across the given number of local
+                               worker processes.
 
 Logging options:
   --log-level <level>          Log messages at or above this level, where <level>
@@ -107,15 +136,19 @@ int main(int argc, char *argv[]) {
     std::string logLevel = "error";
     std::string renderCoordSys = "cameraworld";
     bool format = false, toPly = false;
+    // Command line for local distributed rendering workers
+    std::vector<std::string> workerArgs = {argv[0]};
 
     // Process command-line arguments
     ++argv;
     while (*argv != nullptr) {
         if ((*argv)[0] != '-') {
             filenames.push_back(*argv);
+            workerArgs.push_back(*argv);
             ++argv;
             continue;
         }
+        char **argStart = argv;
 
         auto onError = [](const std::string &err) {
             usage(err);
@@ -152,6 +185,11 @@ int main(int argc, char *argv[]) {
             ParseArg(&argv, "gpu", &options.useGPU, onError) ||
             ParseArg(&argv, "gpu-device", &options.gpuDevice, onError) ||
 #endif
+            ParseArg(&argv, "bvh-cache", &options.bvhCacheDirectory, onError) ||
+            ParseArg(&argv, "checkpoint", &options.checkpointFile, onError) ||
+            ParseArg(&argv, "checkpoint-interval", &options.checkpointInterval,
+                     onError) ||
+            ParseArg(&argv, "coordinator", &options.coordinatorAddress, onError) ||
             ParseArg(&argv, "debugstart", &options.debugStart, onError) ||
             ParseArg(&argv, "disable-pixel-jitter", &options.disablePixelJitter,
                      onError) ||
@@ -164,17 +202,29 @@ int main(int argc, char *argv[]) {
             ParseArg(&argv, "mse-reference-image", &options.mseReferenceImage, onError) ||
             ParseArg(&argv, "mse-reference-out", &options.mseReferenceOutput, onError) ||
             ParseArg(&argv, "nthreads", &options.nThreads, onError) ||
+            ParseArg(&argv, "numa-replicate", &options.numaReplicate, onError) ||
             ParseArg(&argv, "outfile", &options.imageFile, onError) ||
+            ParseArg(&argv, "pin-threads", &options.pinThreads, onError) ||
             ParseArg(&argv, "pixelstats", &options.recordPixelStatistics, onError) ||
             ParseArg(&argv, "quick", &options.quickRender, onError) ||
             ParseArg(&argv, "quiet", &options.quiet, onError) ||
             ParseArg(&argv, "render-coord-sys", &renderCoordSys, onError) ||
+            ParseArg(&argv, "resume", &options.resume, onError) ||
             ParseArg(&argv, "seed", &options.seed, onError) ||
             ParseArg(&argv, "spp", &options.pixelSamples, onError) ||
+            ParseArg(&argv, "texture-cache", &options.textureCacheMB, onError) ||
+            ParseArg(&argv, "time-budget", &options.timeBudget, onError) ||
             ParseArg(&argv, "toply", &toPly, onError) ||
+            ParseArg(&argv, "trace", &options.traceFile, onError) ||
             ParseArg(&argv, "upgrade", &options.upgrade, onError) ||
             ParseArg(&argv, "vlog-level", &options.logConfig.vlogLevel, onError)) {
             // success
+        } else if (ParseArg(&argv, "listen", &options.listenPort, onError) ||
+                   ParseArg(&argv, "stats-file", &options.statsFile, onError) ||
+                   ParseArg(&argv, "workers", &options.nWorkers, onError)) {
+            // Don't pass distributed rendering coordinator options or the
+            // statistics file, which the coordinator writes, to workers
+            continue;
         } else if ((strcmp(*argv, "--help") == 0) || (strcmp(*argv, "-help") == 0) ||
                    (strcmp(*argv, "-h") == 0)) {
             usage();
@@ -183,6 +233,7 @@ int main(int argc, char *argv[]) {
             usage(StringPrintf("argument \"%s\" unknown", *argv));
             return 1;
         }
+        workerArgs.insert(workerArgs.end(), argStart, argv);
     }
 
     // Print welcome banner
@@ -213,8 +264,29 @@ int main(int argc, char *argv[]) {
                   "--mse-reference-out");
     if (!options.mseReferenceOutput.empty() && options.mseReferenceImage.empty())
         ErrorExit("Must provide MSE reference image via --mse-reference-image");
+    if (options.resume && options.checkpointFile.empty())
+        ErrorExit("Must provide checkpoint filename via --checkpoint with --resume");
+    if (options.checkpointInterval < 0)
+        ErrorExit("--checkpoint-interval must not be negative");
+    bool coordinator = options.nWorkers > 0 || options.listenPort >= 0;
+    if (options.nWorkers < 0)
+        ErrorExit("--workers must not be negative");
+    if (coordinator && !options.coordinatorAddress.empty())
+        ErrorExit("Can't be both a distributed rendering coordinator and a worker.");
+    if ((coordinator || !options.coordinatorAddress.empty()) && options.useGPU)
+        ErrorExit("Distributed rendering isn't supported with --gpu.");
+    if (options.timeBudget < 0)
+        ErrorExit("--time-budget must not be negative");
+    if (options.timeBudget > 0 &&
+        (options.useGPU || coordinator || !options.coordinatorAddress.empty()))
+        ErrorExit("--time-budget isn't supported with --gpu or distributed rendering.");
+    if (options.textureCacheMB < 0)
+        ErrorExit("--texture-cache must not be negative");
+    if (options.textureCacheMB > 0 && options.useGPU)
+        ErrorExit("--texture-cache isn't supported with --gpu.");
 
     options.logConfig.level = LogLevelFromString(logLevel);
+    options.sceneFilenames = filenames;
 
     InitPBRT(options);
 
@@ -224,11 +296,16 @@ int main(int argc, char *argv[]) {
     } else {
         // Parse provided scene description files
         ParsedScene scene;
-        ParseFiles(&scene, filenames);
+        {
+            TRACE_SCOPE("Parse scene");
+            ParseFiles(&scene, filenames);
+        }
 
         // Render scene
         if (options.useGPU)
             GPURender(scene);
+        else if (coordinator)
+            CoordinateDistributedRender(scene, workerArgs);
         else
             CPURender(scene);
 
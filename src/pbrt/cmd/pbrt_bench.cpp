@@ -0,0 +1,1372 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/cpu/accelerators.h>
+#include <pbrt/cpu/primitive.h>
+#include <pbrt/lights.h>
+#include <pbrt/lightsamplers.h>
+#include <pbrt/options.h>
+#include <pbrt/samplers.h>
+#include <pbrt/shapes.h>
+#include <pbrt/util/args.h>
+#include <pbrt/util/check.h>
+#include <pbrt/util/color.h>
+#include <pbrt/util/colorspace.h>
+#include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/hash.h>
+#include <pbrt/util/hashgrid.h>
+#include <pbrt/util/image.h>
+#include <pbrt/util/log.h>
+#include <pbrt/util/lowdiscrepancy.h>
+#include <pbrt/util/memory.h>
+#include <pbrt/util/mesh.h>
+#include <pbrt/util/mipmap.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/print.h>
+#include <pbrt/util/progressreporter.h>
+#include <pbrt/util/rng.h>
+#include <pbrt/util/sampling.h>
+#include <pbrt/util/spectrum.h>
+#include <pbrt/util/transform.h>
+
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace pbrt;
+
+static void usage(const std::string &msg = {}) {
+    if (!msg.empty())
+        fprintf(stderr, "pbrt_bench: %s\n\n", msg.c_str());
+
+    fprintf(stderr, R"(usage: pbrt_bench [<options>] [<benchmark name>...]
+
+Runs the given benchmarks, or all of them if none are specified. Exits with an
+error if any of them fail.
+
+Options:
+  --baseline <filename>        Compare the results to those in the given file, which
+                               was written using --json, and exit with an error if
+                               any are worse by more than the tolerance or missing.
+  --help                       Print this help text.
+  --json <filename>            Write the results to the given file in JSON format.
+  --list                       List the available benchmarks.
+  --log-level <level>          Log messages at or above this level, where <level>
+                               is "verbose", "error", or "fatal". Default: "error".
+  --nthreads <num>             Use specified number of threads.
+  --pbrt <filename>            pbrt executable for the "scenes" benchmark. (Default:
+                               "pbrt" in the same directory as pbrt_bench.)
+  --scale <s>                  Scale the problem size of each benchmark. (Default: 1)
+  --scene-dir <dir>            Directory for the "scenes" benchmark's temporary files.
+                               (Default: $TMPDIR or /tmp.)
+  --tolerance <t>              Fraction by which a result may be worse than the
+                               baseline before it is reported as a regression.
+                               (Default: 0.15)
+)");
+    exit(msg.empty() ? 0 : 1);
+}
+
+// BenchmarkResult Definition
+struct BenchmarkResult {
+    std::string benchmark, metric;
+    double value;
+    std::string units;
+    bool higherIsBetter;
+};
+
+// BenchmarkContext Definition
+struct BenchmarkContext {
+    void Report(const std::string &metric, double value, const std::string &units) {
+        // Rates and speedups improve as they increase; times improve as they
+        // decrease.
+        bool higherIsBetter = units == "x" || (units.size() > 2 &&
+                                               units.substr(units.size() - 2) == "/s");
+        results.push_back(
+            BenchmarkResult{benchmark, metric, value, units, higherIsBetter});
+        printf("  %-48s %14.3f %s\n", metric.c_str(), value, units.c_str());
+        fflush(stdout);
+    }
+
+    std::string benchmark;
+    Float scale = 1;
+    std::string pbrtExecutable, sceneDirectory;
+    std::vector<BenchmarkResult> results;
+    // Number of benchmark runs that failed to produce results
+    int nFailures = 0;
+};
+
+// Benchmark Definition
+struct Benchmark {
+    const char *name;
+    const char *description;
+    std::function<void(BenchmarkContext &)> run;
+};
+
+// JSONValue Definition
+// A minimal representation of JSON values, sufficient for the files written
+// by pbrt_bench and by pbrt's --stats-file option.
+struct JSONValue {
+    enum class Type { Null, Bool, Number, String, Array, Object };
+
+    const JSONValue *Find(const std::string &key) const {
+        for (size_t i = 0; i < keys.size(); ++i)
+            if (keys[i] == key)
+                return &array[i];
+        return nullptr;
+    }
+    double GetNumber(const std::string &key, double def = 0) const {
+        const JSONValue *v = Find(key);
+        return (v && v->type == Type::Number) ? v->number : def;
+    }
+
+    Type type = Type::Null;
+    bool boolean = false;
+    double number = 0;
+    std::string string;
+    // Array elements, or object member values with names in _keys_
+    std::vector<JSONValue> array;
+    std::vector<std::string> keys;
+};
+
+// JSONParser Definition
+class JSONParser {
+  public:
+    JSONParser(const std::string &contents, const std::string &filename)
+        : start(contents.c_str()), p(start), filename(filename) {}
+
+    JSONValue Parse() {
+        JSONValue value = ParseValue();
+        SkipSpace();
+        if (*p != '\0')
+            Fail();
+        return value;
+    }
+
+  private:
+    [[noreturn]] void Fail() const {
+        ErrorExit("%s: malformed JSON at offset %d", filename, int(p - start));
+    }
+    void SkipSpace() {
+        while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+            ++p;
+    }
+    void Expect(char c) {
+        SkipSpace();
+        if (*p++ != c)
+            Fail();
+    }
+    bool Match(const char *str) {
+        if (strncmp(p, str, strlen(str)) != 0)
+            return false;
+        p += strlen(str);
+        return true;
+    }
+
+    std::string ParseString() {
+        Expect('"');
+        std::string str;
+        while (*p != '"') {
+            if (*p == '\0')
+                Fail();
+            // Only the escapes that pbrt writes are handled
+            if (*p == '\\')
+                ++p;
+            str += *p++;
+        }
+        ++p;
+        return str;
+    }
+
+    JSONValue ParseValue() {
+        JSONValue value;
+        SkipSpace();
+        if (*p == '{') {
+            value.type = JSONValue::Type::Object;
+            ++p;
+            SkipSpace();
+            while (*p != '}') {
+                value.keys.push_back(ParseString());
+                Expect(':');
+                value.array.push_back(ParseValue());
+                SkipSpace();
+                if (*p != '}')
+                    Expect(',');
+            }
+            ++p;
+        } else if (*p == '[') {
+            value.type = JSONValue::Type::Array;
+            ++p;
+            SkipSpace();
+            while (*p != ']') {
+                value.array.push_back(ParseValue());
+                SkipSpace();
+                if (*p != ']')
+                    Expect(',');
+            }
+            ++p;
+        } else if (*p == '"') {
+            value.type = JSONValue::Type::String;
+            value.string = ParseString();
+        } else if (Match("true")) {
+            value.type = JSONValue::Type::Bool;
+            value.boolean = true;
+        } else if (Match("false")) {
+            value.type = JSONValue::Type::Bool;
+        } else if (!Match("null")) {
+            char *end;
+            value.type = JSONValue::Type::Number;
+            value.number = strtod(p, &end);
+            if (end == p)
+                Fail();
+            p = end;
+        }
+        return value;
+    }
+
+    const char *start, *p;
+    std::string filename;
+};
+
+// JSON Function Definitions
+static std::string JSONString(const std::string &str) {
+    std::string result = "\"";
+    for (char c : str) {
+        if (c == '"' || c == '\\')
+            result += '\\';
+        result += c;
+    }
+    return result + "\"";
+}
+
+static JSONValue ReadJSONFile(const std::string &filename) {
+    return JSONParser(ReadFileContents(filename), filename).Parse();
+}
+
+// Benchmark Utility Functions
+static std::unique_ptr<TriangleMesh> RandomTriangleMesh(int nTriangles, RNG &rng) {
+    static Transform identity;
+    std::vector<Point3f> p;
+    std::vector<int> indices;
+    for (int i = 0; i < nTriangles; ++i) {
+        Point3f c(Lerp(rng.Uniform<Float>(), -1, 1), Lerp(rng.Uniform<Float>(), -1, 1),
+                  Lerp(rng.Uniform<Float>(), -1, 1));
+        Float size = 4 / std::cbrt(Float(nTriangles));
+        for (int j = 0; j < 3; ++j) {
+            indices.push_back(p.size());
+            p.push_back(c + size * Vector3f(rng.Uniform<Float>() - .5f,
+                                            rng.Uniform<Float>() - .5f,
+                                            rng.Uniform<Float>() - .5f));
+        }
+    }
+    return std::make_unique<TriangleMesh>(identity, false, indices, p,
+                                          std::vector<Vector3f>(),
+                                          std::vector<Normal3f>(),
+                                          std::vector<Point2f>(), std::vector<int>());
+}
+
+// Returns rays from a pinhole at z=-3 through a grid of points on the z=0
+// plane, ordered so that each group of 8 covers a 4x2 block of pixels.
+static std::vector<Ray> CameraRays(int resolution) {
+    std::vector<Ray> rays;
+    Point3f o(0, 0, -3);
+    for (int y0 = 0; y0 < resolution; y0 += 2)
+        for (int x0 = 0; x0 < resolution; x0 += 4)
+            for (int y = y0; y < y0 + 2; ++y)
+                for (int x = x0; x < x0 + 4; ++x) {
+                    Point3f p(Lerp((x + .5f) / resolution, -1, 1),
+                              Lerp((y + .5f) / resolution, -1, 1), 0);
+                    rays.push_back(Ray(o, p - o));
+                }
+    return rays;
+}
+
+static std::vector<Ray> RandomRays(int n, RNG &rng) {
+    std::vector<Ray> rays;
+    for (int i = 0; i < n; ++i) {
+        Point3f o(Lerp(rng.Uniform<Float>(), -2, 2), Lerp(rng.Uniform<Float>(), -2, 2),
+                  Lerp(rng.Uniform<Float>(), -2, 2));
+        rays.push_back(
+            Ray(o, SampleUniformSphere({rng.Uniform<Float>(), rng.Uniform<Float>()})));
+    }
+    return rays;
+}
+
+// Returns millions of rays per second for _trace_ applied to blocks of rays.
+static double MeasureRayThroughput(
+    size_t nRays, std::function<void(size_t start, size_t end)> trace) {
+    constexpr size_t blockSize = 1024;
+    size_t nBlocks = (nRays + blockSize - 1) / blockSize;
+    Timer timer;
+    ParallelFor(0, nBlocks, [&](int64_t block) {
+        trace(block * blockSize, std::min(nRays, (block + 1) * blockSize));
+    });
+    return nRays / timer.ElapsedSeconds() / 1e6;
+}
+
+// Micro-benchmarks fold their results into this so that the work being
+// measured isn't optimized away.
+static volatile double benchmarkSink;
+
+// Returns the average time in nanoseconds for a call to _op_ (which is
+// passed the index of the call) over _nOps_ calls, using the fastest of a
+// few trials to reduce the effect of interference from the rest of the
+// system. Micro-benchmarks run on a single thread.
+template <typename F>
+static double NanosecondsPerOp(int64_t nOps, F op) {
+    constexpr int nTrials = 5;
+    double best = Infinity;
+    for (int trial = 0; trial < nTrials; ++trial) {
+        Timer timer;
+        for (int64_t i = 0; i < nOps; ++i)
+            op(i);
+        best = std::min(best, 1e9 * timer.ElapsedSeconds() / nOps);
+    }
+    return best;
+}
+
+static int64_t MicroBenchmarkOps(const BenchmarkContext &context, int64_t baseOps) {
+    return std::max<int64_t>(1024, baseOps * context.scale);
+}
+
+// Returns rays that start on a sphere of radius 3 around the origin and
+// pass through a random point in the [-1,1]^3 box.
+static std::vector<Ray> RaysTowardOrigin(int n, RNG &rng) {
+    std::vector<Ray> rays;
+    for (int i = 0; i < n; ++i) {
+        Vector3f w = SampleUniformSphere({rng.Uniform<Float>(), rng.Uniform<Float>()});
+        Point3f o(3 * w);
+        Point3f p(Lerp(rng.Uniform<Float>(), -1, 1), Lerp(rng.Uniform<Float>(), -1, 1),
+                  Lerp(rng.Uniform<Float>(), -1, 1));
+        rays.push_back(Ray(o, p - o));
+    }
+    return rays;
+}
+
+// Benchmark Function Definitions
+static void BenchmarkBVHPackets(BenchmarkContext &context) {
+    RNG rng;
+    int nTriangles = std::max(1, int(1000000 * context.scale));
+    std::unique_ptr<TriangleMesh> mesh = RandomTriangleMesh(nTriangles, rng);
+    std::vector<PrimitiveHandle> prims;
+    for (ShapeHandle tri : Triangle::CreateTriangles(mesh.get(), Allocator()))
+        prims.push_back(new SimplePrimitive(tri, nullptr));
+    BVHAccel bvh(prims, 4, BVHAccel::SplitMethod::SAH);
+
+    int resolution = std::max(8, int(1024 * std::sqrt(context.scale)));
+    std::vector<Ray> cameraRays = CameraRays(resolution);
+    std::vector<Ray> randomRays = RandomRays(cameraRays.size(), rng);
+    std::vector<Float> tMax(cameraRays.size(), Infinity);
+
+    for (bool coherent : {true, false}) {
+        const std::vector<Ray> &rays = coherent ? cameraRays : randomRays;
+        std::string prefix = coherent ? "coherent " : "incoherent ";
+
+        double single = MeasureRayThroughput(rays.size(), [&](size_t start, size_t end) {
+            for (size_t i = start; i < end; ++i)
+                bvh.Intersect(rays[i], tMax[i]);
+        });
+        context.Report(prefix + "Intersect() single rays", single, "Mrays/s");
+        double packet = MeasureRayThroughput(rays.size(), [&](size_t start, size_t end) {
+            pstd::optional<ShapeIntersection> si[1024];
+            bvh.Intersect(pstd::span<const Ray>(&rays[start], end - start),
+                          pstd::span<const Float>(&tMax[start], end - start),
+                          pstd::span<pstd::optional<ShapeIntersection>>(si, end - start));
+        });
+        context.Report(prefix + "Intersect() packets", packet, "Mrays/s");
+
+        single = MeasureRayThroughput(rays.size(), [&](size_t start, size_t end) {
+            for (size_t i = start; i < end; ++i)
+                bvh.IntersectP(rays[i], tMax[i]);
+        });
+        context.Report(prefix + "IntersectP() single rays", single, "Mrays/s");
+        packet = MeasureRayThroughput(rays.size(), [&](size_t start, size_t end) {
+            bool occluded[1024];
+            bvh.IntersectP(pstd::span<const Ray>(&rays[start], end - start),
+                           pstd::span<const Float>(&tMax[start], end - start),
+                           pstd::span<bool>(occluded, end - start));
+        });
+        context.Report(prefix + "IntersectP() packets", packet, "Mrays/s");
+    }
+
+    for (PrimitiveHandle p : prims)
+        delete p.Cast<SimplePrimitive>();
+}
+
+// Spins for roughly _cost_ units of work; returns a value that depends on
+// all of it so that the loop isn't optimized away.
+static uint64_t BusyWork(uint64_t seed, int cost) {
+    for (int i = 0; i < cost; ++i)
+        seed = Hash(seed, i);
+    return seed;
+}
+
+static void BenchmarkParallelScaling(BenchmarkContext &context) {
+    int maxThreads = RunningThreads();
+    std::vector<int> threadCounts;
+    for (int n = 1; n < maxThreads; n *= 2)
+        threadCounts.push_back(n);
+    threadCounts.push_back(maxThreads);
+
+    int64_t n1D = std::max<int64_t>(1, int64_t(1 << 20) * context.scale);
+    int resolution = std::max(8, int(1024 * std::sqrt(context.scale)));
+    std::vector<uint64_t> results(std::max<int64_t>(n1D, Sqr(resolution)));
+
+    struct Workload {
+        const char *name;
+        std::function<void(void)> run;
+    };
+    Workload workloads[] = {
+        // Many cheap iterations: dominated by scheduling overhead
+        {"fine-grained ParallelFor",
+         [&]() {
+             for (int rep = 0; rep < 16; ++rep)
+                 ParallelFor(0, n1D, [&](int64_t i) { results[i] = BusyWork(i, 4); });
+         }},
+        // Tiles whose cost varies by two orders of magnitude over the image
+        {"imbalanced ParallelFor2D",
+         [&]() {
+             ParallelFor2D(Bounds2i({0, 0}, {resolution, resolution}), [&](Point2i p) {
+                 int cost = 1 + 200 * Sqr(Sqr(Float(p.x) / resolution));
+                 results[p.y * resolution + p.x] = BusyWork(p.x + p.y, cost);
+             });
+         }},
+        // Small parallel loops issued from within a parallel loop
+        {"nested ParallelFor",
+         [&]() {
+             int64_t nInner = std::max<int64_t>(1, n1D / 256);
+             ParallelFor(0, 256, [&](int64_t outer) {
+                 ParallelFor(0, nInner, [&](int64_t i) {
+                     results[outer * nInner + i] = BusyWork(i, 16);
+                 });
+             });
+         }},
+    };
+
+    std::vector<double> singleThreadTime(std::size(workloads));
+    for (int nThreads : threadCounts) {
+        ParallelCleanup();
+        ParallelInit(nThreads);
+        for (size_t w = 0; w < std::size(workloads); ++w) {
+            Timer timer;
+            workloads[w].run();
+            double elapsed = timer.ElapsedSeconds();
+            if (nThreads == 1)
+                singleThreadTime[w] = elapsed;
+            std::string metric =
+                StringPrintf("%s, %d threads", workloads[w].name, nThreads);
+            context.Report(metric, 1000 * elapsed, "ms");
+            context.Report(metric + " speedup", singleThreadTime[w] / elapsed, "x");
+        }
+    }
+
+    // Restore the thread pool that the other benchmarks expect
+    ParallelCleanup();
+    ParallelInit(maxThreads);
+}
+
+static void BenchmarkTriangleIntersect(BenchmarkContext &context) {
+    RNG rng;
+    constexpr int nTriangles = 1 << 12, nRays = 1 << 16;
+    std::vector<Point3f> p;
+    for (int i = 0; i < 3 * nTriangles; ++i)
+        p.push_back(Point3f(Lerp(rng.Uniform<Float>(), -1, 1),
+                            Lerp(rng.Uniform<Float>(), -1, 1),
+                            Lerp(rng.Uniform<Float>(), -1, 1)));
+    std::vector<Ray> rays = RaysTowardOrigin(nRays, rng);
+
+    int64_t nHits = 0;
+    double ns = NanosecondsPerOp(MicroBenchmarkOps(context, 1 << 22), [&](int64_t i) {
+        const Ray &ray = rays[i & (nRays - 1)];
+        int t = 3 * ((i * 7919) & (nTriangles - 1));
+        if (Triangle::Intersect(ray, Infinity, p[t], p[t + 1], p[t + 2]))
+            ++nHits;
+    });
+    benchmarkSink = nHits;
+    context.Report("Triangle::Intersect()", ns, "ns/op");
+}
+
+static void BenchmarkBoundsIntersect(BenchmarkContext &context) {
+    RNG rng;
+    constexpr int nBounds = 1 << 12, nRays = 1 << 16;
+    std::vector<Bounds3f> bounds;
+    for (int i = 0; i < nBounds; ++i) {
+        auto r = [&]() { return Lerp(rng.Uniform<Float>(), -1, 1); };
+        bounds.push_back(Bounds3f(Point3f(r(), r(), r()), Point3f(r(), r(), r())));
+    }
+    std::vector<Ray> rays = RaysTowardOrigin(nRays, rng);
+    std::vector<Vector3f> invDir;
+    std::vector<std::array<int, 3>> dirIsNeg;
+    for (const Ray &ray : rays) {
+        invDir.push_back(Vector3f(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z));
+        dirIsNeg.push_back({int(invDir.back().x < 0), int(invDir.back().y < 0),
+                            int(invDir.back().z < 0)});
+    }
+    int64_t ops = MicroBenchmarkOps(context, 1 << 23);
+
+    int64_t nHits = 0;
+    double ns = NanosecondsPerOp(ops, [&](int64_t i) {
+        const Ray &ray = rays[i & (nRays - 1)];
+        Float t0, t1;
+        if (bounds[(i * 7919) & (nBounds - 1)].IntersectP(ray.o, ray.d, Infinity, &t0,
+                                                          &t1))
+            ++nHits;
+    });
+    context.Report("Bounds3f::IntersectP()", ns, "ns/op");
+
+    ns = NanosecondsPerOp(ops, [&](int64_t i) {
+        int r = i & (nRays - 1);
+        if (bounds[(i * 7919) & (nBounds - 1)].IntersectP(rays[r].o, rays[r].d, Infinity,
+                                                          invDir[r], &dirIsNeg[r][0]))
+            ++nHits;
+    });
+    benchmarkSink = nHits;
+    context.Report("Bounds3f::IntersectP() with precomputed 1/d", ns, "ns/op");
+}
+
+static void BenchmarkBVHIntersect(BenchmarkContext &context) {
+    RNG rng;
+    for (int nTriangles : {1 << 10, std::max(1, int((1 << 18) * context.scale))}) {
+        std::unique_ptr<TriangleMesh> mesh = RandomTriangleMesh(nTriangles, rng);
+        std::vector<PrimitiveHandle> prims;
+        for (ShapeHandle tri : Triangle::CreateTriangles(mesh.get(), Allocator()))
+            prims.push_back(new SimplePrimitive(tri, nullptr));
+        BVHAccel bvh(prims, 4, BVHAccel::SplitMethod::SAH);
+
+        constexpr int nRays = 1 << 16;
+        std::vector<Ray> rays = RandomRays(nRays, rng);
+        int64_t ops = MicroBenchmarkOps(context, 1 << 18);
+
+        int64_t nHits = 0;
+        double ns = NanosecondsPerOp(ops, [&](int64_t i) {
+            if (bvh.Intersect(rays[i & (nRays - 1)], Infinity))
+                ++nHits;
+        });
+        context.Report(StringPrintf("BVHAccel::Intersect(), %d triangles", nTriangles),
+                       ns, "ns/op");
+
+        ns = NanosecondsPerOp(ops, [&](int64_t i) {
+            if (bvh.IntersectP(rays[i & (nRays - 1)], Infinity))
+                ++nHits;
+        });
+        benchmarkSink = nHits;
+        context.Report(StringPrintf("BVHAccel::IntersectP(), %d triangles", nTriangles),
+                       ns, "ns/op");
+
+        for (PrimitiveHandle p : prims)
+            delete p.Cast<SimplePrimitive>();
+    }
+}
+
+// Returns the time to generate the samples for a pixel sample that
+// consumes the pixel sample, four 2D samples, and two 1D samples.
+template <typename S>
+static double SamplerNanosecondsPerSample(const BenchmarkContext &context, S &sampler) {
+    int spp = sampler.SamplesPerPixel();
+    Float sum = 0;
+    double ns = NanosecondsPerOp(MicroBenchmarkOps(context, 1 << 20), [&](int64_t i) {
+        Point2i pixel((i / spp) & 1023, (i / (1024 * spp)) & 1023);
+        sampler.StartPixelSample(pixel, i % spp, 0);
+        for (int d = 0; d < 5; ++d) {
+            Point2f u = sampler.Get2D();
+            sum += u.x + u.y;
+        }
+        sum += sampler.Get1D() + sampler.Get1D();
+    });
+    benchmarkSink = sum;
+    return ns;
+}
+
+static void BenchmarkSamplers(BenchmarkContext &context) {
+    constexpr int spp = 64;
+    for (RandomizeStrategy randomize :
+         {RandomizeStrategy::Xor, RandomizeStrategy::Owen}) {
+        SobolSampler sobol(spp, Point2i(1024, 1024), randomize);
+        std::string metric =
+            StringPrintf("SobolSampler (%s), 12 dimensions", ToString(randomize));
+        context.Report(metric, SamplerNanosecondsPerSample(context, sobol), "ns/sample");
+    }
+    PMJ02BNSampler pmj(spp);
+    context.Report("PMJ02BNSampler, 12 dimensions",
+                   SamplerNanosecondsPerSample(context, pmj), "ns/sample");
+}
+
+static void BenchmarkMIPMap(BenchmarkContext &context) {
+    RNG rng;
+    int resolution = 1024;
+    std::string channels[] = {"R", "G", "B"};
+    Image image(PixelFormat::Float, Point2i(resolution, resolution), channels);
+    for (int y = 0; y < resolution; ++y)
+        for (int x = 0; x < resolution; ++x)
+            for (int c = 0; c < 3; ++c)
+                image.SetChannel(Point2i(x, y), c, rng.Uniform<Float>());
+    MIPMapFilterOptions options;
+    options.filter = FilterFunction::EWA;
+    MIPMap mipmap(std::move(image), RGBColorSpace::sRGB, WrapMode::Repeat, Allocator(),
+                  options);
+
+    // Lookups with footprints from 1 to 64 texels wide and random
+    // orientations and anisotropy
+    constexpr int nLookups = 1 << 14;
+    std::vector<Point2f> st;
+    std::vector<Vector2f> dst0, dst1;
+    for (int i = 0; i < nLookups; ++i) {
+        st.push_back(Point2f(rng.Uniform<Float>(), rng.Uniform<Float>()));
+        Float width = std::pow(2.f, Lerp(rng.Uniform<Float>(), 0, 6)) / resolution;
+        Float aspect = Lerp(rng.Uniform<Float>(), 1, 16);
+        Float theta = 2 * Pi * rng.Uniform<Float>();
+        Vector2f major(std::cos(theta), std::sin(theta));
+        dst0.push_back(width * major);
+        dst1.push_back(width / aspect * Vector2f(-major.y, major.x));
+    }
+
+    Float sum = 0;
+    double ns = NanosecondsPerOp(MicroBenchmarkOps(context, 1 << 18), [&](int64_t i) {
+        int j = i & (nLookups - 1);
+        sum += mipmap.Lookup<RGB>(st[j], dst0[j], dst1[j]).Average();
+    });
+    benchmarkSink = sum;
+    context.Report("EWA Lookup<RGB>()", ns, "ns/op");
+}
+
+static void BenchmarkLightSampler(BenchmarkContext &context) {
+    RNG rng;
+    ConstantSpectrum one(1.f);
+    std::vector<std::unique_ptr<PointLight>> pointLights;
+    std::vector<LightHandle> lights;
+    for (int i = 0; i < 1024; ++i) {
+        Vector3f p(Lerp(rng.Uniform<Float>(), -10, 10),
+                   Lerp(rng.Uniform<Float>(), -10, 10),
+                   Lerp(rng.Uniform<Float>(), -10, 10));
+        pointLights.push_back(std::make_unique<PointLight>(
+            Translate(p), MediumInterface(), &one, 1.f, Allocator()));
+        lights.push_back(pointLights.back().get());
+    }
+    BVHLightSampler lightSampler(lights, Allocator());
+
+    constexpr int nContexts = 1 << 14;
+    std::vector<LightSampleContext> contexts;
+    for (int i = 0; i < nContexts; ++i) {
+        Point3f p(Lerp(rng.Uniform<Float>(), -12, 12),
+                  Lerp(rng.Uniform<Float>(), -12, 12),
+                  Lerp(rng.Uniform<Float>(), -12, 12));
+        Normal3f n(SampleUniformSphere({rng.Uniform<Float>(), rng.Uniform<Float>()}));
+        contexts.push_back(LightSampleContext(Point3fi(p), n, n));
+    }
+
+    Float sum = 0;
+    double ns = NanosecondsPerOp(MicroBenchmarkOps(context, 1 << 20), [&](int64_t i) {
+        Float u = RadicalInverse(0, i);
+        pstd::optional<SampledLight> sl =
+            lightSampler.Sample(contexts[i & (nContexts - 1)], u);
+        if (sl)
+            sum += sl->pdf;
+    });
+    benchmarkSink = sum;
+    context.Report("BVHLightSampler::Sample(), 1024 point lights", ns, "ns/op");
+}
+
+static void BenchmarkSampledSpectrum(BenchmarkContext &context) {
+    RNG rng;
+    constexpr int n = 1 << 12;
+    std::vector<SampledSpectrum> s;
+    std::vector<SampledWavelengths> lambda;
+    for (int i = 0; i < n; ++i) {
+        SampledSpectrum v;
+        for (int j = 0; j < NSpectrumSamples; ++j)
+            v[j] = rng.Uniform<Float>();
+        s.push_back(v);
+        lambda.push_back(SampledWavelengths::SampleXYZ(rng.Uniform<Float>()));
+    }
+    int64_t ops = MicroBenchmarkOps(context, 1 << 23);
+
+    SampledSpectrum acc(0.f);
+    double ns = NanosecondsPerOp(ops, [&](int64_t i) {
+        acc = acc * s[i & (n - 1)] + s[(i + 1) & (n - 1)];
+    });
+    context.Report("SampledSpectrum a * b + c", ns, "ns/op");
+
+    ns = NanosecondsPerOp(
+        ops, [&](int64_t i) { acc += SafeDiv(s[i & (n - 1)], s[(i + 1) & (n - 1)]); });
+    context.Report("SafeDiv(SampledSpectrum)", ns, "ns/op");
+
+    ns = NanosecondsPerOp(ops, [&](int64_t i) { acc += Exp(-s[i & (n - 1)]); });
+    context.Report("Exp(SampledSpectrum)", ns, "ns/op");
+
+    Float sum = acc.Average();
+    ns = NanosecondsPerOp(ops, [&](int64_t i) {
+        sum += s[i & (n - 1)].y(lambda[(i * 7919) & (n - 1)]);
+    });
+    benchmarkSink = sum;
+    context.Report("SampledSpectrum::y()", ns, "ns/op");
+}
+
+static void BenchmarkRGBToSpectrum(BenchmarkContext &context) {
+    RNG rng;
+    constexpr int n = 1 << 14;
+    std::vector<RGB> rgb;
+    std::vector<SampledWavelengths> lambda;
+    for (int i = 0; i < n; ++i) {
+        rgb.push_back(
+            RGB(rng.Uniform<Float>(), rng.Uniform<Float>(), rng.Uniform<Float>()));
+        lambda.push_back(SampledWavelengths::SampleXYZ(rng.Uniform<Float>()));
+    }
+    int64_t ops = MicroBenchmarkOps(context, 1 << 22);
+
+    Float sum = 0;
+    const RGBToSpectrumTable &table = *RGBToSpectrumTable::sRGB;
+    double ns = NanosecondsPerOp(ops, [&](int64_t i) {
+        sum += table(rgb[i & (n - 1)])(550.f);
+    });
+    context.Report("RGBToSpectrumTable::operator()", ns, "ns/op");
+
+    ns = NanosecondsPerOp(ops, [&](int64_t i) {
+        RGBReflectanceSpectrum rs(*RGBColorSpace::sRGB, rgb[i & (n - 1)]);
+        sum += rs.Sample(lambda[(i * 7919) & (n - 1)]).Average();
+    });
+    benchmarkSink = sum;
+    context.Report("RGBReflectanceSpectrum::Sample()", ns, "ns/op");
+}
+
+// LinkedListGrid Definition
+// The hash grid that SPPMIntegrator used before HashGrid: a linked list of
+// items is built for each hashed cell by atomically pushing nodes allocated
+// from scratch buffers. The items are split into one chunk per thread and
+// each chunk's scratch buffer is sized for the nodes that its items need.
+struct LinkedListGrid {
+    struct Node {
+        int item;
+        Node *next;
+    };
+
+    LinkedListGrid(pstd::span<const Point3f> p, pstd::span<const Float> radius,
+                   int hashSize)
+        : p(p), radius(radius), grid(hashSize) {
+        Float maxRadius = 0;
+        for (size_t i = 0; i < p.size(); ++i) {
+            bounds = Union(bounds, Expand(Bounds3f(p[i]), radius[i]));
+            maxRadius = std::max(maxRadius, radius[i]);
+        }
+        Vector3f diag = bounds.Diagonal();
+        Float maxDiag = MaxComponentValue(diag);
+        for (int i = 0; i < 3; ++i)
+            gridRes[i] = std::max<int>(int(maxDiag / maxRadius) * diag[i] / maxDiag, 1);
+
+        // Allocate a scratch buffer for each chunk of items
+        int nChunks = MaxThreadIndex();
+        auto chunkStart = [&](int64_t c) { return c * int64_t(p.size()) / nChunks; };
+        scratchBuffers.resize(nChunks);
+        ParallelFor(0, nChunks, [&](int64_t c) {
+            int64_t nNodes = 0;
+            for (int64_t i = chunkStart(c); i < chunkStart(c + 1); ++i) {
+                Point3i pMin, pMax;
+                ItemCells(i, &pMin, &pMax);
+                nNodes += int64_t(pMax.x - pMin.x + 1) * (pMax.y - pMin.y + 1) *
+                          (pMax.z - pMin.z + 1);
+            }
+            scratchBuffers[c] =
+                ScratchBuffer(std::max<int64_t>(1, nNodes) * sizeof(Node));
+        });
+
+        // Add items to the grid cells that they overlap
+        ParallelFor(0, nChunks, [&](int64_t c) {
+            ScratchBuffer &scratchBuffer = scratchBuffers[c];
+            for (int64_t i = chunkStart(c); i < chunkStart(c + 1); ++i) {
+                Point3i pMin, pMax;
+                ItemCells(i, &pMin, &pMax);
+                for (int z = pMin.z; z <= pMax.z; ++z)
+                    for (int y = pMin.y; y <= pMax.y; ++y)
+                        for (int x = pMin.x; x <= pMax.x; ++x) {
+                            std::atomic<Node *> &head =
+                                grid[Hash(x, y, z) % grid.size()];
+                            Node *node = scratchBuffer.Alloc<Node>();
+                            node->item = i;
+                            node->next = head;
+                            while (!head.compare_exchange_weak(node->next, node))
+                                ;
+                        }
+            }
+        });
+    }
+
+    void ItemCells(int64_t i, Point3i *pMin, Point3i *pMax) const {
+        Vector3f r(radius[i], radius[i], radius[i]);
+        ToGrid(p[i] - r, pMin);
+        ToGrid(p[i] + r, pMax);
+    }
+
+    bool ToGrid(Point3f pt, Point3i *pi) const {
+        bool inBounds = true;
+        Vector3f pg = bounds.Offset(pt);
+        for (int i = 0; i < 3; ++i) {
+            (*pi)[i] = (int)(gridRes[i] * pg[i]);
+            inBounds &= ((*pi)[i] >= 0 && (*pi)[i] < gridRes[i]);
+            (*pi)[i] = Clamp((*pi)[i], 0, gridRes[i] - 1);
+        }
+        return inBounds;
+    }
+
+    template <typename F>
+    void ForEachOverlapping(Point3f pt, F func) const {
+        Point3i pi;
+        if (!ToGrid(pt, &pi))
+            return;
+        int h = Hash(pi.x, pi.y, pi.z) % grid.size();
+        for (Node *node = grid[h].load(std::memory_order_relaxed); node;
+             node = node->next)
+            if (DistanceSquared(p[node->item], pt) <= Sqr(radius[node->item]))
+                func(node->item);
+    }
+
+    pstd::span<const Point3f> p;
+    pstd::span<const Float> radius;
+    Bounds3f bounds;
+    int gridRes[3];
+    std::vector<std::atomic<Node *>> grid;
+    std::vector<ScratchBuffer> scratchBuffers;
+};
+
+static void BenchmarkSPPMGrid(BenchmarkContext &context) {
+    // Generate visible points in pixel order and photons on a bumpy surface,
+    // roughly as SPPMIntegrator sees them for a 1024x1024 image
+    RNG rng;
+    int resolution = std::max(32, int(1024 * std::sqrt(context.scale)));
+    int nPoints = Sqr(resolution);
+    int64_t nPhotons = std::max<int64_t>(1024, int64_t(1 << 22) * context.scale);
+    auto SurfacePoint = [](Float x, Float y) {
+        return Point3f(x, y, 0.05f * std::sin(20 * x) * std::cos(15 * y));
+    };
+    std::vector<Point3f> p(nPoints), photons(nPhotons);
+    std::vector<Float> radius(nPoints);
+    for (int i = 0; i < nPoints; ++i) {
+        p[i] = SurfacePoint((i % resolution + rng.Uniform<Float>()) / resolution,
+                            (i / resolution + rng.Uniform<Float>()) / resolution);
+        radius[i] = (1 + rng.Uniform<Float>()) / resolution;
+    }
+    for (Point3f &photon : photons)
+        photon = SurfacePoint(rng.Uniform<Float>(), rng.Uniform<Float>());
+    int hashSize = NextPrime(nPoints);
+    std::vector<std::atomic<int>> count(nPoints);
+
+    auto PhotonsPerSecond = [&](auto &grid) {
+        Timer timer;
+        ParallelFor(0, nPhotons, [&](int64_t start, int64_t end) {
+            for (int64_t i = start; i < end; ++i)
+                grid.ForEachOverlapping(photons[i], [&](int item) {
+                    count[item].fetch_add(1, std::memory_order_relaxed);
+                });
+        });
+        return nPhotons / timer.ElapsedSeconds() / 1e6;
+    };
+
+    // Measure the linked-list grid
+    Timer timer;
+    LinkedListGrid listGrid(p, radius, hashSize);
+    context.Report("linked-list grid build", 1000 * timer.ElapsedSeconds(), "ms");
+    context.Report("linked-list grid photon lookups", PhotonsPerSecond(listGrid),
+                   "Mphotons/s");
+
+    // Measure _HashGrid_, building it a second time to measure reuse
+    auto getSphere = [&](int i, Point3f *pi, Float *ri) {
+        *pi = p[i];
+        *ri = radius[i];
+        return true;
+    };
+    HashGrid hashGrid;
+    timer = Timer();
+    hashGrid.Build(nPoints, getSphere, hashSize);
+    context.Report("HashGrid build", 1000 * timer.ElapsedSeconds(), "ms");
+    timer = Timer();
+    hashGrid.Build(nPoints, getSphere, hashSize);
+    context.Report("HashGrid rebuild", 1000 * timer.ElapsedSeconds(), "ms");
+    context.Report("HashGrid photon lookups", PhotonsPerSecond(hashGrid), "Mphotons/s");
+}
+
+// Scene Benchmark Definitions
+// Each generator returns the description of a scene, writing any files
+// that it references to _directory_.
+struct BenchmarkScene {
+    const char *name;
+    std::function<std::string(const std::string &directory, Float scale, RNG &rng)>
+        generate;
+};
+
+static std::string SceneHeader(const char *integrator, int maxDepth) {
+    return StringPrintf(
+        "LookAt 0 6 -14  0 0.5 0  0 1 0\n"
+        "Camera \"perspective\" \"float fov\" 40\n"
+        "Sampler \"pmj02bn\"\n"
+        "Integrator \"%s\" \"integer maxdepth\" %d\n"
+        "WorldBegin\n",
+        integrator, maxDepth);
+}
+
+static std::string GroundPlane() {
+    return "AttributeBegin\n"
+           "Material \"diffuse\" \"rgb reflectance\" [0.4 0.4 0.4]\n"
+           "Shape \"bilinearmesh\" \"point3 P\" [-20 0 -20 20 0 -20 -20 0 20 20 0 20]\n"
+           "AttributeEnd\n";
+}
+
+static std::string SkyAndSun() {
+    return "LightSource \"infinite\" \"rgb L\" [0.3 0.35 0.4]\n"
+           "LightSource \"distant\" \"point3 to\" [-1 -3 2] \"rgb L\" [2 2 1.8]\n";
+}
+
+// Returns a "trianglemesh" shape for a height field over [-r,r]^2 in x-z
+// with _n_ x _n_ vertices.
+static std::string HeightFieldMesh(int n, Float r, RNG &rng) {
+    Float phase[4];
+    for (Float &ph : phase)
+        ph = 2 * Pi * rng.Uniform<Float>();
+    std::string str = "Shape \"trianglemesh\" \"point3 P\" [";
+    for (int z = 0; z < n; ++z)
+        for (int x = 0; x < n; ++x) {
+            Float u = Float(x) / (n - 1), v = Float(z) / (n - 1);
+            Float h = 0.3f * std::sin(13 * u + phase[0]) * std::sin(11 * v + phase[1]) +
+                      0.05f * std::sin(97 * u + phase[2]) * std::sin(89 * v + phase[3]);
+            str += StringPrintf(" %f %f %f", Lerp(u, -r, r), 1 + h, Lerp(v, -r, r));
+        }
+    str += " ] \"integer indices\" [";
+    for (int z = 0; z < n - 1; ++z)
+        for (int x = 0; x < n - 1; ++x) {
+            int v00 = z * n + x, v10 = v00 + 1, v01 = v00 + n, v11 = v01 + 1;
+            str += StringPrintf(" %d %d %d %d %d %d", v00, v10, v11, v00, v11, v01);
+        }
+    return str + " ]\n";
+}
+
+static std::string InstancesScene(const std::string &, Float scale, RNG &rng) {
+    std::string str = SceneHeader("path", 5) + SkyAndSun() + GroundPlane();
+    str += "ObjectBegin \"rock\"\n"
+           "Material \"coateddiffuse\" \"rgb reflectance\" [0.5 0.3 0.2]\n";
+    str += HeightFieldMesh(16, 0.5f, rng);
+    str += "ObjectEnd\n";
+
+    int n = std::max(1, int(200 * std::sqrt(scale)));
+    for (int i = 0; i < n; ++i)
+        for (int j = 0; j < n; ++j) {
+            Float x = Lerp((i + .5f) / n, -16, 16), z = Lerp((j + .5f) / n, -16, 16);
+            str += StringPrintf("AttributeBegin\nTranslate %f 0 %f\nRotate %f 0 1 0\n"
+                                "Scale %f %f %f\nObjectInstance \"rock\"\nAttributeEnd\n",
+                                x, z, 360 * rng.Uniform<Float>(), 16.f / n,
+                                Lerp(rng.Uniform<Float>(), 4, 16) / n, 16.f / n);
+        }
+    return str;
+}
+
+static std::string DenseMeshScene(const std::string &, Float scale, RNG &rng) {
+    std::string str = SceneHeader("path", 5) + SkyAndSun() + GroundPlane();
+    str += "Material \"conductor\" \"float roughness\" 0.1\n";
+    return str + HeightFieldMesh(std::max(2, int(400 * std::sqrt(scale))), 8, rng);
+}
+
+static std::string TexturesScene(const std::string &directory, Float scale, RNG &rng) {
+    std::string str = SceneHeader("path", 5) + SkyAndSun();
+    int resolution = std::max(8, int(1024 * std::sqrt(scale)));
+    std::string channels[] = {"R", "G", "B"};
+    for (int t = 0; t < 8; ++t) {
+        // Write an image of random-colored stripes with per-texel noise
+        Image image(PixelFormat::Float, Point2i(resolution, resolution), channels);
+        Float freq = Lerp(rng.Uniform<Float>(), 4, 64), color[3];
+        for (Float &c : color)
+            c = rng.Uniform<Float>();
+        for (int y = 0; y < resolution; ++y)
+            for (int x = 0; x < resolution; ++x) {
+                Float stripe = .5f + .5f * std::sin(freq * 2 * Pi * (x + y) / resolution);
+                for (int c = 0; c < 3; ++c) {
+                    Float noise = Lerp(rng.Uniform<Float>(), .8f, 1);
+                    image.SetChannel(Point2i(x, y), c, color[c] * stripe * noise);
+                }
+            }
+        std::string filename = StringPrintf("%s/pbrt_bench_texture%d.pfm", directory, t);
+        if (!image.Write(filename))
+            ErrorExit("%s: unable to write texture", filename);
+
+        // Use it on a tile of the ground plane
+        Float x0 = Lerp((t % 4) / 4.f, -16, 16), z0 = Lerp((t / 4) / 2.f, -16, 16);
+        str += StringPrintf("Texture \"tex%d\" \"spectrum\" \"imagemap\" "
+                            "\"string filename\" \"%s\" \"string filter\" \"ewa\"\n"
+                            "AttributeBegin\n"
+                            "Material \"diffuse\" \"texture reflectance\" \"tex%d\"\n"
+                            "Shape \"bilinearmesh\" \"point3 P\" "
+                            "[%f 0 %f %f 0 %f %f 0 %f %f 0 %f]\nAttributeEnd\n",
+                            t, filename, t, x0, z0, x0 + 8, z0, x0, z0 + 16, x0 + 8,
+                            z0 + 16);
+    }
+    return str;
+}
+
+static std::string VolumeScene(const std::string &, Float scale, RNG &rng) {
+    std::string str = SceneHeader("volpath", 10) + SkyAndSun() + GroundPlane();
+    // A cloud of overlapping Gaussian blobs
+    int n = std::max(4, int(64 * std::cbrt(scale)));
+    Point3f centers[8];
+    for (Point3f &c : centers)
+        c = Point3f(Lerp(rng.Uniform<Float>(), .3f, .7f),
+                    Lerp(rng.Uniform<Float>(), .3f, .7f),
+                    Lerp(rng.Uniform<Float>(), .3f, .7f));
+    str += StringPrintf("MakeNamedMedium \"cloud\" \"string type\" \"heterogeneous\" "
+                        "\"rgb sigma_a\" [0.5 0.5 0.5] \"rgb sigma_s\" [4 4 4] "
+                        "\"integer nx\" %d \"integer ny\" %d \"integer nz\" %d "
+                        "\"point3 p0\" [-4 0 -4] \"point3 p1\" [4 8 4] "
+                        "\"float density\" [",
+                        n, n, n);
+    for (int z = 0; z < n; ++z)
+        for (int y = 0; y < n; ++y)
+            for (int x = 0; x < n; ++x) {
+                Point3f p((x + .5f) / n, (y + .5f) / n, (z + .5f) / n);
+                Float density = 0;
+                for (Point3f c : centers)
+                    density += std::exp(-DistanceSquared(p, c) / .01f);
+                str += StringPrintf(" %f", density);
+            }
+    str += " ]\n"
+           "AttributeBegin\n"
+           "MediumInterface \"cloud\" \"\"\n"
+           "Material \"none\"\n"
+           "Translate -4 0 -4\n"
+           "Shape \"trianglemesh\" \"point3 P\" [0 0 0 8 0 0 0 8 0 8 8 0 0 0 8 8 0 8 "
+           "0 8 8 8 8 8] \"integer indices\" [0 2 1 1 2 3 4 5 6 5 7 6 0 1 4 1 5 4 "
+           "2 6 3 3 6 7 0 4 2 2 4 6 1 3 5 3 7 5]\n"
+           "AttributeEnd\n";
+    return str;
+}
+
+static std::string ManyLightsScene(const std::string &, Float scale, RNG &rng) {
+    std::string str = SceneHeader("path", 5) + GroundPlane();
+    int nLights = std::max(1, int(1024 * scale));
+    for (int i = 0; i < nLights; ++i)
+        str += StringPrintf("AttributeBegin\nAreaLightSource \"diffuse\" \"rgb L\" "
+                            "[%f %f %f]\nTranslate %f %f %f\n"
+                            "Shape \"sphere\" \"float radius\" 0.05\nAttributeEnd\n",
+                            Lerp(rng.Uniform<Float>(), 1, 20),
+                            Lerp(rng.Uniform<Float>(), 1, 20),
+                            Lerp(rng.Uniform<Float>(), 1, 20),
+                            Lerp(rng.Uniform<Float>(), -16, 16),
+                            Lerp(rng.Uniform<Float>(), 0.1f, 4),
+                            Lerp(rng.Uniform<Float>(), -16, 16));
+    str += "Material \"diffuse\" \"rgb reflectance\" [0.6 0.6 0.6]\n";
+    for (int i = 0; i < 64; ++i)
+        str += StringPrintf("AttributeBegin\nTranslate %f 1 %f\n"
+                            "Shape \"sphere\" \"float radius\" 1\nAttributeEnd\n",
+                            Lerp(rng.Uniform<Float>(), -16, 16),
+                            Lerp(rng.Uniform<Float>(), -16, 16));
+    return str;
+}
+
+static void BenchmarkScenes(BenchmarkContext &context) {
+    BenchmarkScene scenes[] = {{"instances", InstancesScene},
+                               {"dense-mesh", DenseMeshScene},
+                               {"textures", TexturesScene},
+                               {"volume", VolumeScene},
+                               {"many-lights", ManyLightsScene}};
+    int resolution = std::max(16, int(128 * std::sqrt(context.scale)));
+    constexpr int spp = 16;
+    const std::string &dir = context.sceneDirectory;
+
+    for (const BenchmarkScene &scene : scenes) {
+        // Write the scene description
+        RNG rng(HashBuffer(scene.name, strlen(scene.name)));
+        std::string sceneFile = dir + "/pbrt_bench_scene.pbrt";
+        std::string imageFile = dir + "/pbrt_bench_scene.pfm";
+        std::string statsFile = dir + "/pbrt_bench_scene_stats.json";
+        std::string description =
+            StringPrintf("Film \"rgb\" \"integer xresolution\" %d "
+                         "\"integer yresolution\" %d\n",
+                         resolution, resolution) +
+            scene.generate(dir, context.scale, rng);
+        if (!WriteFile(sceneFile, description)) {
+            fprintf(stderr, "pbrt_bench: %s: unable to write scene\n", sceneFile.c_str());
+            ++context.nFailures;
+            return;
+        }
+
+        // Render it with pbrt and read the statistics that it reports
+        std::string command = StringPrintf(
+            "\"%s\" --quiet --spp %d --stats-file \"%s\" --outfile \"%s\"",
+            context.pbrtExecutable, spp, statsFile, imageFile);
+        if (Options->nThreads != 0)
+            command += StringPrintf(" --nthreads %d", Options->nThreads);
+        command += StringPrintf(" \"%s\"", sceneFile);
+        fflush(stdout);
+        int status = system(command.c_str());
+        remove(sceneFile.c_str());
+        remove(imageFile.c_str());
+        if (status != 0) {
+            // Error() is silenced by --quiet, so report this directly
+            fprintf(stderr, "pbrt_bench: %s: pbrt failed with status %d: %s\n",
+                    scene.name, status, command.c_str());
+            ++context.nFailures;
+            continue;
+        }
+        JSONValue stats = ReadJSONFile(statsFile);
+        remove(statsFile.c_str());
+
+        // Report throughput, memory use, and the time spent in each phase
+        JSONValue empty;
+        const JSONValue *counters = stats.Find("counters");
+        const JSONValue *timers = stats.Find("timers");
+        if (!counters)
+            counters = &empty;
+        if (!timers)
+            timers = &empty;
+        std::string name = scene.name;
+        double renderTime = timers->GetNumber("Time/Rendering");
+        double rays =
+            counters->GetNumber("Intersections/Regular ray intersection tests") +
+            counters->GetNumber("Intersections/Shadow ray intersection tests");
+        double samples = counters->GetNumber("Integrator/Camera rays traced");
+        if (renderTime > 0) {
+            context.Report(name + ": rays", rays / renderTime / 1e6, "Mrays/s");
+            context.Report(name + ": samples", samples / renderTime / 1e6, "Msamples/s");
+        }
+        context.Report(name + ": peak RSS", stats.GetNumber("peakRSS") / (1 << 20),
+                       "MiB");
+        // Phases that didn't run are skipped; the set of results reported
+        // must not depend on timing so that missing results can be detected.
+        // The per-phase BVH timers are summed over threads, so report the
+        // wall-clock time instead.
+        double bvhBuildMS = 1000 * timers->GetNumber("BVH/Build wall-clock time");
+        if (bvhBuildMS > 0)
+            context.Report(name + ": BVH build", bvhBuildMS, "ms");
+        for (size_t i = 0; i < timers->keys.size(); ++i) {
+            double ms = 1000 * timers->array[i].number;
+            if (timers->keys[i].compare(0, 5, "Time/") == 0 && ms > 0)
+                context.Report(name + ": " + timers->keys[i].substr(5), ms, "ms");
+        }
+    }
+
+    for (int t = 0; t < 8; ++t)
+        remove(StringPrintf("%s/pbrt_bench_texture%d.pfm", dir, t).c_str());
+}
+
+static std::vector<Benchmark> benchmarks = {
+    {"bvh-packets", "Single-ray vs. packet BVH traversal throughput",
+     BenchmarkBVHPackets},
+    {"parallel-scaling", "Thread pool scaling from 1 to --nthreads threads",
+     BenchmarkParallelScaling},
+    {"triangle-intersect", "Ray-triangle intersection tests",
+     BenchmarkTriangleIntersect},
+    {"bounds-intersect", "Ray-bounding box intersection tests", BenchmarkBoundsIntersect},
+    {"bvh-intersect", "Single-threaded BVH traversal of random triangles",
+     BenchmarkBVHIntersect},
+    {"samplers", "SobolSampler and PMJ02BNSampler sample generation", BenchmarkSamplers},
+    {"mipmap-ewa", "MIPMap EWA filtered lookups", BenchmarkMIPMap},
+    {"light-sampler", "BVHLightSampler light sampling", BenchmarkLightSampler},
+    {"sampled-spectrum", "SampledSpectrum arithmetic", BenchmarkSampledSpectrum},
+    {"rgb-to-spectrum", "RGB to spectrum conversion", BenchmarkRGBToSpectrum},
+    {"sppm-grid", "SPPM visible point grid construction and photon lookups",
+     BenchmarkSPPMGrid},
+    {"scenes", "End-to-end rendering of generated scenes with the pbrt executable",
+     BenchmarkScenes},
+};
+
+// Benchmark Results Function Definitions
+static bool WriteBenchmarkResults(const std::string &filename,
+                                  const std::vector<BenchmarkResult> &results,
+                                  Float scale) {
+    std::string json = StringPrintf("{\n  \"scale\": %f,\n  \"threads\": %d,\n"
+                                    "  \"results\": [",
+                                    scale, RunningThreads());
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchmarkResult &r = results[i];
+        json += StringPrintf("%s\n    { \"benchmark\": %s, \"metric\": %s, "
+                             "\"value\": %.9g, \"units\": %s, \"higherIsBetter\": %s }",
+                             i > 0 ? "," : "", JSONString(r.benchmark),
+                             JSONString(r.metric), r.value, JSONString(r.units),
+                             r.higherIsBetter ? "true" : "false");
+    }
+    json += "\n  ]\n}\n";
+    return WriteFile(filename, json);
+}
+
+// Reads the "results" array of a file written by WriteBenchmarkResults().
+static std::vector<BenchmarkResult> ReadBenchmarkResults(const std::string &filename) {
+    JSONValue json = ReadJSONFile(filename);
+    const JSONValue *array = json.Find("results");
+    if (!array || array->type != JSONValue::Type::Array)
+        ErrorExit("%s: no benchmark results found", filename);
+
+    std::vector<BenchmarkResult> results;
+    for (const JSONValue &r : array->array) {
+        const JSONValue *benchmark = r.Find("benchmark"), *metric = r.Find("metric");
+        const JSONValue *units = r.Find("units"), *value = r.Find("value");
+        const JSONValue *higherIsBetter = r.Find("higherIsBetter");
+        if (!benchmark || !metric || !units || !value || !higherIsBetter)
+            ErrorExit("%s: incomplete benchmark result", filename);
+        results.push_back(BenchmarkResult{benchmark->string, metric->string,
+                                          value->number, units->string,
+                                          higherIsBetter->boolean});
+    }
+    return results;
+}
+
+// Prints a comparison of _results_ to _baseline_ and returns the number of
+// results that are worse than the baseline by more than _tolerance_ plus
+// the number of baseline results of the benchmarks in _benchmarksRun_ that
+// are missing from _results_.
+static int CompareBenchmarkResults(const std::vector<BenchmarkResult> &results,
+                                   const std::vector<BenchmarkResult> &baseline,
+                                   const std::vector<std::string> &benchmarksRun,
+                                   Float tolerance) {
+    std::map<std::pair<std::string, std::string>, const BenchmarkResult *> baselineMap;
+    for (const BenchmarkResult &r : baseline)
+        baselineMap[std::make_pair(r.benchmark, r.metric)] = &r;
+    std::map<std::pair<std::string, std::string>, const BenchmarkResult *> resultsMap;
+    for (const BenchmarkResult &r : results)
+        resultsMap[std::make_pair(r.benchmark, r.metric)] = &r;
+
+    printf("\nComparison to baseline (tolerance %.1f%%)\n", 100 * tolerance);
+    int nRegressions = 0;
+    for (const BenchmarkResult &r : results) {
+        auto iter = baselineMap.find(std::make_pair(r.benchmark, r.metric));
+        std::string name = r.benchmark + ": " + r.metric;
+        if (iter == baselineMap.end() || iter->second->units != r.units) {
+            printf("  %-64s %12.3f %s (not in baseline)\n", name.c_str(), r.value,
+                   r.units.c_str());
+            continue;
+        }
+        // Compute _slowdown_, the relative amount by which _r_ is worse
+        const BenchmarkResult &base = *iter->second;
+        if (base.value <= 0 || r.value <= 0) {
+            printf("  %-64s %12.3f -> %12.3f %s\n", name.c_str(), base.value, r.value,
+                   r.units.c_str());
+            continue;
+        }
+        double slowdown = r.higherIsBetter ? base.value / r.value - 1
+                                           : r.value / base.value - 1;
+        // Times under a millisecond are mostly noise, so they aren't checked
+        bool regressed = slowdown > tolerance && !(r.units == "ms" && base.value < 1);
+        nRegressions += regressed;
+        printf("  %-64s %12.3f -> %12.3f %s (%+.1f%%)%s\n", name.c_str(), base.value,
+               r.value, r.units.c_str(), 100 * (r.value / base.value - 1),
+               regressed ? " REGRESSION" : "");
+    }
+
+    // Report baseline results that weren't reproduced, e.g. due to a crash
+    for (const BenchmarkResult &base : baseline) {
+        if (std::find(benchmarksRun.begin(), benchmarksRun.end(), base.benchmark) ==
+                benchmarksRun.end() ||
+            resultsMap.count(std::make_pair(base.benchmark, base.metric)))
+            continue;
+        std::string name = base.benchmark + ": " + base.metric;
+        printf("  %-64s %12.3f %s (MISSING)\n", name.c_str(), base.value,
+               base.units.c_str());
+        ++nRegressions;
+    }
+    return nRegressions;
+}
+
+// main program
+int main(int argc, char *argv[]) {
+    PBRTOptions options;
+    options.quiet = true;
+    std::string logLevel = "error";
+    Float scale = 1, tolerance = 0.15f;
+    std::string jsonFile, baselineFile, pbrtExecutable, sceneDirectory;
+    bool list = false;
+    std::vector<std::string> names;
+    std::string programName = argv[0];
+
+    // Process command-line arguments
+    ++argv;
+    while (*argv != nullptr) {
+        if ((*argv)[0] != '-') {
+            names.push_back(*argv);
+            ++argv;
+            continue;
+        }
+
+        auto onError = [](const std::string &err) {
+            usage(err);
+            exit(1);
+        };
+        if (ParseArg(&argv, "baseline", &baselineFile, onError) ||
+            ParseArg(&argv, "json", &jsonFile, onError) ||
+            ParseArg(&argv, "list", &list, onError) ||
+            ParseArg(&argv, "log-level", &logLevel, onError) ||
+            ParseArg(&argv, "nthreads", &options.nThreads, onError) ||
+            ParseArg(&argv, "pbrt", &pbrtExecutable, onError) ||
+            ParseArg(&argv, "scale", &scale, onError) ||
+            ParseArg(&argv, "scene-dir", &sceneDirectory, onError) ||
+            ParseArg(&argv, "tolerance", &tolerance, onError)) {
+            // success
+        } else if ((strcmp(*argv, "--help") == 0) || (strcmp(*argv, "-h") == 0)) {
+            usage();
+            return 0;
+        } else {
+            usage(StringPrintf("argument \"%s\" unknown", *argv));
+            return 1;
+        }
+    }
+
+    if (list) {
+        for (const Benchmark &b : benchmarks)
+            printf("%-24s %s\n", b.name, b.description);
+        return 0;
+    }
+    for (const std::string &name : names)
+        if (std::find_if(benchmarks.begin(), benchmarks.end(), [&](const Benchmark &b) {
+                return name == b.name;
+            }) == benchmarks.end())
+            usage(StringPrintf("%s: benchmark not found", name));
+    if (scale <= 0)
+        usage("--scale must be positive");
+    if (tolerance < 0)
+        usage("--tolerance must not be negative");
+    if (pbrtExecutable.empty()) {
+        // Use the pbrt executable that was built along with pbrt_bench
+        size_t slash = programName.find_last_of("/\\");
+        pbrtExecutable =
+            (slash == std::string::npos ? "" : programName.substr(0, slash + 1)) + "pbrt";
+    }
+    if (sceneDirectory.empty())
+        sceneDirectory = TemporaryDirectory();
+
+    options.logConfig.level = LogLevelFromString(logLevel);
+    InitPBRT(options);
+
+    BenchmarkContext context;
+    context.scale = scale;
+    context.pbrtExecutable = pbrtExecutable;
+    context.sceneDirectory = sceneDirectory;
+    std::vector<std::string> benchmarksRun;
+    for (const Benchmark &b : benchmarks) {
+        if (!names.empty() &&
+            std::find(names.begin(), names.end(), b.name) == names.end())
+            continue;
+        printf("%s (%d threads)\n", b.name, RunningThreads());
+        context.benchmark = b.name;
+        b.run(context);
+        benchmarksRun.push_back(b.name);
+    }
+    if (context.nFailures > 0)
+        fprintf(stderr, "pbrt_bench: %d benchmark run(s) failed.\n", context.nFailures);
+
+    if (!jsonFile.empty() && !WriteBenchmarkResults(jsonFile, context.results, scale))
+        return 1;
+    int nRegressions = 0;
+    if (!baselineFile.empty()) {
+        nRegressions = CompareBenchmarkResults(context.results,
+                                               ReadBenchmarkResults(baselineFile),
+                                               benchmarksRun, tolerance);
+        if (nRegressions > 0)
+            printf("%d result(s) regressed or are missing.\n", nRegressions);
+    }
+
+    CleanupPBRT();
+    return (nRegressions > 0 || context.nFailures > 0) ? 1 : 0;
+}
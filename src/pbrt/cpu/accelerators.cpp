@@ -5,17 +5,39 @@
 #include <pbrt/cpu/accelerators.h>
 
 #include <pbrt/interaction.h>
+#include <pbrt/materials.h>
+#include <pbrt/options.h>
 #include <pbrt/paramdict.h>
 #include <pbrt/shapes.h>
+#include <pbrt/textures.h>
 #include <pbrt/util/bits.h>
 #include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/hash.h>
 #include <pbrt/util/log.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
+#include <pbrt/util/progressreporter.h>
 #include <pbrt/util/stats.h>
+#include <pbrt/util/trace.h>
 
 #include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#if defined(__SSE__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+#ifdef PBRT_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
 
 namespace pbrt {
 
@@ -24,6 +46,52 @@ STAT_RATIO("BVH/Primitives per leaf node", totalPrimitives, totalLeafNodes);
 STAT_COUNTER("BVH/Interior nodes", interiorNodes);
 STAT_COUNTER("BVH/Leaf nodes", leafNodes);
 STAT_PIXEL_COUNTER("BVH/Nodes visited", bvhNodesVisited);
+STAT_COUNTER("BVH/Wide nodes", wideNodesCreated);
+STAT_RATIO("BVH/Children per wide node", totalWideChildren, totalWideNodes);
+STAT_RATIO("BVH/Nodes visited per traversal", bvhTraversalSteps, bvhTraversals);
+STAT_MEMORY_COUNTER("Memory/BVH compressed node savings", compressedBytesSaved);
+STAT_COUNTER("BVH/Ray packets traced", bvhPackets);
+STAT_COUNTER("BVH/Ray packets traced as single rays", bvhIncoherentPackets);
+STAT_COUNTER("BVH/Packet subtrees traced with a single ray", bvhPacketSingleRaySubtrees);
+STAT_COUNTER("BVH/Cache hits", bvhCacheHits);
+STAT_COUNTER("BVH/Cache misses", bvhCacheMisses);
+STAT_MEMORY_COUNTER("Memory/BVH cache mapped", bvhCacheBytesMapped);
+STAT_MEMORY_COUNTER("Memory/BVH NUMA node replicas", bvhReplicaBytes);
+STAT_PIXEL_RATIO("Intersections/Mesh primitive ray-triangle tests", meshTriHits,
+                 meshTriTests);
+// Timers are summed over threads, so the phase timers below give the total
+// time that threads spent in each phase, which may be more than the elapsed
+// time if BVHs or their subtrees are built in parallel.
+STAT_TIMER("BVH/Build thread time: primitive info", buildPrimitiveInfoTime);
+STAT_TIMER("BVH/Build thread time: tree construction", buildTreeTime);
+STAT_TIMER("BVH/Build thread time: parallel bounds", buildParallelBoundsTime);
+STAT_TIMER("BVH/Build thread time: parallel binning", buildParallelBinningTime);
+STAT_TIMER("BVH/Build thread time: parallel partitioning", buildParallelPartitionTime);
+STAT_TIMER("BVH/Build thread time: flattening", buildFlattenTime);
+STAT_TIMER("BVH/Build thread time: HLBVH Morton codes", buildMortonTime);
+STAT_TIMER("BVH/Build thread time: HLBVH radix sort", buildRadixSortTime);
+STAT_TIMER("BVH/Build thread time: HLBVH treelet emission", buildTreeletTime);
+STAT_TIMER("BVH/Build thread time: HLBVH upper SAH", buildUpperSAHTime);
+STAT_TIMER("BVH/Build wall-clock time", buildWallClockTime);
+
+// BVH Build Wall-Clock Timing
+// The elapsed time during which at least one BVH is being built is
+// accumulated by whichever build finishes last.
+static std::mutex bvhBuildWallClockMutex;
+static int nActiveBVHBuilds;
+static Timer bvhBuildWallClockTimer;
+
+static void BeginBVHBuildWallClock() {
+    std::lock_guard<std::mutex> lock(bvhBuildWallClockMutex);
+    if (nActiveBVHBuilds++ == 0)
+        bvhBuildWallClockTimer = Timer();
+}
+
+static void EndBVHBuildWallClock() {
+    std::lock_guard<std::mutex> lock(bvhBuildWallClockMutex);
+    if (--nActiveBVHBuilds == 0)
+        buildWallClockTime += bvhBuildWallClockTimer.ElapsedSeconds();
+}
 
 // MortonPrimitive Definition
 struct MortonPrimitive {
@@ -45,6 +113,9 @@ static void RadixSort(std::vector<MortonPrimitive> *v) {
     static_assert((nBits % bitsPerPass) == 0,
                   "Radix sort bitsPerPass must evenly divide nBits");
     constexpr int nPasses = nBits / bitsPerPass;
+    // Split the array into chunks that are histogrammed and scattered in parallel
+    constexpr int chunkSize = 64 * 1024;
+    int nChunks = std::max<int>(1, (v->size() + chunkSize - 1) / chunkSize);
     for (int pass = 0; pass < nPasses; ++pass) {
         // Perform one pass of radix sort, sorting _bitsPerPass_ bits
         int lowBit = pass * bitsPerPass;
@@ -52,28 +123,38 @@ static void RadixSort(std::vector<MortonPrimitive> *v) {
         std::vector<MortonPrimitive> &in = (pass & 1) ? tempVector : *v;
         std::vector<MortonPrimitive> &out = (pass & 1) ? *v : tempVector;
 
-        // Count number of zero bits in array for current radix sort bit
+        // Count number of values in each bucket for each chunk
         constexpr int nBuckets = 1 << bitsPerPass;
-        int bucketCount[nBuckets] = {0};
         constexpr int bitMask = (1 << bitsPerPass) - 1;
-        for (const MortonPrimitive &mp : in) {
-            int bucket = (mp.mortonCode >> lowBit) & bitMask;
-            CHECK_GE(bucket, 0);
-            CHECK_LT(bucket, nBuckets);
-            ++bucketCount[bucket];
-        }
+        std::vector<std::array<int, nBuckets>> bucketCount(nChunks);
+        ParallelFor(0, nChunks, [&](int64_t chunk) {
+            bucketCount[chunk].fill(0);
+            size_t end = std::min(in.size(), size_t(chunk + 1) * chunkSize);
+            for (size_t i = chunk * chunkSize; i < end; ++i) {
+                int bucket = (in[i].mortonCode >> lowBit) & bitMask;
+                DCHECK_GE(bucket, 0);
+                DCHECK_LT(bucket, nBuckets);
+                ++bucketCount[chunk][bucket];
+            }
+        });
 
-        // Compute starting index in output array for each bucket
-        int outIndex[nBuckets];
-        outIndex[0] = 0;
-        for (int i = 1; i < nBuckets; ++i)
-            outIndex[i] = outIndex[i - 1] + bucketCount[i - 1];
+        // Compute starting index in output array for each chunk's buckets
+        std::vector<std::array<int, nBuckets>> outIndex(nChunks);
+        int offset = 0;
+        for (int bucket = 0; bucket < nBuckets; ++bucket)
+            for (int chunk = 0; chunk < nChunks; ++chunk) {
+                outIndex[chunk][bucket] = offset;
+                offset += bucketCount[chunk][bucket];
+            }
 
         // Store sorted values in output array
-        for (const MortonPrimitive &mp : in) {
-            int bucket = (mp.mortonCode >> lowBit) & bitMask;
-            out[outIndex[bucket]++] = mp;
-        }
+        ParallelFor(0, nChunks, [&](int64_t chunk) {
+            size_t end = std::min(in.size(), size_t(chunk + 1) * chunkSize);
+            for (size_t i = chunk * chunkSize; i < end; ++i) {
+                int bucket = (in[i].mortonCode >> lowBit) & bitMask;
+                out[outIndex[chunk][bucket]++] = in[i];
+            }
+        });
     }
     // Copy final result from _tempVector_, if needed
     if (nPasses & 1)
@@ -125,6 +206,134 @@ struct BVHBuildNode {
     int splitAxis, firstPrimOffset, nPrimitives;
 };
 
+// BVH Parallel Build Definitions
+// Ranges of at least this many primitives have their bounds, SAH buckets,
+// and partition computed in parallel. That work is split into fixed-size
+// chunks so that the resulting tree doesn't depend on the thread count.
+static constexpr int parallelSplitMinPrimitives = 256 * 1024;
+static constexpr int parallelChunkSize = 16 * 1024;
+// Subtrees with at least this many primitives are built in parallel
+static constexpr int parallelSubtreeMinPrimitives = 16 * 1024;
+
+// BVH Parallel Build Function Definitions
+template <typename F>
+static void ForEachChunk(int start, int end, F func) {
+    int nChunks = (end - start + parallelChunkSize - 1) / parallelChunkSize;
+    ParallelFor(0, nChunks, [&](int64_t chunk) {
+        int chunkStart = start + chunk * parallelChunkSize;
+        int chunkEnd = std::min(end, chunkStart + parallelChunkSize);
+        func(chunk, chunkStart, chunkEnd);
+    });
+}
+
+static void ComputeBounds(const std::vector<BVHPrimitiveInfo> &primitiveInfo, int start,
+                          int end, Bounds3f *bounds, Bounds3f *centroidBounds) {
+    auto computeRange = [&](int s, int e, Bounds3f *b, Bounds3f *cb) {
+        for (int i = s; i < e; ++i) {
+            *b = Union(*b, primitiveInfo[i].bounds);
+            *cb = Union(*cb, primitiveInfo[i].centroid);
+        }
+    };
+    if (end - start < parallelSplitMinPrimitives) {
+        computeRange(start, end, bounds, centroidBounds);
+        return;
+    }
+
+    // Compute bounds of chunks in parallel and then merge them
+    Timer timer;
+    int nChunks = (end - start + parallelChunkSize - 1) / parallelChunkSize;
+    std::vector<Bounds3f> chunkBounds(nChunks), chunkCentroidBounds(nChunks);
+    ForEachChunk(start, end, [&](int chunk, int s, int e) {
+        computeRange(s, e, &chunkBounds[chunk], &chunkCentroidBounds[chunk]);
+    });
+    for (int i = 0; i < nChunks; ++i) {
+        *bounds = Union(*bounds, chunkBounds[i]);
+        *centroidBounds = Union(*centroidBounds, chunkCentroidBounds[i]);
+    }
+    buildParallelBoundsTime += timer.ElapsedSeconds();
+}
+
+template <int nBuckets, typename BucketIndex>
+static void ComputeBuckets(const std::vector<BVHPrimitiveInfo> &primitiveInfo, int start,
+                           int end, BucketIndex bucketIndex,
+                           BucketInfo buckets[nBuckets]) {
+    auto binRange = [&](int s, int e, BucketInfo *b) {
+        for (int i = s; i < e; ++i) {
+            int index = bucketIndex(primitiveInfo[i]);
+            b[index].count++;
+            b[index].bounds = Union(b[index].bounds, primitiveInfo[i].bounds);
+        }
+    };
+    if (end - start < parallelSplitMinPrimitives) {
+        binRange(start, end, buckets);
+        return;
+    }
+
+    // Bin chunks of primitives in parallel and then merge the buckets
+    Timer timer;
+    int nChunks = (end - start + parallelChunkSize - 1) / parallelChunkSize;
+    std::vector<std::array<BucketInfo, nBuckets>> chunkBuckets(nChunks);
+    ForEachChunk(start, end, [&](int chunk, int s, int e) {
+        binRange(s, e, chunkBuckets[chunk].data());
+    });
+    for (int i = 0; i < nChunks; ++i)
+        for (int b = 0; b < nBuckets; ++b) {
+            buckets[b].count += chunkBuckets[i][b].count;
+            buckets[b].bounds = Union(buckets[b].bounds, chunkBuckets[i][b].bounds);
+        }
+    buildParallelBinningTime += timer.ElapsedSeconds();
+}
+
+// Partitions _primitiveInfo[start, end)_ so that all elements satisfying
+// _pred_ come first and returns the index of the first one that doesn't.
+template <typename Pred>
+static int PartitionPrimitives(std::vector<BVHPrimitiveInfo> &primitiveInfo, int start,
+                               int end, Pred pred) {
+    if (end - start < parallelSplitMinPrimitives) {
+        BVHPrimitiveInfo *pmid =
+            std::partition(&primitiveInfo[start], &primitiveInfo[end - 1] + 1, pred);
+        return pmid - &primitiveInfo[0];
+    }
+
+    Timer timer;
+    // Count primitives in each chunk that go in the first subset
+    int nChunks = (end - start + parallelChunkSize - 1) / parallelChunkSize;
+    std::vector<int> chunkBelow(nChunks, 0);
+    ForEachChunk(start, end, [&](int chunk, int s, int e) {
+        for (int i = s; i < e; ++i)
+            if (pred(primitiveInfo[i]))
+                ++chunkBelow[chunk];
+    });
+
+    // Compute each chunk's output offsets for both subsets
+    std::vector<int> belowOffset(nChunks), aboveOffset(nChunks);
+    int nBelow = 0;
+    for (int i = 0; i < nChunks; ++i) {
+        belowOffset[i] = nBelow;
+        nBelow += chunkBelow[i];
+    }
+    for (int i = 0; i < nChunks; ++i)
+        aboveOffset[i] = nBelow + i * parallelChunkSize - belowOffset[i];
+
+    // Scatter primitives to a temporary buffer and copy them back
+    std::vector<BVHPrimitiveInfo> partitioned(end - start);
+    ForEachChunk(start, end, [&](int chunk, int s, int e) {
+        int below = belowOffset[chunk], above = aboveOffset[chunk];
+        for (int i = s; i < e; ++i) {
+            if (pred(primitiveInfo[i]))
+                partitioned[below++] = primitiveInfo[i];
+            else
+                partitioned[above++] = primitiveInfo[i];
+        }
+    });
+    ForEachChunk(start, end, [&](int chunk, int s, int e) {
+        std::copy(&partitioned[s - start], &partitioned[e - start - 1] + 1,
+                  &primitiveInfo[s]);
+    });
+    buildParallelPartitionTime += timer.ElapsedSeconds();
+    return start + nBelow;
+}
+
 // LinearBVHNode Definition
 struct alignas(32) LinearBVHNode {
     Bounds3f bounds;
@@ -136,18 +345,297 @@ struct alignas(32) LinearBVHNode {
     uint8_t axis;          // interior node: xyz
 };
 
+// BVHAccel Wide Node Intersection Functions
+template <int N>
+inline int IntersectChildBounds(const Float boundsMin[3][N], const Float boundsMax[3][N],
+                                const Point3f &o, const Vector3f &invDir,
+                                const int dirIsNeg[3], Float raytMax, Float tEnter[N]) {
+    int hitMask = 0;
+    for (int i = 0; i < N; ++i) {
+        Float t0 = 0, t1 = raytMax;
+        for (int a = 0; a < 3; ++a) {
+            Float bNear = dirIsNeg[a] ? boundsMax[a][i] : boundsMin[a][i];
+            Float bFar = dirIsNeg[a] ? boundsMin[a][i] : boundsMax[a][i];
+            Float tNear = (bNear - o[a]) * invDir[a];
+            Float tFar = (bFar - o[a]) * invDir[a] * (1 + 2 * gamma(3));
+            // Written so that NaNs (from $0 \cdot \infty$) leave the interval as is
+            t0 = tNear > t0 ? tNear : t0;
+            t1 = tFar < t1 ? tFar : t1;
+        }
+        tEnter[i] = t0;
+        if (t0 <= t1)
+            hitMask |= 1 << i;
+    }
+    return hitMask;
+}
+
+#if defined(__SSE__) && !defined(PBRT_FLOAT_AS_DOUBLE)
+template <>
+inline int IntersectChildBounds<4>(const Float boundsMin[3][4],
+                                   const Float boundsMax[3][4], const Point3f &o,
+                                   const Vector3f &invDir, const int dirIsNeg[3],
+                                   Float raytMax, Float tEnter[4]) {
+    __m128 t0 = _mm_setzero_ps(), t1 = _mm_set1_ps(raytMax);
+    const __m128 farScale = _mm_set1_ps(1 + 2 * gamma(3));
+    for (int a = 0; a < 3; ++a) {
+        __m128 org = _mm_set1_ps(o[a]), inv = _mm_set1_ps(invDir[a]);
+        __m128 bNear = _mm_load_ps(dirIsNeg[a] ? boundsMax[a] : boundsMin[a]);
+        __m128 bFar = _mm_load_ps(dirIsNeg[a] ? boundsMin[a] : boundsMax[a]);
+        __m128 tNear = _mm_mul_ps(_mm_sub_ps(bNear, org), inv);
+        __m128 tFar = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(bFar, org), inv), farScale);
+        // _mm_{max,min}_ps() return their second operand if either is NaN
+        t0 = _mm_max_ps(tNear, t0);
+        t1 = _mm_min_ps(tFar, t1);
+    }
+    _mm_storeu_ps(tEnter, t0);
+    return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+}
+#endif  // __SSE__ && !PBRT_FLOAT_AS_DOUBLE
+
+#if defined(__AVX__) && !defined(PBRT_FLOAT_AS_DOUBLE)
+template <>
+inline int IntersectChildBounds<8>(const Float boundsMin[3][8],
+                                   const Float boundsMax[3][8], const Point3f &o,
+                                   const Vector3f &invDir, const int dirIsNeg[3],
+                                   Float raytMax, Float tEnter[8]) {
+    __m256 t0 = _mm256_setzero_ps(), t1 = _mm256_set1_ps(raytMax);
+    const __m256 farScale = _mm256_set1_ps(1 + 2 * gamma(3));
+    for (int a = 0; a < 3; ++a) {
+        __m256 org = _mm256_set1_ps(o[a]), inv = _mm256_set1_ps(invDir[a]);
+        __m256 bNear = _mm256_load_ps(dirIsNeg[a] ? boundsMax[a] : boundsMin[a]);
+        __m256 bFar = _mm256_load_ps(dirIsNeg[a] ? boundsMin[a] : boundsMax[a]);
+        __m256 tNear = _mm256_mul_ps(_mm256_sub_ps(bNear, org), inv);
+        __m256 tFar =
+            _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(bFar, org), inv), farScale);
+        t0 = _mm256_max_ps(tNear, t0);
+        t1 = _mm256_min_ps(tFar, t1);
+    }
+    _mm256_storeu_ps(tEnter, t0);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+}
+#endif  // __AVX__ && !PBRT_FLOAT_AS_DOUBLE
+
+// WideBVHNode Definition
+template <int N>
+struct alignas(64) WideBVHNode {
+    static constexpr int Width = N;
+    static constexpr bool Compressed = false;
+
+    void Init(const Bounds3f &nodeBounds, int nChildren) {
+        // Give unused child slots the default empty bounds (pMin at the largest
+        // finite _Float_, pMax at the lowest), which never pass the slab test.
+        for (int i = nChildren; i < N; ++i)
+            SetChild(i, Bounds3f(), -1, 0);
+    }
+    void SetChild(int i, const Bounds3f &b, int childOffset, int nPrims) {
+        for (int a = 0; a < 3; ++a) {
+            boundsMin[a][i] = b.pMin[a];
+            boundsMax[a][i] = b.pMax[a];
+        }
+        offset[i] = childOffset;
+        nPrimitives[i] = nPrims;
+    }
+
+    int IntersectChildren(const Point3f &o, const Vector3f &invDir,
+                          const int dirIsNeg[3], Float raytMax, Float tEnter[N]) const {
+        return IntersectChildBounds<N>(boundsMin, boundsMax, o, invDir, dirIsNeg,
+                                       raytMax, tEnter);
+    }
+
+    // Child bounds are stored SoA so that all _N_ children's slabs can be
+    // tested with a single SIMD operation per axis.
+    Float boundsMin[3][N], boundsMax[3][N];
+    int offset[N];            // interior child: node index; leaf: first primitive
+    uint16_t nPrimitives[N];  // 0 -> interior child
+};
+
+// QuantizedBVHNode Definition
+template <int N>
+struct QuantizedBVHNode {
+    static constexpr int Width = N;
+    static constexpr bool Compressed = true;
+
+    void Init(const Bounds3f &nodeBounds, int n) {
+        nChildren = n;
+        for (int a = 0; a < 3; ++a) {
+            // Use a power-of-two scale so that $q \cdot \roman{scale}$ is exact
+            // and decoding gives the same result whether or not it is fused
+            origin[a] = nodeBounds.pMin[a];
+            int exp;
+            std::frexp((nodeBounds.pMax[a] - nodeBounds.pMin[a]) / 255, &exp);
+            scale[a] = std::ldexp(Float(1), exp);
+        }
+    }
+    void SetChild(int i, const Bounds3f &b, int childOffset, int nPrims) {
+        for (int a = 0; a < 3; ++a) {
+            // Round child bounds outward so that the decoded box contains _b_
+            int q0 = Clamp(int(std::floor((b.pMin[a] - origin[a]) / scale[a])), 0, 255);
+            while (q0 > 0 && Decode(a, q0) > b.pMin[a])
+                --q0;
+            int q1 = Clamp(int(std::ceil((b.pMax[a] - origin[a]) / scale[a])), 0, 255);
+            while (q1 < 255 && Decode(a, q1) < b.pMax[a])
+                ++q1;
+            // Traversal relies on the decoded bounds being conservative
+            CHECK(Decode(a, q0) <= b.pMin[a] && Decode(a, q1) >= b.pMax[a]);
+            qMin[a][i] = q0;
+            qMax[a][i] = q1;
+        }
+        offset[i] = childOffset;
+        nPrimitives[i] = nPrims;
+    }
+
+    Float Decode(int axis, int q) const { return origin[axis] + q * scale[axis]; }
+
+    int IntersectChildren(const Point3f &o, const Vector3f &invDir,
+                          const int dirIsNeg[3], Float raytMax, Float tEnter[N]) const {
+        // Decode all children's bounds at once with the per-axis origin and
+        // scale hoisted out of the loop so that it vectorizes.
+        alignas(32) Float boundsMin[3][N], boundsMax[3][N];
+        for (int a = 0; a < 3; ++a) {
+            const Float org = origin[a], s = scale[a];
+            for (int i = 0; i < N; ++i) {
+                boundsMin[a][i] = org + Float(qMin[a][i]) * s;
+                boundsMax[a][i] = org + Float(qMax[a][i]) * s;
+            }
+        }
+        int hitMask = IntersectChildBounds<N>(boundsMin, boundsMax, o, invDir, dirIsNeg,
+                                              raytMax, tEnter);
+        return hitMask & ((1 << nChildren) - 1);
+    }
+
+    // Child bounds are stored as 8-bit offsets from the parent's lower
+    // corner in units of _scale_.
+    Float origin[3], scale[3];
+    uint8_t qMin[3][N], qMax[3][N];
+    int offset[N];            // interior child: node index; leaf: first primitive
+    uint16_t nPrimitives[N];  // 0 -> interior child
+    uint8_t nChildren;
+};
+
+// WideBVHToVisit Definition
+struct WideBVHToVisit {
+    int offset;
+    int nPrimitives;
+    Float tEnter;
+};
+
+// BVHRayPacket Definition
+struct alignas(32) BVHRayPacket {
+    static constexpr int Size = 8;
+
+    // Initializes the packet from _n_ rays and returns false if their
+    // directions don't all have the same signs, in which case they aren't
+    // traced as a packet.
+    bool Init(const Ray *rays, const Float *rayTMax, int n, int dirIsNeg[3]) {
+        for (int i = 0; i < Size; ++i) {
+            // Replicate the first ray in unused slots
+            const Ray &ray = rays[i < n ? i : 0];
+            for (int a = 0; a < 3; ++a) {
+                o[a][i] = ray.o[a];
+                invDir[a][i] = 1 / ray.d[a];
+                if (i == 0)
+                    dirIsNeg[a] = invDir[a][0] < 0;
+                else if ((invDir[a][i] < 0) != dirIsNeg[a])
+                    return false;
+            }
+            tMax[i] = rayTMax[i < n ? i : 0];
+        }
+        return true;
+    }
+
+    // Returns the mask of rays in _activeMask_ that intersect _b_
+    int IntersectBounds(const Bounds3f &b, const int dirIsNeg[3], int activeMask) const {
+#if defined(__AVX__) && !defined(PBRT_FLOAT_AS_DOUBLE)
+        __m256 t0 = _mm256_setzero_ps(), t1 = _mm256_load_ps(tMax);
+        const __m256 farScale = _mm256_set1_ps(1 + 2 * gamma(3));
+        for (int a = 0; a < 3; ++a) {
+            __m256 org = _mm256_load_ps(o[a]), inv = _mm256_load_ps(invDir[a]);
+            __m256 bNear = _mm256_set1_ps(dirIsNeg[a] ? b.pMax[a] : b.pMin[a]);
+            __m256 bFar = _mm256_set1_ps(dirIsNeg[a] ? b.pMin[a] : b.pMax[a]);
+            __m256 tNear = _mm256_mul_ps(_mm256_sub_ps(bNear, org), inv);
+            __m256 tFar =
+                _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(bFar, org), inv), farScale);
+            t0 = _mm256_max_ps(tNear, t0);
+            t1 = _mm256_min_ps(tFar, t1);
+        }
+        return activeMask & _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+#else
+        int hitMask = 0;
+        for (int i = 0; i < Size; ++i) {
+            Float t0 = 0, t1 = tMax[i];
+            for (int a = 0; a < 3; ++a) {
+                Float bNear = dirIsNeg[a] ? b.pMax[a] : b.pMin[a];
+                Float bFar = dirIsNeg[a] ? b.pMin[a] : b.pMax[a];
+                Float tNear = (bNear - o[a][i]) * invDir[a][i];
+                Float tFar = (bFar - o[a][i]) * invDir[a][i] * (1 + 2 * gamma(3));
+                t0 = tNear > t0 ? tNear : t0;
+                t1 = tFar < t1 ? tFar : t1;
+            }
+            if (t0 <= t1)
+                hitMask |= 1 << i;
+        }
+        return activeMask & hitMask;
+#endif
+    }
+
+    // Ray origins, reciprocal directions, and current maximum parametric
+    // distances, stored SoA
+    Float o[3][Size], invDir[3][Size], tMax[Size];
+};
+
+// BVHCacheHeader Definition
+struct BVHCacheHeader {
+    static constexpr int CurrentVersion = 1;
+    char magic[8];
+    uint64_t hash;
+    int32_t version, floatSize, nodeWidth, compressed;
+    int64_t nNodes, nPrimitives;
+    Bounds3f bounds;
+};
+
+// Offset of the node array in BVH cache files; it is followed by the primitive order
+static constexpr size_t BVHCacheNodesOffset = 128;
+static_assert(sizeof(BVHCacheHeader) <= BVHCacheNodesOffset,
+              "BVHCacheHeader is too large");
+
 // BVHAccel Method Definitions
 BVHAccel::BVHAccel(std::vector<PrimitiveHandle> p, int maxPrimsInNode,
-                   SplitMethod splitMethod)
+                   SplitMethod splitMethod, int nodeWidth, bool compressed,
+                   const std::string &cacheDirectory, bool numaReplicate)
     : maxPrimsInNode(std::min(255, maxPrimsInNode)),
       splitMethod(splitMethod),
+      nodeWidth(nodeWidth),
+      compressed(compressed),
       primitives(std::move(p)) {
+    CHECK(nodeWidth == 2 || nodeWidth == 4 || nodeWidth == 8);
     CHECK(!primitives.empty());
+    TRACE_SCOPE("Build BVH", "primitives", primitives.size());
+    if (numaReplicate && NumaNodes() > 1)
+        numaNodeReplicas = std::vector<std::atomic<const void *>>(NumaNodes());
     // Build BVH from _primitives_
+    BeginBVHBuildWallClock();
     // Initialize _primitiveInfo_ array for primitives
+    Timer primitiveInfoTimer;
     std::vector<BVHPrimitiveInfo> primitiveInfo(primitives.size());
-    for (size_t i = 0; i < primitives.size(); ++i)
-        primitiveInfo[i] = {i, primitives[i].Bounds()};
+    ParallelFor(0, primitives.size(), [&](int64_t i) {
+        primitiveInfo[i] = {size_t(i), primitives[i].Bounds()};
+    });
+    buildPrimitiveInfoTime += primitiveInfoTimer.ElapsedSeconds();
+
+    // Use cached BVH for these primitives' bounds, if available
+    std::string cacheFilename;
+    uint64_t cacheHash = 0;
+    if (!cacheDirectory.empty()) {
+        cacheHash = cacheKey(primitiveInfo);
+        cacheFilename = cacheDirectory + "/" +
+                        StringPrintf("bvh-%016llx.bin", (unsigned long long)cacheHash);
+        if (readCache(cacheFilename, cacheHash)) {
+            ++bvhCacheHits;
+            EndBVHBuildWallClock();
+            return;
+        }
+        ++bvhCacheMisses;
+    }
 
     // Build BVH tree for primitives using _primitiveInfo_
     // These need to survive until we've built the compact BVH...
@@ -158,51 +646,80 @@ BVHAccel::BVHAccel(std::vector<PrimitiveHandle> p, int maxPrimsInNode,
     for (size_t i = 0; i < MaxThreadIndex(); ++i)
         threadAllocators.push_back(Allocator(&threadResources[i]));
 
+    Timer treeTimer;
     std::atomic<int> totalNodes{0};
-    std::vector<PrimitiveHandle> orderedPrims(primitives.size());
+    std::vector<int> orderedPrimIndices(primitives.size());
     BVHBuildNode *root;
     if (splitMethod == SplitMethod::HLBVH) {
-        root = HLBVHBuild(alloc, primitiveInfo, &totalNodes, orderedPrims);
+        root = HLBVHBuild(alloc, primitiveInfo, &totalNodes, orderedPrimIndices);
     } else {
         std::atomic<int> orderedPrimsOffset{0};
         root = recursiveBuild(threadAllocators, primitiveInfo, 0, primitives.size(),
-                              &totalNodes, orderedPrims, &orderedPrimsOffset);
-        CHECK_EQ(orderedPrimsOffset.load(), orderedPrims.size());
+                              maxPrimsInNode, splitMethod, &totalNodes,
+                              orderedPrimIndices, &orderedPrimsOffset);
+        CHECK_EQ(orderedPrimsOffset.load(), orderedPrimIndices.size());
     }
 
+    std::vector<PrimitiveHandle> orderedPrims(primitives.size());
+    ParallelFor(0, primitives.size(),
+                [&](int64_t i) { orderedPrims[i] = primitives[orderedPrimIndices[i]]; });
     primitives.swap(orderedPrims);
     primitiveInfo.resize(0);
-    LOG_VERBOSE("BVH created with %d nodes for %d primitives (%.2f MB)",
-                totalNodes.load(), (int)primitives.size(),
-                float(totalNodes.load() * sizeof(LinearBVHNode)) / (1024.f * 1024.f));
+    bounds = root->bounds;
+    buildTreeTime += treeTimer.ElapsedSeconds();
+
+    Timer flattenTimer;
+    if (compressed) {
+        if (nodeWidth == 2)
+            quantizedNodes2 = buildWideBVH<QuantizedBVHNode<2>>(root, totalNodes);
+        else if (nodeWidth == 4)
+            quantizedNodes4 = buildWideBVH<QuantizedBVHNode<4>>(root, totalNodes);
+        else
+            quantizedNodes8 = buildWideBVH<QuantizedBVHNode<8>>(root, totalNodes);
+    } else if (nodeWidth == 4)
+        wideNodes4 = buildWideBVH<WideBVHNode<4>>(root, totalNodes);
+    else if (nodeWidth == 8)
+        wideNodes8 = buildWideBVH<WideBVHNode<8>>(root, totalNodes);
+    else {
+        LOG_VERBOSE("BVH created with %d nodes for %d primitives (%.2f MB)",
+                    totalNodes.load(), (int)primitives.size(),
+                    float(totalNodes.load() * sizeof(LinearBVHNode)) /
+                        (1024.f * 1024.f));
+
+        // Compute representation of depth-first traversal of BVH tree
+        treeBytes += totalNodes * sizeof(LinearBVHNode) + sizeof(*this) +
+                     primitives.size() * sizeof(primitives[0]);
+        nNodes = totalNodes;
+        nodes = new LinearBVHNode[totalNodes];
+        int offset = 0;
+        flattenBVHTree(root, nodes, &offset);
+        CHECK_EQ(totalNodes.load(), offset);
+    }
+    buildFlattenTime += flattenTimer.ElapsedSeconds();
+    EndBVHBuildWallClock();
 
-    // Compute representation of depth-first traversal of BVH tree
-    treeBytes += totalNodes * sizeof(LinearBVHNode) + sizeof(*this) +
-                 primitives.size() * sizeof(primitives[0]);
-    nodes = new LinearBVHNode[totalNodes];
-    int offset = 0;
-    flattenBVHTree(root, &offset);
-    CHECK_EQ(totalNodes.load(), offset);
+    if (!cacheFilename.empty())
+        writeCache(cacheFilename, cacheHash, orderedPrimIndices);
 }
 
 Bounds3f BVHAccel::Bounds() const {
-    CHECK(nodes != nullptr);
-    return nodes[0].bounds;
+    return bounds;
 }
 
 BVHBuildNode *BVHAccel::recursiveBuild(std::vector<Allocator> &threadAllocators,
                                        std::vector<BVHPrimitiveInfo> &primitiveInfo,
-                                       int start, int end, std::atomic<int> *totalNodes,
-                                       std::vector<PrimitiveHandle> &orderedPrims,
+                                       int start, int end, int maxPrimsInNode,
+                                       SplitMethod splitMethod,
+                                       std::atomic<int> *totalNodes,
+                                       std::vector<int> &orderedPrimIndices,
                                        std::atomic<int> *orderedPrimsOffset) {
     DCHECK_NE(start, end);
     Allocator alloc = threadAllocators[ThreadIndex];
     BVHBuildNode *node = alloc.new_object<BVHBuildNode>();
     (*totalNodes)++;
-    // Compute bounds of all primitives in BVH node
-    Bounds3f bounds;
-    for (int i = start; i < end; ++i)
-        bounds = Union(bounds, primitiveInfo[i].bounds);
+    // Compute bounds of all primitives and their centroids in BVH node
+    Bounds3f bounds, centroidBounds;
+    ComputeBounds(primitiveInfo, start, end, &bounds, &centroidBounds);
 
     int nPrimitives = end - start;
     if (bounds.SurfaceArea() == 0 || nPrimitives == 1) {
@@ -210,16 +727,13 @@ BVHBuildNode *BVHAccel::recursiveBuild(std::vector<Allocator> &threadAllocators,
         int firstPrimOffset = orderedPrimsOffset->fetch_add(nPrimitives);
         for (int i = start; i < end; ++i) {
             int primNum = primitiveInfo[i].primitiveNumber;
-            orderedPrims[firstPrimOffset + i - start] = primitives[primNum];
+            orderedPrimIndices[firstPrimOffset + i - start] = primNum;
         }
         node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
         return node;
 
     } else {
-        // Compute bound of primitive centroids, choose split dimension _dim_
-        Bounds3f centroidBounds;
-        for (int i = start; i < end; ++i)
-            centroidBounds = Union(centroidBounds, primitiveInfo[i].centroid);
+        // Choose split dimension _dim_
         int dim = centroidBounds.MaxDimension();
 
         // Partition primitives into two sets and build children
@@ -229,7 +743,7 @@ BVHBuildNode *BVHAccel::recursiveBuild(std::vector<Allocator> &threadAllocators,
             int firstPrimOffset = orderedPrimsOffset->fetch_add(nPrimitives);
             for (int i = start; i < end; ++i) {
                 int primNum = primitiveInfo[i].primitiveNumber;
-                orderedPrims[firstPrimOffset + i - start] = primitives[primNum];
+                orderedPrimIndices[firstPrimOffset + i - start] = primNum;
             }
             node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
             return node;
@@ -240,12 +754,10 @@ BVHBuildNode *BVHAccel::recursiveBuild(std::vector<Allocator> &threadAllocators,
             case SplitMethod::Middle: {
                 // Partition primitives through node's midpoint
                 Float pmid = (centroidBounds.pMin[dim] + centroidBounds.pMax[dim]) / 2;
-                BVHPrimitiveInfo *midPtr =
-                    std::partition(&primitiveInfo[start], &primitiveInfo[end - 1] + 1,
-                                   [dim, pmid](const BVHPrimitiveInfo &pi) {
-                                       return pi.centroid[dim] < pmid;
-                                   });
-                mid = midPtr - &primitiveInfo[0];
+                mid = PartitionPrimitives(primitiveInfo, start, end,
+                                          [dim, pmid](const BVHPrimitiveInfo &pi) {
+                                              return pi.centroid[dim] < pmid;
+                                          });
                 // For lots of prims with large overlapping bounding boxes, this
                 // may fail to partition; in that case don't break and fall through
                 // to EqualCounts.
@@ -281,19 +793,18 @@ BVHBuildNode *BVHAccel::recursiveBuild(std::vector<Allocator> &threadAllocators,
                     // Allocate _BucketInfo_ for SAH partition buckets
                     constexpr int nBuckets = 12;
                     BucketInfo buckets[nBuckets];
-
-                    // Initialize _BucketInfo_ for SAH partition buckets
-                    for (int i = start; i < end; ++i) {
-                        int b = nBuckets *
-                                centroidBounds.Offset(primitiveInfo[i].centroid)[dim];
+                    auto bucketIndex = [=](const BVHPrimitiveInfo &pi) {
+                        int b = nBuckets * centroidBounds.Offset(pi.centroid)[dim];
                         if (b == nBuckets)
                             b = nBuckets - 1;
                         DCHECK_GE(b, 0);
                         DCHECK_LT(b, nBuckets);
-                        buckets[b].count++;
-                        buckets[b].bounds =
-                            Union(buckets[b].bounds, primitiveInfo[i].bounds);
-                    }
+                        return b;
+                    };
+
+                    // Initialize _BucketInfo_ for SAH partition buckets
+                    ComputeBuckets<nBuckets>(primitiveInfo, start, end, bucketIndex,
+                                             buckets);
 
                     // Compute costs for splitting after each bucket
                     int minCostSplitBucket = -1;
@@ -333,23 +844,16 @@ BVHBuildNode *BVHAccel::recursiveBuild(std::vector<Allocator> &threadAllocators,
                     // Either create leaf or split primitives at selected SAH bucket
                     Float leafCost = nPrimitives;
                     if (nPrimitives > maxPrimsInNode || minCost < leafCost) {
-                        BVHPrimitiveInfo *pmid = std::partition(
-                            &primitiveInfo[start], &primitiveInfo[end - 1] + 1,
-                            [=](const BVHPrimitiveInfo &pi) {
-                                int b =
-                                    nBuckets * centroidBounds.Offset(pi.centroid)[dim];
-                                if (b == nBuckets)
-                                    b = nBuckets - 1;
-                                return b <= minCostSplitBucket;
+                        mid = PartitionPrimitives(
+                            primitiveInfo, start, end, [=](const BVHPrimitiveInfo &pi) {
+                                return bucketIndex(pi) <= minCostSplitBucket;
                             });
-                        mid = pmid - &primitiveInfo[0];
                     } else {
                         // Create leaf _BVHBuildNode_
                         int firstPrimOffset = orderedPrimsOffset->fetch_add(nPrimitives);
                         for (int i = start; i < end; ++i) {
                             int primNum = primitiveInfo[i].primitiveNumber;
-                            orderedPrims[firstPrimOffset + i - start] =
-                                primitives[primNum];
+                            orderedPrimIndices[firstPrimOffset + i - start] = primNum;
                         }
                         node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
                         return node;
@@ -361,24 +865,26 @@ BVHBuildNode *BVHAccel::recursiveBuild(std::vector<Allocator> &threadAllocators,
             }
 
             BVHBuildNode *children[2];
-            if (end - start > 1024 * 1024) {
+            if (end - start >= parallelSubtreeMinPrimitives) {
                 ParallelFor(0, 2, [&](int i) {
                     if (i == 0)
-                        children[0] =
-                            recursiveBuild(threadAllocators, primitiveInfo, start, mid,
-                                           totalNodes, orderedPrims, orderedPrimsOffset);
+                        children[0] = recursiveBuild(
+                            threadAllocators, primitiveInfo, start, mid, maxPrimsInNode,
+                            splitMethod, totalNodes, orderedPrimIndices,
+                            orderedPrimsOffset);
                     else
-                        children[1] =
-                            recursiveBuild(threadAllocators, primitiveInfo, mid, end,
-                                           totalNodes, orderedPrims, orderedPrimsOffset);
+                        children[1] = recursiveBuild(
+                            threadAllocators, primitiveInfo, mid, end, maxPrimsInNode,
+                            splitMethod, totalNodes, orderedPrimIndices,
+                            orderedPrimsOffset);
                 });
             } else {
-                children[0] =
-                    recursiveBuild(threadAllocators, primitiveInfo, start, mid,
-                                   totalNodes, orderedPrims, orderedPrimsOffset);
-                children[1] =
-                    recursiveBuild(threadAllocators, primitiveInfo, mid, end, totalNodes,
-                                   orderedPrims, orderedPrimsOffset);
+                children[0] = recursiveBuild(threadAllocators, primitiveInfo, start, mid,
+                                             maxPrimsInNode, splitMethod, totalNodes,
+                                             orderedPrimIndices, orderedPrimsOffset);
+                children[1] = recursiveBuild(threadAllocators, primitiveInfo, mid, end,
+                                             maxPrimsInNode, splitMethod, totalNodes,
+                                             orderedPrimIndices, orderedPrimsOffset);
             }
             node->InitInterior(dim, children[0], children[1]);
         }
@@ -389,11 +895,11 @@ BVHBuildNode *BVHAccel::recursiveBuild(std::vector<Allocator> &threadAllocators,
 BVHBuildNode *BVHAccel::HLBVHBuild(Allocator alloc,
                                    const std::vector<BVHPrimitiveInfo> &primitiveInfo,
                                    std::atomic<int> *totalNodes,
-                                   std::vector<PrimitiveHandle> &orderedPrims) {
+                                   std::vector<int> &orderedPrimIndices) {
     // Compute bounding box of all primitive centroids
-    Bounds3f bounds;
-    for (const BVHPrimitiveInfo &pi : primitiveInfo)
-        bounds = Union(bounds, pi.centroid);
+    Timer mortonTimer;
+    Bounds3f primBounds, bounds;
+    ComputeBounds(primitiveInfo, 0, primitiveInfo.size(), &primBounds, &bounds);
 
     // Compute Morton indices of primitives
     std::vector<MortonPrimitive> mortonPrims(primitiveInfo.size());
@@ -409,24 +915,40 @@ BVHBuildNode *BVHAccel::HLBVHBuild(Allocator alloc,
         }
     });
 
+    buildMortonTime += mortonTimer.ElapsedSeconds();
+
     // Radix sort primitive Morton indices
+    Timer sortTimer;
     RadixSort(&mortonPrims);
+    buildRadixSortTime += sortTimer.ElapsedSeconds();
 
     // Create LBVH treelets at bottom of BVH
     // Find intervals of primitives for each treelet
-    std::vector<LBVHTreelet> treeletsToBuild;
-    for (int start = 0, end = 1; end <= (int)mortonPrims.size(); ++end) {
+    Timer treeletTimer;
+    int nMortonPrims = mortonPrims.size();
+    int nChunks = (nMortonPrims + parallelChunkSize - 1) / parallelChunkSize;
+    std::vector<std::vector<int>> chunkTreeletStarts(nChunks);
+    ForEachChunk(0, nMortonPrims, [&](int chunk, int start, int end) {
+        // Record treelet starts where the high bits of the Morton code change
         uint32_t mask = 0b00111111111111000000000000000000;
-        if (end == (int)mortonPrims.size() || ((mortonPrims[start].mortonCode & mask) !=
-                                               (mortonPrims[end].mortonCode & mask))) {
+        for (int i = start; i < end; ++i)
+            if (i == 0 || ((mortonPrims[i - 1].mortonCode & mask) !=
+                           (mortonPrims[i].mortonCode & mask)))
+                chunkTreeletStarts[chunk].push_back(i);
+    });
+    std::vector<LBVHTreelet> treeletsToBuild;
+    for (const std::vector<int> &starts : chunkTreeletStarts)
+        for (int start : starts) {
             // Add entry to _treeletsToBuild_ for this treelet
-            int nPrimitives = end - start;
-            int maxBVHNodes = 2 * nPrimitives - 1;
-            BVHBuildNode *nodes = alloc.allocate_object<BVHBuildNode>(maxBVHNodes);
-            treeletsToBuild.push_back({start, nPrimitives, nodes});
-
-            start = end;
+            if (!treeletsToBuild.empty()) {
+                LBVHTreelet &prev = treeletsToBuild.back();
+                prev.nPrimitives = start - prev.startIndex;
+            }
+            treeletsToBuild.push_back({start, nMortonPrims - start, nullptr});
         }
+    for (LBVHTreelet &treelet : treeletsToBuild) {
+        int maxBVHNodes = 2 * treelet.nPrimitives - 1;
+        treelet.buildNodes = alloc.allocate_object<BVHBuildNode>(maxBVHNodes);
     }
 
     // Create LBVHs for treelets in parallel
@@ -438,23 +960,27 @@ BVHBuildNode *BVHAccel::HLBVHBuild(Allocator alloc,
         LBVHTreelet &tr = treeletsToBuild[i];
         tr.buildNodes = emitLBVH(
             tr.buildNodes, primitiveInfo, &mortonPrims[tr.startIndex], tr.nPrimitives,
-            &nodesCreated, orderedPrims, &orderedPrimsOffset, firstBitIndex);
+            &nodesCreated, orderedPrimIndices, &orderedPrimsOffset, firstBitIndex);
         *totalNodes += nodesCreated;
     });
+    buildTreeletTime += treeletTimer.ElapsedSeconds();
 
     // Create and return SAH BVH from LBVH treelets
+    Timer upperTimer;
     std::vector<BVHBuildNode *> finishedTreelets;
     finishedTreelets.reserve(treeletsToBuild.size());
     for (LBVHTreelet &treelet : treeletsToBuild)
         finishedTreelets.push_back(treelet.buildNodes);
-    return buildUpperSAH(alloc, finishedTreelets, 0, finishedTreelets.size(), totalNodes);
+    BVHBuildNode *root =
+        buildUpperSAH(alloc, finishedTreelets, 0, finishedTreelets.size(), totalNodes);
+    buildUpperSAHTime += upperTimer.ElapsedSeconds();
+    return root;
 }
 
 BVHBuildNode *BVHAccel::emitLBVH(BVHBuildNode *&buildNodes,
                                  const std::vector<BVHPrimitiveInfo> &primitiveInfo,
                                  MortonPrimitive *mortonPrims, int nPrimitives,
-                                 int *totalNodes,
-                                 std::vector<PrimitiveHandle> &orderedPrims,
+                                 int *totalNodes, std::vector<int> &orderedPrimIndices,
                                  std::atomic<int> *orderedPrimsOffset, int bitIndex) {
     CHECK_GT(nPrimitives, 0);
     if (bitIndex == -1 || nPrimitives < maxPrimsInNode) {
@@ -465,7 +991,7 @@ BVHBuildNode *BVHAccel::emitLBVH(BVHBuildNode *&buildNodes,
         int firstPrimOffset = orderedPrimsOffset->fetch_add(nPrimitives);
         for (int i = 0; i < nPrimitives; ++i) {
             int primitiveIndex = mortonPrims[i].primitiveIndex;
-            orderedPrims[firstPrimOffset + i] = primitives[primitiveIndex];
+            orderedPrimIndices[firstPrimOffset + i] = primitiveIndex;
             bounds = Union(bounds, primitiveInfo[primitiveIndex].bounds);
         }
         node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
@@ -477,7 +1003,8 @@ BVHBuildNode *BVHAccel::emitLBVH(BVHBuildNode *&buildNodes,
         if ((mortonPrims[0].mortonCode & mask) ==
             (mortonPrims[nPrimitives - 1].mortonCode & mask))
             return emitLBVH(buildNodes, primitiveInfo, mortonPrims, nPrimitives,
-                            totalNodes, orderedPrims, orderedPrimsOffset, bitIndex - 1);
+                            totalNodes, orderedPrimIndices, orderedPrimsOffset,
+                            bitIndex - 1);
 
         // Find LBVH split point for this dimension
         int splitOffset = FindInterval(nPrimitives, [&](int index) {
@@ -494,9 +1021,9 @@ BVHBuildNode *BVHAccel::emitLBVH(BVHBuildNode *&buildNodes,
         BVHBuildNode *node = buildNodes++;
         BVHBuildNode *lbvh[2] = {
             emitLBVH(buildNodes, primitiveInfo, mortonPrims, splitOffset, totalNodes,
-                     orderedPrims, orderedPrimsOffset, bitIndex - 1),
+                     orderedPrimIndices, orderedPrimsOffset, bitIndex - 1),
             emitLBVH(buildNodes, primitiveInfo, &mortonPrims[splitOffset],
-                     nPrimitives - splitOffset, totalNodes, orderedPrims,
+                     nPrimitives - splitOffset, totalNodes, orderedPrimIndices,
                      orderedPrimsOffset, bitIndex - 1)};
         int axis = bitIndex % 3;
         node->InitInterior(axis, lbvh[0], lbvh[1]);
@@ -504,7 +1031,7 @@ BVHBuildNode *BVHAccel::emitLBVH(BVHBuildNode *&buildNodes,
     }
 }
 
-int BVHAccel::flattenBVHTree(BVHBuildNode *node, int *offset) {
+int BVHAccel::flattenBVHTree(BVHBuildNode *node, LinearBVHNode *nodes, int *offset) {
     LinearBVHNode *linearNode = &nodes[*offset];
     linearNode->bounds = node->bounds;
     int myOffset = (*offset)++;
@@ -517,26 +1044,333 @@ int BVHAccel::flattenBVHTree(BVHBuildNode *node, int *offset) {
         // Create interior flattened BVH node
         linearNode->axis = node->splitAxis;
         linearNode->nPrimitives = 0;
-        flattenBVHTree(node->children[0], offset);
-        linearNode->secondChildOffset = flattenBVHTree(node->children[1], offset);
+        flattenBVHTree(node->children[0], nodes, offset);
+        linearNode->secondChildOffset = flattenBVHTree(node->children[1], nodes, offset);
+    }
+    return myOffset;
+}
+
+template <typename WideNode>
+WideNode *BVHAccel::buildWideBVH(BVHBuildNode *root, int totalNodes) {
+    // Collapse binary BVH into _WideNode::Width_-wide nodes
+    std::vector<WideNode> wideNodeVector;
+    flattenWideBVHTree(root, wideNodeVector);
+    size_t nodeBytes = wideNodeVector.size() * sizeof(WideNode);
+    LOG_VERBOSE("%d-wide%s BVH created with %d nodes for %d primitives (%.2f MB)",
+                WideNode::Width, WideNode::Compressed ? " compressed" : "",
+                (int)wideNodeVector.size(), (int)primitives.size(),
+                float(nodeBytes) / (1024.f * 1024.f));
+    treeBytes += nodeBytes + sizeof(*this) + primitives.size() * sizeof(primitives[0]);
+    if (WideNode::Compressed) {
+        // Compare to the size of the uncompressed nodes for the same tree
+        size_t uncompressedBytes =
+            (WideNode::Width == 2)
+                ? totalNodes * sizeof(LinearBVHNode)
+                : wideNodeVector.size() * (WideNode::Width == 4 ? sizeof(WideBVHNode<4>)
+                                                                : sizeof(WideBVHNode<8>));
+        compressedBytesSaved += int64_t(uncompressedBytes) - int64_t(nodeBytes);
+    }
+
+    nNodes = wideNodeVector.size();
+    WideNode *wideNodes = new WideNode[wideNodeVector.size()];
+    std::copy(wideNodeVector.begin(), wideNodeVector.end(), wideNodes);
+    return wideNodes;
+}
+
+template <typename WideNode>
+int BVHAccel::flattenWideBVHTree(BVHBuildNode *node, std::vector<WideNode> &wideNodes) {
+    constexpr int N = WideNode::Width;
+    int myOffset = wideNodes.size();
+    wideNodes.push_back(WideNode());
+    ++wideNodesCreated;
+
+    // Gather up to _N_ children by repeatedly opening the largest interior child
+    BVHBuildNode *children[N];
+    int nChildren = 0;
+    if (node->nPrimitives > 0)
+        children[nChildren++] = node;
+    else {
+        children[nChildren++] = node->children[0];
+        children[nChildren++] = node->children[1];
+    }
+    while (nChildren < N) {
+        int open = -1;
+        Float maxArea = -1;
+        for (int i = 0; i < nChildren; ++i)
+            if (children[i]->nPrimitives == 0 &&
+                children[i]->bounds.SurfaceArea() > maxArea) {
+                open = i;
+                maxArea = children[i]->bounds.SurfaceArea();
+            }
+        if (open == -1)
+            break;
+        BVHBuildNode *c = children[open];
+        children[open] = c->children[0];
+        children[nChildren++] = c->children[1];
+    }
+    totalWideChildren += nChildren;
+    ++totalWideNodes;
+    wideNodes[myOffset].Init(node->bounds, nChildren);
+
+    // Initialize child slots of wide node, recursively flattening interior children
+    for (int i = 0; i < nChildren; ++i) {
+        int offset, nPrimitives = 0;
+        if (children[i]->nPrimitives > 0) {
+            CHECK_LT(children[i]->nPrimitives, 65536);
+            offset = children[i]->firstPrimOffset;
+            nPrimitives = children[i]->nPrimitives;
+        } else
+            offset = flattenWideBVHTree(children[i], wideNodes);
+        // _wideNodes_ may have been reallocated by the recursive call
+        wideNodes[myOffset].SetChild(i, children[i]->bounds, offset, nPrimitives);
     }
     return myOffset;
 }
 
+uint64_t BVHAccel::cacheKey(const std::vector<BVHPrimitiveInfo> &primitiveInfo) const {
+    // The BVH only depends on the primitives' bounds and the build parameters
+    int nChunks = (primitiveInfo.size() + parallelChunkSize - 1) / parallelChunkSize;
+    std::vector<uint64_t> chunkHashes(nChunks);
+    ForEachChunk(0, primitiveInfo.size(), [&](int chunk, int start, int end) {
+        uint64_t hash = 0;
+        for (int i = start; i < end; ++i)
+            hash = HashBuffer(&primitiveInfo[i].bounds, sizeof(Bounds3f), hash);
+        chunkHashes[chunk] = hash;
+    });
+    return HashBuffer(chunkHashes.data(), chunkHashes.size() * sizeof(uint64_t),
+                      Hash(BVHCacheHeader::CurrentVersion, int(sizeof(Float)),
+                           maxPrimsInNode, int(splitMethod), nodeWidth, compressed,
+                           primitiveInfo.size()));
+}
+
+// Returns the node array of whichever BVH layout was built along with the
+// size of each node.
+static std::pair<const void *, size_t> BVHNodeArray(
+    const LinearBVHNode *nodes, const WideBVHNode<4> *wideNodes4,
+    const WideBVHNode<8> *wideNodes8, const QuantizedBVHNode<2> *quantizedNodes2,
+    const QuantizedBVHNode<4> *quantizedNodes4,
+    const QuantizedBVHNode<8> *quantizedNodes8) {
+    if (nodes)
+        return {nodes, sizeof(LinearBVHNode)};
+    else if (wideNodes4)
+        return {wideNodes4, sizeof(WideBVHNode<4>)};
+    else if (wideNodes8)
+        return {wideNodes8, sizeof(WideBVHNode<8>)};
+    else if (quantizedNodes2)
+        return {quantizedNodes2, sizeof(QuantizedBVHNode<2>)};
+    else if (quantizedNodes4)
+        return {quantizedNodes4, sizeof(QuantizedBVHNode<4>)};
+    else
+        return {quantizedNodes8, sizeof(QuantizedBVHNode<8>)};
+}
+
+void BVHAccel::writeCache(const std::string &filename, uint64_t hash,
+                          const std::vector<int> &orderedPrimIndices) const {
+    BVHCacheHeader header;
+    std::memcpy(header.magic, "pbrtBVH", 8);
+    header.hash = hash;
+    header.version = BVHCacheHeader::CurrentVersion;
+    header.floatSize = sizeof(Float);
+    header.nodeWidth = nodeWidth;
+    header.compressed = compressed;
+    header.nNodes = nNodes;
+    header.nPrimitives = primitives.size();
+    header.bounds = bounds;
+    std::pair<const void *, size_t> nodeArray =
+        BVHNodeArray(nodes, wideNodes4, wideNodes8, quantizedNodes2, quantizedNodes4,
+                     quantizedNodes8);
+
+    // Write to a temporary file and rename it so that readers never see a
+    // partially-written cache file; the temporary file is unique so that
+    // concurrent writers of the same cache file don't overwrite each other's
+    std::string tempFilename = UniqueTemporaryFilename(filename);
+    FILE *f = fopen(tempFilename.c_str(), "wb");
+    if (!f) {
+        Warning("%s: unable to create BVH cache file: %s", tempFilename, ErrorString());
+        return;
+    }
+    char headerBytes[BVHCacheNodesOffset] = {0};
+    std::memcpy(headerBytes, &header, sizeof(header));
+    bool success =
+        fwrite(headerBytes, sizeof(headerBytes), 1, f) == 1 &&
+        fwrite(nodeArray.first, nodeArray.second, nNodes, f) == size_t(nNodes) &&
+        fwrite(orderedPrimIndices.data(), sizeof(int), orderedPrimIndices.size(), f) ==
+            orderedPrimIndices.size();
+    if (fclose(f) != 0 || !success) {
+        Warning("%s: error writing BVH cache file: %s", tempFilename, ErrorString());
+        std::remove(tempFilename.c_str());
+        return;
+    }
+    if (!RenameFile(tempFilename, filename)) {
+        Warning("%s: unable to rename BVH cache file: %s", tempFilename, ErrorString());
+        std::remove(tempFilename.c_str());
+        return;
+    }
+    LOG_VERBOSE("Wrote BVH cache file %s", filename);
+}
+
+bool BVHAccel::readCache(const std::string &filename, uint64_t hash) {
+    // Map cache file into memory, if it exists
+    const char *data = nullptr;
+    size_t len = 0;
+#ifdef PBRT_HAVE_MMAP
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat stat;
+    if (fstat(fd, &stat) != 0) {
+        close(fd);
+        return false;
+    }
+    len = stat.st_size;
+    void *ptr = len > 0 ? mmap(nullptr, len, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0)
+                        : MAP_FAILED;
+    close(fd);
+    if (ptr == MAP_FAILED)
+        return false;
+    data = (const char *)ptr;
+    auto release = [&]() { munmap(ptr, len); };
+#else
+    // Without _mmap()_, read the file into suitably-aligned memory
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
+    if (!in)
+        return false;
+    len = in.tellg();
+    in.seekg(0);
+    Allocator alloc;
+    char *buf = (char *)alloc.allocate_bytes(len, 64);
+    if (!in.read(buf, len)) {
+        alloc.deallocate_bytes(buf, len, 64);
+        return false;
+    }
+    data = buf;
+    auto release = [&]() { alloc.deallocate_bytes(buf, len, 64); };
+#endif
+
+    // Validate cache file header and size
+    BVHCacheHeader header;
+    if (len < BVHCacheNodesOffset) {
+        release();
+        return false;
+    }
+    std::memcpy(&header, data, sizeof(header));
+    size_t nodeSize = compressed ? (nodeWidth == 2   ? sizeof(QuantizedBVHNode<2>)
+                                    : nodeWidth == 4 ? sizeof(QuantizedBVHNode<4>)
+                                                     : sizeof(QuantizedBVHNode<8>))
+                                 : (nodeWidth == 2   ? sizeof(LinearBVHNode)
+                                    : nodeWidth == 4 ? sizeof(WideBVHNode<4>)
+                                                     : sizeof(WideBVHNode<8>));
+    if (std::memcmp(header.magic, "pbrtBVH", 8) != 0 || header.hash != hash ||
+        header.version != BVHCacheHeader::CurrentVersion ||
+        header.floatSize != sizeof(Float) || header.nodeWidth != nodeWidth ||
+        header.compressed != compressed ||
+        header.nPrimitives != int64_t(primitives.size()) || header.nNodes <= 0 ||
+        header.nNodes > int64_t(len / nodeSize) ||
+        len != BVHCacheNodesOffset + header.nNodes * nodeSize +
+                   header.nPrimitives * sizeof(int)) {
+        Warning("%s: ignoring stale or invalid BVH cache file", filename);
+        release();
+        return false;
+    }
+
+    // Reorder primitives according to cached order
+    const int *orderedPrimIndices =
+        (const int *)(data + BVHCacheNodesOffset + header.nNodes * nodeSize);
+    std::vector<PrimitiveHandle> orderedPrims(primitives.size());
+    for (size_t i = 0; i < primitives.size(); ++i) {
+        if (orderedPrimIndices[i] < 0 || orderedPrimIndices[i] >= header.nPrimitives) {
+            Warning("%s: invalid primitive index in BVH cache file", filename);
+            release();
+            return false;
+        }
+        orderedPrims[i] = primitives[orderedPrimIndices[i]];
+    }
+    primitives.swap(orderedPrims);
+
+    // Point BVH nodes at the cache file's node array
+    void *nodeData = const_cast<char *>(data + BVHCacheNodesOffset);
+    if (compressed) {
+        if (nodeWidth == 2)
+            quantizedNodes2 = (QuantizedBVHNode<2> *)nodeData;
+        else if (nodeWidth == 4)
+            quantizedNodes4 = (QuantizedBVHNode<4> *)nodeData;
+        else
+            quantizedNodes8 = (QuantizedBVHNode<8> *)nodeData;
+    } else if (nodeWidth == 4)
+        wideNodes4 = (WideBVHNode<4> *)nodeData;
+    else if (nodeWidth == 8)
+        wideNodes8 = (WideBVHNode<8> *)nodeData;
+    else
+        nodes = (LinearBVHNode *)nodeData;
+    nNodes = header.nNodes;
+    bounds = header.bounds;
+    bvhCacheBytesMapped += len;
+    treeBytes += sizeof(*this) + primitives.size() * sizeof(primitives[0]);
+    LOG_VERBOSE("Loaded BVH with %d nodes for %d primitives from cache file %s", nNodes,
+                (int)primitives.size(), filename);
+    return true;
+}
+
+template <typename Node>
+const Node *BVHAccel::localNodes(const Node *n) const {
+    if (numaNodeReplicas.empty() || n == nullptr)
+        return n;
+    const void *replica =
+        numaNodeReplicas[ThreadNumaNode].load(std::memory_order_acquire);
+    if (replica == nullptr)
+        replica = replicateNodes(ThreadNumaNode);
+    return (const Node *)replica;
+}
+
+const void *BVHAccel::replicateNodes(int numaNode) const {
+    std::lock_guard<std::mutex> lock(numaReplicaMutex);
+    if (const void *replica = numaNodeReplicas[numaNode].load(); replica != nullptr)
+        return replica;
+    // Copy the nodes from this thread so that the copy's pages are first
+    // touched, and thus allocated, on this thread's NUMA node
+    std::pair<const void *, size_t> nodeArray =
+        BVHNodeArray(nodes, wideNodes4, wideNodes8, quantizedNodes2, quantizedNodes4,
+                     quantizedNodes8);
+    size_t size = nNodes * nodeArray.second;
+    void *replica = Allocator().allocate_bytes(size, 64);
+    memcpy(replica, nodeArray.first, size);
+    bvhReplicaBytes += size;
+    LOG_VERBOSE("Replicated %d BVH nodes on NUMA node %d", nNodes, numaNode);
+    numaNodeReplicas[numaNode].store(replica, std::memory_order_release);
+    return replica;
+}
+
 pstd::optional<ShapeIntersection> BVHAccel::Intersect(const Ray &ray, Float tMax) const {
+    if (wideNodes4)
+        return intersectWide(localNodes(wideNodes4), ray, tMax);
+    else if (wideNodes8)
+        return intersectWide(localNodes(wideNodes8), ray, tMax);
+    else if (quantizedNodes2)
+        return intersectWide(localNodes(quantizedNodes2), ray, tMax);
+    else if (quantizedNodes4)
+        return intersectWide(localNodes(quantizedNodes4), ray, tMax);
+    else if (quantizedNodes8)
+        return intersectWide(localNodes(quantizedNodes8), ray, tMax);
     if (nodes == nullptr)
         return {};
+    return intersectSubtree(0, ray, tMax);
+}
+
+pstd::optional<ShapeIntersection> BVHAccel::intersectSubtree(int rootIndex,
+                                                             const Ray &ray,
+                                                             Float tMax) const {
+    const LinearBVHNode *linearNodes = localNodes(nodes);
     pstd::optional<ShapeIntersection> si;
     Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
     int dirIsNeg[3] = {static_cast<int>(invDir.x < 0), static_cast<int>(invDir.y < 0),
                        static_cast<int>(invDir.z < 0)};
     // Follow ray through BVH nodes to find primitive intersections
-    int toVisitOffset = 0, currentNodeIndex = 0;
+    int toVisitOffset = 0, currentNodeIndex = rootIndex;
     int nodesToVisit[64];
     int nodesVisited = 0;
     while (true) {
         ++nodesVisited;
-        const LinearBVHNode *node = &nodes[currentNodeIndex];
+        const LinearBVHNode *node = &linearNodes[currentNodeIndex];
         // Check ray against BVH node
         if (node->bounds.IntersectP(ray.o, ray.d, tMax, invDir, dirIsNeg)) {
             if (node->nPrimitives > 0) {
@@ -571,28 +1405,47 @@ pstd::optional<ShapeIntersection> BVHAccel::Intersect(const Ray &ray, Float tMax
     }
 
     bvhNodesVisited += nodesVisited;
+    bvhTraversalSteps += nodesVisited;
+    ++bvhTraversals;
     return si;
 }
 
 bool BVHAccel::IntersectP(const Ray &ray, Float tMax) const {
+    if (wideNodes4)
+        return intersectPWide(localNodes(wideNodes4), ray, tMax);
+    else if (wideNodes8)
+        return intersectPWide(localNodes(wideNodes8), ray, tMax);
+    else if (quantizedNodes2)
+        return intersectPWide(localNodes(quantizedNodes2), ray, tMax);
+    else if (quantizedNodes4)
+        return intersectPWide(localNodes(quantizedNodes4), ray, tMax);
+    else if (quantizedNodes8)
+        return intersectPWide(localNodes(quantizedNodes8), ray, tMax);
     if (nodes == nullptr)
         return false;
+    return intersectPSubtree(0, ray, tMax);
+}
+
+bool BVHAccel::intersectPSubtree(int rootIndex, const Ray &ray, Float tMax) const {
+    const LinearBVHNode *linearNodes = localNodes(nodes);
     Vector3f invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
     int dirIsNeg[3] = {static_cast<int>(invDir.x < 0), static_cast<int>(invDir.y < 0),
                        static_cast<int>(invDir.z < 0)};
     int nodesToVisit[64];
-    int toVisitOffset = 0, currentNodeIndex = 0;
+    int toVisitOffset = 0, currentNodeIndex = rootIndex;
     int nodesVisited = 0;
 
     while (true) {
         ++nodesVisited;
-        const LinearBVHNode *node = &nodes[currentNodeIndex];
+        const LinearBVHNode *node = &linearNodes[currentNodeIndex];
         if (node->bounds.IntersectP(ray.o, ray.d, tMax, invDir, dirIsNeg)) {
             // Process BVH node _node_ for traversal
             if (node->nPrimitives > 0) {
                 for (int i = 0; i < node->nPrimitives; ++i) {
                     if (primitives[node->primitivesOffset + i].IntersectP(ray, tMax)) {
                         bvhNodesVisited += nodesVisited;
+                        bvhTraversalSteps += nodesVisited;
+                        ++bvhTraversals;
                         return true;
                     }
                 }
@@ -616,6 +1469,271 @@ bool BVHAccel::IntersectP(const Ray &ray, Float tMax) const {
         }
     }
     bvhNodesVisited += nodesVisited;
+    bvhTraversalSteps += nodesVisited;
+    ++bvhTraversals;
+    return false;
+}
+
+void BVHAccel::Intersect(
+    pstd::span<const Ray> rays, pstd::span<const Float> tMax,
+    pstd::span<pstd::optional<ShapeIntersection>> intersections) const {
+    CHECK_EQ(rays.size(), tMax.size());
+    CHECK_EQ(rays.size(), intersections.size());
+    for (size_t start = 0; start < rays.size(); start += BVHRayPacket::Size) {
+        size_t n = std::min<size_t>(BVHRayPacket::Size, rays.size() - start);
+        BVHRayPacket packet;
+        int dirIsNeg[3];
+        if (nodes == nullptr || !packet.Init(&rays[start], &tMax[start], n, dirIsNeg)) {
+            // Trace rays individually if packet traversal isn't possible
+            ++bvhIncoherentPackets;
+            for (size_t i = start; i < start + n; ++i)
+                intersections[i] = Intersect(rays[i], tMax[i]);
+            continue;
+        }
+        ++bvhPackets;
+        intersectPacket(packet, &rays[start], dirIsNeg, (1 << n) - 1,
+                        &intersections[start]);
+    }
+}
+
+void BVHAccel::intersectPacket(BVHRayPacket &packet, const Ray *rays,
+                               const int dirIsNeg[3], int activeMask,
+                               pstd::optional<ShapeIntersection> *intersections) const {
+    const LinearBVHNode *linearNodes = localNodes(nodes);
+    for (int i = 0; i < BVHRayPacket::Size; ++i)
+        if (activeMask & (1 << i))
+            intersections[i].reset();
+    // Follow packet through BVH nodes, tracking which of its rays reach each node
+    struct NodeToVisit {
+        int nodeIndex, mask;
+    };
+    NodeToVisit nodesToVisit[64];
+    int toVisitOffset = 0;
+    nodesToVisit[toVisitOffset++] = {0, activeMask};
+    int nodesVisited = 0;
+    while (toVisitOffset > 0) {
+        NodeToVisit current = nodesToVisit[--toVisitOffset];
+        const LinearBVHNode *node = &linearNodes[current.nodeIndex];
+        ++nodesVisited;
+        int hitMask = packet.IntersectBounds(node->bounds, dirIsNeg, current.mask);
+        if (hitMask == 0)
+            continue;
+
+        if (node->nPrimitives > 0) {
+            // Intersect each ray that reached the leaf with its primitives
+            for (int r = 0; r < BVHRayPacket::Size; ++r) {
+                if (!(hitMask & (1 << r)))
+                    continue;
+                for (int i = 0; i < node->nPrimitives; ++i) {
+                    pstd::optional<ShapeIntersection> primSi =
+                        primitives[node->primitivesOffset + i].Intersect(
+                            rays[r], packet.tMax[r]);
+                    if (primSi) {
+                        intersections[r] = primSi;
+                        packet.tMax[r] = primSi->tHit;
+                    }
+                }
+            }
+        } else if ((hitMask & (hitMask - 1)) == 0) {
+            // Packet has diverged to a single ray; finish subtree without packet
+            ++bvhPacketSingleRaySubtrees;
+            int r = 0;
+            while (!(hitMask & (1 << r)))
+                ++r;
+            pstd::optional<ShapeIntersection> si =
+                intersectSubtree(current.nodeIndex, rays[r], packet.tMax[r]);
+            if (si) {
+                intersections[r] = si;
+                packet.tMax[r] = si->tHit;
+            }
+        } else {
+            // Push far child, then near child so it's visited next
+            int firstChild = current.nodeIndex + 1, secondChild = node->secondChildOffset;
+            if (dirIsNeg[node->axis])
+                pstd::swap(firstChild, secondChild);
+            nodesToVisit[toVisitOffset++] = {secondChild, hitMask};
+            nodesToVisit[toVisitOffset++] = {firstChild, hitMask};
+        }
+    }
+    bvhNodesVisited += nodesVisited;
+    bvhTraversalSteps += nodesVisited;
+    ++bvhTraversals;
+}
+
+void BVHAccel::IntersectP(pstd::span<const Ray> rays, pstd::span<const Float> tMax,
+                          pstd::span<bool> occluded) const {
+    CHECK_EQ(rays.size(), tMax.size());
+    CHECK_EQ(rays.size(), occluded.size());
+    for (size_t start = 0; start < rays.size(); start += BVHRayPacket::Size) {
+        size_t n = std::min<size_t>(BVHRayPacket::Size, rays.size() - start);
+        BVHRayPacket packet;
+        int dirIsNeg[3];
+        if (nodes == nullptr || !packet.Init(&rays[start], &tMax[start], n, dirIsNeg)) {
+            // Trace rays individually if packet traversal isn't possible
+            ++bvhIncoherentPackets;
+            for (size_t i = start; i < start + n; ++i)
+                occluded[i] = IntersectP(rays[i], tMax[i]);
+            continue;
+        }
+        ++bvhPackets;
+        int occludedMask = intersectPPacket(packet, &rays[start], dirIsNeg, (1 << n) - 1);
+        for (size_t i = 0; i < n; ++i)
+            occluded[start + i] = occludedMask & (1 << i);
+    }
+}
+
+int BVHAccel::intersectPPacket(const BVHRayPacket &packet, const Ray *rays,
+                               const int dirIsNeg[3], int activeMask) const {
+    const LinearBVHNode *linearNodes = localNodes(nodes);
+    struct NodeToVisit {
+        int nodeIndex, mask;
+    };
+    NodeToVisit nodesToVisit[64];
+    int toVisitOffset = 0;
+    nodesToVisit[toVisitOffset++] = {0, activeMask};
+    int occludedMask = 0;
+    int nodesVisited = 0;
+    while (toVisitOffset > 0 && occludedMask != activeMask) {
+        NodeToVisit current = nodesToVisit[--toVisitOffset];
+        // Rays that have already found an occluder needn't be traced further
+        current.mask &= ~occludedMask;
+        if (current.mask == 0)
+            continue;
+        const LinearBVHNode *node = &linearNodes[current.nodeIndex];
+        ++nodesVisited;
+        int hitMask = packet.IntersectBounds(node->bounds, dirIsNeg, current.mask);
+        if (hitMask == 0)
+            continue;
+
+        if (node->nPrimitives > 0) {
+            for (int r = 0; r < BVHRayPacket::Size; ++r) {
+                if (!(hitMask & (1 << r)))
+                    continue;
+                for (int i = 0; i < node->nPrimitives; ++i)
+                    if (primitives[node->primitivesOffset + i].IntersectP(
+                            rays[r], packet.tMax[r])) {
+                        occludedMask |= 1 << r;
+                        break;
+                    }
+            }
+        } else if ((hitMask & (hitMask - 1)) == 0) {
+            // Packet has diverged to a single ray; finish subtree without packet
+            ++bvhPacketSingleRaySubtrees;
+            int r = 0;
+            while (!(hitMask & (1 << r)))
+                ++r;
+            if (intersectPSubtree(current.nodeIndex, rays[r], packet.tMax[r]))
+                occludedMask |= 1 << r;
+        } else {
+            int firstChild = current.nodeIndex + 1, secondChild = node->secondChildOffset;
+            if (dirIsNeg[node->axis])
+                pstd::swap(firstChild, secondChild);
+            nodesToVisit[toVisitOffset++] = {secondChild, hitMask};
+            nodesToVisit[toVisitOffset++] = {firstChild, hitMask};
+        }
+    }
+    bvhNodesVisited += nodesVisited;
+    bvhTraversalSteps += nodesVisited;
+    ++bvhTraversals;
+    return occludedMask;
+}
+
+template <typename WideNode>
+pstd::optional<ShapeIntersection> BVHAccel::intersectWide(const WideNode *wideNodes,
+                                                          const Ray &ray,
+                                                          Float tMax) const {
+    constexpr int N = WideNode::Width;
+    pstd::optional<ShapeIntersection> si;
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    int dirIsNeg[3] = {static_cast<int>(invDir.x < 0), static_cast<int>(invDir.y < 0),
+                       static_cast<int>(invDir.z < 0)};
+    // Follow ray through wide BVH nodes, visiting children front to back
+    WideBVHToVisit toVisit[64 * N];
+    int toVisitOffset = 0;
+    toVisit[toVisitOffset++] = WideBVHToVisit{0, 0, 0};
+    int nodesVisited = 0;
+    while (toVisitOffset > 0) {
+        WideBVHToVisit current = toVisit[--toVisitOffset];
+        // Skip entries that are farther away than the closest hit found so far
+        if (current.tEnter > tMax)
+            continue;
+
+        if (current.nPrimitives > 0) {
+            // Intersect ray with primitives in leaf
+            for (int i = 0; i < current.nPrimitives; ++i) {
+                pstd::optional<ShapeIntersection> primSi =
+                    primitives[current.offset + i].Intersect(ray, tMax);
+                if (primSi) {
+                    si = primSi;
+                    tMax = si->tHit;
+                }
+            }
+            continue;
+        }
+
+        // Test ray against all children of wide node
+        ++nodesVisited;
+        const WideNode &node = wideNodes[current.offset];
+        Float tEnter[N];
+        int hitMask = node.IntersectChildren(ray.o, invDir, dirIsNeg, tMax, tEnter);
+
+        // Push intersected children so that the closest one is visited next
+        int firstPushed = toVisitOffset;
+        for (int i = 0; i < N; ++i) {
+            if (!(hitMask & (1 << i)))
+                continue;
+            WideBVHToVisit child{node.offset[i], node.nPrimitives[i], tEnter[i]};
+            int j = toVisitOffset++;
+            while (j > firstPushed && toVisit[j - 1].tEnter < child.tEnter) {
+                toVisit[j] = toVisit[j - 1];
+                --j;
+            }
+            toVisit[j] = child;
+        }
+    }
+
+    bvhNodesVisited += nodesVisited;
+    bvhTraversalSteps += nodesVisited;
+    ++bvhTraversals;
+    return si;
+}
+
+template <typename WideNode>
+bool BVHAccel::intersectPWide(const WideNode *wideNodes, const Ray &ray,
+                              Float tMax) const {
+    constexpr int N = WideNode::Width;
+    Vector3f invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
+    int dirIsNeg[3] = {static_cast<int>(invDir.x < 0), static_cast<int>(invDir.y < 0),
+                       static_cast<int>(invDir.z < 0)};
+    int nodesToVisit[64 * N];
+    int toVisitOffset = 0;
+    nodesToVisit[toVisitOffset++] = 0;
+    int nodesVisited = 0;
+
+    while (toVisitOffset > 0) {
+        ++nodesVisited;
+        const WideNode &node = wideNodes[nodesToVisit[--toVisitOffset]];
+        Float tEnter[N];
+        int hitMask = node.IntersectChildren(ray.o, invDir, dirIsNeg, tMax, tEnter);
+        // Any hit will do for shadow rays, so children needn't be sorted
+        for (int i = 0; i < N; ++i) {
+            if (!(hitMask & (1 << i)))
+                continue;
+            if (node.nPrimitives[i] > 0) {
+                for (int j = 0; j < node.nPrimitives[i]; ++j)
+                    if (primitives[node.offset[i] + j].IntersectP(ray, tMax)) {
+                        bvhNodesVisited += nodesVisited;
+                        bvhTraversalSteps += nodesVisited;
+                        ++bvhTraversals;
+                        return true;
+                    }
+            } else
+                nodesToVisit[toVisitOffset++] = node.offset[i];
+        }
+    }
+    bvhNodesVisited += nodesVisited;
+    bvhTraversalSteps += nodesVisited;
+    ++bvhTraversals;
     return false;
 }
 
@@ -736,7 +1854,704 @@ BVHAccel *BVHAccel::Create(std::vector<PrimitiveHandle> prims,
     }
 
     int maxPrimsInNode = parameters.GetOneInt("maxnodeprims", 4);
-    return new BVHAccel(std::move(prims), maxPrimsInNode, splitMethod);
+    int nodeWidth = parameters.GetOneInt("width", 2);
+    if (nodeWidth != 2 && nodeWidth != 4 && nodeWidth != 8) {
+        Warning("BVH node width %d is not supported; must be 2, 4, or 8. Using 2.",
+                nodeWidth);
+        nodeWidth = 2;
+    }
+    bool compressed = parameters.GetOneBool("compressed", false);
+    return new BVHAccel(std::move(prims), maxPrimsInNode, splitMethod, nodeWidth,
+                        compressed, Options->bvhCacheDirectory, Options->numaReplicate);
+}
+
+// MeshPrimitiveSettings Method Definitions
+MeshPrimitiveSettings MeshPrimitiveSettings::Create(
+    const ParameterDictionary &parameters) {
+    MeshPrimitiveSettings settings;
+    settings.leafWidth = parameters.GetOneInt("meshleafwidth", 1);
+    if (settings.leafWidth != 1 && settings.leafWidth != 4 && settings.leafWidth != 8) {
+        Warning("Mesh leaf width %d is not supported; must be 1, 4, or 8. Using 1.",
+                settings.leafWidth);
+        settings.leafWidth = 1;
+    }
+    settings.enabled =
+        parameters.GetOneBool("meshprimitives", false) || settings.leafWidth > 1;
+    settings.maxPrimsInNode = parameters.GetOneInt("maxnodeprims", 4);
+    // HLBVH isn't used for the meshes' BVHs, which are built using the SAH
+    // instead, but the other split methods are.
+    std::string splitMethodName = parameters.GetOneString("splitmethod", "sah");
+    if (splitMethodName == "middle")
+        settings.splitMethod = BVHAccel::SplitMethod::Middle;
+    else if (splitMethodName == "equal")
+        settings.splitMethod = BVHAccel::SplitMethod::EqualCounts;
+    return settings;
+}
+
+// TriangleBlock Definition
+// The vertices of up to _N_ triangles, stored SoA. Blocks that aren't full
+// repeat their first triangle in the remaining lanes.
+template <int N>
+struct alignas(32) TriangleBlock {
+    static constexpr int Width = N;
+    Float p[3][3][N];  // vertex, axis, lane
+    int triIndex[N];
+};
+
+// TriangleBlockRay Definition
+// Ray-dependent values used by the watertight ray-triangle test that
+// Triangle::Intersect() recomputes for each triangle.
+struct TriangleBlockRay {
+    TriangleBlockRay(const Ray &ray) {
+        // Permute components of ray origin and direction
+        kz = MaxComponentIndex(Abs(ray.d));
+        kx = kz + 1;
+        if (kx == 3)
+            kx = 0;
+        ky = kx + 1;
+        if (ky == 3)
+            ky = 0;
+        Vector3f d = Permute(ray.d, {kx, ky, kz});
+        o = Permute(ray.o, {kx, ky, kz});
+
+        // Compute shear transformation coefficients
+        Sx = -d.x / d.z;
+        Sy = -d.y / d.z;
+        Sz = 1.f / d.z;
+    }
+
+    int kx, ky, kz;
+    Point3f o;
+    Float Sx, Sy, Sz;
+};
+
+// TriangleBlockHits Definition
+template <int N>
+struct TriangleBlockHits {
+    Float b0[N], b1[N], b2[N], t[N];
+    // Scaled hit distance and determinant, for rechecking hits against a
+    // reduced $t_\roman{max}$
+    Float tScaled[N], det[N];
+};
+
+// Returns true if a triangle hit with the given scaled distance and
+// determinant is inside the ray's $t$ range; see Triangle::Intersect().
+inline bool InTriangleTRange(Float tScaled, Float det, Float tMax) {
+    if (det < 0)
+        return !(tScaled >= 0 || tScaled < tMax * det);
+    return !(tScaled <= 0 || tScaled > tMax * det);
+}
+
+// TriangleBlock Intersection Functions
+// Intersects the ray with all of the triangles in _block_, returning a
+// bitmask of the lanes that are hit. Each lane performs the same
+// floating-point operations as the watertight test in
+// Triangle::Intersect(), including the double-precision fallback at
+// triangle edges, so the results are identical. Rather than using
+// intrinsics, which couldn't match the scalar code's FMA contractions, the
+// loops over lanes are kept free of data-dependent control flow so that
+// the compiler vectorizes them.
+template <int N>
+inline int IntersectTriangleBlock(const TriangleBlock<N> &block,
+                                  const TriangleBlockRay &r, Float tMax,
+                                  TriangleBlockHits<N> *hits) {
+    // Transform triangle vertices to ray coordinate space
+    Float x[3][N], y[3][N], z[3][N];
+    for (int v = 0; v < 3; ++v) {
+        const Float *px = block.p[v][r.kx], *py = block.p[v][r.ky];
+        const Float *pz = block.p[v][r.kz];
+        for (int i = 0; i < N; ++i) {
+            x[v][i] = px[i] - r.o.x;
+            y[v][i] = py[i] - r.o.y;
+            z[v][i] = pz[i] - r.o.z;
+            x[v][i] += r.Sx * z[v][i];
+            y[v][i] += r.Sy * z[v][i];
+        }
+    }
+
+    // Compute edge function coefficients _e0_, _e1_, and _e2_
+    Float e0[N], e1[N], e2[N];
+    for (int i = 0; i < N; ++i) {
+        e0[i] = DifferenceOfProducts(x[1][i], y[2][i], y[1][i], x[2][i]);
+        e1[i] = DifferenceOfProducts(x[2][i], y[0][i], y[2][i], x[0][i]);
+        e2[i] = DifferenceOfProducts(x[0][i], y[1][i], y[0][i], x[1][i]);
+    }
+
+    // Fall back to double precision test at triangle edges
+    if (sizeof(Float) == sizeof(float))
+        for (int i = 0; i < N; ++i) {
+            if (e0[i] != 0.0f && e1[i] != 0.0f && e2[i] != 0.0f)
+                continue;
+            e0[i] = (float)((double)y[2][i] * (double)x[1][i] -
+                            (double)x[2][i] * (double)y[1][i]);
+            e1[i] = (float)((double)y[0][i] * (double)x[2][i] -
+                            (double)x[0][i] * (double)y[2][i]);
+            e2[i] = (float)((double)y[1][i] * (double)x[0][i] -
+                            (double)x[1][i] * (double)y[0][i]);
+        }
+
+    // The tests below use bitwise rather than logical operators so that
+    // they don't introduce branches
+    int hit[N];
+    for (int i = 0; i < N; ++i) {
+        // Perform triangle edge and determinant tests
+        bool edgesOk = !(((e0[i] < 0) | (e1[i] < 0) | (e2[i] < 0)) &
+                         ((e0[i] > 0) | (e1[i] > 0) | (e2[i] > 0)));
+        Float det = e0[i] + e1[i] + e2[i];
+
+        // Compute scaled hit distance to triangle and test against ray $t$ range
+        Float z0 = z[0][i] * r.Sz, z1 = z[1][i] * r.Sz, z2 = z[2][i] * r.Sz;
+        Float tScaled = e0[i] * z0 + e1[i] * z1 + e2[i] * z2;
+        bool inRange = ((det < 0) & !((tScaled >= 0) | (tScaled < tMax * det))) |
+                       ((det > 0) & !((tScaled <= 0) | (tScaled > tMax * det)));
+
+        // Compute barycentric coordinates and $t$ value for triangle intersection
+        Float invDet = 1 / det;
+        hits->b0[i] = e0[i] * invDet;
+        hits->b1[i] = e1[i] * invDet;
+        hits->b2[i] = e2[i] * invDet;
+        Float t = tScaled * invDet;
+        hits->t[i] = t;
+        hits->tScaled[i] = tScaled;
+        hits->det[i] = det;
+
+        // Ensure that computed triangle $t$ is conservatively greater than zero
+        Float maxZt = std::max(std::abs(z0), std::max(std::abs(z1), std::abs(z2)));
+        Float deltaZ = gamma(3) * maxZt;
+        Float maxXt =
+            std::max(std::abs(x[0][i]), std::max(std::abs(x[1][i]), std::abs(x[2][i])));
+        Float maxYt =
+            std::max(std::abs(y[0][i]), std::max(std::abs(y[1][i]), std::abs(y[2][i])));
+        Float deltaX = gamma(5) * (maxXt + maxZt);
+        Float deltaY = gamma(5) * (maxYt + maxZt);
+        Float deltaE = 2 * (gamma(2) * maxXt * maxYt + deltaY * maxXt + deltaX * maxYt);
+        Float maxE =
+            std::max(std::abs(e0[i]), std::max(std::abs(e1[i]), std::abs(e2[i])));
+        Float deltaT = 3 *
+                       (gamma(3) * maxE * maxZt + deltaE * maxZt + deltaZ * maxE) *
+                       std::abs(invDet);
+
+        hit[i] = edgesOk & inRange & (t > deltaT);
+    }
+
+    int hitMask = 0;
+    for (int i = 0; i < N; ++i)
+        hitMask |= hit[i] << i;
+    return hitMask;
+}
+
+// TriangleBlock Build Functions
+// Returns the number of primitives under _node_, stopping once there are
+// more than _maxPrims_.
+static int CountPrimitives(const BVHBuildNode *node, int maxPrims) {
+    if (node->nPrimitives > 0)
+        return node->nPrimitives;
+    int n = CountPrimitives(node->children[0], maxPrims);
+    return n > maxPrims ? n : n + CountPrimitives(node->children[1], maxPrims);
+}
+
+// Appends the indices of the triangles under _node_ to _tris_.
+static void GatherTriangles(const BVHBuildNode *node, const std::vector<int> &triIndices,
+                            std::vector<int> *tris) {
+    if (node->nPrimitives > 0)
+        tris->insert(tris->end(), &triIndices[node->firstPrimOffset],
+                     &triIndices[node->firstPrimOffset] + node->nPrimitives);
+    else {
+        GatherTriangles(node->children[0], triIndices, tris);
+        GatherTriangles(node->children[1], triIndices, tris);
+    }
+}
+
+// Flattens the BVH rooted at _node_ into _nodes_, storing the triangles of
+// its leaves in _blocks_. Subtrees with at most _N_ triangles become a
+// single leaf. The leaves' _primitivesOffset_ is the index of their first
+// block and _nPrimitives_ the number of triangles.
+template <int N>
+static int FlattenTriangleBlocks(BVHBuildNode *node, const TriangleMesh *mesh,
+                                 const std::vector<int> &triIndices,
+                                 std::vector<LinearBVHNode> *nodes,
+                                 std::vector<TriangleBlock<N>> *blocks) {
+    int myOffset = nodes->size();
+    nodes->push_back(LinearBVHNode());
+    (*nodes)[myOffset].bounds = node->bounds;
+    if (node->nPrimitives > 0 || CountPrimitives(node, N) <= N) {
+        // Create leaf with blocks of the subtree's triangles
+        std::vector<int> tris;
+        GatherTriangles(node, triIndices, &tris);
+        CHECK_LT(tris.size(), 65536);
+        (*nodes)[myOffset].primitivesOffset = blocks->size();
+        (*nodes)[myOffset].nPrimitives = tris.size();
+        for (size_t start = 0; start < tris.size(); start += N) {
+            TriangleBlock<N> block;
+            for (int i = 0; i < N; ++i) {
+                int tri = tris[start + i < tris.size() ? start + i : start];
+                const int *v = &mesh->vertexIndices[3 * tri];
+                for (int j = 0; j < 3; ++j)
+                    for (int a = 0; a < 3; ++a)
+                        block.p[j][a][i] = mesh->p[v[j]][a];
+                block.triIndex[i] = tri;
+            }
+            blocks->push_back(block);
+        }
+    } else {
+        // Create interior flattened BVH node
+        (*nodes)[myOffset].axis = node->splitAxis;
+        (*nodes)[myOffset].nPrimitives = 0;
+        FlattenTriangleBlocks(node->children[0], mesh, triIndices, nodes, blocks);
+        int secondChildOffset =
+            FlattenTriangleBlocks(node->children[1], mesh, triIndices, nodes, blocks);
+        (*nodes)[myOffset].secondChildOffset = secondChildOffset;
+    }
+    return myOffset;
+}
+
+// TriangleMeshPrimitive Method Definitions
+TriangleMeshPrimitive::TriangleMeshPrimitive(const TriangleMesh *mesh,
+                                             MaterialHandle material,
+                                             pstd::span<const LightHandle> areaLights,
+                                             const MediumInterface &mediumInterface,
+                                             FloatTextureHandle alpha, int maxPrimsInNode,
+                                             int leafWidth,
+                                             BVHAccel::SplitMethod splitMethod)
+    : mesh(mesh),
+      material(material),
+      areaLights(areaLights.begin(), areaLights.end()),
+      mediumInterface(mediumInterface),
+      alpha(alpha) {
+    CHECK(areaLights.empty() || areaLights.size() == mesh->nTriangles);
+    CHECK(leafWidth == 1 || leafWidth == 4 || leafWidth == 8);
+    // Initialize _primitiveInfo_ for the mesh's triangles
+    // Degenerate triangles are skipped, since _Triangle_ never reports
+    // intersections with them.
+    std::vector<BVHPrimitiveInfo> primitiveInfo;
+    primitiveInfo.reserve(mesh->nTriangles);
+    for (int i = 0; i < mesh->nTriangles; ++i) {
+        const int *v = &mesh->vertexIndices[3 * i];
+        Point3f p0 = mesh->p[v[0]], p1 = mesh->p[v[1]], p2 = mesh->p[v[2]];
+        if (LengthSquared(Cross(p2 - p0, p1 - p0)) == 0)
+            continue;
+        primitiveInfo.push_back(BVHPrimitiveInfo(i, Union(Bounds3f(p0, p1), p2)));
+    }
+    if (primitiveInfo.empty())
+        return;
+
+    // Build BVH over the triangles' indices
+    pstd::pmr::monotonic_buffer_resource resource;
+    std::vector<pstd::pmr::monotonic_buffer_resource> threadResources(MaxThreadIndex());
+    std::vector<Allocator> threadAllocators;
+    for (size_t i = 0; i < MaxThreadIndex(); ++i)
+        threadAllocators.push_back(Allocator(&threadResources[i]));
+    std::atomic<int> totalNodes{0}, orderedPrimsOffset{0};
+    triIndices.resize(primitiveInfo.size());
+    BVHBuildNode *root = BVHAccel::recursiveBuild(
+        threadAllocators, primitiveInfo, 0, primitiveInfo.size(),
+        std::min(255, maxPrimsInNode), splitMethod, &totalNodes, triIndices,
+        &orderedPrimsOffset);
+    CHECK_EQ(orderedPrimsOffset.load(), triIndices.size());
+    bounds = root->bounds;
+    primitiveMemory += sizeof(*this) + this->areaLights.size() * sizeof(LightHandle);
+
+    if (leafWidth > 1) {
+        // Flatten BVH with leaves that store blocks of triangles
+        std::vector<LinearBVHNode> flatNodes;
+        flatNodes.reserve(totalNodes);
+        size_t blockBytes;
+        if (leafWidth == 4) {
+            std::vector<TriangleBlock<4>> blocks;
+            FlattenTriangleBlocks(root, mesh, triIndices, &flatNodes, &blocks);
+            blocks4 = new TriangleBlock<4>[blocks.size()];
+            std::copy(blocks.begin(), blocks.end(), blocks4);
+            blockBytes = blocks.size() * sizeof(TriangleBlock<4>);
+        } else {
+            std::vector<TriangleBlock<8>> blocks;
+            FlattenTriangleBlocks(root, mesh, triIndices, &flatNodes, &blocks);
+            blocks8 = new TriangleBlock<8>[blocks.size()];
+            std::copy(blocks.begin(), blocks.end(), blocks8);
+            blockBytes = blocks.size() * sizeof(TriangleBlock<8>);
+        }
+        nodes = new LinearBVHNode[flatNodes.size()];
+        std::copy(flatNodes.begin(), flatNodes.end(), nodes);
+        triIndices = std::vector<int>();
+        treeBytes += flatNodes.size() * sizeof(LinearBVHNode) + blockBytes;
+        return;
+    }
+
+    nodes = new LinearBVHNode[totalNodes];
+    int offset = 0;
+    BVHAccel::flattenBVHTree(root, nodes, &offset);
+    CHECK_EQ(totalNodes.load(), offset);
+    treeBytes += totalNodes * sizeof(LinearBVHNode) + triIndices.size() * sizeof(int);
+}
+
+template <typename F>
+inline void TriangleMeshPrimitive::traverse(const Ray &ray, Float tMax,
+                                            F intersectLeaf) const {
+    if (nodes == nullptr)
+        return;
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    int dirIsNeg[3] = {static_cast<int>(invDir.x < 0), static_cast<int>(invDir.y < 0),
+                       static_cast<int>(invDir.z < 0)};
+    // Follow ray through BVH nodes, calling _intersectLeaf_ for leaves
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    int nodesToVisit[64];
+    int nodesVisited = 0;
+    while (true) {
+        ++nodesVisited;
+        const LinearBVHNode *node = &nodes[currentNodeIndex];
+        if (node->bounds.IntersectP(ray.o, ray.d, tMax, invDir, dirIsNeg)) {
+            if (node->nPrimitives > 0) {
+                // _intersectLeaf_ returns false to end traversal
+                if (!intersectLeaf(node->primitivesOffset, node->nPrimitives, &tMax))
+                    break;
+                if (toVisitOffset == 0)
+                    break;
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            } else {
+                // Put far BVH node on _nodesToVisit_ stack, advance to near node
+                if (dirIsNeg[node->axis]) {
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node->secondChildOffset;
+                } else {
+                    nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+            }
+        } else {
+            if (toVisitOffset == 0)
+                break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+    bvhNodesVisited += nodesVisited;
+    bvhTraversalSteps += nodesVisited;
+    ++bvhTraversals;
+}
+
+pstd::optional<ShapeIntersection> TriangleMeshPrimitive::Intersect(const Ray &ray,
+                                                                   Float tMax) const {
+    // Find closest triangle intersection, ignoring ones cut away by _alpha_
+    pstd::optional<TriangleIntersection> closest;
+    int closestTriangle = -1;
+    int nTests = 0;
+    auto recordHit = [&](int tri, const TriangleIntersection &ti, Float *tMax) {
+        if (alpha) {
+            pstd::optional<SurfaceInteraction> intr =
+                Triangle::InteractionFromIntersection(mesh, tri, {ti.b0, ti.b1, ti.b2},
+                                                      ray.time, -ray.d);
+            if (!intr || alpha.Evaluate(*intr) == 0)
+                return;
+        }
+        closest = ti;
+        closestTriangle = tri;
+        *tMax = ti.t;
+    };
+    auto intersectBlocks = [&](const auto *blocks, int offset, int nTris,
+                               Float *tMax) {
+        constexpr int N = std::remove_pointer_t<decltype(blocks)>::Width;
+        TriangleBlockRay blockRay(ray);
+        nTests += nTris;
+        for (int b = offset; b < offset + (nTris + N - 1) / N; ++b) {
+            TriangleBlockHits<N> hits;
+            int hitMask = IntersectTriangleBlock(blocks[b], blockRay, *tMax, &hits);
+            // Record hits in lane order, rechecking them against the
+            // reduced $t_\roman{max}$ after the first one
+            for (int i = 0; i < N; ++i)
+                if ((hitMask & (1 << i)) &&
+                    InTriangleTRange(hits.tScaled[i], hits.det[i], *tMax))
+                    recordHit(blocks[b].triIndex[i],
+                              {hits.b0[i], hits.b1[i], hits.b2[i], hits.t[i]}, tMax);
+        }
+        return true;
+    };
+
+    if (blocks4)
+        traverse(ray, tMax, [&](int offset, int nTris, Float *tMax) {
+            return intersectBlocks(blocks4, offset, nTris, tMax);
+        });
+    else if (blocks8)
+        traverse(ray, tMax, [&](int offset, int nTris, Float *tMax) {
+            return intersectBlocks(blocks8, offset, nTris, tMax);
+        });
+    else
+        traverse(ray, tMax, [&](int offset, int nTris, Float *tMax) {
+            nTests += nTris;
+            for (int i = offset; i < offset + nTris; ++i) {
+                int tri = triIndices[i];
+                const int *v = &mesh->vertexIndices[3 * tri];
+                pstd::optional<TriangleIntersection> ti = Triangle::Intersect(
+                    ray, *tMax, mesh->p[v[0]], mesh->p[v[1]], mesh->p[v[2]]);
+                if (ti)
+                    recordHit(tri, *ti, tMax);
+            }
+            return true;
+        });
+    meshTriTests += nTests;
+    if (!closest)
+        return {};
+
+    // Initialize _SurfaceInteraction_ for closest intersection
+    pstd::optional<SurfaceInteraction> intr = Triangle::InteractionFromIntersection(
+        mesh, closestTriangle, {closest->b0, closest->b1, closest->b2}, ray.time,
+        -ray.d);
+    if (!intr)
+        return {};
+    ++meshTriHits;
+    intr->areaLight = areaLights.empty() ? nullptr : areaLights[closestTriangle];
+    intr->material = material;
+    CHECK_GE(Dot(intr->n, intr->shading.n), 0.);
+    if (mediumInterface.IsMediumTransition())
+        intr->mediumInterface = &mediumInterface;
+    else
+        intr->medium = ray.medium;
+    return ShapeIntersection{*intr, closest->t};
+}
+
+bool TriangleMeshPrimitive::IntersectP(const Ray &ray, Float tMax) const {
+    // Skip shadow intersection test for transparent materials
+    if (material && material.IsTransparent())
+        return false;
+    if (alpha)
+        return Intersect(ray, tMax).has_value();
+
+    bool hit = false;
+    int nTests = 0;
+    auto intersectBlocks = [&](const auto *blocks, int offset, int nTris,
+                               Float *tMax) {
+        constexpr int N = std::remove_pointer_t<decltype(blocks)>::Width;
+        TriangleBlockRay blockRay(ray);
+        nTests += nTris;
+        for (int b = offset; b < offset + (nTris + N - 1) / N; ++b) {
+            TriangleBlockHits<N> hits;
+            if (IntersectTriangleBlock(blocks[b], blockRay, *tMax, &hits)) {
+                hit = true;
+                return false;
+            }
+        }
+        return true;
+    };
+
+    if (blocks4)
+        traverse(ray, tMax, [&](int offset, int nTris, Float *tMax) {
+            return intersectBlocks(blocks4, offset, nTris, tMax);
+        });
+    else if (blocks8)
+        traverse(ray, tMax, [&](int offset, int nTris, Float *tMax) {
+            return intersectBlocks(blocks8, offset, nTris, tMax);
+        });
+    else
+        traverse(ray, tMax, [&](int offset, int nTris, Float *tMax) {
+            for (int i = offset; i < offset + nTris; ++i) {
+                ++nTests;
+                const int *v = &mesh->vertexIndices[3 * triIndices[i]];
+                if (Triangle::Intersect(ray, *tMax, mesh->p[v[0]], mesh->p[v[1]],
+                                        mesh->p[v[2]])) {
+                    hit = true;
+                    return false;
+                }
+            }
+            return true;
+        });
+    meshTriTests += nTests;
+    if (hit)
+        ++meshTriHits;
+    return hit;
+}
+
+// InstanceBVH Method Definitions
+InstanceBVH::InstanceBVH(pstd::span<const PrimitiveHandle> instancePrims,
+                         pstd::span<const Transform *const> renderFromInstance,
+                         int maxPrimsInNode, BVHAccel::SplitMethod splitMethod,
+                         PrimitiveHandle geometry)
+    : geometry(geometry) {
+    CHECK_EQ(instancePrims.size(), renderFromInstance.size());
+    if (geometry)
+        bounds = geometry.Bounds();
+    if (instancePrims.empty())
+        return;
+    // Initialize _primitiveInfo_ with the instances' render-space bounds
+    std::vector<BVHPrimitiveInfo> primitiveInfo(instancePrims.size());
+    ParallelFor(0, instancePrims.size(), [&](int64_t start, int64_t end) {
+        for (int64_t i = start; i < end; ++i)
+            primitiveInfo[i] = BVHPrimitiveInfo(
+                i, (*renderFromInstance[i])(instancePrims[i].Bounds()));
+    });
+
+    // Build BVH over the instances
+    std::vector<pstd::pmr::monotonic_buffer_resource> threadResources(MaxThreadIndex());
+    std::vector<Allocator> threadAllocators;
+    for (size_t i = 0; i < MaxThreadIndex(); ++i)
+        threadAllocators.push_back(Allocator(&threadResources[i]));
+    std::atomic<int> totalNodes{0}, orderedPrimsOffset{0};
+    std::vector<int> orderedIndices(primitiveInfo.size());
+    BVHBuildNode *root = BVHAccel::recursiveBuild(
+        threadAllocators, primitiveInfo, 0, primitiveInfo.size(),
+        std::min(255, maxPrimsInNode), splitMethod, &totalNodes, orderedIndices,
+        &orderedPrimsOffset);
+    CHECK_EQ(orderedPrimsOffset.load(), orderedIndices.size());
+    bounds = Union(bounds, root->bounds);
+
+    // Store instances in leaf order and flatten the BVH
+    instances.reserve(orderedIndices.size());
+    for (int index : orderedIndices)
+        instances.push_back(
+            Instance{instancePrims[index], renderFromInstance[index], index});
+    nNodes = totalNodes;
+    nodes = new LinearBVHNode[nNodes];
+    int offset = 0;
+    BVHAccel::flattenBVHTree(root, nodes, &offset);
+    CHECK_EQ(nNodes, offset);
+    primitiveMemory += sizeof(*this) + instances.size() * sizeof(Instance);
+    treeBytes += nNodes * sizeof(LinearBVHNode);
+}
+
+InstanceBVH *InstanceBVH::Create(pstd::span<const PrimitiveHandle> instancePrims,
+                                 pstd::span<const Transform *const> renderFromInstance,
+                                 PrimitiveHandle geometry,
+                                 const ParameterDictionary &parameters) {
+    int maxPrimsInNode = parameters.GetOneInt("maxnodeprims", 4);
+    // As for the meshes' BVHs, HLBVH builds use the SAH instead; unknown
+    // split methods are reported by the scene's accelerator.
+    BVHAccel::SplitMethod splitMethod = BVHAccel::SplitMethod::SAH;
+    std::string splitMethodName = parameters.GetOneString("splitmethod", "sah");
+    if (splitMethodName == "middle")
+        splitMethod = BVHAccel::SplitMethod::Middle;
+    else if (splitMethodName == "equal")
+        splitMethod = BVHAccel::SplitMethod::EqualCounts;
+    return new InstanceBVH(instancePrims, renderFromInstance, maxPrimsInNode,
+                           splitMethod, geometry);
+}
+
+void InstanceBVH::Refit(pstd::span<const Transform *const> renderFromInstance) {
+    CHECK_EQ(renderFromInstance.size(), instances.size());
+    if (instances.empty())
+        return;
+    // Update instances' transforms
+    for (Instance &instance : instances)
+        instance.renderFromInstance = renderFromInstance[instance.index];
+
+    // Recompute leaf nodes' bounds from their instances
+    ParallelFor(0, nNodes, [&](int64_t start, int64_t end) {
+        for (int64_t i = start; i < end; ++i) {
+            LinearBVHNode *node = &nodes[i];
+            if (node->nPrimitives == 0)
+                continue;
+            node->bounds = Bounds3f();
+            for (int j = node->primitivesOffset;
+                 j < node->primitivesOffset + node->nPrimitives; ++j)
+                node->bounds =
+                    Union(node->bounds, (*instances[j].renderFromInstance)(
+                                            instances[j].primitive.Bounds()));
+        }
+    });
+
+    // Recompute interior nodes' bounds from the leaves up
+    // Both of an interior node's children follow it in _nodes_, so visiting
+    // the nodes in reverse order updates the children before their parent.
+    for (int i = nNodes - 1; i >= 0; --i) {
+        LinearBVHNode *node = &nodes[i];
+        if (node->nPrimitives == 0)
+            node->bounds =
+                Union(nodes[i + 1].bounds, nodes[node->secondChildOffset].bounds);
+    }
+    bounds = nodes[0].bounds;
+    if (geometry)
+        bounds = Union(bounds, geometry.Bounds());
+}
+
+template <typename F>
+inline void InstanceBVH::traverse(const Ray &ray, Float tMax, F intersectInstance) const {
+    if (nodes == nullptr)
+        return;
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    int dirIsNeg[3] = {static_cast<int>(invDir.x < 0), static_cast<int>(invDir.y < 0),
+                       static_cast<int>(invDir.z < 0)};
+    // Follow ray through BVH nodes, calling _intersectInstance_ for instances
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    int nodesToVisit[64];
+    int nodesVisited = 0;
+    while (true) {
+        ++nodesVisited;
+        const LinearBVHNode *node = &nodes[currentNodeIndex];
+        if (node->bounds.IntersectP(ray.o, ray.d, tMax, invDir, dirIsNeg)) {
+            if (node->nPrimitives > 0) {
+                // Intersect ray with instances in leaf BVH node
+                // _intersectInstance_ returns false to end traversal.
+                bool done = false;
+                for (int i = 0; i < node->nPrimitives; ++i)
+                    if (!intersectInstance(instances[node->primitivesOffset + i],
+                                           &tMax)) {
+                        done = true;
+                        break;
+                    }
+                if (done || toVisitOffset == 0)
+                    break;
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            } else {
+                // Put far BVH node on _nodesToVisit_ stack, advance to near node
+                if (dirIsNeg[node->axis]) {
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node->secondChildOffset;
+                } else {
+                    nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+            }
+        } else {
+            if (toVisitOffset == 0)
+                break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+    bvhNodesVisited += nodesVisited;
+    bvhTraversalSteps += nodesVisited;
+    ++bvhTraversals;
+}
+
+pstd::optional<ShapeIntersection> InstanceBVH::Intersect(const Ray &r,
+                                                         Float tMax) const {
+    // Intersect ray with non-instanced geometry
+    pstd::optional<ShapeIntersection> geometrySi =
+        geometry ? geometry.Intersect(r, tMax) : pstd::optional<ShapeIntersection>{};
+    if (geometrySi)
+        tMax = geometrySi->tHit;
+
+    // Find closest instance intersection in instance space
+    pstd::optional<ShapeIntersection> si;
+    const Transform *renderFromClosest = nullptr;
+    traverse(r, tMax, [&](const Instance &instance, Float *tMax) {
+        // Transform ray to instance space and intersect with instance
+        Float instanceTMax = *tMax;
+        Ray ray = instance.renderFromInstance->ApplyInverse(r, &instanceTMax);
+        pstd::optional<ShapeIntersection> instanceSi =
+            instance.primitive.Intersect(ray, instanceTMax);
+        if (instanceSi) {
+            CHECK_LT(instanceSi->tHit, 1.001 * instanceTMax);
+            si = instanceSi;
+            renderFromClosest = instance.renderFromInstance;
+            *tMax = si->tHit;
+        }
+        return true;
+    });
+    if (!si)
+        return geometrySi;
+
+    // Return transformed instance's intersection information
+    si->intr = (*renderFromClosest)(si->intr);
+    CHECK_GE(Dot(si->intr.n, si->intr.shading.n), 0);
+    return si;
+}
+
+bool InstanceBVH::IntersectP(const Ray &r, Float tMax) const {
+    if (geometry && geometry.IntersectP(r, tMax))
+        return true;
+    bool hit = false;
+    traverse(r, tMax, [&](const Instance &instance, Float *tMax) {
+        Float instanceTMax = *tMax;
+        Ray ray = instance.renderFromInstance->ApplyInverse(r, &instanceTMax);
+        hit = instance.primitive.IntersectP(ray, instanceTMax);
+        return !hit;
+    });
+    return hit;
 }
 
 // KdToDo Definition
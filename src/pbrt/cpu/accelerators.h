@@ -11,6 +11,8 @@
 
 #include <atomic>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
 namespace pbrt {
@@ -21,8 +23,15 @@ PrimitiveHandle CreateAccelerator(const std::string &name,
 
 struct BVHBuildNode;
 struct BVHPrimitiveInfo;
+struct BVHRayPacket;
 struct LinearBVHNode;
 struct MortonPrimitive;
+template <int N>
+struct WideBVHNode;
+template <int N>
+struct QuantizedBVHNode;
+template <int N>
+struct TriangleBlock;
 
 // BVHAccel Definition
 class BVHAccel {
@@ -32,7 +41,9 @@ class BVHAccel {
 
     // BVHAccel Public Methods
     BVHAccel(std::vector<PrimitiveHandle> p, int maxPrimsInNode = 1,
-             SplitMethod splitMethod = SplitMethod::SAH);
+             SplitMethod splitMethod = SplitMethod::SAH, int nodeWidth = 2,
+             bool compressed = false, const std::string &cacheDirectory = {},
+             bool numaReplicate = false);
 
     static BVHAccel *Create(std::vector<PrimitiveHandle> prims,
                             const ParameterDictionary &parameters);
@@ -41,31 +52,223 @@ class BVHAccel {
     pstd::optional<ShapeIntersection> Intersect(const Ray &ray, Float tMax) const;
     bool IntersectP(const Ray &ray, Float tMax) const;
 
+    // Ray packet queries: each ray is tested over $[0, \roman{tMax}_i)$.
+    // Coherent groups of rays are traversed together.
+    void Intersect(pstd::span<const Ray> rays, pstd::span<const Float> tMax,
+                   pstd::span<pstd::optional<ShapeIntersection>> intersections) const;
+    void IntersectP(pstd::span<const Ray> rays, pstd::span<const Float> tMax,
+                    pstd::span<bool> occluded) const;
+
   private:
     // BVHAccel Private Methods
-    BVHBuildNode *recursiveBuild(std::vector<Allocator> &threadAllocators,
-                                 std::vector<BVHPrimitiveInfo> &primitiveInfo, int start,
-                                 int end, std::atomic<int> *totalNodes,
-                                 std::vector<PrimitiveHandle> &orderedPrims,
-                                 std::atomic<int> *orderedPrimsOffset);
+    static BVHBuildNode *recursiveBuild(std::vector<Allocator> &threadAllocators,
+                                        std::vector<BVHPrimitiveInfo> &primitiveInfo,
+                                        int start, int end, int maxPrimsInNode,
+                                        SplitMethod splitMethod,
+                                        std::atomic<int> *totalNodes,
+                                        std::vector<int> &orderedPrimIndices,
+                                        std::atomic<int> *orderedPrimsOffset);
     BVHBuildNode *HLBVHBuild(Allocator alloc,
                              const std::vector<BVHPrimitiveInfo> &primitiveInfo,
                              std::atomic<int> *totalNodes,
-                             std::vector<PrimitiveHandle> &orderedPrims);
+                             std::vector<int> &orderedPrimIndices);
     BVHBuildNode *emitLBVH(BVHBuildNode *&buildNodes,
                            const std::vector<BVHPrimitiveInfo> &primitiveInfo,
                            MortonPrimitive *mortonPrims, int nPrimitives, int *totalNodes,
-                           std::vector<PrimitiveHandle> &orderedPrims,
+                           std::vector<int> &orderedPrimIndices,
                            std::atomic<int> *orderedPrimsOffset, int bitIndex);
     BVHBuildNode *buildUpperSAH(Allocator alloc,
                                 std::vector<BVHBuildNode *> &treeletRoots, int start,
                                 int end, std::atomic<int> *totalNodes) const;
-    int flattenBVHTree(BVHBuildNode *node, int *offset);
+    static int flattenBVHTree(BVHBuildNode *node, LinearBVHNode *nodes, int *offset);
+    template <typename WideNode>
+    int flattenWideBVHTree(BVHBuildNode *node, std::vector<WideNode> &wideNodes);
+    template <typename WideNode>
+    WideNode *buildWideBVH(BVHBuildNode *root, int totalNodes);
+
+    pstd::optional<ShapeIntersection> intersectSubtree(int rootIndex, const Ray &ray,
+                                                       Float tMax) const;
+    bool intersectPSubtree(int rootIndex, const Ray &ray, Float tMax) const;
+    void intersectPacket(BVHRayPacket &packet, const Ray *rays, const int dirIsNeg[3],
+                         int activeMask,
+                         pstd::optional<ShapeIntersection> *intersections) const;
+    int intersectPPacket(const BVHRayPacket &packet, const Ray *rays,
+                         const int dirIsNeg[3], int activeMask) const;
+
+    template <typename WideNode>
+    pstd::optional<ShapeIntersection> intersectWide(const WideNode *wideNodes,
+                                                    const Ray &ray, Float tMax) const;
+    template <typename WideNode>
+    bool intersectPWide(const WideNode *wideNodes, const Ray &ray, Float tMax) const;
+
+    uint64_t cacheKey(const std::vector<BVHPrimitiveInfo> &primitiveInfo) const;
+    void writeCache(const std::string &filename, uint64_t hash,
+                    const std::vector<int> &orderedPrimIndices) const;
+    bool readCache(const std::string &filename, uint64_t hash);
+
+    template <typename Node>
+    const Node *localNodes(const Node *n) const;
+    const void *replicateNodes(int numaNode) const;
+
+    friend class TriangleMeshPrimitive;
+    friend class InstanceBVH;
 
     // BVHAccel Private Members
     int maxPrimsInNode;
     SplitMethod splitMethod;
+    int nodeWidth;
+    bool compressed;
     std::vector<PrimitiveHandle> primitives;
+    Bounds3f bounds;
+    int nNodes = 0;
+    LinearBVHNode *nodes = nullptr;
+    WideBVHNode<4> *wideNodes4 = nullptr;
+    WideBVHNode<8> *wideNodes8 = nullptr;
+    QuantizedBVHNode<2> *quantizedNodes2 = nullptr;
+    QuantizedBVHNode<4> *quantizedNodes4 = nullptr;
+    QuantizedBVHNode<8> *quantizedNodes8 = nullptr;
+    // Per-NUMA node copies of the node array, made on first use by a
+    // thread on each node
+    mutable std::vector<std::atomic<const void *>> numaNodeReplicas;
+    mutable std::mutex numaReplicaMutex;
+};
+
+// MeshPrimitiveSettings Definition
+// Determines whether _CreatePrimitives()_ represents all of the triangles of
+// a large mesh with a single _TriangleMeshPrimitive_ and how its BVH is
+// built. They are given by the scene's "accelerator" parameters:
+// "meshprimitives" enables mesh primitives, "maxnodeprims" and "splitmethod"
+// are used for the meshes' BVHs as for the scene's, and "meshleafwidth"
+// gives the leaf width. A "meshleafwidth" of 4 or 8 also enables mesh
+// primitives. The meshes' BVHs are always binary and aren't cached.
+struct MeshPrimitiveSettings {
+    static MeshPrimitiveSettings Create(const ParameterDictionary &parameters);
+
+    bool enabled = false;
+    int maxPrimsInNode = 4;
+    BVHAccel::SplitMethod splitMethod = BVHAccel::SplitMethod::SAH;
+    int leafWidth = 1;
+};
+
+// TriangleMeshPrimitive Definition
+// Represents the triangles of a _TriangleMesh_ that share a material, alpha
+// texture, and medium interface as a single primitive. The triangles are
+// found using a BVH whose leaves store indices into the mesh, so that they
+// are intersected directly using the mesh's vertices rather than through a
+// _PrimitiveHandle_ and _ShapeHandle_ for each one.
+//
+// If _leafWidth_ is 4 or 8, the leaves instead store blocks of that many
+// triangles' vertices SoA, which are intersected together. Subtrees with
+// no more triangles than that are collapsed into a single leaf. This uses
+// about 10x more memory per triangle than storing indices.
+class TriangleMeshPrimitive {
+  public:
+    // TriangleMeshPrimitive Public Methods
+    // _areaLights_ is either empty or holds the area light for each of the
+    // mesh's triangles.
+    TriangleMeshPrimitive(const TriangleMesh *mesh, MaterialHandle material,
+                          pstd::span<const LightHandle> areaLights,
+                          const MediumInterface &mediumInterface,
+                          FloatTextureHandle alpha, int maxPrimsInNode = 4,
+                          int leafWidth = 1,
+                          BVHAccel::SplitMethod splitMethod = BVHAccel::SplitMethod::SAH);
+
+    Bounds3f Bounds() const { return bounds; }
+    pstd::optional<ShapeIntersection> Intersect(const Ray &ray, Float tMax) const;
+    bool IntersectP(const Ray &ray, Float tMax) const;
+
+  private:
+    // TriangleMeshPrimitive Private Methods
+    template <typename F>
+    void traverse(const Ray &ray, Float tMax, F intersectLeaf) const;
+
+    // TriangleMeshPrimitive Private Members
+    const TriangleMesh *mesh;
+    MaterialHandle material;
+    std::vector<LightHandle> areaLights;
+    MediumInterface mediumInterface;
+    FloatTextureHandle alpha;
+    Bounds3f bounds;
+    LinearBVHNode *nodes = nullptr;
+    // The leaves of the BVH refer to ranges of _triIndices_, or, if the
+    // triangles are stored in blocks, to ranges of one of the block arrays.
+    std::vector<int> triIndices;
+    TriangleBlock<4> *blocks4 = nullptr;
+    TriangleBlock<8> *blocks8 = nullptr;
+};
+
+// InstanceBVH Definition
+// Stores object instances that each have a single transform in a BVH of
+// their own. Each instance is a small record in a contiguous array that
+// holds the shared primitive it instantiates and its transform, rather than
+// a separately-allocated _TransformedPrimitive_ stored in the scene's BVH.
+// The instances' render-space bounds are only stored in the BVH's nodes.
+// The rest of the scene's geometry may be given as a further primitive that
+// is intersected along with the instances, which lets the _InstanceBVH_ be
+// the scene's aggregate.
+//
+// The renderer only uses an _InstanceBVH_ if the scene's "accelerator" has
+// a true "instancebvh" parameter; otherwise instances are stored in the
+// scene's accelerator. The _InstanceBVH_'s tree uses the accelerator's
+// "maxnodeprims" and "splitmethod" but is always binary and isn't cached;
+// the accelerator for the rest of the scene is its child.
+//
+// Refit() updates the instances' transforms and the node bounds without
+// rebuilding the tree, which is much faster than a rebuild but gives a
+// less efficient tree if the instances move far relative to each other.
+// If the _InstanceBVH_ is the scene's aggregate, refitting it updates the
+// scene without rebuilding any other accelerator.
+class InstanceBVH {
+  public:
+    // InstanceBVH Public Methods
+    // The i-th instance is _instancePrims[i]_ placed in the scene by
+    // _renderFromInstance[i]_. The transforms must outlive the _InstanceBVH_.
+    // _geometry_, if provided, holds the geometry that isn't instanced.
+    InstanceBVH(pstd::span<const PrimitiveHandle> instancePrims,
+                pstd::span<const Transform *const> renderFromInstance,
+                int maxPrimsInNode = 1,
+                BVHAccel::SplitMethod splitMethod = BVHAccel::SplitMethod::SAH,
+                PrimitiveHandle geometry = nullptr);
+
+    static InstanceBVH *Create(pstd::span<const PrimitiveHandle> instancePrims,
+                               pstd::span<const Transform *const> renderFromInstance,
+                               PrimitiveHandle geometry,
+                               const ParameterDictionary &parameters);
+
+    Bounds3f Bounds() const { return bounds; }
+    pstd::optional<ShapeIntersection> Intersect(const Ray &ray, Float tMax) const;
+    bool IntersectP(const Ray &ray, Float tMax) const;
+
+    // Replaces each instance's transform with the corresponding one in
+    // _renderFromInstance_, which is indexed like the constructor's
+    // arguments, and updates the bounds of the BVH's nodes. Renders that
+    // start afterward see the instances at their new positions, though
+    // lights that were preprocessed with the old scene bounds keep them.
+    // pbrt itself doesn't call Refit(); it is for applications that move
+    // instances between renders.
+    void Refit(pstd::span<const Transform *const> renderFromInstance);
+
+    size_t NInstances() const { return instances.size(); }
+
+  private:
+    // InstanceBVH::Instance Definition
+    struct Instance {
+        PrimitiveHandle primitive;
+        const Transform *renderFromInstance;
+        // Index of the instance in the constructor's arguments
+        int index;
+    };
+
+    // InstanceBVH Private Methods
+    template <typename F>
+    void traverse(const Ray &ray, Float tMax, F intersectInstance) const;
+
+    // InstanceBVH Private Members
+    // Instances are stored in the order of the BVH's leaves
+    std::vector<Instance> instances;
+    PrimitiveHandle geometry;
+    Bounds3f bounds;
+    int nNodes = 0;
     LinearBVHNode *nodes = nullptr;
 };
 
@@ -0,0 +1,565 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/cpu/accelerators.h>
+#include <pbrt/cpu/primitive.h>
+#include <pbrt/paramdict.h>
+#include <pbrt/parser.h>
+#include <pbrt/shapes.h>
+#include <pbrt/util/colorspace.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/mesh.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/rng.h>
+#include <pbrt/util/sampling.h>
+#include <pbrt/util/transform.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+#ifdef PBRT_IS_WINDOWS
+#include <direct.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace pbrt;
+
+// Returns a mesh of randomly placed small triangles inside [-1,1]^3. If
+// _degenerateEvery_ is nonzero, every _degenerateEvery_th triangle has zero area.
+static std::unique_ptr<TriangleMesh> RandomTriangleMesh(RNG &rng, int nTriangles,
+                                                        int degenerateEvery = 0) {
+    static Transform identity;
+    std::vector<Point3f> p;
+    std::vector<int> indices;
+    for (int i = 0; i < nTriangles; ++i) {
+        Point3f c(Lerp(rng.Uniform<Float>(), -1, 1), Lerp(rng.Uniform<Float>(), -1, 1),
+                  Lerp(rng.Uniform<Float>(), -1, 1));
+        for (int j = 0; j < 3; ++j) {
+            indices.push_back(p.size());
+            p.push_back(c + Vector3f(Lerp(rng.Uniform<Float>(), -.1f, .1f),
+                                     Lerp(rng.Uniform<Float>(), -.1f, .1f),
+                                     Lerp(rng.Uniform<Float>(), -.1f, .1f)));
+        }
+        if (degenerateEvery > 0 && i % degenerateEvery == 0)
+            p[p.size() - 2] = p[p.size() - 3];
+    }
+    return std::make_unique<TriangleMesh>(identity, false, indices, p,
+                                          std::vector<Vector3f>(),
+                                          std::vector<Normal3f>(),
+                                          std::vector<Point2f>(), std::vector<int>());
+}
+
+static std::vector<PrimitiveHandle> MakePrimitives(const TriangleMesh *mesh) {
+    std::vector<PrimitiveHandle> prims;
+    for (ShapeHandle tri : Triangle::CreateTriangles(mesh, Allocator()))
+        prims.push_back(new SimplePrimitive(tri, nullptr));
+    return prims;
+}
+
+static void CheckMatchesBinaryBVH(BVHAccel::SplitMethod splitMethod, int width,
+                                  bool compressed = false) {
+    RNG rng(width);
+    std::unique_ptr<TriangleMesh> mesh = RandomTriangleMesh(rng, 2000);
+    std::vector<PrimitiveHandle> prims = MakePrimitives(mesh.get());
+
+    BVHAccel binary(prims, 4, splitMethod, 2);
+    BVHAccel wide(prims, 4, splitMethod, width, compressed);
+
+    Bounds3f b = binary.Bounds(), bw = wide.Bounds();
+    for (int c = 0; c < 2; ++c)
+        EXPECT_EQ(b[c], bw[c]);
+
+    for (int i = 0; i < 10000; ++i) {
+        Point3f o(Lerp(rng.Uniform<Float>(), -2, 2), Lerp(rng.Uniform<Float>(), -2, 2),
+                  Lerp(rng.Uniform<Float>(), -2, 2));
+        Vector3f d = SampleUniformSphere({rng.Uniform<Float>(), rng.Uniform<Float>()});
+        // Exercise axis-aligned directions as well
+        if (i % 10 == 0)
+            d[i % 3] = d[(i + 1) % 3] = 0;
+        if (LengthSquared(d) == 0)
+            continue;
+        Ray ray(o, d);
+        Float tMax = (i & 1) ? Infinity : rng.Uniform<Float>() * 4;
+
+        pstd::optional<ShapeIntersection> si = binary.Intersect(ray, tMax);
+        pstd::optional<ShapeIntersection> siw = wide.Intersect(ray, tMax);
+        ASSERT_EQ(si.has_value(), siw.has_value()) << ray;
+        if (si)
+            EXPECT_EQ(si->tHit, siw->tHit) << ray;
+
+        EXPECT_EQ(binary.IntersectP(ray, tMax), wide.IntersectP(ray, tMax)) << ray;
+    }
+
+    for (PrimitiveHandle p : prims)
+        delete p.Cast<SimplePrimitive>();
+}
+
+TEST(BVHAccel, Wide4MatchesBinary) {
+    CheckMatchesBinaryBVH(BVHAccel::SplitMethod::SAH, 4);
+    CheckMatchesBinaryBVH(BVHAccel::SplitMethod::HLBVH, 4);
+}
+
+TEST(BVHAccel, Wide8MatchesBinary) {
+    CheckMatchesBinaryBVH(BVHAccel::SplitMethod::SAH, 8);
+    CheckMatchesBinaryBVH(BVHAccel::SplitMethod::Middle, 8);
+}
+
+TEST(BVHAccel, CompressedMatchesBinary) {
+    for (int width : {2, 4, 8})
+        CheckMatchesBinaryBVH(BVHAccel::SplitMethod::SAH, width, true);
+    CheckMatchesBinaryBVH(BVHAccel::SplitMethod::HLBVH, 4, true);
+}
+
+TEST(BVHAccel, ParallelBuildMatchesBruteForce) {
+    // Enough primitives that the upper levels are built in parallel
+    RNG rng;
+    std::unique_ptr<TriangleMesh> mesh = RandomTriangleMesh(rng, 300000);
+    std::vector<PrimitiveHandle> prims = MakePrimitives(mesh.get());
+    BVHAccel sah(prims, 4, BVHAccel::SplitMethod::SAH);
+    BVHAccel hlbvh(prims, 4, BVHAccel::SplitMethod::HLBVH);
+
+    for (int i = 0; i < 100; ++i) {
+        Point3f o(Lerp(rng.Uniform<Float>(), -2, 2), Lerp(rng.Uniform<Float>(), -2, 2),
+                  Lerp(rng.Uniform<Float>(), -2, 2));
+        Vector3f d = SampleUniformSphere({rng.Uniform<Float>(), rng.Uniform<Float>()});
+        Ray ray(o, d);
+
+        Float tHit = Infinity;
+        for (PrimitiveHandle p : prims)
+            if (pstd::optional<ShapeIntersection> si = p.Intersect(ray, tHit))
+                tHit = si->tHit;
+
+        for (const BVHAccel *bvh : {&sah, &hlbvh}) {
+            pstd::optional<ShapeIntersection> si = bvh->Intersect(ray, Infinity);
+            ASSERT_EQ(tHit < Infinity, si.has_value()) << ray;
+            if (si)
+                EXPECT_EQ(tHit, si->tHit) << ray;
+        }
+    }
+
+    for (PrimitiveHandle p : prims)
+        delete p.Cast<SimplePrimitive>();
+}
+
+TEST(BVHAccel, Cache) {
+    RNG rng;
+    std::unique_ptr<TriangleMesh> mesh = RandomTriangleMesh(rng, 5000);
+    std::vector<PrimitiveHandle> prims = MakePrimitives(mesh.get());
+    // Use a new directory so that files left by earlier runs aren't counted
+    std::string dir = TemporaryDirectory() + "/pbrt-test-bvhcache-XXXXXX";
+#ifdef PBRT_IS_WINDOWS
+    ASSERT_EQ(0, _mktemp_s(&dir[0], dir.size() + 1));
+    ASSERT_EQ(0, _mkdir(dir.c_str()));
+#else
+    ASSERT_TRUE(mkdtemp(&dir[0]) != nullptr);
+#endif
+
+    for (int width : {2, 4, 8}) {
+        // The first BVH writes the cache file and the second reads it
+        BVHAccel built(prims, 4, BVHAccel::SplitMethod::SAH, width, false, dir);
+        BVHAccel cached(prims, 4, BVHAccel::SplitMethod::SAH, width, false, dir);
+        EXPECT_EQ(built.Bounds().pMin, cached.Bounds().pMin);
+        EXPECT_EQ(built.Bounds().pMax, cached.Bounds().pMax);
+
+        for (int i = 0; i < 1000; ++i) {
+            Point3f o(Lerp(rng.Uniform<Float>(), -2, 2),
+                      Lerp(rng.Uniform<Float>(), -2, 2),
+                      Lerp(rng.Uniform<Float>(), -2, 2));
+            Vector3f d =
+                SampleUniformSphere({rng.Uniform<Float>(), rng.Uniform<Float>()});
+            Ray ray(o, d);
+            pstd::optional<ShapeIntersection> si = built.Intersect(ray, Infinity);
+            pstd::optional<ShapeIntersection> sic = cached.Intersect(ray, Infinity);
+            ASSERT_EQ(si.has_value(), sic.has_value()) << ray;
+            if (si)
+                EXPECT_EQ(si->tHit, sic->tHit) << ray;
+        }
+    }
+
+    std::vector<std::string> cacheFiles = MatchingFilenames(dir + "/bvh-");
+    EXPECT_EQ(3, cacheFiles.size());
+    for (const std::string &fn : cacheFiles)
+        EXPECT_EQ(0, remove(fn.c_str()));
+#ifdef PBRT_IS_WINDOWS
+    EXPECT_EQ(0, _rmdir(dir.c_str()));
+#else
+    EXPECT_EQ(0, rmdir(dir.c_str()));
+#endif
+
+    for (PrimitiveHandle p : prims)
+        delete p.Cast<SimplePrimitive>();
+}
+
+TEST(BVHAccel, CacheConcurrentWritersAndTruncation) {
+    RNG rng;
+    std::unique_ptr<TriangleMesh> mesh = RandomTriangleMesh(rng, 5000);
+    std::vector<PrimitiveHandle> prims = MakePrimitives(mesh.get());
+    std::string dir = TemporaryDirectory() + "/pbrt-test-bvhcache-XXXXXX";
+#ifdef PBRT_IS_WINDOWS
+    ASSERT_EQ(0, _mktemp_s(&dir[0], dir.size() + 1));
+    ASSERT_EQ(0, _mkdir(dir.c_str()));
+#else
+    ASSERT_TRUE(mkdtemp(&dir[0]) != nullptr);
+#endif
+    BVHAccel reference(prims, 4);
+    auto checkIntersections = [&](const BVHAccel &bvh) {
+        for (int i = 0; i < 1000; ++i) {
+            Point3f o(Lerp(rng.Uniform<Float>(), -2, 2),
+                      Lerp(rng.Uniform<Float>(), -2, 2),
+                      Lerp(rng.Uniform<Float>(), -2, 2));
+            Vector3f d =
+                SampleUniformSphere({rng.Uniform<Float>(), rng.Uniform<Float>()});
+            Ray ray(o, d);
+            pstd::optional<ShapeIntersection> si = reference.Intersect(ray, Infinity);
+            pstd::optional<ShapeIntersection> sic = bvh.Intersect(ray, Infinity);
+            ASSERT_EQ(si.has_value(), sic.has_value()) << ray;
+            if (si)
+                EXPECT_EQ(si->tHit, sic->tHit) << ray;
+        }
+    };
+
+    // Concurrent builds of the same BVH all write its cache file; they
+    // must leave a single valid file and no temporary files.
+    ParallelFor(0, 8, [&](int64_t) {
+        BVHAccel bvh(prims, 4, BVHAccel::SplitMethod::SAH, 2, false, dir);
+    });
+    std::vector<std::string> cacheFiles = MatchingFilenames(dir + "/bvh-");
+    ASSERT_EQ(1, cacheFiles.size());
+    checkIntersections(BVHAccel(prims, 4, BVHAccel::SplitMethod::SAH, 2, false, dir));
+
+    // A truncated cache file is ignored and replaced
+    std::string contents = ReadFileContents(cacheFiles[0]);
+    FILE *f = fopen(cacheFiles[0].c_str(), "wb");
+    ASSERT_TRUE(f != nullptr);
+    fwrite(contents.data(), 1, contents.size() / 2, f);
+    fclose(f);
+    checkIntersections(BVHAccel(prims, 4, BVHAccel::SplitMethod::SAH, 2, false, dir));
+    EXPECT_EQ(contents.size(), ReadFileContents(cacheFiles[0]).size());
+
+    for (const std::string &fn : MatchingFilenames(dir + "/bvh-"))
+        EXPECT_EQ(0, remove(fn.c_str()));
+#ifdef PBRT_IS_WINDOWS
+    EXPECT_EQ(0, _rmdir(dir.c_str()));
+#else
+    EXPECT_EQ(0, rmdir(dir.c_str()));
+#endif
+
+    for (PrimitiveHandle p : prims)
+        delete p.Cast<SimplePrimitive>();
+}
+
+TEST(BVHAccel, PacketsMatchSingleRays) {
+    RNG rng;
+    std::unique_ptr<TriangleMesh> mesh = RandomTriangleMesh(rng, 5000);
+    std::vector<PrimitiveHandle> prims = MakePrimitives(mesh.get());
+
+    for (int width : {2, 4}) {
+        BVHAccel bvh(prims, 4, BVHAccel::SplitMethod::SAH, width);
+        for (bool coherent : {true, false}) {
+            // Coherent rays leave one point toward a small square; the
+            // others have random origins and directions
+            int nRays = 1003;
+            std::vector<Ray> rays;
+            std::vector<Float> tMax;
+            for (int i = 0; i < nRays; ++i) {
+                if (coherent) {
+                    Point3f p(Lerp(rng.Uniform<Float>(), -.5, .5),
+                              Lerp(rng.Uniform<Float>(), -.5, .5), 0);
+                    rays.push_back(Ray(Point3f(0, 0, -3), p - Point3f(0, 0, -3)));
+                } else {
+                    Point3f o(Lerp(rng.Uniform<Float>(), -2, 2),
+                              Lerp(rng.Uniform<Float>(), -2, 2),
+                              Lerp(rng.Uniform<Float>(), -2, 2));
+                    rays.push_back(Ray(o, SampleUniformSphere({rng.Uniform<Float>(),
+                                                               rng.Uniform<Float>()})));
+                }
+                tMax.push_back((i % 3 == 0) ? Infinity : 4 * rng.Uniform<Float>());
+            }
+
+            std::vector<pstd::optional<ShapeIntersection>> si(nRays);
+            bvh.Intersect(rays, tMax, pstd::span<pstd::optional<ShapeIntersection>>(si));
+            std::unique_ptr<bool[]> occluded(new bool[nRays]);
+            bvh.IntersectP(rays, tMax, pstd::span<bool>(occluded.get(), nRays));
+
+            for (int i = 0; i < nRays; ++i) {
+                pstd::optional<ShapeIntersection> s = bvh.Intersect(rays[i], tMax[i]);
+                ASSERT_EQ(s.has_value(), si[i].has_value()) << rays[i];
+                if (s)
+                    EXPECT_EQ(s->tHit, si[i]->tHit) << rays[i];
+                EXPECT_EQ(bvh.IntersectP(rays[i], tMax[i]), occluded[i]) << rays[i];
+            }
+        }
+    }
+
+    for (PrimitiveHandle p : prims)
+        delete p.Cast<SimplePrimitive>();
+}
+
+TEST(TriangleMeshPrimitive, MatchesBVH) {
+    RNG rng;
+    std::unique_ptr<TriangleMesh> mesh = RandomTriangleMesh(rng, 3000, 100);
+    std::vector<PrimitiveHandle> prims = MakePrimitives(mesh.get());
+    BVHAccel bvh(prims, 4, BVHAccel::SplitMethod::SAH);
+
+    MeshPrimitiveSettings meshSettings;
+    meshSettings.enabled = true;
+    std::vector<PrimitiveHandle> meshPrims =
+        CreatePrimitives(Triangle::CreateTriangles(mesh.get(), Allocator()), nullptr, {},
+                         {}, nullptr, meshSettings, Allocator());
+    ASSERT_EQ(1, meshPrims.size());
+    ASSERT_TRUE(meshPrims[0].Is<TriangleMeshPrimitive>());
+    PrimitiveHandle meshPrim = meshPrims[0];
+
+    Bounds3f b = bvh.Bounds(), bm = meshPrim.Bounds();
+    for (int c = 0; c < 2; ++c)
+        EXPECT_EQ(b[c], bm[c]);
+
+    for (int i = 0; i < 10000; ++i) {
+        Point3f o(Lerp(rng.Uniform<Float>(), -2, 2), Lerp(rng.Uniform<Float>(), -2, 2),
+                  Lerp(rng.Uniform<Float>(), -2, 2));
+        Vector3f d = SampleUniformSphere({rng.Uniform<Float>(), rng.Uniform<Float>()});
+        Ray ray(o, d);
+        Float tMax = (i & 1) ? Infinity : rng.Uniform<Float>() * 4;
+
+        pstd::optional<ShapeIntersection> si = bvh.Intersect(ray, tMax);
+        pstd::optional<ShapeIntersection> sim = meshPrim.Intersect(ray, tMax);
+        ASSERT_EQ(si.has_value(), sim.has_value()) << ray;
+        if (si) {
+            EXPECT_EQ(si->tHit, sim->tHit) << ray;
+            EXPECT_EQ(si->intr.p(), sim->intr.p()) << ray;
+            EXPECT_EQ(si->intr.n, sim->intr.n) << ray;
+        }
+        EXPECT_EQ(bvh.IntersectP(ray, tMax), meshPrim.IntersectP(ray, tMax)) << ray;
+    }
+
+    for (PrimitiveHandle p : prims)
+        delete p.Cast<SimplePrimitive>();
+}
+
+TEST(TriangleMeshPrimitive, SmallMeshes) {
+    // Small meshes get a primitive for each triangle
+    RNG rng;
+    std::unique_ptr<TriangleMesh> mesh = RandomTriangleMesh(rng, 10);
+    MeshPrimitiveSettings meshSettings;
+    meshSettings.enabled = true;
+    std::vector<PrimitiveHandle> prims =
+        CreatePrimitives(Triangle::CreateTriangles(mesh.get(), Allocator()), nullptr, {},
+                         {}, nullptr, meshSettings, Allocator());
+    ASSERT_EQ(10, prims.size());
+    for (PrimitiveHandle p : prims)
+        EXPECT_TRUE(p.Is<SimplePrimitive>());
+}
+
+TEST(TriangleMeshPrimitive, OptIn) {
+    RNG rng;
+    std::unique_ptr<TriangleMesh> mesh = RandomTriangleMesh(rng, 3000, 100);
+    pstd::vector<ShapeHandle> triangles =
+        Triangle::CreateTriangles(mesh.get(), Allocator());
+
+    // Without accelerator parameters, large meshes also get a primitive for
+    // each triangle
+    ParameterDictionary noParameters;
+    MeshPrimitiveSettings meshSettings = MeshPrimitiveSettings::Create(noParameters);
+    EXPECT_FALSE(meshSettings.enabled);
+    std::vector<PrimitiveHandle> prims =
+        CreatePrimitives(triangles, nullptr, {}, {}, nullptr, meshSettings, Allocator());
+    ASSERT_EQ(3000, prims.size());
+    for (PrimitiveHandle p : prims)
+        EXPECT_TRUE(p.Is<SimplePrimitive>());
+
+    // "meshprimitives" or a leaf width of 4 or 8 enables mesh primitives
+    auto createSettings = [](const char *type, const char *name, double value) {
+        auto param = std::make_unique<ParsedParameter>(Allocator(), FileLoc());
+        param->type = type;
+        param->name = name;
+        if (param->type == "bool")
+            param->AddBool(value != 0);
+        else
+            param->AddNumber(value);
+        ParsedParameterVector params;
+        params.push_back(param.get());
+        return MeshPrimitiveSettings::Create(
+            ParameterDictionary(params, RGBColorSpace::sRGB));
+    };
+    for (MeshPrimitiveSettings settings :
+         {createSettings("bool", "meshprimitives", 1),
+          createSettings("integer", "meshleafwidth", 4),
+          createSettings("integer", "meshleafwidth", 8)}) {
+        EXPECT_TRUE(settings.enabled);
+        prims =
+            CreatePrimitives(triangles, nullptr, {}, {}, nullptr, settings, Allocator());
+        ASSERT_EQ(1, prims.size());
+        EXPECT_TRUE(prims[0].Is<TriangleMeshPrimitive>());
+    }
+}
+
+TEST(TriangleMeshPrimitive, BlocksMatchIndices) {
+    RNG rng;
+    // A grid of triangles in the $z=0$ plane, for testing rays through
+    // shared edges and vertices, and a mesh of random triangles
+    std::vector<Point3f> p;
+    std::vector<int> indices;
+    int res = 16;
+    for (int y = 0; y <= res; ++y)
+        for (int x = 0; x <= res; ++x)
+            p.push_back(Point3f(Float(x) / res, Float(y) / res, 0));
+    for (int y = 0; y < res; ++y)
+        for (int x = 0; x < res; ++x) {
+            int v = y * (res + 1) + x;
+            for (int i : {v, v + 1, v + res + 2, v, v + res + 2, v + res + 1})
+                indices.push_back(i);
+        }
+    static Transform identity;
+    const TriangleMesh grid(identity, false, indices, p, {}, {}, {}, {});
+    std::unique_ptr<TriangleMesh> random = RandomTriangleMesh(rng, 3000, 100);
+
+    for (const TriangleMesh *mesh : {&grid, (const TriangleMesh *)random.get()}) {
+        TriangleMeshPrimitive indexed(mesh, nullptr, {}, {}, nullptr);
+        TriangleMeshPrimitive blocks4(mesh, nullptr, {}, {}, nullptr, 4, 4);
+        TriangleMeshPrimitive blocks8(mesh, nullptr, {}, {}, nullptr, 4, 8);
+
+        for (int i = 0; i < 10000; ++i) {
+            Point3f o(Lerp(rng.Uniform<Float>(), -2, 2),
+                      Lerp(rng.Uniform<Float>(), -2, 2),
+                      Lerp(rng.Uniform<Float>(), -2, 2));
+            Vector3f d;
+            if (mesh == &grid) {
+                // Aim at an interior vertex or the midpoint of an interior edge
+                Point3f target(
+                    Float(1 + rng.Uniform<uint32_t>() % (2 * res - 1)) / (2 * res),
+                    Float(1 + rng.Uniform<uint32_t>() % (res - 1)) / res, 0);
+                if (i & 1)
+                    std::swap(target.x, target.y);
+                d = target - o;
+            } else
+                d = SampleUniformSphere({rng.Uniform<Float>(), rng.Uniform<Float>()});
+            Ray ray(o, d);
+            Float tMax = (i % 3 == 0) ? rng.Uniform<Float>() * 4 : Infinity;
+
+            pstd::optional<ShapeIntersection> si = indexed.Intersect(ray, tMax);
+            bool occluded = indexed.IntersectP(ray, tMax);
+            EXPECT_EQ(si.has_value(), occluded) << ray;
+            for (const TriangleMeshPrimitive *prim : {&blocks4, &blocks8}) {
+                pstd::optional<ShapeIntersection> sib = prim->Intersect(ray, tMax);
+                ASSERT_EQ(si.has_value(), sib.has_value()) << ray;
+                if (si) {
+                    EXPECT_EQ(si->tHit, sib->tHit) << ray;
+                    EXPECT_EQ(si->intr.p(), sib->intr.p()) << ray;
+                    EXPECT_EQ(si->intr.n, sib->intr.n) << ray;
+                }
+                EXPECT_EQ(occluded, prim->IntersectP(ray, tMax)) << ray;
+            }
+            // Rays toward the grid from above it must never slip through
+            if (mesh == &grid && o.z > 0 && tMax == Infinity)
+                EXPECT_TRUE(occluded) << ray;
+        }
+    }
+}
+
+static std::vector<Transform> RandomInstanceTransforms(RNG &rng, int n) {
+    std::vector<Transform> transforms;
+    for (int i = 0; i < n; ++i) {
+        Vector3f axis = SampleUniformSphere({rng.Uniform<Float>(), rng.Uniform<Float>()});
+        transforms.push_back(Translate(Vector3f(Lerp(rng.Uniform<Float>(), -10, 10),
+                                                Lerp(rng.Uniform<Float>(), -10, 10),
+                                                Lerp(rng.Uniform<Float>(), -10, 10))) *
+                             Rotate(360 * rng.Uniform<Float>(), axis) *
+                             Scale(Lerp(rng.Uniform<Float>(), .5f, 1.5f),
+                                   Lerp(rng.Uniform<Float>(), .5f, 1.5f),
+                                   Lerp(rng.Uniform<Float>(), .5f, 1.5f)));
+    }
+    return transforms;
+}
+
+TEST(InstanceBVH, MatchesTransformedPrimitives) {
+    RNG rng;
+    std::unique_ptr<TriangleMesh> mesh0 = RandomTriangleMesh(rng, 100);
+    std::unique_ptr<TriangleMesh> mesh1 = RandomTriangleMesh(rng, 200);
+    TriangleMeshPrimitive prototype0(mesh0.get(), nullptr, {}, {}, nullptr);
+    BVHAccel prototype1(MakePrimitives(mesh1.get()), 4);
+
+    const int nInstances = 1000;
+    std::vector<PrimitiveHandle> instancePrims;
+    for (int i = 0; i < nInstances; ++i)
+        instancePrims.push_back((i % 3) ? PrimitiveHandle(&prototype0)
+                                        : PrimitiveHandle(&prototype1));
+    std::vector<Transform> transforms = RandomInstanceTransforms(rng, nInstances);
+    std::vector<Transform> movedTransforms = transforms;
+    for (int i = 0; i < nInstances; i += 2)
+        movedTransforms[i] = Translate(Vector3f(Lerp(rng.Uniform<Float>(), -1, 1),
+                                                Lerp(rng.Uniform<Float>(), -1, 1),
+                                                Lerp(rng.Uniform<Float>(), -1, 1))) *
+                             transforms[i];
+
+    std::vector<const Transform *> renderFromInstance, movedRenderFromInstance;
+    for (int i = 0; i < nInstances; ++i) {
+        renderFromInstance.push_back(&transforms[i]);
+        movedRenderFromInstance.push_back(&movedTransforms[i]);
+    }
+
+    // Non-instanced geometry, as when the _InstanceBVH_ is the scene's aggregate
+    std::unique_ptr<TriangleMesh> mesh2 = RandomTriangleMesh(rng, 300);
+    BVHAccel geometry(MakePrimitives(mesh2.get()), 4);
+
+    for (int maxPrims : {1, 4}) {
+        for (bool withGeometry : {false, true}) {
+            InstanceBVH instanceBVH(instancePrims, renderFromInstance, maxPrims,
+                                    BVHAccel::SplitMethod::SAH,
+                                    withGeometry ? PrimitiveHandle(&geometry) : nullptr);
+            EXPECT_EQ(nInstances, instanceBVH.NInstances());
+            for (bool refit : {false, true}) {
+                if (refit)
+                    instanceBVH.Refit(movedRenderFromInstance);
+                const std::vector<const Transform *> &t =
+                    refit ? movedRenderFromInstance : renderFromInstance;
+
+                // Compare with a BVH of _TransformedPrimitive_s
+                std::vector<TransformedPrimitive> transformed;
+                for (int i = 0; i < nInstances; ++i)
+                    transformed.push_back(TransformedPrimitive(instancePrims[i], t[i]));
+                std::vector<PrimitiveHandle> transformedPrims;
+                for (TransformedPrimitive &tp : transformed)
+                    transformedPrims.push_back(&tp);
+                if (withGeometry)
+                    transformedPrims.push_back(&geometry);
+                BVHAccel bvh(transformedPrims, 1);
+
+                Bounds3f b = bvh.Bounds(), bi = instanceBVH.Bounds();
+                for (int c = 0; c < 2; ++c)
+                    EXPECT_EQ(b[c], bi[c]);
+
+                for (int i = 0; i < 10000; ++i) {
+                    Point3f o(Lerp(rng.Uniform<Float>(), -15, 15),
+                              Lerp(rng.Uniform<Float>(), -15, 15),
+                              Lerp(rng.Uniform<Float>(), -15, 15));
+                    Vector3f d =
+                        SampleUniformSphere({rng.Uniform<Float>(), rng.Uniform<Float>()});
+                    Ray ray(o, d);
+                    Float tMax = (i & 1) ? Infinity : rng.Uniform<Float>() * 20;
+
+                    pstd::optional<ShapeIntersection> si = bvh.Intersect(ray, tMax);
+                    pstd::optional<ShapeIntersection> sii =
+                        instanceBVH.Intersect(ray, tMax);
+                    ASSERT_EQ(si.has_value(), sii.has_value()) << ray;
+                    if (si) {
+                        EXPECT_EQ(si->tHit, sii->tHit) << ray;
+                        EXPECT_EQ(si->intr.p(), sii->intr.p()) << ray;
+                        EXPECT_EQ(si->intr.n, sii->intr.n) << ray;
+                    }
+                    EXPECT_EQ(bvh.IntersectP(ray, tMax),
+                              instanceBVH.IntersectP(ray, tMax))
+                        << ray;
+                }
+            }
+        }
+    }
+}
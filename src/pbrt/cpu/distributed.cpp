@@ -0,0 +1,545 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/cpu/distributed.h>
+
+#include <pbrt/cameras.h>
+#include <pbrt/cpu/integrators.h>
+#include <pbrt/film.h>
+#include <pbrt/filters.h>
+#include <pbrt/options.h>
+#include <pbrt/parsedscene.h>
+#include <pbrt/samplers.h>
+#include <pbrt/util/error.h>
+#include <pbrt/util/image.h>
+#include <pbrt/util/log.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/progressreporter.h>
+#include <pbrt/util/stats.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <initializer_list>
+
+#ifndef PBRT_IS_WINDOWS
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace pbrt {
+
+STAT_COUNTER("Distributed/Work units rendered", nWorkUnitsRendered);
+STAT_COUNTER("Distributed/Work units reassigned", nWorkUnitsReassigned);
+STAT_COUNTER("Distributed/Film state bytes received", filmStateBytesReceived);
+
+#ifdef PBRT_IS_WINDOWS
+
+void CoordinateDistributedRender(ParsedScene &scene,
+                                 const std::vector<std::string> &workerArgs) {
+    ErrorExit("Distributed rendering is not supported on Windows.");
+}
+
+void RunDistributedWorker(Integrator *integrator, CameraHandle camera,
+                          SamplerHandle sampler) {
+    ErrorExit("Distributed rendering is not supported on Windows.");
+}
+
+#else
+
+// Distributed Rendering Protocol Definitions
+// Each message is a _MessageHeader_ followed by _size_ bytes of payload.
+// A worker starts with _Hello_; the coordinator then sends _WorkUnit_
+// messages, each of which the worker answers with a _UnitResult_ holding the
+// film state for the unit's pixels. After _Finish_, the worker sends the
+// state of any pixels it splatted to outside its units in _FinalState_.
+enum class MessageType : uint32_t { Hello, WorkUnit, Finish, UnitResult, FinalState };
+
+struct MessageHeader {
+    MessageType type;
+    uint32_t pad = 0;
+    uint64_t size;
+};
+
+struct HelloMessage {
+    static constexpr int CurrentVersion = 1;
+    int32_t version;
+    int32_t spp;
+    Bounds2i pixelBounds;
+};
+
+// Number of work units that the coordinator keeps queued at each worker, so
+// that workers don't wait for the next unit after sending a result
+static constexpr int MaxOutstandingUnits = 2;
+
+// Socket Utility Functions
+static bool SendBytes(int socketFd, const void *data, size_t size) {
+    const char *ptr = (const char *)data;
+    while (size > 0) {
+        ssize_t sent = send(socketFd, ptr, size, 0);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return false;
+        ptr += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static bool ReceiveBytes(int socketFd, void *data, size_t size) {
+    char *ptr = (char *)data;
+    while (size > 0) {
+        ssize_t received = recv(socketFd, ptr, size, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+        ptr += received;
+        size -= received;
+    }
+    return true;
+}
+
+static bool SendMessage(int socketFd, MessageType type, const void *data = nullptr,
+                        size_t size = 0) {
+    MessageHeader header;
+    header.type = type;
+    header.size = size;
+    return SendBytes(socketFd, &header, sizeof(header)) &&
+           SendBytes(socketFd, data, size);
+}
+
+// Receives a message, returning false if the connection was lost or if the
+// peer sent a message that isn't one of the _expected_ types or that has more
+// than _maxSize_ bytes of payload.
+static bool ReceiveMessage(int socketFd, std::initializer_list<MessageType> expected,
+                           size_t maxSize, MessageType *type, std::string *payload) {
+    MessageHeader header;
+    if (!ReceiveBytes(socketFd, &header, sizeof(header)))
+        return false;
+    if (std::find(expected.begin(), expected.end(), header.type) == expected.end() ||
+        header.size > maxSize) {
+        Warning("Received unexpected message of type %d with %d bytes of payload.",
+                int(header.type), header.size);
+        return false;
+    }
+    *type = header.type;
+    payload->resize(header.size);
+    return ReceiveBytes(socketFd, &(*payload)[0], header.size);
+}
+
+// Returns the bounds that film state _state_ covers
+static Bounds2i StateBounds(const std::string &state) {
+    Bounds2i bounds;
+    if (state.size() >= sizeof(bounds))
+        std::memcpy(&bounds, state.data(), sizeof(bounds));
+    return bounds;
+}
+
+// WorkerConnection Definition
+struct WorkerConnection {
+    int socketFd = -1;
+    bool helloReceived = false, finishSent = false;
+    std::vector<Bounds2i> outstandingUnits;
+    // Results for completed units are only merged into the film once the
+    // worker's final state has arrived, so that all of a lost worker's units
+    // can be rendered again without losing the splats it hadn't sent yet.
+    std::vector<Bounds2i> completedUnits;
+    std::vector<std::string> unitStates;
+};
+
+// Distributed Rendering Function Definitions
+void CoordinateDistributedRender(ParsedScene &parsedScene,
+                                 const std::vector<std::string> &workerArgs) {
+    // Ignore SIGPIPE so that a worker that goes away is a failed send
+    signal(SIGPIPE, SIG_IGN);
+
+    // Create film and camera for accumulating the workers' results
+    Allocator alloc;
+    FilterHandle filter =
+        FilterHandle::Create(parsedScene.filter.name, parsedScene.filter.parameters,
+                             &parsedScene.filter.loc, alloc);
+    FilmHandle film =
+        FilmHandle::Create(parsedScene.film.name, parsedScene.film.parameters,
+                           &parsedScene.film.loc, filter, alloc);
+    CameraHandle camera = CameraHandle::Create(
+        parsedScene.camera.name, parsedScene.camera.parameters, nullptr,
+        parsedScene.camera.cameraTransform, film, &parsedScene.camera.loc, alloc);
+    SamplerHandle sampler = SamplerHandle::Create(
+        parsedScene.sampler.name, parsedScene.sampler.parameters,
+        film.FullResolution(), &parsedScene.sampler.loc, alloc);
+    int spp = sampler.SamplesPerPixel();
+    Bounds2i pixelBounds = film.PixelBounds();
+
+    // Split film's pixel bounds into work units
+    // Aim for enough units for each worker that load imbalance at the end
+    // of rendering is small.
+    int nExpectedWorkers = std::max(1, Options->nWorkers);
+    int unitSize =
+        Clamp(int(std::sqrt(pixelBounds.Area() / (16. * nExpectedWorkers))), 8, 128);
+    std::deque<Bounds2i> pendingUnits;
+    for (int y = pixelBounds.pMin.y; y < pixelBounds.pMax.y; y += unitSize)
+        for (int x = pixelBounds.pMin.x; x < pixelBounds.pMax.x; x += unitSize)
+            pendingUnits.push_back(
+                Intersect(Bounds2i({x, y}, {x + unitSize, y + unitSize}), pixelBounds));
+    size_t nUnits = pendingUnits.size(), nUnitsCompleted = 0;
+    LOG_VERBOSE("Split pixel bounds %s into %d work units of up to %d^2 pixels",
+                pixelBounds, nUnits, unitSize);
+
+    // Compute the largest film states that workers may send
+    // The first unit is the largest one; film state is a _Bounds2i_ followed
+    // by a fixed-size state for each pixel.
+    size_t maxUnitStateSize = film.SaveState(pendingUnits.front()).size();
+    size_t pixelStateSize =
+        (maxUnitStateSize - sizeof(Bounds2i)) / pendingUnits.front().Area();
+    size_t maxFinalStateSize = sizeof(Bounds2i) + pixelBounds.Area() * pixelStateSize;
+
+    // Start listening for worker connections
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd < 0)
+        ErrorExit("socket(): %s", ErrorString());
+    int reuse = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    // Only accept connections from other machines if asked to
+    address.sin_addr.s_addr =
+        htonl(Options->listenPort >= 0 ? INADDR_ANY : INADDR_LOOPBACK);
+    address.sin_port = htons(std::max(0, Options->listenPort));
+    if (bind(listenFd, (sockaddr *)&address, sizeof(address)) < 0)
+        ErrorExit("Unable to listen on port %d: %s", std::max(0, Options->listenPort),
+                  ErrorString());
+    if (listen(listenFd, 64) < 0)
+        ErrorExit("listen(): %s", ErrorString());
+    socklen_t addressLength = sizeof(address);
+    getsockname(listenFd, (sockaddr *)&address, &addressLength);
+    int port = ntohs(address.sin_port);
+    if (Options->listenPort >= 0 && !Options->quiet)
+        printf("Waiting for workers on port %d.\n", port);
+
+    // Start local worker processes
+    std::vector<std::string> args = workerArgs;
+    args.push_back("--coordinator");
+    args.push_back(StringPrintf("127.0.0.1:%d", port));
+    args.push_back("--quiet");
+    if (Options->nThreads == 0 && Options->nWorkers > 0) {
+        // Share this machine's cores among the local workers
+        args.push_back("--nthreads");
+        args.push_back(std::to_string(std::max(1, AvailableCores() / Options->nWorkers)));
+    }
+    std::vector<char *> argv;
+    for (std::string &arg : args)
+        argv.push_back(&arg[0]);
+    argv.push_back(nullptr);
+#ifdef PBRT_IS_LINUX
+    const char *executable = "/proc/self/exe";
+#else
+    const char *executable = argv[0];
+#endif
+    std::vector<pid_t> workerPids;
+    for (int i = 0; i < Options->nWorkers; ++i) {
+        fflush(stdout);
+        fflush(stderr);
+        pid_t pid = fork();
+        if (pid < 0)
+            ErrorExit("fork(): %s", ErrorString());
+        if (pid == 0) {
+            close(listenFd);
+            execvp(executable, argv.data());
+            fprintf(stderr, "Unable to run %s: %s\n", executable, ErrorString().c_str());
+            _exit(127);
+        }
+        workerPids.push_back(pid);
+    }
+    LOG_VERBOSE("Started %d local workers", workerPids.size());
+
+    // Hand out work units to workers until the image is complete
+    ProgressReporter progress(int64_t(spp) * pixelBounds.Area(), "Rendering",
+                              Options->quiet);
+    std::vector<WorkerConnection> workers;
+    auto disconnect = [&](WorkerConnection &worker) {
+        // Reassign all of the worker's units to other workers
+        // Its completed units' results haven't been merged yet, but its
+        // splats for them would be lost without its final state.
+        size_t nLostUnits = worker.outstandingUnits.size() + worker.completedUnits.size();
+        if (nLostUnits > 0)
+            Warning("Lost connection to a worker with %d work units whose results "
+                    "haven't been merged. Reassigning them.",
+                    nLostUnits);
+        for (const Bounds2i &unit : worker.outstandingUnits) {
+            pendingUnits.push_front(unit);
+            ++nWorkUnitsReassigned;
+        }
+        for (const Bounds2i &unit : worker.completedUnits) {
+            pendingUnits.push_front(unit);
+            ++nWorkUnitsReassigned;
+        }
+        nUnitsCompleted -= worker.completedUnits.size();
+        worker.outstandingUnits.clear();
+        worker.completedUnits.clear();
+        worker.unitStates.clear();
+        close(worker.socketFd);
+        worker.socketFd = -1;
+    };
+
+    while (true) {
+        // Send work units, or _Finish_ once all units are done, to workers
+        for (WorkerConnection &worker : workers) {
+            if (worker.socketFd < 0 || !worker.helloReceived || worker.finishSent)
+                continue;
+            while (worker.outstandingUnits.size() < MaxOutstandingUnits &&
+                   !pendingUnits.empty()) {
+                Bounds2i unit = pendingUnits.front();
+                pendingUnits.pop_front();
+                worker.outstandingUnits.push_back(unit);
+                if (!SendMessage(worker.socketFd, MessageType::WorkUnit, &unit,
+                                 sizeof(unit))) {
+                    disconnect(worker);
+                    break;
+                }
+            }
+            if (worker.socketFd >= 0 && nUnitsCompleted == nUnits) {
+                worker.finishSent = true;
+                if (!SendMessage(worker.socketFd, MessageType::Finish))
+                    disconnect(worker);
+            }
+        }
+
+        // Stop once all units are done and all workers have sent final state
+        bool workersConnected = false;
+        for (const WorkerConnection &worker : workers)
+            workersConnected |= worker.socketFd >= 0;
+        if (nUnitsCompleted == nUnits && !workersConnected)
+            break;
+
+        // Give up if all of the local workers have exited early
+        if (!workersConnected && Options->listenPort < 0 && !workerPids.empty()) {
+            int status;
+            pid_t pid = waitpid(-1, &status, WNOHANG);
+            if (pid > 0) {
+                workerPids.erase(std::find(workerPids.begin(), workerPids.end(), pid));
+                if (workerPids.empty())
+                    ErrorExit("All workers exited before rendering finished.");
+            }
+        }
+
+        // Wait for new connections or messages from workers
+        std::vector<pollfd> pollFds(1 + workers.size());
+        pollFds[0] = {listenFd, POLLIN, 0};
+        for (size_t i = 0; i < workers.size(); ++i)
+            pollFds[i + 1] = {workers[i].socketFd, POLLIN, 0};
+        if (poll(pollFds.data(), pollFds.size(), 1000 /* ms */) < 0) {
+            if (errno == EINTR)
+                continue;
+            ErrorExit("poll(): %s", ErrorString());
+        }
+
+        if (pollFds[0].revents & POLLIN) {
+            int socketFd = accept(listenFd, nullptr, nullptr);
+            if (socketFd >= 0) {
+                int noDelay = 1;
+                setsockopt(socketFd, IPPROTO_TCP, TCP_NODELAY, &noDelay,
+                           sizeof(noDelay));
+                workers.push_back(WorkerConnection());
+                workers.back().socketFd = socketFd;
+                LOG_VERBOSE("Accepted worker connection");
+            }
+        }
+
+        for (size_t i = 1; i < pollFds.size(); ++i) {
+            WorkerConnection &worker = workers[i - 1];
+            if (worker.socketFd < 0 || !(pollFds[i].revents & (POLLIN | POLLHUP)))
+                continue;
+
+            // Receive the message that the worker's protocol state calls for
+            MessageType type;
+            std::string payload;
+            bool received;
+            if (!worker.helloReceived)
+                received = ReceiveMessage(worker.socketFd, {MessageType::Hello},
+                                          sizeof(HelloMessage), &type, &payload);
+            else if (!worker.finishSent)
+                received = ReceiveMessage(worker.socketFd, {MessageType::UnitResult},
+                                          maxUnitStateSize, &type, &payload);
+            else
+                received = ReceiveMessage(worker.socketFd, {MessageType::FinalState},
+                                          maxFinalStateSize, &type, &payload);
+            if (!received) {
+                disconnect(worker);
+                continue;
+            }
+            filmStateBytesReceived += payload.size();
+
+            switch (type) {
+            case MessageType::Hello: {
+                HelloMessage hello;
+                if (payload.size() != sizeof(hello)) {
+                    Warning("Ignoring worker with an incompatible protocol.");
+                    disconnect(worker);
+                    break;
+                }
+                std::memcpy(&hello, payload.data(), sizeof(hello));
+                if (hello.version != HelloMessage::CurrentVersion ||
+                    hello.spp != spp || hello.pixelBounds != pixelBounds) {
+                    Warning("Ignoring worker with %d spp and pixel bounds %s. Expected "
+                            "%d spp and %s.",
+                            hello.spp, hello.pixelBounds, spp, pixelBounds);
+                    disconnect(worker);
+                    break;
+                }
+                worker.helloReceived = true;
+                break;
+            }
+            case MessageType::UnitResult: {
+                // Hold on to the unit's film state and mark the unit done
+                Bounds2i unit = StateBounds(payload);
+                auto iter = std::find(worker.outstandingUnits.begin(),
+                                      worker.outstandingUnits.end(), unit);
+                if (iter == worker.outstandingUnits.end() ||
+                    payload.size() != sizeof(Bounds2i) + unit.Area() * pixelStateSize) {
+                    Warning("Received invalid film state for work unit %s.", unit);
+                    disconnect(worker);
+                    break;
+                }
+                worker.outstandingUnits.erase(iter);
+                worker.completedUnits.push_back(unit);
+                worker.unitStates.push_back(std::move(payload));
+                ++nUnitsCompleted;
+                ++nWorkUnitsRendered;
+                progress.Update(int64_t(spp) * unit.Area());
+                break;
+            }
+            case MessageType::FinalState:
+                // Merge the worker's results now that they are complete
+                for (const std::string &state : worker.unitStates)
+                    if (!film.MergeState(state))
+                        Warning("Received invalid film state for work unit %s.",
+                                StateBounds(state));
+                if (!payload.empty() && !film.MergeState(payload))
+                    Warning("Received invalid final film state from worker.");
+                worker.completedUnits.clear();
+                worker.unitStates.clear();
+                close(worker.socketFd);
+                worker.socketFd = -1;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+    close(listenFd);
+    progress.Done();
+
+    // Wait for local workers to exit
+    for (pid_t pid : workerPids) {
+        int status;
+        if (waitpid(pid, &status, 0) == pid &&
+            (!WIFEXITED(status) || WEXITSTATUS(status) != 0))
+            Warning("Worker process %d exited abnormally.", int(pid));
+    }
+
+    // Write the merged image
+    ImageMetadata metadata;
+    metadata.renderTimeSeconds = progress.ElapsedSeconds();
+    metadata.samplesPerPixel = spp;
+    camera.InitMetadata(&metadata);
+    film.WriteImage(metadata, 1.f / spp);
+    LOG_VERBOSE("Distributed rendering finished");
+}
+
+void RunDistributedWorker(Integrator *integrator, CameraHandle camera,
+                          SamplerHandle sampler) {
+    ImageTileIntegrator *tileIntegrator = dynamic_cast<ImageTileIntegrator *>(integrator);
+    if (!tileIntegrator)
+        ErrorExit("Distributed rendering is only supported with integrators that "
+                  "render the image in tiles.");
+    // Light paths splat to pixels outside the unit being rendered; the
+    // state of those pixels is sent after all units are done.
+    bool splats = dynamic_cast<BDPTIntegrator *>(integrator) ||
+                  dynamic_cast<LightPathIntegrator *>(integrator);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Connect to coordinator
+    const std::string &coordinator = Options->coordinatorAddress;
+    size_t split = coordinator.find_last_of(':');
+    if (split == std::string::npos)
+        ErrorExit("Expected \"host:port\" for coordinator address. Given \"%s\".",
+                  coordinator);
+    std::string host = coordinator.substr(0, split), port = coordinator.substr(split + 1);
+    addrinfo hints = {}, *addresses;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (int err = getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses))
+        ErrorExit("%s: %s", coordinator, gai_strerror(err));
+    int socketFd = -1;
+    for (addrinfo *ptr = addresses; ptr; ptr = ptr->ai_next) {
+        socketFd = socket(ptr->ai_family, ptr->ai_socktype, ptr->ai_protocol);
+        if (socketFd >= 0 && connect(socketFd, ptr->ai_addr, ptr->ai_addrlen) == 0)
+            break;
+        if (socketFd >= 0)
+            close(socketFd);
+        socketFd = -1;
+    }
+    freeaddrinfo(addresses);
+    if (socketFd < 0)
+        ErrorExit("%s: unable to connect to coordinator: %s", coordinator, ErrorString());
+    int noDelay = 1;
+    setsockopt(socketFd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    FilmHandle film = camera.GetFilm();
+    HelloMessage hello;
+    hello.version = HelloMessage::CurrentVersion;
+    hello.spp = sampler.SamplesPerPixel();
+    hello.pixelBounds = film.PixelBounds();
+    if (!SendMessage(socketFd, MessageType::Hello, &hello, sizeof(hello)))
+        ErrorExit("%s: lost connection to coordinator.", coordinator);
+
+    // Render work units until the coordinator says to finish
+    auto nextUnit = [&]() -> pstd::optional<Bounds2i> {
+        MessageType type;
+        std::string payload;
+        if (!ReceiveMessage(socketFd, {MessageType::WorkUnit, MessageType::Finish},
+                            sizeof(Bounds2i), &type, &payload))
+            ErrorExit("%s: lost connection to coordinator.", coordinator);
+        if (type == MessageType::Finish)
+            return {};
+        Bounds2i unit;
+        if (payload.size() != sizeof(unit))
+            ErrorExit("%s: unexpected message from coordinator.", coordinator);
+        std::memcpy(&unit, payload.data(), sizeof(unit));
+        VLOG(1, "Rendering work unit %s", unit);
+        return unit;
+    };
+    auto unitDone = [&](const Bounds2i &unit) {
+        // Send the unit's film state and clear it so that splats to its
+        // pixels from later units are all that's left in the final state
+        std::string state = film.SaveState(unit);
+        film.ClearState(unit);
+        if (!SendMessage(socketFd, MessageType::UnitResult, state.data(), state.size()))
+            ErrorExit("%s: lost connection to coordinator.", coordinator);
+        ++nWorkUnitsRendered;
+    };
+    tileIntegrator->RenderWorkUnits(nextUnit, unitDone);
+
+    std::string finalState = splats ? film.SaveState(film.PixelBounds()) : "";
+    if (!SendMessage(socketFd, MessageType::FinalState, finalState.data(),
+                     finalState.size()))
+        ErrorExit("%s: lost connection to coordinator.", coordinator);
+    close(socketFd);
+    LOG_VERBOSE("Worker finished");
+}
+
+#endif  // PBRT_IS_WINDOWS
+
+}  // namespace pbrt
@@ -0,0 +1,39 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#ifndef PBRT_CPU_DISTRIBUTED_H
+#define PBRT_CPU_DISTRIBUTED_H
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/base/camera.h>
+#include <pbrt/base/sampler.h>
+
+#include <string>
+#include <vector>
+
+namespace pbrt {
+
+class Integrator;
+class ParsedScene;
+
+// Distributed rendering splits the film's pixel bounds into work units that
+// the coordinator hands out over TCP sockets to worker processes, each of
+// which has created the entire scene. Workers return the film state for each
+// unit as they finish it; the coordinator merges it into its own film and
+// writes the final image.
+
+// Runs the coordinator, starting _Options->nWorkers_ local workers by running
+// _workerArgs_ (the command line, without the coordinator's options) with the
+// coordinator's address added.
+void CoordinateDistributedRender(ParsedScene &scene,
+                                 const std::vector<std::string> &workerArgs);
+
+// Renders work units for the coordinator at _Options->coordinatorAddress_.
+void RunDistributedWorker(Integrator *integrator, CameraHandle camera,
+                          SamplerHandle sampler);
+
+}  // namespace pbrt
+
+#endif  // PBRT_CPU_DISTRIBUTED_H
@@ -7,6 +7,7 @@
 #include <pbrt/bsdf.h>
 #include <pbrt/bssrdf.h>
 #include <pbrt/cameras.h>
+#include <pbrt/cpu/wavefront.h>
 #include <pbrt/film.h>
 #include <pbrt/filters.h>
 #include <pbrt/interaction.h>
@@ -24,6 +25,7 @@
 #include <pbrt/util/error.h>
 #include <pbrt/util/file.h>
 #include <pbrt/util/hash.h>
+#include <pbrt/util/hashgrid.h>
 #include <pbrt/util/image.h>
 #include <pbrt/util/lowdiscrepancy.h>
 #include <pbrt/util/math.h>
@@ -37,10 +39,21 @@
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/stats.h>
 #include <pbrt/util/string.h>
+#include <pbrt/util/trace.h>
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#ifndef PBRT_IS_WINDOWS
+#include <unistd.h>
+#endif
 
 namespace pbrt {
 
 STAT_COUNTER("Integrator/Camera rays traced", nCameraRays);
+STAT_COUNTER("Integrator/Adaptive sampling waves", adaptiveSamplingWaves);
+STAT_COUNTER("Integrator/Renders stopped by time budget", timeBudgetStops);
+STAT_INT_DISTRIBUTION("Integrator/Adaptive samples per pixel", adaptiveSamplesPerPixel);
 
 // RandomWalkIntegrator Method Definitions
 std::unique_ptr<RandomWalkIntegrator> RandomWalkIntegrator::Create(
@@ -108,6 +121,137 @@ SampledSpectrum RandomWalkIntegrator::RandomWalk(RayDifferential ray,
 // Integrator Method Definitions
 Integrator::~Integrator() {}
 
+// AdaptiveSamplingSettings Method Definitions
+AdaptiveSamplingSettings AdaptiveSamplingSettings::Create(
+    const ParameterDictionary &parameters, const FileLoc *loc) {
+    AdaptiveSamplingSettings settings;
+    settings.errorThreshold = parameters.GetOneFloat("adaptivethreshold", 0);
+    settings.minSamples = parameters.GetOneInt("adaptiveminsamples", 16);
+    settings.timeLimit = parameters.GetOneFloat("adaptivetimelimit", 0);
+    if (settings.errorThreshold < 0)
+        ErrorExit(loc, "\"adaptivethreshold\" must not be negative.");
+    if (settings.minSamples < 2)
+        ErrorExit(loc, "\"adaptiveminsamples\" must be at least 2.");
+    if (settings.timeLimit < 0)
+        ErrorExit(loc, "\"adaptivetimelimit\" must not be negative.");
+    return settings;
+}
+
+std::string AdaptiveSamplingSettings::ToString() const {
+    return StringPrintf("[ AdaptiveSamplingSettings errorThreshold: %f minSamples: %d "
+                        "timeLimit: %f ]",
+                        errorThreshold, minSamples, timeLimit);
+}
+
+// RenderCheckpoint Definition
+// The progress of ImageTileIntegrator::Render() that is stored in checkpoint
+// files, along with the film's state and, with adaptive sampling, each
+// pixel's sample count.
+struct RenderCheckpoint {
+    static constexpr int CurrentVersion = 3;
+    char magic[8];
+    int32_t version;
+    int32_t spp, adaptive;
+    int32_t startWave, endWave, waveDelta;
+    // Hash of the scene description files, the integrator's name, and the
+    // random number seed
+    uint64_t sceneHash;
+    int64_t samplesTaken;
+    // Rendering time before the checkpoint, including earlier resumed runs
+    double elapsedSeconds;
+    Bounds2i pixelBounds;
+};
+
+// RenderCheckpoint Function Definitions
+static uint64_t CheckpointSceneHash(const std::string &integratorName) {
+    uint64_t hash = Hash(Options->seed);
+    for (const std::string &filename : Options->sceneFilenames) {
+        std::string contents = ReadFileContents(filename);
+        hash = HashBuffer(contents.data(), contents.size(), hash);
+    }
+    return HashBuffer(integratorName.data(), integratorName.size(), hash);
+}
+
+static void WriteCheckpoint(const std::string &filename, RenderCheckpoint checkpoint,
+                            const Array2D<int> &pixelSampleCounts, FilmHandle film) {
+    std::memcpy(checkpoint.magic, "pbrtCKP", 8);
+    checkpoint.version = RenderCheckpoint::CurrentVersion;
+    std::string contents((const char *)&checkpoint, sizeof(checkpoint));
+    if (checkpoint.adaptive)
+        contents.append((const char *)pixelSampleCounts.begin(),
+                        pixelSampleCounts.size() * sizeof(int));
+    contents += film.SaveState(checkpoint.pixelBounds);
+
+    // Write to a temporary file and rename it so that an interruption never
+    // leaves a partially-written checkpoint
+    std::string tempFilename = UniqueTemporaryFilename(filename);
+    FILE *f = fopen(tempFilename.c_str(), "wb");
+    if (!f) {
+        Warning("%s: unable to create checkpoint file: %s", tempFilename, ErrorString());
+        return;
+    }
+    bool success = fwrite(contents.data(), 1, contents.size(), f) == contents.size() &&
+                   fflush(f) == 0;
+#ifndef PBRT_IS_WINDOWS
+    // Make sure that the data is on disk before the rename makes it visible
+    success = success && fsync(fileno(f)) == 0;
+#endif
+    if (fclose(f) != 0 || !success) {
+        Warning("%s: error writing checkpoint file: %s", tempFilename, ErrorString());
+        std::remove(tempFilename.c_str());
+        return;
+    }
+    if (!RenameFile(tempFilename, filename)) {
+        Warning("%s: unable to rename checkpoint file: %s", tempFilename, ErrorString());
+        std::remove(tempFilename.c_str());
+        return;
+    }
+    LOG_VERBOSE("Wrote checkpoint %s at wave %d (%d bytes)", filename,
+                checkpoint.startWave, contents.size());
+}
+
+// Returns false if there is no checkpoint file; other problems with it are
+// errors, since continuing would overwrite the rendering it stores.
+static bool ReadCheckpoint(const std::string &filename, RenderCheckpoint *checkpoint,
+                           Array2D<int> *pixelSampleCounts, FilmHandle film) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in)
+        return false;
+    std::string contents((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+
+    RenderCheckpoint stored;
+    if (contents.size() < sizeof(stored))
+        ErrorExit("%s: checkpoint file is truncated.", filename);
+    std::memcpy(&stored, contents.data(), sizeof(stored));
+    if (std::memcmp(stored.magic, "pbrtCKP", 8) != 0 ||
+        stored.version != RenderCheckpoint::CurrentVersion)
+        ErrorExit("%s: not a checkpoint file from this version of pbrt.", filename);
+    if (stored.sceneHash != checkpoint->sceneHash)
+        ErrorExit("%s: checkpoint was made with a different scene description, "
+                  "integrator, or seed than the current render.",
+                  filename);
+    if (stored.spp != checkpoint->spp || stored.adaptive != checkpoint->adaptive ||
+        stored.pixelBounds != checkpoint->pixelBounds)
+        ErrorExit("%s: checkpoint was made with different sampling settings or pixel "
+                  "bounds than the current scene.",
+                  filename);
+
+    size_t offset = sizeof(stored);
+    if (stored.adaptive) {
+        size_t countBytes = pixelSampleCounts->size() * sizeof(int);
+        if (contents.size() < offset + countBytes)
+            ErrorExit("%s: checkpoint file is truncated.", filename);
+        std::memcpy(pixelSampleCounts->begin(), contents.data() + offset, countBytes);
+        offset += countBytes;
+    }
+    if (!film.RestoreState(contents.substr(offset)))
+        ErrorExit("%s: checkpoint film state doesn't match the scene's film.", filename);
+
+    *checkpoint = stored;
+    return true;
+}
+
 // ImageTileIntegrator Method Definitions
 void ImageTileIntegrator::Render() {
     // Handle debugStart, if set
@@ -206,15 +350,88 @@ void ImageTileIntegrator::Render() {
                        });
     }
 
+    // Allocate per-pixel sample counts for adaptive sampling
+    bool adaptive = adaptiveSampling.Enabled();
+    int minSamples = std::min(spp, adaptiveSampling.minSamples);
+    Array2D<int> pixelSampleCounts(adaptive ? pixelBounds : Bounds2i({0, 0}, {0, 0}), 0);
+    std::atomic<int64_t> samplesTaken{0};
+    if (adaptive)
+        LOG_VERBOSE("Rendering with adaptive sampling: %s", adaptiveSampling);
+
+    // Resume rendering from the checkpoint file, if requested
+    // Rendering time from before the checkpoint is included in the time
+    // that the adaptive sampling time limit is measured against.
+    double resumedSeconds = 0;
+    auto elapsedSeconds = [&]() { return resumedSeconds + progress.ElapsedSeconds(); };
+    RenderCheckpoint checkpoint;
+    checkpoint.spp = spp;
+    checkpoint.adaptive = adaptive;
+    checkpoint.pixelBounds = pixelBounds;
+    checkpoint.sceneHash =
+        Options->checkpointFile.empty() ? 0 : CheckpointSceneHash(name);
+    if (Options->resume && ReadCheckpoint(Options->checkpointFile, &checkpoint,
+                                          &pixelSampleCounts, camera.GetFilm())) {
+        startWave = checkpoint.startWave;
+        endWave = checkpoint.endWave;
+        waveDelta = checkpoint.waveDelta;
+        samplesTaken = checkpoint.samplesTaken;
+        resumedSeconds = checkpoint.elapsedSeconds;
+        progress.Update(samplesTaken);
+        LOG_VERBOSE("Resuming from checkpoint %s at wave %d", Options->checkpointFile,
+                    startWave);
+    } else if (Options->resume)
+        Warning("%s: checkpoint file not found. Starting from the beginning.",
+                Options->checkpointFile);
+    Timer checkpointTimer;
+    int checkpointWave = -1;
+    auto writeCheckpoint = [&]() {
+        checkpoint.startWave = startWave;
+        checkpoint.endWave = endWave;
+        checkpoint.waveDelta = waveDelta;
+        checkpoint.samplesTaken = samplesTaken;
+        checkpoint.elapsedSeconds = elapsedSeconds();
+        TRACE_SCOPE("Write checkpoint");
+        WriteCheckpoint(Options->checkpointFile, checkpoint, pixelSampleCounts,
+                        camera.GetFilm());
+        checkpointTimer = Timer();
+        checkpointWave = startWave;
+    };
+    // Set if adaptive sampling stops because all pixels have converged
+    bool converged = false;
+
+    // Measured time to take one sample in each pixel and time to write the
+    // image, for fitting sample waves into the time budget
+    Float sppSeconds = 0, writeSeconds = 0;
+
     while (startWave < spp) {
         // Render image tiles in parallel
+        Timer waveTimer;
+        std::atomic<int64_t> pixelsSampled{0};
+        TraceScope waveTrace("Render wave", "startWave", startWave);
         ParallelFor2D(pixelBounds, [&](Bounds2i tileBounds) {
+            // Skip tile if the adaptive sampling time limit has been reached
+            if (adaptive && startWave > 0 && adaptiveSampling.timeLimit > 0 &&
+                elapsedSeconds() > adaptiveSampling.timeLimit)
+                return;
+
             // Render image tile given by _tileBounds_
             ScratchBuffer &scratchBuffer = scratchBuffers[ThreadIndex];
             SamplerHandle &sampler = samplers[ThreadIndex];
             VLOG(1, "Starting image tile %s startWave %d, endWave %d", tileBounds,
                  startWave, endWave);
+            int64_t tileSamples = 0;
             for (Point2i pPixel : tileBounds) {
+                if (adaptive) {
+                    // Skip pixels that have fallen behind or have converged
+                    int &pixelSamples = pixelSampleCounts[pPixel];
+                    if (pixelSamples != startWave ||
+                        (startWave >= minSamples &&
+                         camera.GetFilm().GetPixelRelativeError(pPixel) <=
+                             adaptiveSampling.errorThreshold))
+                        continue;
+                    pixelSamples = endWave;
+                }
+
                 StatsReportPixelStart(pPixel);
                 threadPixel = pPixel;
                 // Render samples in pixel _pPixel_
@@ -224,12 +441,23 @@ void ImageTileIntegrator::Render() {
                     EvaluatePixelSample(pPixel, sampleIndex, sampler, scratchBuffer);
                     scratchBuffer.Reset();
                 }
+                tileSamples += endWave - startWave;
 
                 StatsReportPixelEnd(pPixel);
             }
             VLOG(1, "Finished image tile %s", tileBounds);
-            progress.Update((endWave - startWave) * tileBounds.Area());
+            samplesTaken += tileSamples;
+            pixelsSampled += tileSamples / (endWave - startWave);
+            progress.Update(tileSamples);
         });
+        if (adaptive) {
+            ++adaptiveSamplingWaves;
+            LOG_VERBOSE("Adaptive sampling wave [%d, %d) sampled %d pixels", startWave,
+                        endWave, pixelsSampled.load());
+        }
+
+        Float waveRenderSeconds = waveTimer.ElapsedSeconds();
+        sppSeconds = waveRenderSeconds / (endWave - startWave);
 
         // Update start and end wave
         startWave = endWave;
@@ -238,21 +466,78 @@ void ImageTileIntegrator::Render() {
             waveDelta = std::min(2 * waveDelta, 64);
 
         // Write current image to disk
-        LOG_VERBOSE("Writing image with spp = %d", startWave);
+        // With adaptive sampling, splats are normalized by the average number
+        // of samples taken in each pixel.
+        Float splatScale =
+            adaptive ? Float(pixelBounds.Area()) / std::max<int64_t>(1, samplesTaken)
+                     : 1.f / startWave;
+        int samplesPerPixel = adaptive ? std::lround(1 / splatScale) : startWave;
+        LOG_VERBOSE("Writing image with spp = %d", samplesPerPixel);
         ImageMetadata metadata;
-        metadata.renderTimeSeconds = progress.ElapsedSeconds();
-        metadata.samplesPerPixel = startWave;
+        metadata.renderTimeSeconds = elapsedSeconds();
+        metadata.samplesPerPixel = samplesPerPixel;
         if (referenceImage) {
             ImageMetadata filmMetadata;
-            Image filmImage = camera.GetFilm().GetImage(&filmMetadata, 1.f / startWave);
+            Image filmImage = camera.GetFilm().GetImage(&filmMetadata, splatScale);
             ImageChannelValues mse =
                 filmImage.MSE(filmImage.AllChannelsDesc(), *referenceImage);
-            fprintf(mseOutFile, "%d, %.9g\n", startWave, mse.Average());
+            fprintf(mseOutFile, "%d, %.9g\n", samplesPerPixel, mse.Average());
             metadata.MSE = mse.Average();
             fflush(mseOutFile);
         }
         camera.InitMetadata(&metadata);
-        camera.GetFilm().WriteImage(metadata, 1.0f / startWave);
+        {
+            TRACE_SCOPE("Write image", "spp", samplesPerPixel);
+            camera.GetFilm().WriteImage(metadata, splatScale);
+        }
+
+        // Write checkpoint if enough time has passed since the last one
+        if (!Options->checkpointFile.empty() && startWave < spp &&
+            checkpointTimer.ElapsedSeconds() >= Options->checkpointInterval)
+            writeCheckpoint();
+
+        // Shrink the next wave to fit into the remaining time budget
+        if (Options->timeBudget > 0 && startWave < spp) {
+            writeSeconds = waveTimer.ElapsedSeconds() - waveRenderSeconds;
+            Float remainingSeconds = Options->timeBudget - SecondsSinceInit();
+            // Leave a 10% margin for variation in the sampling rate
+            Float fitSpp = (remainingSeconds - writeSeconds) / (1.1f * sppSeconds);
+            if (fitSpp < 1) {
+                LOG_VERBOSE("Stopping at %d spp to stay within the %fs time budget",
+                            startWave, Options->timeBudget);
+                ++timeBudgetStops;
+                break;
+            }
+            endWave = std::min<int64_t>(endWave, startWave + int64_t(fitSpp));
+            LOG_VERBOSE("Time budget: %.3fs per spp, %.3fs per image write, %.3fs "
+                        "remaining; next wave [%d, %d)",
+                        sppSeconds, writeSeconds, remainingSeconds, startWave, endWave);
+        }
+
+        // Stop adaptive sampling if all pixels have converged or time is up
+        if (adaptive && pixelsSampled == 0) {
+            converged = true;
+            break;
+        }
+        if (adaptive && adaptiveSampling.timeLimit > 0 &&
+            elapsedSeconds() > adaptiveSampling.timeLimit)
+            break;
+    }
+    // The checkpoint is no longer needed once rendering has finished; if it
+    // stopped early for a time limit, save the final waves so that it can be
+    // resumed.
+    if (!Options->checkpointFile.empty()) {
+        if (startWave >= spp || converged)
+            std::remove(Options->checkpointFile.c_str());
+        else if (checkpointWave != startWave)
+            writeCheckpoint();
+    }
+
+    if (adaptive) {
+        for (int count : pixelSampleCounts)
+            ReportValue(adaptiveSamplesPerPixel, count);
+        LOG_VERBOSE("Adaptive sampling took %d samples (%.2f per pixel)",
+                    samplesTaken.load(), double(samplesTaken) / pixelBounds.Area());
     }
     if (mseOutFile)
         fclose(mseOutFile);
@@ -260,6 +545,37 @@ void ImageTileIntegrator::Render() {
     LOG_VERBOSE("Rendering finished");
 }
 
+void ImageTileIntegrator::RenderWorkUnits(
+    std::function<pstd::optional<Bounds2i>()> nextUnit,
+    std::function<void(const Bounds2i &)> unitDone) {
+    int spp = samplerPrototype.SamplesPerPixel();
+    std::vector<ScratchBuffer> scratchBuffers;
+    for (int i = 0; i < MaxThreadIndex(); ++i)
+        scratchBuffers.push_back(ScratchBuffer(65536));
+    std::vector<SamplerHandle> samplers =
+        samplerPrototype.Clone(MaxThreadIndex(), Allocator());
+
+    while (pstd::optional<Bounds2i> unitBounds = nextUnit()) {
+        // Render all pixel samples in _unitBounds_ in parallel
+        ParallelFor2D(*unitBounds, [&](Bounds2i tileBounds) {
+            ScratchBuffer &scratchBuffer = scratchBuffers[ThreadIndex];
+            SamplerHandle &sampler = samplers[ThreadIndex];
+            for (Point2i pPixel : tileBounds) {
+                // Take the pixel's samples in the same order as _Render()_ so
+                // that its film values are computed identically
+                StatsReportPixelStart(pPixel);
+                for (int sampleIndex = 0; sampleIndex < spp; ++sampleIndex) {
+                    sampler.StartPixelSample(pPixel, sampleIndex);
+                    EvaluatePixelSample(pPixel, sampleIndex, sampler, scratchBuffer);
+                    scratchBuffer.Reset();
+                }
+                StatsReportPixelEnd(pPixel);
+            }
+        });
+        unitDone(*unitBounds);
+    }
+}
+
 // RayIntegrator Method Definitions
 void RayIntegrator::EvaluatePixelSample(const Point2i &pPixel, int sampleIndex,
                                         SamplerHandle sampler,
@@ -2169,6 +2485,10 @@ void BDPTIntegrator::Render() {
     if (visualizeStrategies || visualizeWeights) {
         const int bufferCount = (1 + maxDepth) * (6 + maxDepth) / 2;
         weightFilms.resize(bufferCount);
+        // Use the same splatting method as the main film
+        FilmHandle film = camera.GetFilm();
+        bool perThreadSplats =
+            film.Is<RGBFilm>() && film.Cast<RGBFilm>()->UsesPerThreadSplats();
         for (int depth = 0; depth <= maxDepth; ++depth) {
             for (int s = 0; s <= depth + 2; ++s) {
                 int t = depth + 2 - s;
@@ -2184,7 +2504,7 @@ void BDPTIntegrator::Render() {
                     Bounds2i(Point2i(0, 0), camera.GetFilm().FullResolution()),
                     new BoxFilter,  // FIXME: leaks
                     camera.GetFilm().Diagonal() * 1000, filename, 1.f,
-                    RGBColorSpace::sRGB);
+                    RGBColorSpace::sRGB, Infinity, true, Allocator(), perThreadSplats);
             }
         }
     }
@@ -2684,29 +3004,6 @@ struct SPPMPixel {
     RGB tau;
 };
 
-// SPPMPixelListNode Definition
-struct SPPMPixelListNode {
-    SPPMPixel *pixel;
-    SPPMPixelListNode *next;
-};
-
-// SPPM Utility Functions
-static bool ToGrid(const Point3f &p, const Bounds3f &bounds, const int gridRes[3],
-                   Point3i *pi) {
-    bool inBounds = true;
-    Vector3f pg = bounds.Offset(p);
-    for (int i = 0; i < 3; ++i) {
-        (*pi)[i] = (int)(gridRes[i] * pg[i]);
-        inBounds &= ((*pi)[i] >= 0 && (*pi)[i] < gridRes[i]);
-        (*pi)[i] = Clamp((*pi)[i], 0, gridRes[i] - 1);
-    }
-    return inBounds;
-}
-
-inline unsigned int hash(const Point3i &p, int hashSize) {
-    return Hash(p.x, p.y, p.z) % hashSize;
-}
-
 // SPPM Method Definitions
 void SPPMIntegrator::Render() {
     // Initialize local variables for _SPPMIntegrator::Render()_
@@ -2739,6 +3036,9 @@ void SPPMIntegrator::Render() {
     for (int i = 0; i < MaxThreadIndex(); ++i)
         // TODO: size this
         perThreadScratchBuffers.push_back(ScratchBuffer(nPixels * 1024));
+    // Allocate grid for SPPM visible points, which is rebuilt for each iteration
+    HashGrid grid;
+    const int hashSize = NextPrime(nPixels);
 
     for (int iter = 0; iter < nIterations; ++iter) {
         // Generate SPPM visible points
@@ -2851,63 +3151,20 @@ void SPPMIntegrator::Render() {
         }
         progress.Update();
         // Create grid of all SPPM visible points
-        // Allocate grid for SPPM visible points
-        const int hashSize = NextPrime(nPixels);
-        std::vector<std::atomic<SPPMPixelListNode *>> grid(hashSize);
-
-        // Compute grid bounds for SPPM visible points
-        Bounds3f gridBounds;
-        Float maxRadius = 0.;
-        for (const SPPMPixel &pixel : pixels) {
-            if (!pixel.vp.beta)
-                continue;
-            Bounds3f vpBound = Expand(Bounds3f(pixel.vp.p), pixel.radius);
-            gridBounds = Union(gridBounds, vpBound);
-            maxRadius = std::max(maxRadius, pixel.radius);
-        }
-
-        // Compute resolution of SPPM grid in each dimension
-        int gridRes[3];
-        Vector3f diag = gridBounds.Diagonal();
-        Float maxDiag = MaxComponentValue(diag);
-        int baseGridRes = (int)(maxDiag / maxRadius);
-        for (int i = 0; i < 3; ++i)
-            gridRes[i] = std::max<int>(baseGridRes * diag[i] / maxDiag, 1);
-
-        // Add visible points to SPPM grid
-        ParallelFor2D(pixelBounds, [&](Bounds2i tileBounds) {
-            ScratchBuffer &scratchBuffer = perThreadScratchBuffers[ThreadIndex];
-            for (Point2i pPixel : tileBounds) {
-                SPPMPixel &pixel = pixels[pPixel];
-                if (pixel.vp.beta) {
-                    // Add pixel's visible point to applicable grid cells
-                    Float radius = pixel.radius;
-                    Point3i pMin, pMax;
-                    ToGrid(pixel.vp.p - Vector3f(radius, radius, radius), gridBounds,
-                           gridRes, &pMin);
-                    ToGrid(pixel.vp.p + Vector3f(radius, radius, radius), gridBounds,
-                           gridRes, &pMax);
-                    for (int z = pMin.z; z <= pMax.z; ++z)
-                        for (int y = pMin.y; y <= pMax.y; ++y)
-                            for (int x = pMin.x; x <= pMax.x; ++x) {
-                                // Add visible point to grid cell $(x, y, z)$
-                                int h = hash(Point3i(x, y, z), hashSize);
-                                SPPMPixelListNode *node =
-                                    scratchBuffer.Alloc<SPPMPixelListNode>();
-                                node->pixel = &pixel;
-
-                                // Atomically add _node_ to the start of _grid[h]_'s
-                                // linked list
-                                node->next = grid[h];
-                                while (!grid[h].compare_exchange_weak(node->next, node))
-                                    ;
-                            }
-                    ReportValue(gridCellsPerVisiblePoint, (1 + pMax.x - pMin.x) *
-                                                              (1 + pMax.y - pMin.y) *
-                                                              (1 + pMax.z - pMin.z));
-                }
-            }
-        });
+        grid.Build(
+            nPixels,
+            [&](int i, Point3f *p, Float *radius) {
+                const SPPMPixel &pixel = pixels.begin()[i];
+                if (!pixel.vp.beta)
+                    return false;
+                *p = pixel.vp.p;
+                *radius = pixel.radius;
+                return true;
+            },
+            hashSize);
+        for (int i = 0; i < nPixels; ++i)
+            if (int nCells = grid.CellsOverlapped(i); nCells > 0)
+                ReportValue(gridCellsPerVisiblePoint, nCells);
 
         // Trace photons and accumulate contributions
         // Create per-thread scratch buffers for photon shooting
@@ -2972,28 +3229,17 @@ void SPPMIntegrator::Render() {
                     ++totalPhotonSurfaceInteractions;
                     if (depth > 0) {
                         // Add photon contribution to nearby visible points
-                        Point3i photonGridIndex;
-                        if (ToGrid(isect.p(), gridBounds, gridRes, &photonGridIndex)) {
-                            int h = hash(photonGridIndex, hashSize);
-                            // Add photon contribution to visible points in _grid[h]_
-                            for (SPPMPixelListNode *node =
-                                     grid[h].load(std::memory_order_relaxed);
-                                 node != nullptr; node = node->next) {
-                                ++visiblePointsChecked;
-                                SPPMPixel &pixel = *node->pixel;
-                                Float radius = pixel.radius;
-                                if (DistanceSquared(pixel.vp.p, isect.p()) >
-                                    radius * radius)
-                                    continue;
-                                // Update _pixel_ $\Phi$ and $M$ for nearby photon
-                                Vector3f wi = -photonRay.d;
-                                SampledSpectrum Phi =
-                                    beta * pixel.vp.bsdf.f(pixel.vp.wo, wi);
-                                for (int i = 0; i < NSpectrumSamples; ++i)
-                                    pixel.Phi[i].Add(Phi[i]);
-                                ++pixel.M;
-                            }
-                        }
+                        auto addPhoton = [&](int pixelIndex) {
+                            // Update _pixel_ $\Phi$ and $M$ for nearby photon
+                            SPPMPixel &pixel = pixels.begin()[pixelIndex];
+                            Vector3f wi = -photonRay.d;
+                            SampledSpectrum Phi = beta * pixel.vp.bsdf.f(pixel.vp.wo, wi);
+                            for (int i = 0; i < NSpectrumSamples; ++i)
+                                pixel.Phi[i].Add(Phi[i]);
+                            ++pixel.M;
+                        };
+                        visiblePointsChecked +=
+                            grid.ForEachOverlapping(isect.p(), addPhoton);
                     }
                     // Sample new photon ray direction
                     // Compute BSDF at photon intersection point
@@ -3119,6 +3365,7 @@ void SPPMIntegrator::Render() {
                                                            return v + arena.BytesAllocated();
                                                        });
 #endif
+    sppmMemoryArenaBytes += grid.BytesAllocated();
     progress.Done();
 }
 
@@ -3238,6 +3485,7 @@ std::unique_ptr<Integrator> Integrator::Create(
     const std::string &name, const ParameterDictionary &parameters, CameraHandle camera,
     SamplerHandle sampler, PrimitiveHandle aggregate, std::vector<LightHandle> lights,
     const RGBColorSpace *colorSpace, const FileLoc *loc) {
+    TRACE_SCOPE("Create integrator");
     std::unique_ptr<Integrator> integrator;
     if (name == "path")
         integrator =
@@ -3268,12 +3516,23 @@ std::unique_ptr<Integrator> Integrator::Create(
     else if (name == "sppm")
         integrator = SPPMIntegrator::Create(parameters, colorSpace, camera, aggregate,
                                             lights, loc);
+    else if (name == "wavefrontpath")
+        integrator = WavefrontPathIntegrator::Create(parameters, camera, sampler,
+                                                     aggregate, lights, loc);
     else
         ErrorExit(loc, "%s: integrator type unknown.", name);
 
     if (!integrator)
         ErrorExit(loc, "%s: unable to create integrator.", name);
 
+    // Set up adaptive sampling for integrators that render image tiles
+    if (ImageTileIntegrator *tileIntegrator =
+            dynamic_cast<ImageTileIntegrator *>(integrator.get())) {
+        tileIntegrator->SetAdaptiveSampling(
+            AdaptiveSamplingSettings::Create(parameters, loc));
+        tileIntegrator->SetName(name);
+    }
+
     parameters.ReportUnused();
     return integrator;
 }
@@ -22,6 +22,7 @@
 #include <pbrt/util/rng.h>
 #include <pbrt/util/sampling.h>
 
+#include <functional>
 #include <memory>
 #include <ostream>
 #include <string>
@@ -84,6 +85,24 @@ class Integrator {
     Bounds3f sceneBounds;
 };
 
+// AdaptiveSamplingSettings Definition
+// With adaptive sampling, all pixels first receive _minSamples_ samples;
+// after that, only pixels whose relative error is above _errorThreshold_
+// are given more, up to the sampler's sample count. Rendering also stops
+// once _timeLimit_ seconds have passed, if it is nonzero.
+struct AdaptiveSamplingSettings {
+    static AdaptiveSamplingSettings Create(const ParameterDictionary &parameters,
+                                           const FileLoc *loc);
+
+    bool Enabled() const { return errorThreshold > 0 || timeLimit > 0; }
+
+    std::string ToString() const;
+
+    Float errorThreshold = 0;
+    int minSamples = 16;
+    Float timeLimit = 0;
+};
+
 // ImageTileIntegrator Definition
 class ImageTileIntegrator : public Integrator {
   public:
@@ -94,6 +113,17 @@ class ImageTileIntegrator : public Integrator {
 
     void Render();
 
+    // Renders all of the samples in each pixel of the bounds returned by
+    // _nextUnit_ until it returns an unset value, calling _unitDone_ after
+    // each. Doesn't write the image.
+    void RenderWorkUnits(std::function<pstd::optional<Bounds2i>()> nextUnit,
+                         std::function<void(const Bounds2i &)> unitDone);
+
+    void SetAdaptiveSampling(const AdaptiveSamplingSettings &settings) {
+        adaptiveSampling = settings;
+    }
+    void SetName(const std::string &n) { name = n; }
+
     virtual void EvaluatePixelSample(const Point2i &pPixel, int sampleIndex,
                                      SamplerHandle sampler,
                                      ScratchBuffer &scratchBuffer) = 0;
@@ -102,6 +132,9 @@ class ImageTileIntegrator : public Integrator {
     // ImageTileIntegrator Protected Members
     CameraHandle camera;
     SamplerHandle samplerPrototype;
+    AdaptiveSamplingSettings adaptiveSampling;
+    // The integrator's name in the scene description, which checkpoints store
+    std::string name;
 };
 
 // RayIntegrator Definition
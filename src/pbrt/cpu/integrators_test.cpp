@@ -7,6 +7,7 @@
 #include <pbrt/cameras.h>
 #include <pbrt/cpu/accelerators.h>
 #include <pbrt/cpu/integrators.h>
+#include <pbrt/cpu/wavefront.h>
 #include <pbrt/filters.h>
 #include <pbrt/lights.h>
 #include <pbrt/materials.h>
@@ -17,11 +18,17 @@
 #include <pbrt/textures.h>
 #include <pbrt/util/color.h>
 #include <pbrt/util/colorspace.h>
+#include <pbrt/util/file.h>
 #include <pbrt/util/image.h>
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/vecmath.h>
 
+#include <atomic>
+#include <cmath>
+#include <limits>
 #include <memory>
+#include <string>
+#include <vector>
 
 using namespace pbrt;
 
@@ -357,6 +364,27 @@ std::vector<TestIntegrator> GetIntegrators() {
                                    scene});
         }
 
+        // Wavefront path; the queue is smaller than the image so that each
+        // sample index takes multiple passes
+        for (auto &sampler : GetSamplers(resolution)) {
+            FilterHandle filter = new BoxFilter(Vector2f(0.5, 0.5));
+            RGBFilm *film = new RGBFilm(resolution,
+                                        Bounds2i(Point2i(0, 0), resolution), filter, 1.,
+                                        inTestDir("test.exr"), 1., RGBColorSpace::sRGB);
+            PerspectiveCamera *camera = new PerspectiveCamera(
+                CameraTransform(identity), Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0.,
+                1., 0., 10., 45, film, nullptr);
+            const FilmHandle filmp = camera->GetFilm();
+
+            Integrator *integrator = new WavefrontPathIntegrator(
+                8, camera, sampler.first, scene.aggregate, scene.lights, "bvh", false,
+                64 /* queue size */);
+            integrators.push_back({integrator, filmp,
+                                   "WavefrontPath, depth 8, Perspective, " +
+                                       sampler.second + ", " + scene.description,
+                                   scene});
+        }
+
         // BDPT
         for (auto &sampler : GetSamplers(resolution)) {
             FilterHandle filter = new BoxFilter(Vector2f(0.5, 0.5));
@@ -419,3 +447,230 @@ TEST_P(RenderTest, RadianceMatches) {
 
 INSTANTIATE_TEST_CASE_P(AnalyticTestScenes, RenderTest,
                         testing::ValuesIn(GetIntegrators()));
+
+// NoiseIntegrator Definition
+// Adds samples with a mean of 0.5 to the film; they vary by +/-
+// _noise[0]_ in the left half of the image and +/- _noise[1]_ in the right.
+// The number of samples taken in each pixel is recorded.
+class NoiseIntegrator : public ImageTileIntegrator {
+  public:
+    NoiseIntegrator(CameraHandle camera, SamplerHandle sampler, Float noise0,
+                    Float noise1)
+        : ImageTileIntegrator(camera, sampler, nullptr, {}),
+          noise{noise0, noise1},
+          sampleCounts(camera.GetFilm().PixelBounds().Area()) {}
+
+    void EvaluatePixelSample(const Point2i &pPixel, int sampleIndex,
+                             SamplerHandle sampler, ScratchBuffer &scratchBuffer) {
+        FilmHandle film = camera.GetFilm();
+        Bounds2i pixelBounds = film.PixelBounds();
+        bool right = 2 * pPixel.x >= pixelBounds.pMax.x;
+        Float value = 0.5f + noise[right] * (2 * sampler.Get1D() - 1);
+        SampledWavelengths lambda = film.SampleWavelengths(0.5f);
+        film.AddSample(pPixel, SampledSpectrum(value), lambda, nullptr, 1);
+        ++sampleCounts[pPixel.y * pixelBounds.pMax.x + pPixel.x];
+    }
+
+    int SampleCount(Point2i p) const {
+        return sampleCounts[p.y * camera.GetFilm().PixelBounds().pMax.x + p.x];
+    }
+
+    std::string ToString() const { return "NoiseIntegrator"; }
+
+  private:
+    Float noise[2];
+    std::vector<std::atomic<int>> sampleCounts;
+};
+
+static CameraHandle MakeTestCamera(Point2i resolution, const std::string &filename) {
+    static Transform id;
+    AnimatedTransform identity(id, 0, id, 1);
+    FilterHandle filter = new BoxFilter(Vector2f(0.5, 0.5));
+    RGBFilm *film = new RGBFilm(resolution, Bounds2i(Point2i(0, 0), resolution), filter,
+                                1., filename, 1., RGBColorSpace::sRGB);
+    return new PerspectiveCamera(CameraTransform(identity),
+                                 Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 1., 0.,
+                                 10., 45, film, nullptr);
+}
+
+TEST(ImageTileIntegrator, AdaptiveSampling) {
+    Point2i resolution(16, 8);
+    std::string filename = TemporaryDirectory() + "/pbrt-test-adaptive.pfm";
+    SamplerHandle sampler = new RandomSampler(64);
+
+    AdaptiveSamplingSettings settings;
+    settings.errorThreshold = 0.02f;
+    settings.minSamples = 8;
+
+    // The left half's relative error is well below the threshold after the
+    // minimum number of samples while the right half's never reaches it.
+    CameraHandle fixedCamera = MakeTestCamera(resolution, filename);
+    NoiseIntegrator fixed(fixedCamera, sampler, 0.01f, 0.4f);
+    fixed.Render();
+    CameraHandle adaptiveCamera = MakeTestCamera(resolution, filename);
+    NoiseIntegrator adaptive(adaptiveCamera, sampler, 0.01f, 0.4f);
+    adaptive.SetAdaptiveSampling(settings);
+    adaptive.Render();
+    EXPECT_EQ(0, remove(filename.c_str()));
+
+    for (Point2i p : Bounds2i(Point2i(0, 0), resolution)) {
+        EXPECT_EQ(64, fixed.SampleCount(p));
+        RGB fixedRGB = fixedCamera.GetFilm().GetPixelRGB(p);
+        RGB adaptiveRGB = adaptiveCamera.GetFilm().GetPixelRGB(p);
+        if (2 * p.x < resolution.x) {
+            // Converged pixels stop after the minimum number of samples
+            EXPECT_EQ(settings.minSamples, adaptive.SampleCount(p)) << p;
+            for (int c = 0; c < 3; ++c)
+                EXPECT_LE(std::abs(adaptiveRGB[c] - fixedRGB[c]),
+                          settings.errorThreshold * fixedRGB[c])
+                    << p;
+        } else {
+            // Other pixels take all of the samples in the same order
+            EXPECT_EQ(64, adaptive.SampleCount(p)) << p;
+            EXPECT_EQ(fixedRGB, adaptiveRGB) << p;
+        }
+    }
+}
+
+TEST(ImageTileIntegrator, TimeBudget) {
+    Point2i resolution(8, 8);
+    // Only EXR files store the number of samples per pixel
+    std::string filename = TemporaryDirectory() + "/pbrt-test-time-budget.exr";
+    std::string checkpointFile = TemporaryDirectory() + "/pbrt-test-time-budget.ckp";
+    PBRTOptions savedOptions = *Options;
+    SamplerHandle sampler = new RandomSampler(64);
+
+    // A budget that has run out by the end of the first wave leaves 1 spp;
+    // one that hasn't allows all 64.
+    for (Float timeBudget : {1e-6f, 1e6f}) {
+        Options->timeBudget = timeBudget;
+        Options->checkpointFile = checkpointFile;
+        Options->checkpointInterval = 1e6f;
+        CameraHandle camera = MakeTestCamera(resolution, filename);
+        NoiseIntegrator integrator(camera, sampler, 0.1f, 0.1f);
+        integrator.Render();
+        int expectedSpp = timeBudget < 1 ? 1 : 64;
+        for (Point2i p : Bounds2i(Point2i(0, 0), resolution))
+            EXPECT_EQ(expectedSpp, integrator.SampleCount(p)) << p;
+
+        // The achieved sample count is recorded in the image metadata
+        ImageAndMetadata im = Image::Read(filename);
+        EXPECT_TRUE(im.metadata.samplesPerPixel.has_value());
+        if (im.metadata.samplesPerPixel)
+            EXPECT_EQ(expectedSpp, *im.metadata.samplesPerPixel);
+        EXPECT_EQ(0, remove(filename.c_str()));
+
+        // A checkpoint is kept only if the render stopped early
+        if (timeBudget < 1)
+            EXPECT_EQ(0, remove(checkpointFile.c_str()));
+        else
+            EXPECT_NE(0, remove(checkpointFile.c_str()));
+    }
+    *Options = savedOptions;
+}
+
+// CheckpointTestIntegrator Definition
+// Renders using _integrator_ and copies the checkpoint file when the wave
+// that starts with sample _copySample_ begins, which leaves a copy of the
+// checkpoint from after the earlier waves. Records the first sample index
+// that is rendered.
+class CheckpointTestIntegrator : public ImageTileIntegrator {
+  public:
+    CheckpointTestIntegrator(ImageTileIntegrator *integrator, CameraHandle camera,
+                             SamplerHandle sampler, int copySample = -1,
+                             std::string checkpointFile = {},
+                             std::string copyFile = {})
+        : ImageTileIntegrator(camera, sampler, nullptr, {}),
+          integrator(integrator),
+          copySample(copySample),
+          checkpointFile(checkpointFile),
+          copyFile(copyFile) {}
+
+    void EvaluatePixelSample(const Point2i &pPixel, int sampleIndex,
+                             SamplerHandle sampler, ScratchBuffer &scratchBuffer) {
+        // Checkpoints are only written between waves, so the file can be
+        // copied while other threads continue rendering.
+        if (sampleIndex == copySample && !copied.exchange(true))
+            EXPECT_TRUE(WriteFile(copyFile, ReadFileContents(checkpointFile)));
+        int first = firstSample;
+        while (sampleIndex < first &&
+               !firstSample.compare_exchange_weak(first, sampleIndex))
+            ;
+        integrator->EvaluatePixelSample(pPixel, sampleIndex, sampler, scratchBuffer);
+    }
+
+    bool Copied() const { return copied; }
+    int FirstSample() const { return firstSample; }
+
+    std::string ToString() const { return "CheckpointTestIntegrator"; }
+
+  private:
+    ImageTileIntegrator *integrator;
+    int copySample;
+    std::string checkpointFile, copyFile;
+    std::atomic<bool> copied{false};
+    std::atomic<int> firstSample{std::numeric_limits<int>::max()};
+};
+
+TEST(ImageTileIntegrator, ResumeFromCheckpoint) {
+    Point2i resolution(10, 10);
+    std::string filename = TemporaryDirectory() + "/pbrt-test-checkpoint.pfm";
+    std::string checkpointFile = TemporaryDirectory() + "/pbrt-test-checkpoint.ckp";
+    std::string copyFile = TemporaryDirectory() + "/pbrt-test-checkpoint-copy.ckp";
+    PBRTOptions savedOptions = *Options;
+    TestScene scene = GetScenes()[0];
+    SamplerHandle sampler = new HaltonSampler(16, resolution);
+
+    for (bool adaptive : {false, true}) {
+        AdaptiveSamplingSettings settings;
+        if (adaptive) {
+            settings.errorThreshold = 0.01f;
+            settings.minSamples = 4;
+        }
+
+        // Render the whole image, writing a checkpoint after each wave and
+        // keeping the one from after the first 8 samples (4 waves)
+        Options->checkpointFile = checkpointFile;
+        Options->checkpointInterval = 0;
+        Options->resume = false;
+        CameraHandle camera = MakeTestCamera(resolution, filename);
+        std::unique_ptr<PathIntegrator> path = std::make_unique<PathIntegrator>(
+            8, camera, sampler, scene.aggregate, scene.lights);
+        CheckpointTestIntegrator uninterrupted(path.get(), camera, sampler, 8,
+                                               checkpointFile, copyFile);
+        uninterrupted.SetAdaptiveSampling(settings);
+        uninterrupted.Render();
+        path.reset();
+        EXPECT_TRUE(uninterrupted.Copied());
+        if (!uninterrupted.Copied())
+            break;
+        // The checkpoint is removed once rendering finishes
+        EXPECT_NE(0, remove(checkpointFile.c_str()));
+
+        // Finish rendering from the copied checkpoint with a new film
+        Options->checkpointFile = copyFile;
+        Options->resume = true;
+        CameraHandle resumedCamera = MakeTestCamera(resolution, filename);
+        path = std::make_unique<PathIntegrator>(8, resumedCamera, sampler,
+                                                scene.aggregate, scene.lights);
+        CheckpointTestIntegrator resumed(path.get(), resumedCamera, sampler);
+        resumed.SetAdaptiveSampling(settings);
+        if (!adaptive) {
+            // The checkpoint can't be resumed with a different seed
+            Options->seed = savedOptions.seed + 1;
+            EXPECT_DEATH(resumed.Render(), "different scene description");
+            Options->seed = savedOptions.seed;
+        }
+        resumed.Render();
+        path.reset();
+        EXPECT_EQ(8, resumed.FirstSample());
+        EXPECT_NE(0, remove(copyFile.c_str()));
+
+        Bounds2i pixelBounds(Point2i(0, 0), resolution);
+        EXPECT_TRUE(camera.GetFilm().SaveState(pixelBounds) ==
+                    resumedCamera.GetFilm().SaveState(pixelBounds))
+            << "adaptive: " << adaptive;
+    }
+    *Options = savedOptions;
+    EXPECT_EQ(0, remove(filename.c_str()));
+}
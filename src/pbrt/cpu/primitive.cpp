@@ -32,6 +32,81 @@ bool PrimitiveHandle::IntersectP(const Ray &r, Float tMax) const {
     return DispatchCPU(isectp);
 }
 
+// Primitive Function Definitions
+// Meshes with fewer triangles than this get a primitive for each triangle,
+// since a _TriangleMeshPrimitive_'s BVH wouldn't save much
+static constexpr int MinMeshPrimitiveTriangles = 64;
+
+// Returns the _TriangleMesh_ that _shapes_ hold all of the triangles of, in
+// order, or nullptr if they don't.
+static const TriangleMesh *GetTriangleMesh(pstd::span<const ShapeHandle> shapes) {
+    if (shapes.empty() || !shapes[0].Is<Triangle>())
+        return nullptr;
+    const Triangle *first = shapes[0].Cast<Triangle>();
+    for (size_t i = 0; i < shapes.size(); ++i) {
+        const Triangle *tri = shapes[i].CastOrNullptr<Triangle>();
+        if (!tri || tri->MeshIndex() != first->MeshIndex() ||
+            size_t(tri->TriangleIndex()) != i)
+            return nullptr;
+    }
+    const TriangleMesh *mesh = first->Mesh();
+    return mesh->nTriangles == shapes.size() ? mesh : nullptr;
+}
+
+std::vector<PrimitiveHandle> CreatePrimitives(pstd::span<const ShapeHandle> shapes,
+                                              MaterialHandle material,
+                                              pstd::span<const LightHandle> areaLights,
+                                              const MediumInterface &mediumInterface,
+                                              FloatTextureHandle alpha,
+                                              const MeshPrimitiveSettings &meshSettings,
+                                              Allocator alloc) {
+    CHECK(areaLights.empty() || areaLights.size() == shapes.size());
+    if (meshSettings.enabled && shapes.size() >= MinMeshPrimitiveTriangles) {
+        if (const TriangleMesh *mesh = GetTriangleMesh(shapes); mesh) {
+            TriangleMeshPrimitive *meshPrimitive =
+                alloc.new_object<TriangleMeshPrimitive>(
+                    mesh, material, areaLights, mediumInterface, alpha,
+                    meshSettings.maxPrimsInNode, meshSettings.leafWidth,
+                    meshSettings.splitMethod);
+            // All of the mesh's triangles may be degenerate
+            if (meshPrimitive->Bounds().IsDegenerate())
+                return {};
+            return {meshPrimitive};
+        }
+    }
+
+    // Shapes without area lights only need a _GeometricPrimitive_ if they're
+    // at a medium transition or have an alpha texture
+    auto needsGeometricPrimitive = [&](size_t i) {
+        return (!areaLights.empty() && areaLights[i]) ||
+               mediumInterface.IsMediumTransition() || alpha;
+    };
+    size_t nGeometric = 0;
+    for (size_t i = 0; i < shapes.size(); ++i)
+        if (needsGeometricPrimitive(i))
+            ++nGeometric;
+
+    // Allocate and initialize primitives in shape order
+    size_t nSimple = shapes.size() - nGeometric;
+    SimplePrimitive *simple =
+        nSimple > 0 ? alloc.allocate_object<SimplePrimitive>(nSimple) : nullptr;
+    GeometricPrimitive *geometric =
+        nGeometric > 0 ? alloc.allocate_object<GeometricPrimitive>(nGeometric) : nullptr;
+    std::vector<PrimitiveHandle> primitives(shapes.size());
+    for (size_t i = 0; i < shapes.size(); ++i) {
+        if (needsGeometricPrimitive(i)) {
+            LightHandle areaLight = areaLights.empty() ? nullptr : areaLights[i];
+            alloc.construct(geometric, shapes[i], material, areaLight, mediumInterface,
+                            alpha);
+            primitives[i] = geometric++;
+        } else {
+            alloc.construct(simple, shapes[i], material);
+            primitives[i] = simple++;
+        }
+    }
+    return primitives;
+}
+
 // GeometricPrimitive Method Definitions
 GeometricPrimitive::GeometricPrimitive(ShapeHandle shape, MaterialHandle material,
                                        LightHandle areaLight,
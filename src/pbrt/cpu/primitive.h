@@ -12,11 +12,13 @@
 #include <pbrt/base/medium.h>
 #include <pbrt/base/shape.h>
 #include <pbrt/base/texture.h>
+#include <pbrt/util/pstd.h>
 #include <pbrt/util/stats.h>
 #include <pbrt/util/taggedptr.h>
 #include <pbrt/util/transform.h>
 
 #include <memory>
+#include <vector>
 
 namespace pbrt {
 
@@ -28,11 +30,15 @@ class TransformedPrimitive;
 class AnimatedPrimitive;
 class BVHAccel;
 class KdTreeAccel;
+class TriangleMeshPrimitive;
+class InstanceBVH;
+struct MeshPrimitiveSettings;
 
 // PrimitiveHandle Definition
 class PrimitiveHandle
     : public TaggedPointer<SimplePrimitive, GeometricPrimitive, TransformedPrimitive,
-                           AnimatedPrimitive, BVHAccel, KdTreeAccel> {
+                           AnimatedPrimitive, BVHAccel, KdTreeAccel,
+                           TriangleMeshPrimitive, InstanceBVH> {
   public:
     // Primitive Interface
     using TaggedPointer::TaggedPointer;
@@ -117,6 +123,22 @@ class AnimatedPrimitive {
     AnimatedTransform renderFromPrimitive;
 };
 
+// Primitive Function Declarations
+// Returns a _SimplePrimitive_ or _GeometricPrimitive_ for each of _shapes_,
+// which are usually the shapes of a single mesh. The primitives are
+// allocated in contiguous arrays from _alloc_ rather than one at a time.
+// If _meshSettings_ enables mesh primitives and _shapes_ are all of the
+// triangles of a large mesh, a single _TriangleMeshPrimitive_ built using
+// _meshSettings_ is returned instead. _areaLights_ is either empty or holds
+// each shape's area light.
+std::vector<PrimitiveHandle> CreatePrimitives(pstd::span<const ShapeHandle> shapes,
+                                              MaterialHandle material,
+                                              pstd::span<const LightHandle> areaLights,
+                                              const MediumInterface &mediumInterface,
+                                              FloatTextureHandle alpha,
+                                              const MeshPrimitiveSettings &meshSettings,
+                                              Allocator alloc);
+
 }  // namespace pbrt
 
 #endif  // PBRT_CPU_PRIMITIVE_H
@@ -6,6 +6,7 @@
 
 #include <pbrt/cameras.h>
 #include <pbrt/cpu/accelerators.h>
+#include <pbrt/cpu/distributed.h>
 #include <pbrt/cpu/integrators.h>
 #include <pbrt/film.h>
 #include <pbrt/filters.h>
@@ -17,16 +18,32 @@
 #include <pbrt/shapes.h>
 #include <pbrt/textures.h>
 #include <pbrt/util/colorspace.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/progressreporter.h>
+#include <pbrt/util/stats.h>
+#include <pbrt/util/trace.h>
+
+#include <atomic>
 
 namespace pbrt {
 
+STAT_TIMER("Time/Scene creation", sceneCreationTime);
+STAT_TIMER("Time/Texture creation", textureCreationTime);
+STAT_TIMER("Time/Material creation", materialCreationTime);
+STAT_TIMER("Time/Light creation", lightCreationTime);
+STAT_TIMER("Time/Primitive creation", primitiveCreationTime);
+STAT_TIMER("Time/Accelerator creation", acceleratorCreationTime);
+STAT_TIMER("Time/Rendering", renderingTime);
+
 void CPURender(ParsedScene &parsedScene) {
     Allocator alloc;
+    Timer sceneTimer;
 
     // Create media first (so have them for the camera...)
     std::map<std::string, MediumHandle> media = parsedScene.CreateMedia(alloc);
 
-    bool haveScatteringMedia = false;
+    // Atomic since shapes' media are found in parallel
+    std::atomic<bool> haveScatteringMedia{false};
     auto findMedium = [&media, &haveScatteringMedia](const std::string &s,
                                                      const FileLoc *loc) -> MediumHandle {
         if (s.empty())
@@ -64,13 +81,17 @@ void CPURender(ParsedScene &parsedScene) {
     // Textures
     std::map<std::string, FloatTextureHandle> floatTextures;
     std::map<std::string, SpectrumTextureHandle> spectrumTextures;
+    Timer textureTimer;
     parsedScene.CreateTextures(&floatTextures, &spectrumTextures, alloc, false);
+    textureCreationTime += textureTimer.ElapsedSeconds();
 
     // Materials
     std::map<std::string, MaterialHandle> namedMaterials;
     std::vector<MaterialHandle> materials;
+    Timer materialTimer;
     parsedScene.CreateMaterials(floatTextures, spectrumTextures, alloc, &namedMaterials,
                                 &materials);
+    materialCreationTime += materialTimer.ElapsedSeconds();
     bool haveSubsurface = false;
     for (const auto &mtl : parsedScene.materials)
         if (mtl.name == "subsurface")
@@ -82,7 +103,9 @@ void CPURender(ParsedScene &parsedScene) {
     // Lights (area lights will be done later, with shapes...)
     std::vector<LightHandle> lights;
     lights.reserve(parsedScene.lights.size() + parsedScene.areaLights.size());
+    Timer lightTimer;
     for (const auto &light : parsedScene.lights) {
+        TRACE_SCOPE("Create light");
         MediumHandle outsideMedium = findMedium(light.medium, &light.loc);
         if (light.renderFromObject.IsAnimated())
             Warning(&light.loc,
@@ -92,14 +115,20 @@ void CPURender(ParsedScene &parsedScene) {
             parsedScene.camera.cameraTransform, outsideMedium, &light.loc, alloc);
         lights.push_back(l);
     }
+    lightCreationTime += lightTimer.ElapsedSeconds();
 
     // Primitives
+    // Large triangle meshes may each be a single _TriangleMeshPrimitive_,
+    // depending on the accelerator's parameters
+    MeshPrimitiveSettings meshSettings =
+        MeshPrimitiveSettings::Create(parsedScene.accelerator.parameters);
     auto getAlphaTexture = [&](const ParameterDictionary &parameters,
                                const FileLoc *loc) -> FloatTextureHandle {
         std::string alphaTexName = parameters.GetTexture("alpha");
         if (!alphaTexName.empty()) {
-            if (floatTextures.find(alphaTexName) != floatTextures.end())
-                return floatTextures[alphaTexName];
+            auto iter = floatTextures.find(alphaTexName);
+            if (iter != floatTextures.end())
+                return iter->second;
             else
                 ErrorExit(loc, "%s: couldn't find float texture for \"alpha\" parameter.",
                           alphaTexName);
@@ -112,13 +141,27 @@ void CPURender(ParsedScene &parsedScene) {
     // Non-animated shapes
     auto CreatePrimitivesForShapes =
         [&](const std::vector<ShapeSceneEntity> &shapes) -> std::vector<PrimitiveHandle> {
-        std::vector<PrimitiveHandle> primitives;
-        for (const auto &sh : shapes) {
+        TRACE_SCOPE("Create shapes", "shapes", shapes.size());
+        // Create each entity's shapes and primitives in parallel. Primitives
+        // for shapes with area lights are created afterward, in order, so that
+        // the order of _lights_ doesn't depend on scheduling and the area
+        // lights' parameters aren't accessed concurrently.
+        struct EntityPrimitives {
+            std::vector<PrimitiveHandle> primitives;
+            // Area light shapes and their primitives' other properties
+            pstd::vector<ShapeHandle> areaLightShapes;
+            MaterialHandle mtl;
+            MediumInterface mi;
+            FloatTextureHandle alphaTex;
+        };
+        std::vector<EntityPrimitives> entityPrimitives(shapes.size());
+        ParallelFor(0, shapes.size(), [&](int64_t i) {
+            const ShapeSceneEntity &sh = shapes[i];
             pstd::vector<ShapeHandle> shapes =
                 ShapeHandle::Create(sh.name, sh.renderFromObject, sh.objectFromRender,
                                     sh.reverseOrientation, sh.parameters, &sh.loc, alloc);
             if (shapes.empty())
-                continue;
+                return;
 
             FloatTextureHandle alphaTex = getAlphaTexture(sh.parameters, &sh.loc);
             sh.parameters.ReportUnused();  // do now so can grab alpha...
@@ -137,30 +180,54 @@ void CPURender(ParsedScene &parsedScene) {
             MediumInterface mi(findMedium(sh.insideMedium, &sh.loc),
                                findMedium(sh.outsideMedium, &sh.loc));
 
-            for (auto &s : shapes) {
-                // Possibly create area light for shape
-                LightHandle areaHandle = nullptr;
-                if (sh.lightIndex != -1) {
-                    CHECK_LT(sh.lightIndex, parsedScene.areaLights.size());
-                    const auto &areaLightEntity = parsedScene.areaLights[sh.lightIndex];
-
-                    LightHandle area = LightHandle::CreateArea(
-                        areaLightEntity.name, areaLightEntity.parameters,
-                        *sh.renderFromObject, mi, s, &areaLightEntity.loc, Allocator{});
-                    areaHandle = area;
-                    if (area)
-                        lights.push_back(area);
-                }
-                if (areaHandle == nullptr && !mi.IsMediumTransition() && !alphaTex)
-                    primitives.push_back(new SimplePrimitive(s, mtl));
-                else
-                    primitives.push_back(
-                        new GeometricPrimitive(s, mtl, areaHandle, mi, alphaTex));
+            EntityPrimitives &ep = entityPrimitives[i];
+            if (sh.lightIndex != -1) {
+                CHECK_LT(sh.lightIndex, parsedScene.areaLights.size());
+                ep.areaLightShapes = std::move(shapes);
+                ep.mtl = mtl;
+                ep.mi = mi;
+                ep.alphaTex = alphaTex;
+                return;
+            }
+            ep.primitives = CreatePrimitives(shapes, mtl, {}, mi, alphaTex,
+                                             meshSettings, alloc);
+        });
+
+        // Create area lights and their primitives
+        for (size_t i = 0; i < shapes.size(); ++i) {
+            const ShapeSceneEntity &sh = shapes[i];
+            EntityPrimitives &ep = entityPrimitives[i];
+            if (ep.areaLightShapes.empty())
+                continue;
+            std::vector<LightHandle> areaLights;
+            areaLights.reserve(ep.areaLightShapes.size());
+            for (auto &s : ep.areaLightShapes) {
+                const auto &areaLightEntity = parsedScene.areaLights[sh.lightIndex];
+                LightHandle area = LightHandle::CreateArea(
+                    areaLightEntity.name, areaLightEntity.parameters,
+                    *sh.renderFromObject, ep.mi, s, &areaLightEntity.loc, Allocator{});
+                areaLights.push_back(area);
+                if (area)
+                    lights.push_back(area);
             }
+            ep.primitives = CreatePrimitives(ep.areaLightShapes, ep.mtl, areaLights,
+                                             ep.mi, ep.alphaTex, meshSettings, alloc);
+        }
+
+        size_t nPrimitives = 0;
+        for (const EntityPrimitives &ep : entityPrimitives)
+            nPrimitives += ep.primitives.size();
+        std::vector<PrimitiveHandle> primitives;
+        primitives.reserve(nPrimitives);
+        for (EntityPrimitives &ep : entityPrimitives) {
+            primitives.insert(primitives.end(), ep.primitives.begin(),
+                              ep.primitives.end());
+            ep = EntityPrimitives();
         }
         return primitives;
     };
 
+    Timer primitiveTimer;
     std::vector<PrimitiveHandle> primitives =
         CreatePrimitivesForShapes(parsedScene.shapes);
 
@@ -168,6 +235,7 @@ void CPURender(ParsedScene &parsedScene) {
     auto CreatePrimitivesForAnimatedShapes =
         [&](const std::vector<AnimatedShapeSceneEntity> &shapes)
         -> std::vector<PrimitiveHandle> {
+        TRACE_SCOPE("Create animated shapes", "shapes", shapes.size());
         std::vector<PrimitiveHandle> primitives;
         primitives.reserve(shapes.size());
 
@@ -197,10 +265,9 @@ void CPURender(ParsedScene &parsedScene) {
             MediumInterface mi(findMedium(sh.insideMedium, &sh.loc),
                                findMedium(sh.outsideMedium, &sh.loc));
 
-            std::vector<PrimitiveHandle> prims;
+            std::vector<LightHandle> areaLights;
             for (auto &s : shapes) {
                 // Possibly create area light for shape
-                LightHandle areaHandle = nullptr;
                 if (sh.lightIndex != -1) {
                     CHECK_LT(sh.lightIndex, parsedScene.areaLights.size());
                     const auto &areaLightEntity = parsedScene.areaLights[sh.lightIndex];
@@ -212,16 +279,14 @@ void CPURender(ParsedScene &parsedScene) {
                     LightHandle area = LightHandle::CreateArea(
                         areaLightEntity.name, areaLightEntity.parameters,
                         sh.renderFromObject.startTransform, mi, s, &sh.loc, Allocator{});
-                    areaHandle = area;
+                    areaLights.push_back(area);
                     if (area)
                         lights.push_back(area);
                 }
-                if (areaHandle == nullptr && !mi.IsMediumTransition() && !alphaTex)
-                    prims.push_back(new SimplePrimitive(s, mtl));
-                else
-                    prims.push_back(
-                        new GeometricPrimitive(s, mtl, areaHandle, mi, alphaTex));
             }
+            std::vector<PrimitiveHandle> prims =
+                CreatePrimitives(shapes, mtl, areaLights, mi, alphaTex, meshSettings,
+                                 alloc);
 
             // TODO: could try to be greedy or even segment them according
             // to same sh.renderFromObject...
@@ -267,6 +332,14 @@ void CPURender(ParsedScene &parsedScene) {
     }
 
     // Instances
+    // If the accelerator's "instancebvh" parameter is true, instances with a
+    // single transform are stored in an _InstanceBVH_ that is the scene's
+    // aggregate; otherwise they are _TransformedPrimitive_s in the scene's
+    // accelerator. Animated ones are always _AnimatedPrimitive_s there.
+    bool useInstanceBVH =
+        parsedScene.accelerator.parameters.GetOneBool("instancebvh", false);
+    std::vector<PrimitiveHandle> instancePrims;
+    std::vector<const Transform *> renderFromInstance;
     for (const auto &inst : parsedScene.instances) {
         auto iter = instanceDefinitions.find(inst.name);
         if (iter == instanceDefinitions.end())
@@ -276,7 +349,10 @@ void CPURender(ParsedScene &parsedScene) {
             // empty instance
             continue;
 
-        if (inst.renderFromInstance)
+        if (inst.renderFromInstance && useInstanceBVH) {
+            instancePrims.push_back(iter->second);
+            renderFromInstance.push_back(inst.renderFromInstance);
+        } else if (inst.renderFromInstance)
             primitives.push_back(
                 new TransformedPrimitive(iter->second, inst.renderFromInstance));
         else
@@ -284,11 +360,24 @@ void CPURender(ParsedScene &parsedScene) {
                 new AnimatedPrimitive(iter->second, inst.renderFromInstanceAnim));
     }
 
+    primitiveCreationTime += primitiveTimer.ElapsedSeconds();
+
     // Accelerator
     PrimitiveHandle accel = nullptr;
-    if (!primitives.empty())
+    if (!primitives.empty()) {
+        TRACE_SCOPE("Create accelerator");
+        Timer acceleratorTimer;
         accel = CreateAccelerator(parsedScene.accelerator.name, std::move(primitives),
                                   parsedScene.accelerator.parameters);
+        acceleratorCreationTime += acceleratorTimer.ElapsedSeconds();
+    }
+    if (!instancePrims.empty()) {
+        TRACE_SCOPE("Create instance BVH");
+        Timer acceleratorTimer;
+        accel = InstanceBVH::Create(instancePrims, renderFromInstance, accel,
+                                    parsedScene.accelerator.parameters);
+        acceleratorCreationTime += acceleratorTimer.ElapsedSeconds();
+    }
 
     // Integrator
     const RGBColorSpace *integratorColorSpace = parsedScene.film.parameters.ColorSpace();
@@ -313,12 +402,18 @@ void CPURender(ParsedScene &parsedScene) {
         parsedScene.integrator.name != "aov")
         Warning("No light sources defined in scene; rendering a black image.");
 
-    if (parsedScene.film.name == "gbuffer" && parsedScene.integrator.name != "path")
+    if (parsedScene.film.name == "gbuffer" && parsedScene.integrator.name != "path" &&
+        parsedScene.integrator.name != "wavefrontpath")
         Warning(&parsedScene.film.loc,
                 "GBufferFilm is not supported by %s. The channels "
                 "other than R, G, B will be zero.",
                 parsedScene.integrator.name);
 
+    if (Options->timeBudget > 0 && !dynamic_cast<ImageTileIntegrator *>(integrator.get()))
+        Warning("The \"%s\" integrator doesn't support --time-budget. Rendering all "
+                "samples.",
+                parsedScene.integrator.name);
+
     if (haveSubsurface && parsedScene.integrator.name != "volpath")
         Warning("Some objects in the scene have subsurface scattering, which is "
                 "not supported by the %s integrator. Use the \"volpath\" integrator "
@@ -326,13 +421,23 @@ void CPURender(ParsedScene &parsedScene) {
                 parsedScene.integrator.name);
 
     LOG_VERBOSE("Memory used after scene creation: %d", GetCurrentRSS());
+    sceneCreationTime += sceneTimer.ElapsedSeconds();
 
     // Render!
-    integrator->Render();
+    {
+        TRACE_SCOPE("Render");
+        Timer renderTimer;
+        if (!Options->coordinatorAddress.empty())
+            RunDistributedWorker(integrator.get(), camera, sampler);
+        else
+            integrator->Render();
+        renderingTime += renderTimer.ElapsedSeconds();
+    }
 
     LOG_VERBOSE("Memory used after rendering: %s", GetCurrentRSS());
 
     PtexTextureBase::ReportStats();
+    ImageTextureBase::ReportStats();
     ImageTextureBase::ClearCache();
     FreeBufferCaches();
 }
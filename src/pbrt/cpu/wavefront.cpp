@@ -0,0 +1,608 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/cpu/wavefront.h>
+
+#include <pbrt/bxdfs.h>
+#include <pbrt/cameras.h>
+#include <pbrt/cpu/accelerators.h>
+#include <pbrt/film.h>
+#include <pbrt/filters.h>
+#include <pbrt/interaction.h>
+#include <pbrt/lights.h>
+#include <pbrt/lightsamplers.h>
+#include <pbrt/materials.h>
+#include <pbrt/options.h>
+#include <pbrt/samplers.h>
+#include <pbrt/shapes.h>
+#include <pbrt/textures.h>
+#include <pbrt/util/bluenoise.h>
+#include <pbrt/util/check.h>
+#include <pbrt/util/containers.h>
+#include <pbrt/util/log.h>
+#include <pbrt/util/lowdiscrepancy.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/print.h>
+#include <pbrt/util/progressreporter.h>
+#include <pbrt/util/spectrum.h>
+#include <pbrt/util/stats.h>
+
+#include <algorithm>
+#include <type_traits>
+
+namespace pbrt {
+
+STAT_MEMORY_COUNTER("Memory/Wavefront integrator queues", wavefrontQueueBytes);
+STAT_COUNTER("Integrator/Camera rays traced", nWavefrontCameraRays);
+STAT_COUNTER("Intersections/Regular ray intersection tests", nWavefrontIntersectionTests);
+STAT_COUNTER("Intersections/Shadow ray intersection tests", nWavefrontShadowTests);
+STAT_TIMER("Wavefront/Camera ray generation", cameraRayTime);
+STAT_TIMER("Wavefront/Ray sample generation", raySampleTime);
+STAT_TIMER("Wavefront/Closest-hit tracing", closestHitTime);
+STAT_TIMER("Wavefront/Emission", emissionTime);
+STAT_TIMER("Wavefront/Material evaluation", materialEvalTime);
+STAT_TIMER("Wavefront/Shadow ray tracing", shadowRayTime);
+STAT_TIMER("Wavefront/Film update", filmUpdateTime);
+
+// Rays are gathered from the SoA queues into batches of this many before
+// tracing, so that a BVHAccel aggregate can trace them as packets.
+static constexpr int wavefrontTraceBatchSize = 64;
+
+// WavefrontPathIntegrator Method Definitions
+WavefrontPathIntegrator::WavefrontPathIntegrator(
+    int maxDepth, CameraHandle camera, SamplerHandle sampler, PrimitiveHandle aggregate,
+    std::vector<LightHandle> lights, const std::string &lightSampleStrategy,
+    bool regularize, int queueSize)
+    : Integrator(aggregate, lights),
+      camera(camera),
+      film(camera.GetFilm()),
+      filter(film.GetFilter()),
+      sampler(sampler),
+      lightSampler(LightSamplerHandle::Create(lightSampleStrategy, lights, Allocator())),
+      maxDepth(maxDepth),
+      regularize(regularize),
+      initializeVisibleSurface(film.UsesVisibleSurface()) {
+    // Split the image into equal passes of at most _queueSize_ pixel samples
+    int nPixels = film.PixelBounds().Area();
+    int nPasses = (nPixels + queueSize - 1) / queueSize;
+    maxQueueSize = (nPixels + nPasses - 1) / nPasses;
+    LOG_VERBOSE("Wavefront integrator: %d passes of %d pixel samples", nPasses,
+                maxQueueSize);
+
+    // Allocate the pixel sample state and work queues
+    Allocator alloc(&memoryResource);
+    pixelSampleState = SOA<PixelSampleState>(maxQueueSize, alloc);
+    rayQueues[0] = alloc.new_object<RayQueue>(maxQueueSize, alloc);
+    rayQueues[1] = alloc.new_object<RayQueue>(maxQueueSize, alloc);
+    shadowRayQueue = alloc.new_object<ShadowRayQueue>(maxQueueSize, alloc);
+    if (!infiniteLights.empty())
+        escapedRayQueue = alloc.new_object<EscapedRayQueue>(maxQueueSize, alloc);
+    hitAreaLightQueue = alloc.new_object<HitAreaLightQueue>(maxQueueSize, alloc);
+    // The material types present aren't known here, so a queue is allocated
+    // for each of them
+    pstd::array<bool, MaterialHandle::NumTags() - 1> haveMaterial;
+    haveMaterial.fill(true);
+    materialEvalQueue = alloc.new_object<MaterialEvalQueue>(
+        maxQueueSize, alloc,
+        pstd::MakeConstSpan(haveMaterial.data(), haveMaterial.size()));
+    mediumTransitionQueue = alloc.new_object<MediumTransitionQueue>(maxQueueSize, alloc);
+    wavefrontQueueBytes += memoryResource.CurrentAllocatedBytes();
+}
+
+std::unique_ptr<WavefrontPathIntegrator> WavefrontPathIntegrator::Create(
+    const ParameterDictionary &parameters, CameraHandle camera, SamplerHandle sampler,
+    PrimitiveHandle aggregate, std::vector<LightHandle> lights, const FileLoc *loc) {
+    int maxDepth = parameters.GetOneInt("maxdepth", 5);
+    std::string lightStrategy = parameters.GetOneString("lightsampler", "bvh");
+    bool regularize = parameters.GetOneBool("regularize", false);
+    int queueSize = parameters.GetOneInt("queuesize", 65536);
+    if (queueSize < 1)
+        ErrorExit(loc, "\"queuesize\" must be positive.");
+    if (sampler.Is<MLTSampler>() || sampler.Is<DebugMLTSampler>())
+        ErrorExit(loc, "The \"wavefrontpath\" integrator doesn't support the %s.",
+                  sampler);
+    return std::make_unique<WavefrontPathIntegrator>(
+        maxDepth, camera, sampler, aggregate, lights, lightStrategy, regularize,
+        queueSize);
+}
+
+std::string WavefrontPathIntegrator::ToString() const {
+    return StringPrintf("[ WavefrontPathIntegrator maxDepth: %d lightSampler: %s "
+                        "regularize: %s maxQueueSize: %d ]",
+                        maxDepth, lightSampler, regularize, maxQueueSize);
+}
+
+void WavefrontPathIntegrator::Render() {
+    Bounds2i pixelBounds = film.PixelBounds();
+    int nPixels = pixelBounds.Area();
+    int spp = sampler.SamplesPerPixel();
+    int nPasses = (nPixels + maxQueueSize - 1) / maxQueueSize;
+
+    ProgressReporter progress(int64_t(spp) * nPasses, "Rendering", Options->quiet);
+    for (int sampleIndex = 0; sampleIndex < spp; ++sampleIndex) {
+        for (int pixelStart = 0; pixelStart < nPixels; pixelStart += maxQueueSize) {
+            // Trace paths for the pixel samples in the current pass
+            rayQueues[0]->Reset();
+            GenerateCameraRays(pixelStart, sampleIndex);
+            nWavefrontCameraRays += rayQueues[0]->Size();
+
+            for (int depth = 0; true; ++depth) {
+                GenerateRaySamples(depth, sampleIndex);
+
+                // Reset queues before tracing rays
+                hitAreaLightQueue->Reset();
+                if (escapedRayQueue)
+                    escapedRayQueue->Reset();
+                materialEvalQueue->Reset();
+                mediumTransitionQueue->Reset();
+                rayQueues[(depth + 1) & 1]->Reset();
+
+                TraceClosestRays(depth);
+
+                if (escapedRayQueue)
+                    HandleEscapedRays(depth);
+                HandleRayFoundEmission(depth);
+
+                if (depth == maxDepth || rayQueues[depth & 1]->Size() == 0)
+                    break;
+
+                EvaluateMaterialsAndBSDFs(depth);
+                TraceShadowRays(depth);
+                HandleMediumTransitions(depth);
+            }
+
+            UpdateFilm();
+            progress.Update();
+        }
+    }
+    progress.Done();
+
+    // Write the final image
+    ImageMetadata metadata;
+    metadata.renderTimeSeconds = progress.ElapsedSeconds();
+    metadata.samplesPerPixel = spp;
+    camera.InitMetadata(&metadata);
+    film.WriteImage(metadata, 1.0f / spp);
+    LOG_VERBOSE("Rendering finished");
+}
+
+template <typename Sampler>
+void WavefrontPathIntegrator::GenerateCameraRays(int pixelStart, int sampleIndex) {
+    Bounds2i pixelBounds = film.PixelBounds();
+    Vector2i resolution = pixelBounds.Diagonal();
+
+    ParallelFor(0, maxQueueSize, [&](int64_t start, int64_t end) {
+        // Initialize the Sampler for this range of pixels
+        Sampler pixelSampler = *sampler.Cast<Sampler>();
+
+        for (int pixelIndex = start; pixelIndex < end; ++pixelIndex) {
+            // The last pass may have fewer pixels than the queues hold; the
+            // extra entries get pixel coordinates outside of the film
+            int offset = pixelStart + pixelIndex;
+            Point2i pPixel(pixelBounds.pMin.x + offset % resolution.x,
+                           pixelBounds.pMin.y + offset / resolution.x);
+            pixelSampleState.pPixel[pixelIndex] = pPixel;
+            if (!InsideExclusive(pPixel, pixelBounds))
+                continue;
+            pixelSampler.StartPixelSample(pPixel, sampleIndex, 0);
+
+            // Sample wavelengths for the ray path for the pixel sample
+            Float lu = RadicalInverse(1, sampleIndex) + BlueNoise(47, pPixel.x, pPixel.y);
+            if (lu >= 1)
+                lu -= 1;
+            if (Options->disableWavelengthJitter)
+                lu = 0.5f;
+            SampledWavelengths lambda = film.SampleWavelengths(lu);
+
+            // Generate the camera ray and initialize the pixel sample state
+            CameraSample cameraSample = GetCameraSample(pixelSampler, pPixel, filter);
+            CameraRay cameraRay = camera.GenerateRay(cameraSample, lambda);
+            pixelSampleState.L[pixelIndex] = SampledSpectrum(0.f);
+            pixelSampleState.lambda[pixelIndex] = lambda;
+            pixelSampleState.cameraRayWeight[pixelIndex] = cameraRay.weight;
+            pixelSampleState.filterWeight[pixelIndex] = cameraSample.weight;
+            if (initializeVisibleSurface)
+                pixelSampleState.visibleSurface[pixelIndex] = VisibleSurface();
+
+            if (cameraRay.weight)
+                rayQueues[0]->PushCameraRay(cameraRay.ray, lambda, pixelIndex);
+        }
+    });
+}
+
+void WavefrontPathIntegrator::GenerateCameraRays(int pixelStart, int sampleIndex) {
+    Timer timer;
+    // As on the GPU, specialize on the sampler type so that each thread can
+    // work with its own copy of the sampler
+    auto generateRays = [=](auto sampler) {
+        using Sampler = std::remove_reference_t<decltype(*sampler)>;
+        if constexpr (!std::is_same_v<Sampler, MLTSampler> &&
+                      !std::is_same_v<Sampler, DebugMLTSampler>)
+            GenerateCameraRays<Sampler>(pixelStart, sampleIndex);
+    };
+    sampler.DispatchCPU(generateRays);
+    cameraRayTime += timer.ElapsedSeconds();
+}
+
+template <typename Sampler>
+void WavefrontPathIntegrator::GenerateRaySamples(int depth, int sampleIndex) {
+    RayQueue *rayQueue = rayQueues[depth & 1];
+    CPUForAllQueued(rayQueue, [&](const RayWorkItem w, int index) {
+        // 5 dimensions are used for the camera sample and 7 per bounce
+        int dimension = 5 + 7 * depth;
+        Sampler pixelSampler = *sampler.Cast<Sampler>();
+        Point2i pPixel = pixelSampleState.pPixel[w.pixelIndex];
+        pixelSampler.StartPixelSample(pPixel, sampleIndex, dimension);
+
+        RaySamples rs;
+        rs.direct.u = pixelSampler.Get2D();
+        rs.direct.uc = pixelSampler.Get1D();
+        rs.indirect.u = pixelSampler.Get2D();
+        rs.indirect.uc = pixelSampler.Get1D();
+        rs.indirect.rr = pixelSampler.Get1D();
+        rs.haveSubsurface = false;
+        rayQueue->raySamples[index] = rs;
+    });
+}
+
+void WavefrontPathIntegrator::GenerateRaySamples(int depth, int sampleIndex) {
+    Timer timer;
+    auto generateSamples = [=](auto sampler) {
+        using Sampler = std::remove_reference_t<decltype(*sampler)>;
+        if constexpr (!std::is_same_v<Sampler, MLTSampler> &&
+                      !std::is_same_v<Sampler, DebugMLTSampler>)
+            GenerateRaySamples<Sampler>(depth, sampleIndex);
+    };
+    sampler.DispatchCPU(generateSamples);
+    raySampleTime += timer.ElapsedSeconds();
+}
+
+void WavefrontPathIntegrator::TraceClosestRays(int depth) {
+    Timer timer;
+    RayQueue *rayQueue = rayQueues[depth & 1];
+    const BVHAccel *bvh = aggregate ? aggregate.CastOrNullptr<BVHAccel>() : nullptr;
+
+    ParallelFor(0, rayQueue->Size(), [&](int64_t start, int64_t end) {
+        Ray rays[wavefrontTraceBatchSize];
+        Float tMax[wavefrontTraceBatchSize];
+        pstd::optional<ShapeIntersection> si[wavefrontTraceBatchSize];
+        std::fill(tMax, tMax + wavefrontTraceBatchSize, Infinity);
+
+        for (int64_t batchStart = start; batchStart < end;
+             batchStart += wavefrontTraceBatchSize) {
+            // Gather and trace the next batch of rays
+            int n = std::min<int64_t>(wavefrontTraceBatchSize, end - batchStart);
+            for (int i = 0; i < n; ++i)
+                rays[i] = rayQueue->ray[batchStart + i];
+            nWavefrontIntersectionTests += n;
+            if (bvh)
+                bvh->Intersect(pstd::span<const Ray>(rays, n),
+                               pstd::span<const Float>(tMax, n),
+                               pstd::span<pstd::optional<ShapeIntersection>>(si, n));
+            else
+                for (int i = 0; i < n; ++i)
+                    si[i] = aggregate ? aggregate.Intersect(rays[i], Infinity)
+                                      : pstd::optional<ShapeIntersection>();
+
+            // Enqueue work for each ray according to what it hit
+            for (int i = 0; i < n; ++i) {
+                int rayIndex = batchStart + i;
+                const RayWorkItem r = (*rayQueue)[rayIndex];
+                if (!si[i]) {
+                    if (escapedRayQueue)
+                        escapedRayQueue->Push(EscapedRayWorkItem{
+                            r.beta, r.pdfUni, r.pdfNEE, r.lambda, r.ray.o, r.ray.d,
+                            r.piPrev, r.nPrev, r.nsPrev, (int)r.isSpecularBounce,
+                            r.pixelIndex});
+                    continue;
+                }
+
+                const SurfaceInteraction &intr = si[i]->intr;
+                MaterialHandle material = intr.material;
+                if (!material) {
+                    // Continue through surfaces that only mark medium boundaries
+                    Ray newRay = intr.SpawnRay(r.ray.d);
+                    mediumTransitionQueue->Push(MediumTransitionWorkItem{
+                        newRay, r.lambda, r.beta, r.pdfUni, r.pdfNEE, r.piPrev, r.nPrev,
+                        r.nsPrev, r.isSpecularBounce, r.anyNonSpecularBounces,
+                        r.etaScale, r.pixelIndex});
+                    continue;
+                }
+
+                if (intr.areaLight)
+                    hitAreaLightQueue->Push(HitAreaLightWorkItem{
+                        intr.areaLight, r.lambda, r.beta, r.pdfUni, r.pdfNEE, intr.p(),
+                        intr.n, intr.uv, intr.wo, r.piPrev, r.ray.d, r.ray.time, r.nPrev,
+                        r.nsPrev, (int)r.isSpecularBounce, r.pixelIndex});
+
+                MediumInterface mediumInterface = intr.mediumInterface
+                                                      ? *intr.mediumInterface
+                                                      : MediumInterface(r.ray.medium);
+                auto enqueue = [&](auto ptr) {
+                    using Material = typename std::remove_reference_t<decltype(*ptr)>;
+                    materialEvalQueue->Push<Material>(MaterialEvalWorkItem<Material>{
+                        ptr, r.lambda, r.beta, r.pdfUni, intr.pi, intr.n, intr.shading.n,
+                        intr.shading.dpdu, intr.shading.dpdv, intr.shading.dndu,
+                        intr.shading.dndv, intr.wo, intr.uv, intr.time,
+                        r.anyNonSpecularBounces, r.etaScale, mediumInterface, rayIndex,
+                        r.pixelIndex});
+                };
+                material.Dispatch(enqueue);
+            }
+        }
+    });
+    closestHitTime += timer.ElapsedSeconds();
+}
+
+void WavefrontPathIntegrator::TraceShadowRays(int depth) {
+    Timer timer;
+    ParallelFor(0, shadowRayQueue->Size(), [&](int64_t start, int64_t end) {
+        Ray rays[wavefrontTraceBatchSize];
+        Float tMax[wavefrontTraceBatchSize];
+        bool occluded[wavefrontTraceBatchSize];
+
+        for (int64_t batchStart = start; batchStart < end;
+             batchStart += wavefrontTraceBatchSize) {
+            // Gather and trace the next batch of shadow rays
+            int n = std::min<int64_t>(wavefrontTraceBatchSize, end - batchStart);
+            for (int i = 0; i < n; ++i) {
+                rays[i] = shadowRayQueue->ray[batchStart + i];
+                tMax[i] = shadowRayQueue->tMax[batchStart + i];
+            }
+            nWavefrontShadowTests += n;
+            if (const BVHAccel *bvh =
+                    aggregate ? aggregate.CastOrNullptr<BVHAccel>() : nullptr)
+                bvh->IntersectP(pstd::span<const Ray>(rays, n),
+                                pstd::span<const Float>(tMax, n),
+                                pstd::span<bool>(occluded, n));
+            else
+                for (int i = 0; i < n; ++i)
+                    occluded[i] = aggregate && aggregate.IntersectP(rays[i], tMax[i]);
+
+            // Add contribution if light was visible; each pixel has at most
+            // one shadow ray in the queue
+            for (int i = 0; i < n; ++i) {
+                if (occluded[i])
+                    continue;
+                const ShadowRayWorkItem sr = (*shadowRayQueue)[batchStart + i];
+                SampledSpectrum Ld = sr.Ld / (sr.pdfUni + sr.pdfNEE).Average();
+                if (Ld)
+                    pixelSampleState.L[sr.pixelIndex] =
+                        SampledSpectrum(pixelSampleState.L[sr.pixelIndex]) + Ld;
+            }
+        }
+    });
+    shadowRayQueue->Reset();
+    shadowRayTime += timer.ElapsedSeconds();
+}
+
+void WavefrontPathIntegrator::HandleEscapedRays(int depth) {
+    Timer timer;
+    CPUForAllQueued(escapedRayQueue, [&](const EscapedRayWorkItem er, int index) {
+        Ray ray(er.rayo, er.rayd);
+        SampledSpectrum L = pixelSampleState.L[er.pixelIndex];
+        for (LightHandle light : infiniteLights) {
+            SampledSpectrum Le = light.Le(ray, er.lambda);
+            if (!Le)
+                continue;
+
+            if (depth == 0 || er.specularBounce)
+                L += er.beta * Le / er.pdfUni.Average();
+            else {
+                // Compute MIS-weighted contribution of infinite light
+                LightSampleContext ctx(er.piPrev, er.nPrev, er.nsPrev);
+                Float lightPDF = lightSampler.PDF(ctx, light) *
+                                 light.PDF_Li(ctx, ray.d, LightSamplingMode::WithMIS);
+                SampledSpectrum pdfNEE = er.pdfNEE * lightPDF;
+                L += er.beta * Le / (er.pdfUni + pdfNEE).Average();
+            }
+        }
+        pixelSampleState.L[er.pixelIndex] = L;
+    });
+    emissionTime += timer.ElapsedSeconds();
+}
+
+void WavefrontPathIntegrator::HandleRayFoundEmission(int depth) {
+    Timer timer;
+    CPUForAllQueued(hitAreaLightQueue, [&](const HitAreaLightWorkItem he, int index) {
+        LightHandle areaLight = he.areaLight;
+        SampledSpectrum Le = areaLight.L(he.p, he.n, he.uv, he.wo, he.lambda);
+        if (!Le)
+            return;
+
+        SampledSpectrum L = pixelSampleState.L[he.pixelIndex];
+        if (depth == 0 || he.isSpecularBounce)
+            L += he.beta * Le / he.pdfUni.Average();
+        else {
+            // Compute MIS-weighted contribution of area light
+            LightSampleContext ctx(he.piPrev, he.nPrev, he.nsPrev);
+            Float lightPDF = lightSampler.PDF(ctx, areaLight) *
+                             areaLight.PDF_Li(ctx, he.rayd, LightSamplingMode::WithMIS);
+            SampledSpectrum pdfNEE = he.pdfNEE * lightPDF;
+            L += he.beta * Le / (he.pdfUni + pdfNEE).Average();
+        }
+        pixelSampleState.L[he.pixelIndex] = L;
+    });
+    emissionTime += timer.ElapsedSeconds();
+}
+
+void WavefrontPathIntegrator::HandleMediumTransitions(int depth) {
+    CPUForAllQueued(mediumTransitionQueue, [&](const MediumTransitionWorkItem mt,
+                                               int index) {
+        rayQueues[(depth + 1) & 1]->PushIndirect(
+            mt.ray, mt.piPrev, mt.nPrev, mt.nsPrev, mt.beta, mt.pdfUni, mt.pdfNEE,
+            mt.lambda, mt.etaScale, mt.isSpecularBounce, mt.anyNonSpecularBounces,
+            mt.pixelIndex);
+    });
+}
+
+template <typename Material>
+void WavefrontPathIntegrator::EvaluateMaterialAndBSDF(int depth) {
+    UniversalTextureEvaluator texEval;
+    RayQueue *rayQueue = rayQueues[depth & 1];
+    RayQueue *nextRayQueue = rayQueues[(depth + 1) & 1];
+
+    auto *evalQueue = materialEvalQueue->Get<Material>();
+    CPUForAllQueued(evalQueue, [&](const MaterialEvalWorkItem<Material> me, int index) {
+        const Material *material = me.material;
+
+        // Compute shading normal (and shading dpdu) via bump mapping
+        Normal3f ns = me.ns;
+        Vector3f dpdus = me.dpdus;
+        FloatTextureHandle displacement = material->GetDisplacement();
+        if (displacement) {
+            BumpEvalContext bctx = me.GetBumpEvalContext();
+            Vector3f dpdvs;
+            Bump(texEval, displacement, bctx, &dpdus, &dpdvs);
+            ns = Normal3f(Normalize(Cross(dpdus, dpdvs)));
+            ns = FaceForward(ns, me.n);
+        }
+
+        // Evaluate the material and its textures to get the BSDF
+        SampledWavelengths lambda = me.lambda;
+        MaterialEvalContext ctx = me.GetMaterialEvalContext(ns, dpdus);
+        using BxDF = typename Material::BxDF;
+        BxDF bxdf;
+        BSDF bsdf = material->GetBSDF(texEval, ctx, lambda, &bxdf);
+        if (regularize && me.anyNonSpecularBounces)
+            bsdf.Regularize();
+
+        if (depth == 0 && initializeVisibleSurface) {
+            SurfaceInteraction intr;
+            intr.pi = me.pi;
+            intr.n = me.n;
+            intr.shading.n = ns;
+            intr.wo = me.wo;
+            intr.time = me.time;
+
+            // Estimate BSDF's albedo
+            constexpr int nRhoSamples = 16;
+            SampledSpectrum rho(0.f);
+            for (int i = 0; i < nRhoSamples; ++i) {
+                Float uc = RadicalInverse(0, i + 1);
+                Point2f u(RadicalInverse(1, i + 1), RadicalInverse(2, i + 1));
+                BSDFSample bs = bsdf.Sample_f(me.wo, uc, u);
+                if (bs && bs.pdf > 0)
+                    rho += bs.f * AbsDot(bs.wi, ns) / bs.pdf;
+            }
+            SampledSpectrum albedo = rho / nRhoSamples;
+
+            pixelSampleState.visibleSurface[me.pixelIndex] =
+                VisibleSurface(intr, camera.GetCameraTransform(), albedo, lambda);
+        }
+
+        Vector3f wo = me.wo;
+        RaySamples raySamples = rayQueue->raySamples[me.rayIndex];
+
+        // Sample BSDF to get the indirect ray
+        BSDFSample bsdfSample =
+            bsdf.Sample_f<BxDF>(wo, raySamples.indirect.uc, raySamples.indirect.u);
+        if (bsdfSample && bsdfSample.f) {
+            Vector3f wi = bsdfSample.wi;
+            SampledSpectrum beta = me.beta * bsdfSample.f * AbsDot(wi, ns);
+            SampledSpectrum pdfUni = me.pdfUni, pdfNEE = pdfUni;
+            if (bsdf.SampledPDFIsProportional()) {
+                Float pdf = bsdf.PDF(wo, wi);
+                beta *= pdf / bsdfSample.pdf;
+                pdfUni *= pdf;
+            } else
+                pdfUni *= bsdfSample.pdf;
+
+            Float etaScale = me.etaScale;
+            if (bsdfSample.IsTransmission())
+                etaScale *= Sqr(bsdf.eta);
+
+            // Possibly terminate the path with Russian roulette
+            SampledSpectrum rrBeta = beta * etaScale / pdfUni.Average();
+            if (rrBeta.MaxComponentValue() < 1 && depth > 1) {
+                Float q = std::max<Float>(0, 1 - rrBeta.MaxComponentValue());
+                if (raySamples.indirect.rr < q)
+                    beta = SampledSpectrum(0.f);
+                pdfUni *= 1 - q;
+                pdfNEE *= 1 - q;
+            }
+
+            if (beta) {
+                Ray ray = SpawnRay(me.pi, me.n, me.time, wi);
+                bool anyNonSpecularBounces =
+                    !bsdfSample.IsSpecular() || me.anyNonSpecularBounces;
+                nextRayQueue->PushIndirect(ray, me.pi, me.n, ns, beta, pdfUni, pdfNEE,
+                                           lambda, etaScale, bsdfSample.IsSpecular(),
+                                           anyNonSpecularBounces, me.pixelIndex);
+            }
+        }
+
+        // Sample direct lighting and enqueue a shadow ray
+        if (bsdf.IsSpecular())
+            return;
+        LightSampleContext lightCtx(me.pi, me.n, ns);
+        pstd::optional<SampledLight> sampledLight =
+            lightSampler.Sample(lightCtx, raySamples.direct.uc);
+        if (!sampledLight)
+            return;
+        LightHandle light = sampledLight->light;
+
+        LightLiSample ls = light.SampleLi(lightCtx, raySamples.direct.u, lambda,
+                                          LightSamplingMode::WithMIS);
+        if (!ls || !ls.L)
+            return;
+        Vector3f wi = ls.wi;
+        SampledSpectrum f = bsdf.f<BxDF>(wo, wi);
+        if (!f)
+            return;
+
+        // Compute light and BSDF PDFs for MIS
+        SampledSpectrum beta = me.beta * f * AbsDot(wi, ns);
+        Float lightPDF = ls.pdf * sampledLight->pdf;
+        Float bsdfPDF = IsDeltaLight(light.Type()) ? 0.f : bsdf.PDF<BxDF>(wo, wi);
+        SampledSpectrum pdfUni = me.pdfUni * bsdfPDF;
+        SampledSpectrum pdfNEE = me.pdfUni * lightPDF;
+
+        Ray ray = SpawnRayTo(me.pi, me.n, me.time, ls.pLight.pi, ls.pLight.n);
+        shadowRayQueue->Push(ShadowRayWorkItem{ray, 1 - ShadowEpsilon, lambda,
+                                               beta * ls.L, pdfUni, pdfNEE,
+                                               me.pixelIndex});
+    });
+}
+
+struct WavefrontEvaluateMaterialCallback {
+    int depth;
+    WavefrontPathIntegrator *integrator;
+    template <typename Material>
+    void operator()() {
+        integrator->EvaluateMaterialAndBSDF<Material>(depth);
+    }
+};
+
+void WavefrontPathIntegrator::EvaluateMaterialsAndBSDFs(int depth) {
+    Timer timer;
+    // Each material type is processed in turn, so that all of the threads
+    // run the same BSDF code over a contiguous queue at once
+    MaterialHandle::ForEachType(WavefrontEvaluateMaterialCallback{depth, this});
+    materialEvalTime += timer.ElapsedSeconds();
+}
+
+void WavefrontPathIntegrator::UpdateFilm() {
+    Timer timer;
+    Bounds2i pixelBounds = film.PixelBounds();
+    ParallelFor(0, maxQueueSize, [&](int64_t pixelIndex) {
+        Point2i pPixel = pixelSampleState.pPixel[pixelIndex];
+        if (!InsideExclusive(pPixel, pixelBounds))
+            return;
+
+        // Compute final weighted radiance value
+        SampledSpectrum Lw = SampledSpectrum(pixelSampleState.L[pixelIndex]) *
+                             pixelSampleState.cameraRayWeight[pixelIndex];
+        SampledWavelengths lambda = pixelSampleState.lambda[pixelIndex];
+        Float filterWeight = pixelSampleState.filterWeight[pixelIndex];
+        if (initializeVisibleSurface) {
+            VisibleSurface visibleSurface = pixelSampleState.visibleSurface[pixelIndex];
+            film.AddSample(pPixel, Lw, lambda, &visibleSurface, filterWeight);
+        } else
+            film.AddSample(pPixel, Lw, lambda, nullptr, filterWeight);
+    });
+    filmUpdateTime += timer.ElapsedSeconds();
+}
+
+}  // namespace pbrt
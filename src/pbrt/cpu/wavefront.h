@@ -0,0 +1,95 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#ifndef PBRT_CPU_WAVEFRONT_H
+#define PBRT_CPU_WAVEFRONT_H
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/base/camera.h>
+#include <pbrt/base/film.h>
+#include <pbrt/base/filter.h>
+#include <pbrt/base/light.h>
+#include <pbrt/base/lightsampler.h>
+#include <pbrt/base/sampler.h>
+#include <pbrt/cpu/integrators.h>
+#include <pbrt/gpu/workitems.h>
+#include <pbrt/gpu/workqueue.h>
+#include <pbrt/util/memory.h>
+#include <pbrt/util/pstd.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace pbrt {
+
+// WavefrontPathIntegrator Definition
+// Path tracer that processes many pixel samples at once, one stage of the
+// path at a time, using the same SoA work queues as the GPU renderer. Each
+// stage is a ParallelFor over a queue; material evaluation is sorted by
+// material type via a MultiWorkQueue.
+class WavefrontPathIntegrator : public Integrator {
+  public:
+    // WavefrontPathIntegrator Public Methods
+    WavefrontPathIntegrator(int maxDepth, CameraHandle camera, SamplerHandle sampler,
+                            PrimitiveHandle aggregate, std::vector<LightHandle> lights,
+                            const std::string &lightSampleStrategy = "bvh",
+                            bool regularize = false, int queueSize = 65536);
+
+    static std::unique_ptr<WavefrontPathIntegrator> Create(
+        const ParameterDictionary &parameters, CameraHandle camera, SamplerHandle sampler,
+        PrimitiveHandle aggregate, std::vector<LightHandle> lights, const FileLoc *loc);
+
+    void Render();
+
+    std::string ToString() const;
+
+    // WavefrontPathIntegrator Stages
+    void GenerateCameraRays(int pixelStart, int sampleIndex);
+    template <typename Sampler>
+    void GenerateCameraRays(int pixelStart, int sampleIndex);
+
+    void GenerateRaySamples(int depth, int sampleIndex);
+    template <typename Sampler>
+    void GenerateRaySamples(int depth, int sampleIndex);
+
+    void TraceClosestRays(int depth);
+    void TraceShadowRays(int depth);
+
+    void HandleEscapedRays(int depth);
+    void HandleRayFoundEmission(int depth);
+    void HandleMediumTransitions(int depth);
+
+    void EvaluateMaterialsAndBSDFs(int depth);
+    template <typename Material>
+    void EvaluateMaterialAndBSDF(int depth);
+
+    void UpdateFilm();
+
+  private:
+    // WavefrontPathIntegrator Private Members
+    CameraHandle camera;
+    FilmHandle film;
+    FilterHandle filter;
+    SamplerHandle sampler;
+    LightSamplerHandle lightSampler;
+    int maxDepth;
+    bool regularize;
+    bool initializeVisibleSurface;
+    int maxQueueSize;
+
+    TrackedMemoryResource memoryResource;
+    SOA<PixelSampleState> pixelSampleState;
+    RayQueue *rayQueues[2] = {nullptr, nullptr};
+    ShadowRayQueue *shadowRayQueue = nullptr;
+    EscapedRayQueue *escapedRayQueue = nullptr;
+    HitAreaLightQueue *hitAreaLightQueue = nullptr;
+    MaterialEvalQueue *materialEvalQueue = nullptr;
+    MediumTransitionQueue *mediumTransitionQueue = nullptr;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_CPU_WAVEFRONT_H
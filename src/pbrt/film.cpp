@@ -23,6 +23,9 @@
 #include <pbrt/util/stats.h>
 #include <pbrt/util/transform.h>
 
+#include <cstring>
+#include <type_traits>
+
 namespace pbrt {
 
 void FilmHandle::AddSplat(const Point2f &p, SampledSpectrum v,
@@ -41,6 +44,26 @@ Image FilmHandle::GetImage(ImageMetadata *metadata, Float splatScale) {
     return DispatchCPU(get);
 }
 
+std::string FilmHandle::SaveState(const Bounds2i &bounds) {
+    auto save = [&](auto ptr) { return ptr->SaveState(bounds); };
+    return DispatchCPU(save);
+}
+
+bool FilmHandle::RestoreState(const std::string &state) {
+    auto restore = [&](auto ptr) { return ptr->RestoreState(state); };
+    return DispatchCPU(restore);
+}
+
+bool FilmHandle::MergeState(const std::string &state) {
+    auto merge = [&](auto ptr) { return ptr->MergeState(state); };
+    return DispatchCPU(merge);
+}
+
+void FilmHandle::ClearState(const Bounds2i &bounds) {
+    auto clear = [&](auto ptr) { ptr->ClearState(bounds); };
+    return DispatchCPU(clear);
+}
+
 std::string FilmHandle::ToString() const {
     if (ptr() == nullptr)
         return "(nullptr)";
@@ -90,13 +113,134 @@ std::string VisibleSurface::ToString() const {
                         set, p, n, ns, dzdx, dzdy, time, albedo);
 }
 
+// Film State Serialization Functions
+template <typename T>
+static void AppendState(std::string *state, const T &value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Film state must be trivially copyable");
+    state->append((const char *)&value, sizeof(T));
+}
+
+template <typename T>
+static bool ReadState(const std::string &state, size_t *offset, T *value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Film state must be trivially copyable");
+    if (*offset + sizeof(T) > state.size())
+        return false;
+    std::memcpy(value, state.data() + *offset, sizeof(T));
+    *offset += sizeof(T);
+    return true;
+}
+
+// Film state holds the bounds of the pixels it covers followed by a
+// film-specific _PixelState_ for each of them.
+template <typename PixelState, typename F>
+static std::string SavePixelStates(const Bounds2i &bounds, F getState) {
+    std::string state;
+    state.reserve(sizeof(Bounds2i) + bounds.Area() * sizeof(PixelState));
+    AppendState(&state, bounds);
+    for (Point2i p : bounds)
+        AppendState<PixelState>(&state, getState(p));
+    return state;
+}
+
+template <typename PixelState, typename F>
+static bool ForEachPixelState(const std::string &state, const Bounds2i &pixelBounds,
+                              F func) {
+    size_t offset = 0;
+    Bounds2i bounds;
+    if (!ReadState(state, &offset, &bounds) || bounds.IsDegenerate() ||
+        !Inside(bounds, pixelBounds) ||
+        state.size() != offset + bounds.Area() * sizeof(PixelState))
+        return false;
+    for (Point2i p : bounds) {
+        PixelState pixelState;
+        ReadState(state, &offset, &pixelState);
+        func(p, pixelState);
+    }
+    return true;
+}
+
 STAT_MEMORY_COUNTER("Memory/Film pixels", filmPixelMemory);
+STAT_MEMORY_COUNTER("Memory/Film per-thread splat tiles", splatTileMemory);
+
+// SplatBuffer Method Definitions
+SplatBuffer::SplatBuffer(const Bounds2i &pixelBounds, int nThreads)
+    : pixelBounds(pixelBounds),
+      nTiles((pixelBounds.Diagonal().x + TileSize - 1) / TileSize,
+             (pixelBounds.Diagonal().y + TileSize - 1) / TileSize),
+      threadTiles(nThreads) {}
+
+SplatBuffer::~SplatBuffer() {
+    for (ThreadTiles &tt : threadTiles)
+        for (Tile *tile : tt.tiles)
+            delete tile;
+}
+
+SplatBuffer::Tile *SplatBuffer::AllocateTile() {
+    ThreadTiles &tt = threadTiles[ThreadIndex];
+    // Account for the thread's table of tile pointers with its first tile
+    if (tt.nAllocated++ == 0)
+        splatTileMemory += tt.tiles.size() * sizeof(Tile *);
+    splatTileMemory += sizeof(Tile);
+    return new Tile;
+}
+
+void SplatBuffer::Reduce(std::function<void(Point2i, const double *)> func) {
+    ParallelFor(0, nTiles.x * nTiles.y, [&](int64_t tileIndex) {
+        // Sum and clear all threads' splats in tile _tileIndex_
+        Tile sum;
+        bool splatted = false;
+        for (ThreadTiles &tt : threadTiles) {
+            if (tt.tiles.empty() || tt.tiles[tileIndex] == nullptr)
+                continue;
+            Tile *tile = tt.tiles[tileIndex];
+            for (int i = 0; i < TileSize * TileSize; ++i)
+                for (int c = 0; c < 3; ++c)
+                    sum.rgb[i][c] += tile->rgb[i][c];
+            *tile = Tile();
+            splatted = true;
+        }
+        if (!splatted)
+            return;
+
+        // Pass the sums for the tile's pixels to _func_
+        Point2i pTile(pixelBounds.pMin.x + (tileIndex % nTiles.x) * TileSize,
+                      pixelBounds.pMin.y + (tileIndex / nTiles.x) * TileSize);
+        Bounds2i tileBounds =
+            Intersect(Bounds2i(pTile, pTile + Vector2i(TileSize, TileSize)), pixelBounds);
+        for (Point2i p : tileBounds)
+            func(p, sum.rgb[(p.y - pTile.y) * TileSize + (p.x - pTile.x)]);
+    });
+}
+
+size_t SplatBuffer::TilesAllocated() const {
+    size_t n = 0;
+    for (const ThreadTiles &tt : threadTiles)
+        n += tt.nAllocated;
+    return n;
+}
+
+size_t SplatBuffer::BytesAllocated() const {
+    size_t bytes = 0;
+    for (const ThreadTiles &tt : threadTiles)
+        if (tt.nAllocated > 0)
+            bytes += tt.tiles.size() * sizeof(Tile *) + tt.nAllocated * sizeof(Tile);
+    return bytes;
+}
+
+std::string SplatBuffer::ToString() const {
+    return StringPrintf("[ SplatBuffer pixelBounds: %s nTiles: %s threads: %d "
+                        "tilesAllocated: %d bytesAllocated: %d ]",
+                        pixelBounds, nTiles, threadTiles.size(), TilesAllocated(),
+                        BytesAllocated());
+}
 
 // RGBFilm Method Definitions
 RGBFilm::RGBFilm(const Point2i &resolution, const Bounds2i &pixelBounds,
                  FilterHandle filter, Float diagonal, const std::string &filename,
                  Float scale, const RGBColorSpace *colorSpace, Float maxComponentValue,
-                 bool writeFP16, Allocator allocator)
+                 bool writeFP16, Allocator allocator, bool perThreadSplats)
     : FilmBase(resolution, pixelBounds, filter, diagonal, filename),
       pixels(pixelBounds, allocator),
       scale(scale),
@@ -107,6 +251,8 @@ RGBFilm::RGBFilm(const Point2i &resolution, const Bounds2i &pixelBounds,
     CHECK(!pixelBounds.IsEmpty());
     CHECK(colorSpace != nullptr);
     filmPixelMemory += pixelBounds.Area() * sizeof(Pixel);
+    if (perThreadSplats)
+        splatBuffer = std::make_unique<SplatBuffer>(pixelBounds, MaxThreadIndex());
 }
 
 SampledWavelengths RGBFilm::SampleWavelengths(Float u) const {
@@ -132,6 +278,12 @@ void RGBFilm::AddSplat(const Point2f &p, SampledSpectrum v,
         // Evaluate filter at _pi_ and add splat contribution
         Float wt = filter.Evaluate(Point2f(p - pi - Vector2f(0.5, 0.5)));
         if (wt != 0) {
+#ifndef PBRT_IS_GPU_CODE
+            if (splatBuffer) {
+                splatBuffer->Add(pi, wt * rgb);
+                continue;
+            }
+#endif
             Pixel &pixel = pixels[pi];
             for (int i = 0; i < 3; ++i)
                 pixel.splatRGB[i].Add(wt * rgb[i]);
@@ -151,6 +303,8 @@ Image RGBFilm::GetImage(ImageMetadata *metadata, Float splatScale) {
     PixelFormat format = writeFP16 ? PixelFormat::Half : PixelFormat::Float;
     Image image(format, Point2i(pixelBounds.Diagonal()), {"R", "G", "B"});
 
+    reduceSplats();
+
     ParallelFor2D(pixelBounds, [&](Point2i p) {
         RGB rgb = GetPixelRGB(p, splatScale);
 
@@ -172,10 +326,81 @@ Image RGBFilm::GetImage(ImageMetadata *metadata, Float splatScale) {
     return image;
 }
 
+void RGBFilm::reduceSplats() {
+    if (!splatBuffer)
+        return;
+    // Add per-thread splats to the film's pixels
+    LOG_VERBOSE("Per-thread splat buffers use %d tiles (%.2f MB); shared splat "
+                "pixels use %.2f MB",
+                splatBuffer->TilesAllocated(),
+                splatBuffer->BytesAllocated() / (1024.f * 1024.f),
+                pixelBounds.Area() * sizeof(Pixel::splatRGB) / (1024.f * 1024.f));
+    splatBuffer->Reduce([&](Point2i p, const double *rgb) {
+        Pixel &pixel = pixels[p];
+        for (int c = 0; c < 3; ++c)
+            pixel.splatRGB[c].Add(rgb[c]);
+    });
+}
+
+std::string RGBFilm::SaveState(const Bounds2i &bounds) {
+    CHECK(Inside(bounds, pixelBounds));
+    reduceSplats();
+    return SavePixelStates<PixelState>(bounds, [&](Point2i p) {
+        const Pixel &pixel = pixels[p];
+        PixelState state;
+        for (int c = 0; c < 3; ++c) {
+            state.rgbSum[c] = pixel.rgbSum[c];
+            state.splatRGB[c] = pixel.splatRGB[c];
+        }
+        state.weightSum = pixel.weightSum;
+        state.varianceEstimator = pixel.varianceEstimator;
+        return state;
+    });
+}
+
+bool RGBFilm::RestoreState(const std::string &state) {
+    return ForEachPixelState<PixelState>(
+        state, pixelBounds, [&](Point2i p, const PixelState &pixelState) {
+            Pixel &pixel = pixels[p];
+            for (int c = 0; c < 3; ++c) {
+                pixel.rgbSum[c] = pixelState.rgbSum[c];
+                pixel.splatRGB[c] = pixelState.splatRGB[c];
+            }
+            pixel.weightSum = pixelState.weightSum;
+            pixel.varianceEstimator = pixelState.varianceEstimator;
+        });
+}
+
+bool RGBFilm::MergeState(const std::string &state) {
+    return ForEachPixelState<PixelState>(
+        state, pixelBounds, [&](Point2i p, const PixelState &pixelState) {
+            Pixel &pixel = pixels[p];
+            for (int c = 0; c < 3; ++c) {
+                pixel.rgbSum[c] += pixelState.rgbSum[c];
+                pixel.splatRGB[c].Add(pixelState.splatRGB[c]);
+            }
+            pixel.weightSum += pixelState.weightSum;
+            pixel.varianceEstimator.Merge(pixelState.varianceEstimator);
+        });
+}
+
+void RGBFilm::ClearState(const Bounds2i &bounds) {
+    for (Point2i p : Intersect(bounds, pixelBounds)) {
+        Pixel &pixel = pixels[p];
+        for (int c = 0; c < 3; ++c) {
+            pixel.rgbSum[c] = 0;
+            pixel.splatRGB[c] = 0;
+        }
+        pixel.weightSum = 0;
+        pixel.varianceEstimator = VarianceEstimator<Float>();
+    }
+}
+
 std::string RGBFilm::ToString() const {
     return StringPrintf("[ RGBFilm %s scale: %f colorSpace: %s maxComponentValue: %f "
-                        "writeFP16: %s ]",
-                        BaseToString(), scale, *colorSpace, maxComponentValue, writeFP16);
+                        "writeFP16: %s splatBuffer: %s ]",
+                        BaseToString(), scale, *colorSpace, maxComponentValue, writeFP16,
+                        splatBuffer ? splatBuffer->ToString() : std::string("(nullptr)"));
 }
 
 RGBFilm *RGBFilm::Create(const ParameterDictionary &parameters, FilterHandle filter,
@@ -273,10 +498,15 @@ RGBFilm *RGBFilm::Create(const ParameterDictionary &parameters, FilterHandle fil
     Float diagonal = parameters.GetOneFloat("diagonal", 35.);
     Float maxComponentValue = parameters.GetOneFloat("maxcomponentvalue", Infinity);
     bool writeFP16 = parameters.GetOneBool("savefp16", true);
+    bool perThreadSplats = parameters.GetOneBool("perthreadsplats", false);
+    if (perThreadSplats && Options->useGPU) {
+        Warning(loc, "\"perthreadsplats\" is not supported with the GPU renderer.");
+        perThreadSplats = false;
+    }
 
     return alloc.new_object<RGBFilm>(fullResolution, pixelBounds, filter, diagonal,
                                      filename, scale, colorSpace, maxComponentValue,
-                                     writeFP16, alloc);
+                                     writeFP16, alloc, perThreadSplats);
 }
 
 // GBufferFilm Method Definitions
@@ -364,6 +594,81 @@ void GBufferFilm::WriteImage(ImageMetadata metadata, Float splatScale) {
     image.Write(filename, metadata);
 }
 
+std::string GBufferFilm::SaveState(const Bounds2i &bounds) {
+    CHECK(Inside(bounds, pixelBounds));
+    return SavePixelStates<PixelState>(bounds, [&](Point2i p) {
+        const Pixel &pixel = pixels[p];
+        PixelState state;
+        for (int c = 0; c < 3; ++c) {
+            state.rgbSum[c] = pixel.rgbSum[c];
+            state.splatRGB[c] = pixel.splatRGB[c];
+            state.albedoSum[c] = pixel.albedoSum[c];
+        }
+        state.weightSum = pixel.weightSum;
+        state.rgbVarianceEstimator = pixel.rgbVarianceEstimator;
+        state.pSum = pixel.pSum;
+        state.dzdxSum = pixel.dzdxSum;
+        state.dzdySum = pixel.dzdySum;
+        state.nSum = pixel.nSum;
+        state.nsSum = pixel.nsSum;
+        return state;
+    });
+}
+
+bool GBufferFilm::RestoreState(const std::string &state) {
+    return ForEachPixelState<PixelState>(
+        state, pixelBounds, [&](Point2i p, const PixelState &pixelState) {
+            Pixel &pixel = pixels[p];
+            for (int c = 0; c < 3; ++c) {
+                pixel.rgbSum[c] = pixelState.rgbSum[c];
+                pixel.splatRGB[c] = pixelState.splatRGB[c];
+                pixel.albedoSum[c] = pixelState.albedoSum[c];
+            }
+            pixel.weightSum = pixelState.weightSum;
+            pixel.rgbVarianceEstimator = pixelState.rgbVarianceEstimator;
+            pixel.pSum = pixelState.pSum;
+            pixel.dzdxSum = pixelState.dzdxSum;
+            pixel.dzdySum = pixelState.dzdySum;
+            pixel.nSum = pixelState.nSum;
+            pixel.nsSum = pixelState.nsSum;
+        });
+}
+
+bool GBufferFilm::MergeState(const std::string &state) {
+    return ForEachPixelState<PixelState>(
+        state, pixelBounds, [&](Point2i p, const PixelState &pixelState) {
+            Pixel &pixel = pixels[p];
+            for (int c = 0; c < 3; ++c) {
+                pixel.rgbSum[c] += pixelState.rgbSum[c];
+                pixel.splatRGB[c].Add(pixelState.splatRGB[c]);
+                pixel.albedoSum[c] += pixelState.albedoSum[c];
+            }
+            pixel.weightSum += pixelState.weightSum;
+            pixel.rgbVarianceEstimator.Merge(pixelState.rgbVarianceEstimator);
+            pixel.pSum += pixelState.pSum;
+            pixel.dzdxSum += pixelState.dzdxSum;
+            pixel.dzdySum += pixelState.dzdySum;
+            pixel.nSum += pixelState.nSum;
+            pixel.nsSum += pixelState.nsSum;
+        });
+}
+
+void GBufferFilm::ClearState(const Bounds2i &bounds) {
+    for (Point2i p : Intersect(bounds, pixelBounds)) {
+        Pixel &pixel = pixels[p];
+        for (int c = 0; c < 3; ++c) {
+            pixel.rgbSum[c] = 0;
+            pixel.splatRGB[c] = 0;
+            pixel.albedoSum[c] = 0;
+        }
+        pixel.weightSum = 0;
+        pixel.rgbVarianceEstimator = VarianceEstimator<Float>();
+        pixel.pSum = Point3f();
+        pixel.dzdxSum = pixel.dzdySum = 0;
+        pixel.nSum = pixel.nsSum = Normal3f();
+    }
+}
+
 Image GBufferFilm::GetImage(ImageMetadata *metadata, Float splatScale) {
     // Convert image to RGB and compute final pixel values
     LOG_VERBOSE("Converting image to RGB and computing final weighted pixel values");
@@ -21,7 +21,9 @@
 #include <pbrt/util/vecmath.h>
 
 #include <atomic>
+#include <functional>
 #include <map>
+#include <memory>
 #include <string>
 #include <thread>
 #include <vector>
@@ -87,6 +89,16 @@ class FilmBase {
     Bounds2f SampleBounds() const;
 
   protected:
+    // FilmBase Protected Methods
+    PBRT_CPU_GPU
+    static Float RelativeError(const VarianceEstimator<Float> &ve) {
+        if (ve.Count() < 2)
+            return Infinity;
+        // Measure dark pixels' error relative to a floor so that they can
+        // converge, too
+        return std::sqrt(ve.Variance() / ve.Count()) / std::max<Float>(ve.Mean(), 0.01f);
+    }
+
     // FilmBase Protected Members
     Point2i fullResolution;
     Float diagonal;
@@ -95,6 +107,65 @@ class FilmBase {
     Bounds2i pixelBounds;
 };
 
+// SplatBuffer Definition
+// Accumulates splats separately for each thread, so that splatting doesn't
+// require atomics. Each thread's buffer is divided into tiles that are only
+// allocated once the thread splats into them.
+class SplatBuffer {
+  public:
+    // SplatBuffer Public Methods
+    SplatBuffer(const Bounds2i &pixelBounds, int nThreads);
+    ~SplatBuffer();
+
+    SplatBuffer(const SplatBuffer &) = delete;
+    SplatBuffer &operator=(const SplatBuffer &) = delete;
+
+    void Add(const Point2i &p, const RGB &rgb) {
+        // Find the calling thread's tile for _p_, allocating it if needed
+        DCHECK_LT(ThreadIndex, threadTiles.size());
+        DCHECK(InsideExclusive(p, pixelBounds));
+        std::vector<Tile *> &tiles = threadTiles[ThreadIndex].tiles;
+        Point2i pt(p.x - pixelBounds.pMin.x, p.y - pixelBounds.pMin.y);
+        if (tiles.empty())
+            tiles.resize(nTiles.x * nTiles.y, nullptr);
+        Tile *&tile = tiles[(pt.y >> LogTileSize) * nTiles.x + (pt.x >> LogTileSize)];
+        if (tile == nullptr)
+            tile = AllocateTile();
+
+        int offset = (pt.y & (TileSize - 1)) * TileSize + (pt.x & (TileSize - 1));
+        double *v = tile->rgb[offset];
+        for (int c = 0; c < 3; ++c)
+            v[c] += rgb[c];
+    }
+
+    // Calls _func_ with the sum of all threads' splats at each pixel that
+    // has been splatted to and then clears the buffers. Must not be called
+    // concurrently with Add().
+    void Reduce(std::function<void(Point2i, const double *)> func);
+
+    size_t BytesAllocated() const;
+    size_t TilesAllocated() const;
+
+    std::string ToString() const;
+
+  private:
+    // SplatBuffer Private Members
+    static constexpr int LogTileSize = 4, TileSize = 1 << LogTileSize;
+    struct Tile {
+        double rgb[TileSize * TileSize][3] = {};
+    };
+    struct alignas(64) ThreadTiles {
+        std::vector<Tile *> tiles;
+        size_t nAllocated = 0;
+    };
+
+    Tile *AllocateTile();
+
+    Bounds2i pixelBounds;
+    Point2i nTiles;
+    std::vector<ThreadTiles> threadTiles;
+};
+
 // RGBFilm Definition
 class RGBFilm : public FilmBase {
   public:
@@ -144,11 +215,19 @@ class RGBFilm : public FilmBase {
         return rgb;
     }
 
+    // Returns the standard error of the pixel's mean radiance relative to
+    // the mean, or infinity if there aren't enough samples to estimate it.
+    PBRT_CPU_GPU
+    Float GetPixelRelativeError(const Point2i &p) const {
+        return RelativeError(pixels[p].varianceEstimator);
+    }
+
     RGBFilm() = default;
     RGBFilm(const Point2i &resolution, const Bounds2i &pixelBounds, FilterHandle filter,
             Float diagonal, const std::string &filename, Float scale,
             const RGBColorSpace *colorSpace, Float maxComponentValue = Infinity,
-            bool writeFP16 = true, Allocator allocator = {});
+            bool writeFP16 = true, Allocator allocator = {},
+            bool perThreadSplats = false);
 
     static RGBFilm *Create(const ParameterDictionary &parameters, FilterHandle filter,
                            const RGBColorSpace *colorSpace, const FileLoc *loc,
@@ -160,12 +239,22 @@ class RGBFilm : public FilmBase {
     PBRT_CPU_GPU
     void AddSplat(const Point2f &p, SampledSpectrum v, const SampledWavelengths &lambda);
 
+    bool UsesPerThreadSplats() const { return splatBuffer != nullptr; }
+
     void WriteImage(ImageMetadata metadata, Float splatScale = 1);
     Image GetImage(ImageMetadata *metadata, Float splatScale = 1);
 
+    std::string SaveState(const Bounds2i &bounds);
+    bool RestoreState(const std::string &state);
+    bool MergeState(const std::string &state);
+    void ClearState(const Bounds2i &bounds);
+
     std::string ToString() const;
 
   private:
+    // RGBFilm Private Methods
+    void reduceSplats();
+
     // RGBFilm::Pixel Definition
     struct Pixel {
         Pixel() = default;
@@ -175,6 +264,14 @@ class RGBFilm : public FilmBase {
         VarianceEstimator<Float> varianceEstimator;
     };
 
+    // RGBFilm::PixelState Definition
+    struct PixelState {
+        double rgbSum[3];
+        double weightSum;
+        double splatRGB[3];
+        VarianceEstimator<Float> varianceEstimator;
+    };
+
     // RGBFilm Private Members
     Array2D<Pixel> pixels;
     Float scale;
@@ -182,6 +279,7 @@ class RGBFilm : public FilmBase {
     Float maxComponentValue;
     bool writeFP16;
     Float filterIntegral;
+    std::unique_ptr<SplatBuffer> splatBuffer;
 };
 
 // GBufferFilm Definition
@@ -232,9 +330,19 @@ class GBufferFilm : public FilmBase {
         return rgb;
     }
 
+    PBRT_CPU_GPU
+    Float GetPixelRelativeError(const Point2i &p) const {
+        return RelativeError(pixels[p].rgbVarianceEstimator);
+    }
+
     void WriteImage(ImageMetadata metadata, Float splatScale = 1);
     Image GetImage(ImageMetadata *metadata, Float splatScale = 1);
 
+    std::string SaveState(const Bounds2i &bounds);
+    bool RestoreState(const std::string &state);
+    bool MergeState(const std::string &state);
+    void ClearState(const Bounds2i &bounds);
+
     std::string ToString() const;
 
   private:
@@ -251,6 +359,18 @@ class GBufferFilm : public FilmBase {
         VarianceEstimator<Float> rgbVarianceEstimator;
     };
 
+    // GBufferFilm::PixelState Definition
+    struct PixelState {
+        double rgbSum[3];
+        double weightSum;
+        double splatRGB[3];
+        double albedoSum[3];
+        VarianceEstimator<Float> rgbVarianceEstimator;
+        Point3f pSum;
+        Float dzdxSum, dzdySum;
+        Normal3f nSum, nsSum;
+    };
+
     // GBufferFilm Private Members
     Array2D<Pixel> pixels;
     Float scale;
@@ -308,6 +428,12 @@ inline RGB FilmHandle::GetPixelRGB(const Point2i &p, Float splatScale) const {
     return Dispatch(get);
 }
 
+PBRT_CPU_GPU
+inline Float FilmHandle::GetPixelRelativeError(const Point2i &p) const {
+    auto error = [&](auto ptr) { return ptr->GetPixelRelativeError(p); };
+    return Dispatch(error);
+}
+
 PBRT_CPU_GPU
 inline void FilmHandle::AddSample(const Point2i &pFilm, SampledSpectrum L,
                                   const SampledWavelengths &lambda,
@@ -0,0 +1,111 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/film.h>
+#include <pbrt/filters.h>
+#include <pbrt/pbrt.h>
+#include <pbrt/util/colorspace.h>
+#include <pbrt/util/containers.h>
+#include <pbrt/util/hash.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/rng.h>
+
+#include <atomic>
+
+using namespace pbrt;
+
+TEST(SplatBuffer, MatchesSerialSum) {
+    // Use pixel bounds that don't start at the origin and don't cover a
+    // whole number of tiles
+    Bounds2i pixelBounds({3, 5}, {70, 41});
+    SplatBuffer splatBuffer(pixelBounds, MaxThreadIndex());
+    EXPECT_EQ(0, splatBuffer.TilesAllocated());
+
+    // Splat values in parallel, only touching the top half of the image
+    int nSplats = 10000;
+    auto splat = [&](int i) {
+        RNG rng(i);
+        Point2i p(pixelBounds.pMin.x + rng.Uniform<uint32_t>(67),
+                  pixelBounds.pMin.y + rng.Uniform<uint32_t>(18));
+        return std::make_pair(p, RGB(1, i % 3, 0.5f));
+    };
+    ParallelFor(0, nSplats, [&](int64_t i) {
+        std::pair<Point2i, RGB> s = splat(i);
+        splatBuffer.Add(s.first, s.second);
+    });
+    EXPECT_GT(splatBuffer.TilesAllocated(), 0);
+    EXPECT_GT(splatBuffer.BytesAllocated(), 0);
+
+    Array2D<RGB> expected(pixelBounds);
+    for (int i = 0; i < nSplats; ++i) {
+        std::pair<Point2i, RGB> s = splat(i);
+        expected[s.first] += s.second;
+    }
+
+    Array2D<RGB> reduced(pixelBounds);
+    std::atomic<int> nCalls{0};
+    splatBuffer.Reduce([&](Point2i p, const double *rgb) {
+        ++nCalls;
+        EXPECT_TRUE(InsideExclusive(p, pixelBounds));
+        EXPECT_LT(p.y, pixelBounds.pMin.y + 32);
+        reduced[p] = RGB(rgb[0], rgb[1], rgb[2]);
+    });
+    EXPECT_GT(nCalls, 0);
+    for (Point2i p : pixelBounds)
+        for (int c = 0; c < 3; ++c)
+            EXPECT_EQ(expected[p][c], reduced[p][c]) << p;
+
+    // The buffers should be empty after reduction
+    splatBuffer.Reduce([&](Point2i p, const double *rgb) {
+        for (int c = 0; c < 3; ++c)
+            EXPECT_EQ(0, rgb[c]);
+    });
+}
+
+TEST(RGBFilm, MergeState) {
+    Bounds2i pixelBounds({2, 3}, {34, 27});
+    BoxFilter filter;
+    auto makeFilm = [&]() {
+        return RGBFilm(Point2i(40, 30), pixelBounds, &filter, 0.035f, "test.pfm", 1.f,
+                       RGBColorSpace::sRGB);
+    };
+    RGBFilm reference = makeFilm(), left = makeFilm(), right = makeFilm();
+
+    // Add the same samples to _reference_ and to one of _left_ and _right_
+    Bounds2i leftBounds({2, 3}, {17, 27}), rightBounds({17, 3}, {34, 27});
+    for (Point2i p : pixelBounds)
+        for (int i = 0; i < 4; ++i) {
+            RNG rng(Hash(p, i));
+            SampledWavelengths lambda = reference.SampleWavelengths(rng.Uniform<Float>());
+            SampledSpectrum L(rng.Uniform<Float>());
+            reference.AddSample(p, L, lambda, nullptr, 1);
+            RGBFilm &film = InsideExclusive(p, leftBounds) ? left : right;
+            film.AddSample(p, L, lambda, nullptr, 1);
+        }
+
+    // Merging the two halves should exactly match the reference
+    RGBFilm merged = makeFilm();
+    EXPECT_TRUE(merged.MergeState(left.SaveState(leftBounds)));
+    EXPECT_TRUE(merged.MergeState(right.SaveState(pixelBounds)));
+    for (Point2i p : pixelBounds)
+        EXPECT_EQ(reference.GetPixelRGB(p), merged.GetPixelRGB(p)) << p;
+
+    // Cleared pixels should be black and restoring should bring them back
+    merged.ClearState(leftBounds);
+    for (Point2i p : leftBounds)
+        EXPECT_EQ(RGB(0, 0, 0), merged.GetPixelRGB(p)) << p;
+    EXPECT_TRUE(merged.RestoreState(reference.SaveState(leftBounds)));
+    for (Point2i p : pixelBounds)
+        EXPECT_EQ(reference.GetPixelRGB(p), merged.GetPixelRGB(p)) << p;
+
+    // Invalid state should be rejected
+    EXPECT_FALSE(merged.MergeState("invalid"));
+    std::string state = reference.SaveState(pixelBounds);
+    EXPECT_FALSE(merged.MergeState(state.substr(0, state.size() - 1)));
+    RGBFilm smaller(Point2i(40, 30), leftBounds, &filter, 0.035f, "test.pfm", 1.f,
+                    RGBColorSpace::sRGB);
+    EXPECT_FALSE(smaller.MergeState(state));
+}
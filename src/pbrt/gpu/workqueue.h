@@ -7,10 +7,16 @@
 
 #include <pbrt/pbrt.h>
 
-#include <pbrt/gpu/launch.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/pstd.h>
 
+#ifdef PBRT_BUILD_GPU_RENDERER
+#include <pbrt/gpu/launch.h>
+
 #include <cuda/atomic>
+#else
+#include <atomic>
+#endif
 #include <utility>
 
 namespace pbrt {
@@ -21,22 +27,48 @@ class WorkQueue : public SOA<WorkItem> {
     WorkQueue(int n, Allocator alloc) : SOA<WorkItem>(n, alloc) {}
 
     PBRT_CPU_GPU
-    int Size() const { return size.load(cuda::std::memory_order_relaxed); }
+    int Size() const {
+#ifdef PBRT_BUILD_GPU_RENDERER
+        return size.load(cuda::std::memory_order_relaxed);
+#else
+        return size.load(std::memory_order_relaxed);
+#endif
+    }
 
     PBRT_CPU_GPU
-    void Reset() { size.store(0, cuda::std::memory_order_relaxed); }
+    void Reset() {
+#ifdef PBRT_BUILD_GPU_RENDERER
+        size.store(0, cuda::std::memory_order_relaxed);
+#else
+        size.store(0, std::memory_order_relaxed);
+#endif
+    }
 
     PBRT_CPU_GPU
     int Push(WorkItem w) {
-        int index = size.fetch_add(1, cuda::std::memory_order_relaxed);
+        int index = AllocateEntry();
         (*this)[index] = w;
         return index;
     }
 
   protected:
+    PBRT_CPU_GPU
+    int AllocateEntry() {
+#ifdef PBRT_BUILD_GPU_RENDERER
+        return size.fetch_add(1, cuda::std::memory_order_relaxed);
+#else
+        return size.fetch_add(1, std::memory_order_relaxed);
+#endif
+    }
+
+#ifdef PBRT_BUILD_GPU_RENDERER
     cuda::atomic<int, cuda::thread_scope_device> size{0};
+#else
+    std::atomic<int> size{0};
+#endif
 };
 
+#ifdef PBRT_BUILD_GPU_RENDERER
 template <typename F, typename WorkItem>
 void ForAllQueued(const char *desc, WorkQueue<WorkItem> *q, int maxQueued, F func) {
     GPUParallelFor(desc, maxQueued, [=] PBRT_GPU(int index) {
@@ -45,6 +77,17 @@ void ForAllQueued(const char *desc, WorkQueue<WorkItem> *q, int maxQueued, F fun
         func((*q)[index], index);
     });
 }
+#endif  // PBRT_BUILD_GPU_RENDERER
+
+// Runs _func_ for each item in the queue on the CPU using the thread pool;
+// the queue must not be pushed to while this runs.
+template <typename F, typename WorkItem>
+void CPUForAllQueued(WorkQueue<WorkItem> *q, F func) {
+    ParallelFor(0, q->Size(), [&](int64_t start, int64_t end) {
+        for (int index = start; index < end; ++index)
+            func((*q)[index], index);
+    });
+}
 
 template <template <typename> class Work, typename... Ts>
 class MultiWorkQueueHelper;
@@ -97,7 +140,6 @@ class MultiWorkQueueHelper<WorkItem, T, Ts...>
     }
 
   private:
-    cuda::atomic<int, cuda::thread_scope_device> size{0};
     WorkQueue<WorkItem<T>> q;
 };
 
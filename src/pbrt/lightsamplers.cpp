@@ -15,6 +15,7 @@
 #include <pbrt/util/print.h>
 #include <pbrt/util/sampling.h>
 #include <pbrt/util/spectrum.h>
+#include <pbrt/util/trace.h>
 
 #include <atomic>
 #include <cstdint>
@@ -31,6 +32,7 @@ std::string SampledLight::ToString() const {
 LightSamplerHandle LightSamplerHandle::Create(const std::string &name,
                                               pstd::span<const LightHandle> lights,
                                               Allocator alloc) {
+    TRACE_SCOPE("Build light sampler");
     if (name == "uniform")
         return alloc.new_object<UniformLightSampler>(lights, alloc);
     else if (name == "power")
@@ -20,11 +20,16 @@ std::string PBRTOptions::ToString() const {
         "recordPixelStatistics: %s upgrade: %s disablePixelJitter: %s "
         "disableWavelengthJitter: %s forceDiffuse: %s useGPU: %s "
         "imageFile: %s mseReferenceImage: %s mseReferenceOutput: %s "
-        "debugStart: %s displayServer: %s cropWindow: %s pixelBounds: %s ]",
+        "debugStart: %s displayServer: %s bvhCacheDirectory: %s pinThreads: %s "
+        "numaReplicate: %s checkpointFile: %s checkpointInterval: %f resume: %s "
+        "timeBudget: %f textureCacheMB: %d traceFile: %s statsFile: %s nWorkers: %d "
+        "listenPort: %d coordinatorAddress: %s cropWindow: %s pixelBounds: %s ]",
         nThreads, seed, quickRender, quiet, recordPixelStatistics, upgrade,
         disablePixelJitter, disableWavelengthJitter, forceDiffuse, useGPU, imageFile,
-        mseReferenceImage, mseReferenceOutput, debugStart, displayServer, cropWindow,
-        pixelBounds);
+        mseReferenceImage, mseReferenceOutput, debugStart, displayServer,
+        bvhCacheDirectory, pinThreads, numaReplicate, checkpointFile, checkpointInterval,
+        resume, timeBudget, textureCacheMB, traceFile, statsFile, nWorkers, listenPort,
+        coordinatorAddress, cropWindow, pixelBounds);
 }
 
 }  // namespace pbrt
@@ -11,6 +11,7 @@
 #include <pbrt/util/vecmath.h>
 
 #include <string>
+#include <vector>
 
 namespace pbrt {
 
@@ -40,8 +41,21 @@ struct PBRTOptions : BasicOptions {
     std::string mseReferenceImage, mseReferenceOutput;
     std::string debugStart;
     std::string displayServer;
+    std::string bvhCacheDirectory;
+    bool pinThreads = false, numaReplicate = false;
+    std::string checkpointFile;
+    Float checkpointInterval = 300;
+    bool resume = false;
+    Float timeBudget = 0;
+    int textureCacheMB = 0;
+    std::string traceFile, statsFile;
+    int nWorkers = 0, listenPort = -1;
+    std::string coordinatorAddress;
     pstd::optional<Bounds2f> cropWindow;
     pstd::optional<Bounds2i> pixelBounds;
+    // Scene description files given on the command line; checkpoints store a
+    // hash of their contents
+    std::vector<std::string> sceneFilenames;
 
     std::string ToString() const;
 };
@@ -18,6 +18,7 @@
 #include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/spectrum.h>
+#include <pbrt/util/trace.h>
 #include <pbrt/util/transform.h>
 
 #include <iostream>
@@ -757,6 +758,7 @@ void ParsedScene::CreateMaterials(
     /*const*/ std::map<std::string, SpectrumTextureHandle> &spectrumTextures,
     Allocator alloc, std::map<std::string, MaterialHandle> *namedMaterialsOut,
     std::vector<MaterialHandle> *materialsOut) const {
+    TRACE_SCOPE("Create materials");
     // Named materials
     for (const auto &nm : namedMaterials) {
         const std::string &name = nm.first;
@@ -796,6 +798,7 @@ void ParsedScene::CreateTextures(
     std::map<std::string, FloatTextureHandle> *floatTextureMap,
     std::map<std::string, SpectrumTextureHandle> *spectrumTextureMap, Allocator alloc,
     bool gpu) const {
+    TRACE_SCOPE("Create textures");
     std::set<std::string> seenFloatTextureFilenames, seenSpectrumTextureFilenames;
     std::vector<size_t> parallelFloatTextures, serialFloatTextures;
     std::vector<size_t> parallelSpectrumTextures, serialSpectrumTextures;
@@ -916,6 +919,7 @@ void ParsedScene::CreateTextures(
 }
 
 std::map<std::string, MediumHandle> ParsedScene::CreateMedia(Allocator alloc) const {
+    TRACE_SCOPE("Create media");
     std::map<std::string, MediumHandle> mediaMap;
 
     for (const auto &m : media) {
@@ -12,6 +12,7 @@
 #include <pbrt/util/file.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/print.h>
+#include <pbrt/util/progressreporter.h>
 #include <pbrt/util/stats.h>
 
 #include <double-conversion/double-conversion.h>
@@ -83,6 +84,7 @@ std::string Token::ToString() const {
 }
 
 STAT_MEMORY_COUNTER("Memory/Tokenizer buffers", tokenizerMemory);
+STAT_TIMER("Time/Scene parsing", sceneParsingTime);
 
 // Tokenizer Implementation
 static char decodeEscaped(int ch, const FileLoc &loc) {
@@ -867,6 +869,7 @@ void ParseFiles(SceneRepresentation *scene, pstd::span<const std::string> filena
     };
 
     // Process scene description
+    Timer timer;
     if (filenames.empty()) {
         // Parse scene from standard input
         std::unique_ptr<Tokenizer> t = Tokenizer::CreateFromFile("-", tokError);
@@ -883,6 +886,7 @@ void ParseFiles(SceneRepresentation *scene, pstd::span<const std::string> filena
                 parse(scene, std::move(t));
         }
     }
+    sceneParsingTime += timer.ElapsedSeconds();
 }
 
 void ParseString(SceneRepresentation *scene, std::string str) {
@@ -14,13 +14,19 @@
 #include <pbrt/util/error.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/parallel.h>
+#include <pbrt/util/progressreporter.h>
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/stats.h>
+#include <pbrt/util/trace.h>
 
 namespace pbrt {
 
+// Time at which pbrt was initialized, for _SecondsSinceInit()_
+static Timer initTimer;
+
 // API Function Definitions
 void InitPBRT(const PBRTOptions &opt) {
+    initTimer = Timer();
     Options = new PBRTOptions(opt);
     // API Initialization
 
@@ -29,10 +35,16 @@ void InitPBRT(const PBRTOptions &opt) {
 
     InitLogging(opt.logConfig, Options->useGPU);
 
+    if (!Options->traceFile.empty())
+        EnableTracing();
+
     // General \pbrt Initialization
     int nThreads = Options->nThreads != 0 ? Options->nThreads : AvailableCores();
-    ParallelInit(nThreads);  // Threads must be launched before the
-                             // profiler is initialized.
+    // Threads must be launched before the profiler is initialized.
+    bool pinThreads = Options->pinThreads || Options->numaReplicate;
+    ParallelInit(nThreads, pinThreads);
+    if (pinThreads && !Options->quiet)
+        printf("%s\n", NumaTopologyString().c_str());
 
     if (Options->useGPU) {
 #ifdef PBRT_BUILD_GPU_RENDERER
@@ -71,6 +83,9 @@ void CleanupPBRT() {
     if (Options->recordPixelStatistics)
         StatsWritePixelImages();
 
+    if (!Options->statsFile.empty())
+        WriteStatsFile(Options->statsFile);
+
     if (!Options->quiet) {
         PrintStats(stdout);
         ClearStats();
@@ -81,6 +96,12 @@ void CleanupPBRT() {
     if (!Options->displayServer.empty())
         DisconnectFromDisplayServer();
 
+    if (!Options->traceFile.empty()) {
+        WriteTrace(Options->traceFile);
+        DisableTracing();
+        ClearTrace();
+    }
+
     // API Cleanup
     ParallelCleanup();
 
@@ -88,4 +109,8 @@ void CleanupPBRT() {
     Options = nullptr;
 }
 
+double SecondsSinceInit() {
+    return initTimer.ElapsedSeconds();
+}
+
 }  // namespace pbrt
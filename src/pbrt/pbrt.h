@@ -150,6 +150,8 @@ using Allocator = pstd::pmr::polymorphic_allocator<std::byte>;
 // Initialization and Cleanup Function Declarations
 void InitPBRT(const PBRTOptions &opt);
 void CleanupPBRT();
+// Returns the wall-clock time since _InitPBRT()_ was called
+double SecondsSinceInit();
 
 }  // namespace pbrt
 
@@ -25,8 +25,16 @@
 #include <cuda.h>
 #endif
 
+#include <mutex>
+#include <shared_mutex>
+
 namespace pbrt {
 
+// Guards Triangle::allMeshes and BilinearPatch::allMeshes while shapes are
+// being created, which may happen concurrently: adding a mesh may reallocate
+// the array of meshes.
+static std::shared_mutex allMeshesMutex;
+
 // Sphere Method Definitions
 Bounds3f Sphere::Bounds() const {
     return (*renderFromObject)(
@@ -154,9 +162,13 @@ STAT_MEMORY_COUNTER("Memory/Triangles", triangleBytes);
 // Triangle Method Definitions
 pstd::vector<ShapeHandle> Triangle::CreateTriangles(const TriangleMesh *mesh,
                                                     Allocator alloc) {
-    CHECK_LT(allMeshes->size(), 1 << 31);
-    int meshIndex = int(allMeshes->size());
-    allMeshes->push_back(mesh);
+    int meshIndex;
+    {
+        std::lock_guard<std::shared_mutex> lock(allMeshesMutex);
+        CHECK_LT(allMeshes->size(), 1 << 31);
+        meshIndex = int(allMeshes->size());
+        allMeshes->push_back(mesh);
+    }
 
     pstd::vector<ShapeHandle> tris(mesh->nTriangles, alloc);
     Triangle *t = alloc.allocate_object<Triangle>(mesh->nTriangles);
@@ -245,6 +257,8 @@ bool Triangle::IntersectP(const Ray &ray, Float tMax) const {
         return false;
 }
 
+// IntersectTriangleBlock() in cpu/accelerators.cpp performs the same
+// computation for several triangles at once; keep the two in sync.
 pstd::optional<TriangleIntersection> Triangle::Intersect(const Ray &ray, Float tMax,
                                                          const Point3f &p0,
                                                          const Point3f &p1,
@@ -347,6 +361,11 @@ pstd::optional<TriangleIntersection> Triangle::Intersect(const Ray &ray, Float t
     return TriangleIntersection{b0, b1, b2, t};
 }
 
+const TriangleMesh *Triangle::Mesh() const {
+    std::shared_lock<std::shared_mutex> lock(allMeshesMutex);
+    return GetMesh();
+}
+
 std::string Triangle::ToString() const {
     // Get triangle vertices in _p0_, _p1_, and _p2_
     auto mesh = GetMesh();
@@ -1013,11 +1032,16 @@ BilinearPatchMesh *BilinearPatch::CreateMesh(const Transform *renderFromObject,
 
 pstd::vector<ShapeHandle> BilinearPatch::CreatePatches(const BilinearPatchMesh *mesh,
                                                        Allocator alloc) {
-    CHECK_LT(allMeshes->size(), 1 << 31);
-    int meshIndex = int(allMeshes->size());
-
-    allMeshes->push_back(mesh);
+    int meshIndex;
+    {
+        std::lock_guard<std::shared_mutex> lock(allMeshesMutex);
+        CHECK_LT(allMeshes->size(), 1 << 31);
+        meshIndex = int(allMeshes->size());
+        allMeshes->push_back(mesh);
+    }
 
+    // The _BilinearPatch_ constructor accesses the mesh through _allMeshes_
+    std::shared_lock<std::shared_mutex> lock(allMeshesMutex);
     pstd::vector<ShapeHandle> blps(mesh->nPatches, alloc);
     BilinearPatch *patches = alloc.allocate_object<BilinearPatch>(mesh->nPatches);
     for (int i = 0; i < mesh->nPatches; ++i) {
@@ -912,6 +912,12 @@ class Triangle {
 
     std::string ToString() const;
 
+    // Returns the triangle's mesh; unlike GetMesh(), this can be called
+    // while other meshes are being created.
+    const TriangleMesh *Mesh() const;
+    int MeshIndex() const { return meshIndex; }
+    int TriangleIndex() const { return triIndex; }
+
     static TriangleMesh *CreateMesh(const Transform *renderFromObject,
                                     bool reverseOrientation,
                                     const ParameterDictionary &parameters,
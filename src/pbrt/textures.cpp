@@ -5,6 +5,7 @@
 #include <pbrt/textures.h>
 
 #include <pbrt/interaction.h>
+#include <pbrt/options.h>
 #include <pbrt/paramdict.h>
 #include <pbrt/util/color.h>
 #include <pbrt/util/colorspace.h>
@@ -525,8 +526,11 @@ MIPMap *ImageTextureBase::GetTexture(const std::string &filename,
     std::unique_lock<std::mutex> lock(textureCacheMutex);
     if (textureCache.find(texInfo) != textureCache.end())
         return textureCache[texInfo].get();
-    else
-        lock.unlock();
+    if (Options->textureCacheMB > 0 && !tileCache)
+        tileCache =
+            std::make_unique<TextureTileCache>(size_t(Options->textureCacheMB) << 20);
+    TextureTileCache *cache = tileCache.get();
+    lock.unlock();
 
     // Create _MIPMap_ for _filename_
     MIPMapFilterOptions options;
@@ -539,7 +543,7 @@ MIPMap *ImageTextureBase::GetTexture(const std::string &filename,
         Warning("%s: filter function unknown", filter);
 
     std::unique_ptr<MIPMap> mipmap =
-        MIPMap::CreateFromFile(filename, options, wrap, encoding, alloc);
+        MIPMap::CreateFromFile(filename, options, wrap, encoding, alloc, cache);
     if (mipmap) {
         lock.lock();
         // This is actually ok, but if it hits, it means we've wastefully
@@ -598,6 +602,12 @@ std::string TexInfo::ToString() const {
 
 std::mutex ImageTextureBase::textureCacheMutex;
 std::map<TexInfo, std::unique_ptr<MIPMap>> ImageTextureBase::textureCache;
+std::unique_ptr<TextureTileCache> ImageTextureBase::tileCache;
+
+void ImageTextureBase::ReportStats() {
+    if (tileCache)
+        tileCache->ReportStats();
+}
 
 FloatImageTexture *FloatImageTexture::Create(const Transform &renderFromTexture,
                                              const TextureParameterDictionary &parameters,
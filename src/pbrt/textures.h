@@ -589,7 +589,11 @@ class ImageTextureBase {
                      const std::string &filter, Float maxAniso, WrapMode wm, Float scale,
                      ColorEncodingHandle encoding, Allocator alloc);
 
-    static void ClearCache() { textureCache.clear(); }
+    static void ClearCache() {
+        textureCache.clear();
+        tileCache.reset();
+    }
+    static void ReportStats();
 
     TextureMapping2DHandle mapping;
     Float scale;
@@ -603,6 +607,8 @@ class ImageTextureBase {
     // ImageTextureBase Private Data
     static std::mutex textureCacheMutex;
     static std::map<TexInfo, std::unique_ptr<MIPMap>> textureCache;
+    // Holds the tiles of all MIP maps when --texture-cache is given
+    static std::unique_ptr<TextureTileCache> tileCache;
 };
 
 // FloatImageTexture Definition
@@ -450,6 +450,9 @@ class GammaColorEncoding {
     PBRT_CPU_GPU
     GammaColorEncoding(Float gamma);
 
+    PBRT_CPU_GPU
+    Float Gamma() const { return gamma; }
+
     PBRT_CPU_GPU
     void ToLinear(pstd::span<const uint8_t> vin, pstd::span<Float> vout) const;
     PBRT_CPU_GPU
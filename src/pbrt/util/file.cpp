@@ -10,16 +10,20 @@
 
 #include <filesystem/path.h>
 #include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <climits>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
-#ifndef PBRT_IS_WINDOWS
+#ifdef PBRT_IS_WINDOWS
+#include <process.h>
+#else
 #include <dirent.h>
 #include <sys/dir.h>
 #include <sys/types.h>
+#include <unistd.h>
 #endif
 
 namespace pbrt {
@@ -60,6 +64,13 @@ std::string RemoveExtension(const std::string &filename) {
     return f;
 }
 
+std::string TemporaryDirectory() {
+    const char *tmp = getenv("TMPDIR");
+    if (!tmp)
+        tmp = getenv("TEMP");
+    return tmp ? tmp : "/tmp";
+}
+
 std::string ResolveFilename(const std::string &filename) {
     if (searchDirectory.empty() || filename.empty())
         return filename;
@@ -172,4 +183,22 @@ bool WriteFile(const std::string &filename, const std::string &contents) {
     return true;
 }
 
+std::string UniqueTemporaryFilename(const std::string &filename) {
+    static std::atomic<int> nTemporaryFiles{0};
+#ifdef PBRT_IS_WINDOWS
+    int pid = _getpid();
+#else
+    int pid = getpid();
+#endif
+    return StringPrintf("%s.%d-%d.tmp", filename, pid, nTemporaryFiles++);
+}
+
+bool RenameFile(const std::string &from, const std::string &to) {
+#ifdef PBRT_IS_WINDOWS
+    // rename() fails on Windows if the destination exists
+    std::remove(to.c_str());
+#endif
+    return std::rename(from.c_str(), to.c_str()) == 0;
+}
+
 }  // namespace pbrt
@@ -28,6 +28,17 @@ std::string RemoveExtension(const std::string &filename);
 
 std::vector<std::string> MatchingFilenames(const std::string &base);
 
+// Returns a filename next to _filename_ that is unique to this call and
+// process, for writing a file that is then moved into place with
+// RenameFile() so that readers and concurrent writers never see it
+// partially written.
+std::string UniqueTemporaryFilename(const std::string &filename);
+// Renames _from_ to _to_, replacing _to_ if it exists.
+bool RenameFile(const std::string &from, const std::string &to);
+
+// Returns the directory for temporary files: $TMPDIR, $TEMP, or /tmp.
+std::string TemporaryDirectory();
+
 }  // namespace pbrt
 
 #endif  // PBRT_UTIL_FILE_H
@@ -0,0 +1,196 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#ifndef PBRT_UTIL_HASHGRID_H
+#define PBRT_UTIL_HASHGRID_H
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/util/check.h>
+#include <pbrt/util/containers.h>
+#include <pbrt/util/hash.h>
+#include <pbrt/util/math.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/vecmath.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace pbrt {
+
+// HashGrid Definition
+// Stores spheres in the cells of a uniform grid that are hashed into a table
+// with a fixed number of entries. Each table entry's spheres are stored
+// contiguously: the grid is built with a counting sort, so lookups walk a
+// single array rather than chasing pointers. The grid's memory is reused
+// when it is rebuilt.
+class HashGrid {
+  public:
+    // HashGrid Public Methods
+    // Builds the grid for _nItems_ spheres. _getSphere(i, &p, &radius)_ returns
+    // the i-th sphere; items for which it returns false are not stored.
+    template <typename F>
+    void Build(int nItems, F getSphere, int hashSize);
+
+    // Calls _func(i)_ for each stored item whose sphere contains _p_ and
+    // returns the number of items checked.
+    template <typename F>
+    int ForEachOverlapping(Point3f p, F func) const;
+
+    int CellsOverlapped(int item) const { return spheres[item].nCells; }
+
+    size_t BytesAllocated() const {
+        return cellCounts.capacity() * sizeof(std::atomic<int>) +
+               cellOffsets.capacity() * sizeof(int) +
+               cellItems.capacity() * sizeof(int) + spheres.capacity() * sizeof(Sphere);
+    }
+
+  private:
+    // HashGrid::Sphere Definition
+    struct Sphere {
+        Point3f p;
+        Float radius;
+        // Number of grid cells overlapped, or zero if the item wasn't stored
+        int nCells;
+    };
+
+    // HashGrid Private Methods
+    bool ToGrid(Point3f p, Point3i *pi) const {
+        bool inBounds = true;
+        Vector3f pg = bounds.Offset(p);
+        for (int i = 0; i < 3; ++i) {
+            (*pi)[i] = (int)(gridRes[i] * pg[i]);
+            inBounds &= ((*pi)[i] >= 0 && (*pi)[i] < gridRes[i]);
+            (*pi)[i] = Clamp((*pi)[i], 0, gridRes[i] - 1);
+        }
+        return inBounds;
+    }
+
+    // Cells that are adjacent in $x$ map to adjacent hash table entries so that
+    // building the grid and looking up nearby points access nearby memory.
+    int HashCell(int x, int y, int z) const { return (Hash(y, z) + x) % hashSize; }
+
+    // Calls _func(h)_ once for each hashed cell that the grid cells overlapped
+    // by the sphere map to and returns the number of grid cells. Grid cells
+    // that hash to the same entry must not store the sphere twice, since a
+    // point in either would then find it twice.
+    template <typename F>
+    int ForEachCell(Point3f p, Float radius, F func) const {
+        Point3i pMin, pMax;
+        ToGrid(p - Vector3f(radius, radius, radius), &pMin);
+        ToGrid(p + Vector3f(radius, radius, radius), &pMax);
+        InlinedVector<int, 32> hashes;
+        for (int z = pMin.z; z <= pMax.z; ++z)
+            for (int y = pMin.y; y <= pMax.y; ++y)
+                for (int x = pMin.x; x <= pMax.x; ++x) {
+                    int h = HashCell(x, y, z);
+                    if (std::find(hashes.begin(), hashes.end(), h) != hashes.end())
+                        continue;
+                    hashes.push_back(h);
+                    func(h);
+                }
+        return (1 + pMax.x - pMin.x) * (1 + pMax.y - pMin.y) * (1 + pMax.z - pMin.z);
+    }
+
+    // HashGrid Private Members
+    Bounds3f bounds;
+    int gridRes[3] = {1, 1, 1};
+    int hashSize = 0;
+    // Per-cell counts while building, then the insertion cursor for each cell
+    std::vector<std::atomic<int>> cellCounts;
+    // The items in hashed cell _h_ are _cellItems[cellOffsets[h]]_ up to
+    // _cellItems[cellOffsets[h + 1]]_
+    std::vector<int> cellOffsets;
+    std::vector<int> cellItems;
+    std::vector<Sphere> spheres;
+};
+
+// HashGrid Inline Methods
+template <typename F>
+inline void HashGrid::Build(int nItems, F getSphere, int hashSize) {
+    CHECK_GT(hashSize, 0);
+    this->hashSize = hashSize;
+    if (cellCounts.size() != size_t(hashSize))
+        cellCounts = std::vector<std::atomic<int>>(hashSize);
+    for (std::atomic<int> &count : cellCounts)
+        count.store(0, std::memory_order_relaxed);
+    cellOffsets.resize(hashSize + 1);
+    spheres.resize(nItems);
+
+    // Compute grid bounds and maximum radius of the items' spheres
+    bounds = Bounds3f();
+    Float maxRadius = 0;
+    for (int i = 0; i < nItems; ++i) {
+        Point3f p;
+        Float radius;
+        if (!getSphere(i, &p, &radius))
+            continue;
+        bounds = Union(bounds, Expand(Bounds3f(p), radius));
+        maxRadius = std::max(maxRadius, radius);
+    }
+
+    // Compute resolution of grid in each dimension
+    Vector3f diag = bounds.Diagonal();
+    Float maxDiag = MaxComponentValue(diag);
+    int baseGridRes = maxRadius > 0 ? (int)(maxDiag / maxRadius) : 1;
+    for (int i = 0; i < 3; ++i)
+        gridRes[i] = maxDiag > 0 ? std::max<int>(baseGridRes * diag[i] / maxDiag, 1) : 1;
+
+    // Count the items in each hashed cell
+    ParallelFor(0, nItems, [&](int64_t start, int64_t end) {
+        for (int64_t i = start; i < end; ++i) {
+            Point3f p;
+            Float radius;
+            if (!getSphere(i, &p, &radius)) {
+                spheres[i] = Sphere{};
+                continue;
+            }
+            int nCells = ForEachCell(p, radius, [&](int h) {
+                cellCounts[h].fetch_add(1, std::memory_order_relaxed);
+            });
+            spheres[i] = Sphere{p, radius, nCells};
+        }
+    });
+
+    // Compute cell offsets and reset _cellCounts_ to the start of each cell
+    int offset = 0;
+    for (int h = 0; h < hashSize; ++h) {
+        cellOffsets[h] = offset;
+        offset += cellCounts[h].load(std::memory_order_relaxed);
+        cellCounts[h].store(cellOffsets[h], std::memory_order_relaxed);
+    }
+    cellOffsets[hashSize] = offset;
+
+    // Store each item in the cells that it overlaps
+    cellItems.resize(offset);
+    ParallelFor(0, nItems, [&](int64_t start, int64_t end) {
+        for (int64_t i = start; i < end; ++i) {
+            if (spheres[i].nCells == 0)
+                continue;
+            ForEachCell(spheres[i].p, spheres[i].radius, [&](int h) {
+                cellItems[cellCounts[h].fetch_add(1, std::memory_order_relaxed)] = i;
+            });
+        }
+    });
+}
+
+template <typename F>
+inline int HashGrid::ForEachOverlapping(Point3f p, F func) const {
+    Point3i pi;
+    if (cellItems.empty() || !ToGrid(p, &pi))
+        return 0;
+    int h = HashCell(pi.x, pi.y, pi.z);
+    for (int i = cellOffsets[h]; i < cellOffsets[h + 1]; ++i) {
+        const Sphere &sphere = spheres[cellItems[i]];
+        if (DistanceSquared(sphere.p, p) <= Sqr(sphere.radius))
+            func(cellItems[i]);
+    }
+    return cellOffsets[h + 1] - cellOffsets[h];
+}
+
+}  // namespace pbrt
+
+#endif  // PBRT_UTIL_HASHGRID_H
@@ -0,0 +1,68 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/pbrt.h>
+#include <pbrt/util/hashgrid.h>
+#include <pbrt/util/rng.h>
+
+#include <algorithm>
+#include <vector>
+
+using namespace pbrt;
+
+TEST(HashGrid, MatchesBruteForce) {
+    RNG rng;
+    std::vector<Point3f> p;
+    std::vector<Float> radius;
+    HashGrid grid;
+    // Build the grid twice with different sets of spheres to exercise reuse
+    for (int pass = 0; pass < 2; ++pass) {
+        int n = pass == 0 ? 1000 : 3000;
+        p.resize(n);
+        radius.resize(n);
+        for (int i = 0; i < n; ++i) {
+            p[i] = Point3f(rng.Uniform<Float>(), rng.Uniform<Float>(),
+                           0.1f * rng.Uniform<Float>());
+            radius[i] = 0.01f + 0.05f * rng.Uniform<Float>();
+        }
+        // Odd-numbered items aren't stored
+        grid.Build(
+            n,
+            [&](int i, Point3f *pi, Float *ri) {
+                *pi = p[i];
+                *ri = radius[i];
+                return (i & 1) == 0;
+            },
+            NextPrime(n));
+
+        for (int i = 0; i < n; ++i)
+            EXPECT_EQ((i & 1) == 0, grid.CellsOverlapped(i) > 0);
+
+        for (int j = 0; j < 1000; ++j) {
+            Point3f pt(rng.Uniform<Float>(), rng.Uniform<Float>(),
+                       0.1f * rng.Uniform<Float>());
+            std::vector<int> found, expected;
+            grid.ForEachOverlapping(pt, [&](int i) { found.push_back(i); });
+            for (int i = 0; i < n; i += 2)
+                if (DistanceSquared(p[i], pt) <= Sqr(radius[i]))
+                    expected.push_back(i);
+
+            std::sort(found.begin(), found.end());
+            EXPECT_EQ(expected, found);
+        }
+    }
+}
+
+TEST(HashGrid, Empty) {
+    HashGrid grid;
+    int nCalls = 0;
+    EXPECT_EQ(0, grid.ForEachOverlapping(Point3f(0, 0, 0), [&](int) { ++nCalls; }));
+
+    grid.Build(
+        16, [](int, Point3f *, Float *) { return false; }, 17);
+    EXPECT_EQ(0, grid.ForEachOverlapping(Point3f(0, 0, 0), [&](int) { ++nCalls; }));
+    EXPECT_EQ(0, nCalls);
+}
@@ -25,6 +25,9 @@
 #ifdef PBRT_IS_OSX
 #include <mach/mach.h>
 #endif  // PBRT_IS_OSX
+#if defined(PBRT_IS_LINUX) || defined(PBRT_IS_OSX)
+#include <sys/resource.h>
+#endif
 
 #if defined(PBRT_BUILD_GPU_RENDERER)
 #include <cuda_runtime.h>
@@ -168,4 +171,26 @@ size_t GetCurrentRSS() {
 #endif
 }
 
+size_t GetPeakRSS() {
+#ifdef PBRT_IS_WINDOWS
+    PROCESS_MEMORY_COUNTERS info;
+    GetProcessMemoryInfo(GetCurrentProcess(), &info, sizeof(info));
+    return (size_t)info.PeakWorkingSetSize;
+#elif defined(PBRT_IS_LINUX) || defined(PBRT_IS_OSX)
+    struct rusage rusage;
+    if (getrusage(RUSAGE_SELF, &rusage) != 0) {
+        LOG_ERROR("getrusage() failed");
+        return 0;
+    }
+#ifdef PBRT_IS_OSX
+    // macOS reports bytes, while Linux reports kilobytes
+    return (size_t)rusage.ru_maxrss;
+#else
+    return (size_t)rusage.ru_maxrss * 1024;
+#endif
+#else
+    return 0;
+#endif
+}
+
 }  // namespace pbrt
@@ -23,6 +23,9 @@
 namespace pbrt {
 
 size_t GetCurrentRSS();
+// Returns the largest resident set size the process has had so far, in bytes,
+// or zero if it cannot be determined.
+size_t GetPeakRSS();
 
 #ifdef PBRT_BUILD_GPU_RENDERER
 
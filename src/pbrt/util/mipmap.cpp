@@ -13,6 +13,7 @@
 #include <pbrt/util/math.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/stats.h>
+#include <pbrt/util/trace.h>
 
 #include <algorithm>
 #include <cmath>
@@ -201,15 +202,75 @@ MIPMap::MIPMap(Image image, const RGBColorSpace *colorSpace, WrapMode wrapMode,
                   [](const Image &im) { imageMapBytes += im.BytesUsed(); });
 }
 
+MIPMap::MIPMap(const TiledTextureFile *file, TextureTileCache *tileCache,
+               WrapMode wrapMode, const MIPMapFilterOptions &options)
+    : tileFile(file),
+      tileCache(tileCache),
+      colorSpace(file->ColorSpace()),
+      wrapMode(wrapMode),
+      options(options) {
+    CHECK(tileCache != nullptr);
+}
+
+MIPMap::MIPMap(std::unique_ptr<TiledTextureFile> file, WrapMode wrapMode,
+               const MIPMapFilterOptions &options)
+    : tileFile(file.get()),
+      mappedFile(std::move(file)),
+      colorSpace(tileFile->ColorSpace()),
+      wrapMode(wrapMode),
+      options(options) {
+    CHECK(tileFile->IsMapped());
+}
+
+void MIPMap::TiledTexel(int level, Point2i st, Float rgb[3]) const {
+    if (!RemapPixelCoords(&st, tileFile->LevelResolution(level), wrapMode)) {
+        rgb[0] = rgb[1] = rgb[2] = 0;
+        return;
+    }
+    if (tileCache)
+        tileCache->GetTexel(tileFile, level, st, rgb);
+    else
+        tileFile->GetMappedTexel(level, st, rgb);
+    if (tileFile->NChannels() == 1)
+        rgb[1] = rgb[2] = rgb[0];
+}
+
+void MIPMap::TiledBilerp(int level, Point2f st, Float rgb[3]) const {
+    // Compute bilinear weights as Image::BilerpChannel() does
+    Point2i resolution = tileFile->LevelResolution(level);
+    Float x = st[0] * resolution.x - 0.5f, y = st[1] * resolution.y - 0.5f;
+    int xi = std::floor(x), yi = std::floor(y);
+    Float dx = x - xi, dy = y - yi;
+    Float v[4][3];
+    TiledTexel(level, {xi, yi}, v[0]);
+    TiledTexel(level, {xi + 1, yi}, v[1]);
+    TiledTexel(level, {xi, yi + 1}, v[2]);
+    TiledTexel(level, {xi + 1, yi + 1}, v[3]);
+    for (int c = 0; c < 3; ++c) {
+        pstd::array<Float, 4> vc = {v[0][c], v[1][c], v[2][c], v[3][c]};
+        rgb[c] = pbrt::Bilerp({dx, dy}, vc);
+    }
+}
+
 template <>
 Float MIPMap::Texel(int level, Point2i st) const {
-    CHECK(level >= 0 && level < pyramid.size());
+    CHECK(level >= 0 && level < Levels());
+    if (tileFile) {
+        Float rgb[3];
+        TiledTexel(level, st, rgb);
+        return rgb[0];
+    }
     return pyramid[level].GetChannel(st, 0, wrapMode);
 }
 
 template <>
 RGB MIPMap::Texel(int level, Point2i st) const {
-    CHECK(level >= 0 && level < pyramid.size());
+    CHECK(level >= 0 && level < Levels());
+    if (tileFile) {
+        Float rgb[3];
+        TiledTexel(level, st, rgb);
+        return RGB(rgb[0], rgb[1], rgb[2]);
+    }
     if (pyramid[level].NChannels() == 3) {
         RGB rgb;
         for (int c = 0; c < 3; ++c)
@@ -340,7 +401,27 @@ std::unique_ptr<MIPMap> MIPMap::CreateFromFile(const std::string &filename,
                                                const MIPMapFilterOptions &options,
                                                WrapMode wrapMode,
                                                ColorEncodingHandle encoding,
-                                               Allocator alloc) {
+                                               Allocator alloc,
+                                               TextureTileCache *tileCache) {
+    TRACE_SCOPE("Load texture");
+    if (HasExtension(filename, "tex")) {
+        // Use the MIP map stored in the tiled texture file
+        std::unique_ptr<TiledTextureFile> file = TiledTextureFile::Open(filename);
+        if (!file)
+            ErrorExit("%s: unable to read tiled texture file", filename);
+        if (file->GetWrapMode() != wrapMode)
+            Warning("%s: texture's wrap mode \"%s\" differs from the \"%s\" wrap mode "
+                    "that was used to generate the tiled texture file",
+                    filename, wrapMode, file->GetWrapMode());
+        if (tileCache)
+            return std::make_unique<MIPMap>(tileCache->AddFile(std::move(file)),
+                                            tileCache, wrapMode, options);
+        if (!file->Map())
+            ErrorExit("%s: unable to map tiled texture file: %s", filename,
+                      ErrorString());
+        return std::make_unique<MIPMap>(std::move(file), wrapMode, options);
+    }
+
     ImageAndMetadata imageAndMetadata = Image::Read(filename, alloc, encoding);
 
     Image &image = imageAndMetadata.image;
@@ -353,6 +434,18 @@ std::unique_ptr<MIPMap> MIPMap::CreateFromFile(const std::string &filename,
     }
 
     const RGBColorSpace *colorSpace = imageAndMetadata.metadata.GetColorSpace();
+    if (tileCache) {
+        // Store the MIP map in a tiled file and read its texels on demand
+        pstd::vector<Image> pyramid =
+            Image::GenerateMIPMap(std::move(image), wrapMode, alloc);
+        const TiledTextureFile *file =
+            tileCache->AddPyramid(pyramid, colorSpace, wrapMode);
+        if (file)
+            return std::make_unique<MIPMap>(file, tileCache, wrapMode, options);
+        Warning("%s: unable to store texture in tile cache; keeping it in memory",
+                filename);
+        image = std::move(pyramid[0]);
+    }
     return std::make_unique<MIPMap>(std::move(image), colorSpace, wrapMode, alloc,
                                     options);
 }
@@ -369,13 +462,23 @@ T MIPMap::Bilerp(int level, Point2f st) const {
 
 template <>
 Float MIPMap::Bilerp(int level, Point2f st) const {
-    CHECK(level >= 0 && level < pyramid.size());
+    CHECK(level >= 0 && level < Levels());
+    if (tileFile) {
+        Float rgb[3];
+        TiledBilerp(level, st, rgb);
+        return rgb[0];
+    }
     return pyramid[level].BilerpChannel(st, 0, wrapMode);
 }
 
 template <>
 RGB MIPMap::Bilerp(int level, Point2f st) const {
-    CHECK(level >= 0 && level < pyramid.size());
+    CHECK(level >= 0 && level < Levels());
+    if (tileFile) {
+        Float rgb[3];
+        TiledBilerp(level, st, rgb);
+        return RGB(rgb[0], rgb[1], rgb[2]);
+    }
     if (pyramid[level].NChannels() == 3) {
         RGB rgb;
         for (int c = 0; c < 3; ++c)
@@ -389,9 +492,11 @@ RGB MIPMap::Bilerp(int level, Point2f st) const {
 }
 
 std::string MIPMap::ToString() const {
-    return StringPrintf("[ MIPMap pyramid: %s colorSpace: %s wrapMode: %s "
-                        "options: %s ]",
-                        pyramid, colorSpace->ToString(), wrapMode, options);
+    return StringPrintf("[ MIPMap pyramid: %s tileFile: %s colorSpace: %s "
+                        "wrapMode: %s options: %s ]",
+                        pyramid,
+                        tileFile ? tileFile->ToString() : std::string("(nullptr)"),
+                        colorSpace->ToString(), wrapMode, options);
 }
 
 // Explicit template instantiation..
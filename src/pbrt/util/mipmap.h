@@ -9,6 +9,7 @@
 
 #include <pbrt/util/image.h>
 #include <pbrt/util/pstd.h>
+#include <pbrt/util/texturecache.h>
 #include <pbrt/util/vecmath.h>
 
 #include <memory>
@@ -46,11 +47,24 @@ class MIPMap {
   public:
     MIPMap(Image image, const RGBColorSpace *colorSpace, WrapMode wrapMode,
            Allocator alloc, const MIPMapFilterOptions &options);
+    // Creates a MIPMap whose texels are read on demand from _file_'s tiles
+    // through _tileCache_, which must already own _file_.
+    MIPMap(const TiledTextureFile *file, TextureTileCache *tileCache, WrapMode wrapMode,
+           const MIPMapFilterOptions &options);
+    // Creates a MIPMap that accesses the texels of _file_, which must have
+    // been mapped with TiledTextureFile::Map(), directly.
+    MIPMap(std::unique_ptr<TiledTextureFile> file, WrapMode wrapMode,
+           const MIPMapFilterOptions &options);
+    // Tiled texture files (".tex", as written by "imgtool maketx") are used
+    // as is; their levels aren't regenerated. If _tileCache_ is non-null,
+    // the image's MIP map is stored on disk and accessed through the cache
+    // rather than being kept in memory.
     static std::unique_ptr<MIPMap> CreateFromFile(const std::string &filename,
                                                   const MIPMapFilterOptions &options,
                                                   WrapMode wrapMode,
                                                   ColorEncodingHandle encoding,
-                                                  Allocator alloc);
+                                                  Allocator alloc,
+                                                  TextureTileCache *tileCache = nullptr);
 
     template <typename T>
     T Lookup(const Point2f &st, Float width = 0.f) const;
@@ -58,10 +72,10 @@ class MIPMap {
     T Lookup(const Point2f &st, Vector2f dstdx, Vector2f dstdy) const;
 
     Point2i LevelResolution(int level) const {
-        CHECK(level >= 0 && level < pyramid.size());
-        return pyramid[level].Resolution();
+        CHECK(level >= 0 && level < Levels());
+        return tileFile ? tileFile->LevelResolution(level) : pyramid[level].Resolution();
     }
-    int Levels() const { return int(pyramid.size()); }
+    int Levels() const { return tileFile ? tileFile->Levels() : int(pyramid.size()); }
 
     const RGBColorSpace *GetRGBColorSpace() const { return colorSpace; }
 
@@ -74,8 +88,18 @@ class MIPMap {
     T Bilerp(int level, Point2f st) const;
     template <typename T>
     T EWA(int level, Point2f st, Vector2f dst0, Vector2f dst1) const;
+    // Returns the channels of a texel of the tiled texture in _rgb_; a
+    // single channel is replicated to all three.
+    void TiledTexel(int level, Point2i st, Float rgb[3]) const;
+    void TiledBilerp(int level, Point2f st, Float rgb[3]) const;
 
     pstd::vector<Image> pyramid;
+    // Set instead of _pyramid_ for MIP maps that are stored in tiled files
+    const TiledTextureFile *tileFile = nullptr;
+    // Texels are read through _tileCache_ if it's non-null and directly from
+    // the mapped _tileFile_ otherwise, in which case the MIPMap owns it
+    TextureTileCache *tileCache = nullptr;
+    std::unique_ptr<TiledTextureFile> mappedFile;
     const RGBColorSpace *colorSpace;
     WrapMode wrapMode;
     MIPMapFilterOptions options;
@@ -5,13 +5,23 @@
 #include <pbrt/util/parallel.h>
 
 #include <pbrt/util/check.h>
+#include <pbrt/util/error.h>
 #include <pbrt/util/print.h>
+#include <pbrt/util/stats.h>
+#include <pbrt/util/trace.h>
 
-#include <iterator>
-#include <list>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
 #include <thread>
 #include <vector>
 
+#ifdef PBRT_IS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 namespace pbrt {
 
 std::string AtomicFloat::ToString() const {
@@ -37,30 +47,127 @@ bool Barrier::Block() {
     return --numToExit == 0;
 }
 
+// NUMA Topology Definitions
+// Available cores, grouped by NUMA node
+static std::vector<std::vector<int>> numaNodeCores;
+// For each thread, the core it is pinned to and that core's NUMA node
+static std::vector<std::pair<int, int>> threadCores;
+
+thread_local int ThreadNumaNode;
+
+// Parses Linux cpu list strings like "0-3,8,10-11".
+static std::vector<int> ParseCPUList(const std::string &str) {
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < str.size()) {
+        size_t comma = str.find(',', pos);
+        std::string range = str.substr(pos, comma == std::string::npos ? std::string::npos
+                                                                        : comma - pos);
+        int first, last;
+        if (sscanf(range.c_str(), "%d-%d", &first, &last) == 2) {
+            for (int cpu = first; cpu <= last; ++cpu)
+                cpus.push_back(cpu);
+        } else if (sscanf(range.c_str(), "%d", &first) == 1)
+            cpus.push_back(first);
+        if (comma == std::string::npos)
+            break;
+        pos = comma + 1;
+    }
+    return cpus;
+}
+
+static std::vector<std::vector<int>> DetectNumaTopology() {
+    std::vector<std::vector<int>> nodes;
+#ifdef PBRT_IS_LINUX
+    // Only consider the cores that this process is allowed to run on
+    cpu_set_t available;
+    CPU_ZERO(&available);
+    if (sched_getaffinity(0, sizeof(available), &available) == 0) {
+        // Node numbers may be sparse, so check all of the possible ones
+        for (int node = 0; node < 1024; ++node) {
+            std::ifstream in(StringPrintf("/sys/devices/system/node/node%d/cpulist",
+                                          node));
+            std::string cpuList;
+            if (!in || !std::getline(in, cpuList))
+                continue;
+            std::vector<int> cores;
+            for (int cpu : ParseCPUList(cpuList))
+                if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &available))
+                    cores.push_back(cpu);
+            if (!cores.empty())
+                nodes.push_back(cores);
+        }
+    }
+#endif
+    if (nodes.empty()) {
+        // Treat all cores as a single node if the topology is unavailable
+        nodes.resize(1);
+        for (int i = 0; i < AvailableCores(); ++i)
+            nodes[0].push_back(i);
+    }
+    return nodes;
+}
+
+// Pins the calling thread to the core assigned to thread _tIndex_.
+static void PinCurrentThread(int tIndex) {
+    if (threadCores.empty())
+        return;
+    std::pair<int, int> core = threadCores[tIndex % threadCores.size()];
+#ifdef PBRT_IS_LINUX
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core.first, &cpus);
+    if (int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus); err != 0) {
+        Warning("Unable to pin thread %d to core %d: %s", tIndex, core.first,
+                strerror(err));
+        return;
+    }
+#endif
+    ThreadNumaNode = core.second;
+}
+
 // ParallelJob Definition
+// A parallel loop, split into _nChunks_ independently-runnable chunks.
 class ParallelJob {
   public:
-    virtual ~ParallelJob() { DCHECK(removed); }
+    explicit ParallelJob(int64_t nChunks) : nChunks(nChunks), chunksRemaining(nChunks) {}
+    virtual ~ParallelJob() { DCHECK_EQ(chunksRemaining.load(), 0); }
 
-    // *lock should be locked going in and and unlocked coming out.
-    virtual void RunStep(std::unique_lock<std::mutex> *lock) = 0;
-    virtual bool HaveWork() const = 0;
+    virtual void RunChunk(int64_t chunk) = 0;
 
-    bool Finished() const { return !HaveWork() && activeWorkers == 0; }
+    bool Finished() const { return chunksRemaining.load() == 0; }
 
     virtual std::string ToString() const = 0;
 
+    const int64_t nChunks;
+
   protected:
     std::string BaseToString() const {
-        return StringPrintf("activeWorkers: %d removed: %s", activeWorkers, removed);
+        return StringPrintf("nChunks: %d chunksRemaining: %d", nChunks,
+                            chunksRemaining.load());
     }
 
   private:
     friend class ThreadPool;
 
-    ParallelJob *prev = nullptr, *next = nullptr;
-    int activeWorkers = 0;
-    bool removed = false;
+    std::atomic<int64_t> chunksRemaining;
+};
+
+// ParallelTask Definition
+// A contiguous range of chunks of a _ParallelJob_. Tasks are split lazily:
+// the thread that runs a task first pushes the upper half of it back to its
+// own deque, where it may be stolen by another thread.
+struct ParallelTask {
+    ParallelJob *job;
+    int64_t chunkStart, chunkEnd;
+};
+
+// WorkDeque Definition
+// Each thread pushes and pops tasks at the back of its own deque; idle
+// threads steal from the front, where the largest tasks are.
+struct alignas(64) WorkDeque {
+    std::mutex mutex;
+    std::deque<ParallelTask> tasks;
 };
 
 // ThreadPool Definition
@@ -71,10 +178,7 @@ class ThreadPool {
 
     size_t size() const { return threads.size(); }
 
-    std::unique_lock<std::mutex> AddToJobList(ParallelJob *job);
-    void RemoveFromJobList(ParallelJob *job);
-
-    void WorkOrWait(std::unique_lock<std::mutex> *lock);
+    void Run(ParallelJob *job);
 
     void ForEachThread(std::function<void(void)> func);
 
@@ -83,15 +187,24 @@ class ThreadPool {
   private:
     void workerFunc(int tIndex);
 
-    ParallelJob *jobList = nullptr;
-    // Protects jobList
-    mutable std::mutex jobListMutex;
-    // Signaled both when a new job is added to the list and when a job has
-    // finished.
-    std::condition_variable jobListCondition;
+    void Push(const ParallelTask &task);
+    bool Pop(ParallelTask *task);
+    bool Steal(ParallelTask *task);
+    bool RunOneTask();
+    void Wait(const std::function<bool(void)> &done);
+
+    std::vector<WorkDeque> deques;
+    // Total number of tasks in all of the deques
+    std::atomic<int64_t> queuedTasks{0};
+
+    // Threads that find no work sleep on _sleepCondition_; it is signaled
+    // when a task is pushed, when a job finishes, and at shutdown.
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+    std::atomic<int> sleepingThreads{0};
 
     std::vector<std::thread> threads;
-    bool shutdownThreads = false;
+    std::atomic<bool> shutdownThreads{false};
 };
 
 thread_local int ThreadIndex;
@@ -99,8 +212,11 @@ thread_local int ThreadIndex;
 static std::unique_ptr<ThreadPool> threadPool;
 static bool maxThreadIndexCalled = false;
 
+STAT_COUNTER("Parallel/Tasks run", nTasksRun);
+STAT_COUNTER("Parallel/Tasks stolen", nTasksStolen);
+
 // ThreadPool Method Definitions
-ThreadPool::ThreadPool(int nThreads) {
+ThreadPool::ThreadPool(int nThreads) : deques(nThreads) {
     ThreadIndex = 0;
 
     // Launch one fewer worker thread than the total number we want doing
@@ -109,66 +225,120 @@ ThreadPool::ThreadPool(int nThreads) {
         threads.push_back(std::thread(&ThreadPool::workerFunc, this, i + 1));
 }
 
-std::unique_lock<std::mutex> ThreadPool::AddToJobList(ParallelJob *job) {
-    std::unique_lock<std::mutex> lock(jobListMutex);
-    if (jobList != nullptr)
-        jobList->prev = job;
-    job->next = jobList;
-    jobList = job;
-    jobListCondition.notify_all();
-    return lock;
+void ThreadPool::Push(const ParallelTask &task) {
+    WorkDeque &deque = deques[ThreadIndex];
+    {
+        std::lock_guard<std::mutex> lock(deque.mutex);
+        deque.tasks.push_back(task);
+        queuedTasks.fetch_add(1);
+    }
+    // The update of _queuedTasks_ and the check of _sleepingThreads_ are
+    // sequentially consistent, as are the corresponding operations in
+    // Wait(), so either the sleeping thread sees the new task or we see it.
+    if (sleepingThreads.load() > 0) {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        sleepCondition.notify_one();
+    }
 }
 
-void ThreadPool::RemoveFromJobList(ParallelJob *job) {
-    DCHECK(!job->removed);
+bool ThreadPool::Pop(ParallelTask *task) {
+    WorkDeque &deque = deques[ThreadIndex];
+    std::lock_guard<std::mutex> lock(deque.mutex);
+    if (deque.tasks.empty())
+        return false;
+    *task = deque.tasks.back();
+    deque.tasks.pop_back();
+    queuedTasks.fetch_sub(1);
+    return true;
+}
 
-    if (job->prev != nullptr) {
-        job->prev->next = job->next;
-    } else {
-        DCHECK(jobList == job);
-        jobList = job->next;
+bool ThreadPool::Steal(ParallelTask *task) {
+    // Visit the other threads' deques in a per-thread pseudo-random order
+    static thread_local uint32_t state = 0x9e3779b9u * (ThreadIndex + 1);
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    int n = deques.size();
+    for (int i = 0, start = state % n; i < n; ++i) {
+        WorkDeque &victim = deques[(start + i) % n];
+        if (&victim == &deques[ThreadIndex])
+            continue;
+        std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+        if (!lock.owns_lock() || victim.tasks.empty())
+            continue;
+        *task = victim.tasks.front();
+        victim.tasks.pop_front();
+        queuedTasks.fetch_sub(1);
+        ++nTasksStolen;
+        return true;
     }
-    if (job->next != nullptr)
-        job->next->prev = job->prev;
-
-    job->removed = true;
+    return false;
 }
 
-void ThreadPool::workerFunc(int tIndex) {
-    LOG_VERBOSE("Started execution in worker thread %d", tIndex);
-    ThreadIndex = tIndex;
-
-    std::unique_lock<std::mutex> lock(jobListMutex);
-    while (!shutdownThreads)
-        WorkOrWait(&lock);
+bool ThreadPool::RunOneTask() {
+    ParallelTask task;
+    if (!Pop(&task) && !Steal(&task))
+        return false;
+    ++nTasksRun;
+
+    // Split off the upper half of _task_ until a single chunk remains
+    while (task.chunkEnd - task.chunkStart > 1) {
+        int64_t mid = (task.chunkStart + task.chunkEnd) / 2;
+        Push(ParallelTask{task.job, mid, task.chunkEnd});
+        task.chunkEnd = mid;
+    }
 
-    LOG_VERBOSE("Exiting worker thread %d", tIndex);
+    ParallelJob *job = task.job;
+    {
+        TRACE_SCOPE("ParallelFor chunk", "chunk", task.chunkStart);
+        job->RunChunk(task.chunkStart);
+    }
+    if (job->chunksRemaining.fetch_sub(1) == 1 &&
+        sleepingThreads.load() > 0) {
+        // Wake up the thread waiting for _job_ to finish
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        sleepCondition.notify_all();
+    }
+    return true;
 }
 
-void ThreadPool::WorkOrWait(std::unique_lock<std::mutex> *lock) {
-    DCHECK(lock->owns_lock());
+void ThreadPool::Wait(const std::function<bool(void)> &done) {
+    while (!done()) {
+        if (RunOneTask())
+            continue;
+        // Spin briefly before going to sleep; some other thread may be
+        // about to push more work or finish the job.
+        bool found = false;
+        for (int i = 0; i < 64 && !found; ++i) {
+            std::this_thread::yield();
+            found = done() || queuedTasks.load(std::memory_order_relaxed) > 0;
+        }
+        if (found)
+            continue;
 
-    ParallelJob *job = jobList;
-    while ((job != nullptr) && !job->HaveWork())
-        job = job->next;
-    if (job != nullptr) {
-        // Run a chunk of loop iterations for _loop_
-        job->activeWorkers++;
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepingThreads.fetch_add(1);
+        sleepCondition.wait(lock, [&]() { return done() || queuedTasks.load() > 0; });
+        sleepingThreads.fetch_sub(1);
+    }
+}
 
-        job->RunStep(lock);
+void ThreadPool::Run(ParallelJob *job) {
+    if (job->nChunks == 0)
+        return;
+    Push(ParallelTask{job, 0, job->nChunks});
+    // Help out with this and any other jobs' tasks until _job_ is done
+    Wait([job]() { return job->Finished(); });
+}
 
-        DCHECK(!lock->owns_lock());
-        lock->lock();
+void ThreadPool::workerFunc(int tIndex) {
+    LOG_VERBOSE("Started execution in worker thread %d", tIndex);
+    ThreadIndex = tIndex;
+    PinCurrentThread(tIndex);
 
-        // Update _loop_ to reflect completion of iterations
-        job->activeWorkers--;
+    Wait([this]() { return shutdownThreads.load(); });
 
-        if (job->Finished())
-            jobListCondition.notify_all();
-    } else
-        // Wait for something to change (new work, or this loop being
-        // finished).
-        jobListCondition.wait(*lock);
+    LOG_VERBOSE("Exiting worker thread %d", tIndex);
 }
 
 void ThreadPool::ForEachThread(std::function<void(void)> func) {
@@ -186,9 +356,9 @@ ThreadPool::~ThreadPool() {
         return;
 
     {
-        std::lock_guard<std::mutex> lock(jobListMutex);
+        std::lock_guard<std::mutex> lock(sleepMutex);
         shutdownThreads = true;
-        jobListCondition.notify_all();
+        sleepCondition.notify_all();
     }
 
     for (std::thread &thread : threads)
@@ -196,110 +366,82 @@ ThreadPool::~ThreadPool() {
 }
 
 std::string ThreadPool::ToString() const {
-    std::string s = StringPrintf("[ ThreadPool threads.size(): %d shutdownThreads: %s ",
-                                 threads.size(), shutdownThreads);
-    if (jobListMutex.try_lock()) {
-        s += "jobList: [ ";
-        ParallelJob *job = jobList;
-        while (job) {
-            s += job->ToString() + " ";
-            job = job->next;
-        }
-        s += "] ";
-        jobListMutex.unlock();
-    } else
-        s += "(job list mutex locked) ";
+    std::string s = StringPrintf("[ ThreadPool threads.size(): %d shutdownThreads: %s "
+                                 "queuedTasks: %d sleepingThreads: %d ",
+                                 threads.size(), shutdownThreads.load(),
+                                 queuedTasks.load(), sleepingThreads.load());
     return s + "]";
 }
 
 // ParallelForLoop1D Definition
 class ParallelForLoop1D : public ParallelJob {
   public:
-    ParallelForLoop1D(int64_t start, int64_t end, int chunkSize,
+    ParallelForLoop1D(int64_t start, int64_t end, int64_t chunkSize,
                       std::function<void(int64_t, int64_t)> func)
-        : func(std::move(func)), nextIndex(start), maxIndex(end), chunkSize(chunkSize) {}
+        : ParallelJob((end - start + chunkSize - 1) / chunkSize),
+          func(std::move(func)),
+          startIndex(start),
+          endIndex(end),
+          chunkSize(chunkSize) {}
 
-    bool HaveWork() const { return nextIndex < maxIndex; }
-    void RunStep(std::unique_lock<std::mutex> *lock);
+    void RunChunk(int64_t chunk) {
+        // Run loop indices in _[indexStart, indexEnd)_
+        int64_t indexStart = startIndex + chunk * chunkSize;
+        int64_t indexEnd = std::min(indexStart + chunkSize, endIndex);
+        func(indexStart, indexEnd);
+    }
 
     std::string ToString() const {
-        return StringPrintf("[ ParallelForLoop1D nextIndex: %d maxIndex: %d "
-                            "chunkSize: %d ]",
-                            nextIndex, maxIndex, chunkSize);
+        return StringPrintf("[ ParallelForLoop1D startIndex: %d endIndex: %d "
+                            "chunkSize: %d %s ]",
+                            startIndex, endIndex, chunkSize, BaseToString());
     }
 
   private:
     std::function<void(int64_t, int64_t)> func;
-    int64_t nextIndex;
-    int64_t maxIndex;
-    int chunkSize;
+    int64_t startIndex, endIndex;
+    int64_t chunkSize;
 };
 
+// ParallelForLoop2D Definition
 class ParallelForLoop2D : public ParallelJob {
   public:
-    ParallelForLoop2D(const Bounds2i &extent, int chunkSize,
+    ParallelForLoop2D(const Bounds2i &extent, int tileSize,
                       std::function<void(Bounds2i)> func)
-        : func(std::move(func)),
+        : ParallelJob(int64_t(NumTiles(extent.Diagonal().x, tileSize)) *
+                      NumTiles(extent.Diagonal().y, tileSize)),
+          func(std::move(func)),
           extent(extent),
-          nextStart(extent.pMin),
-          chunkSize(chunkSize) {}
-
-    bool HaveWork() const { return nextStart.y < extent.pMax.y; }
-    void RunStep(std::unique_lock<std::mutex> *lock);
+          nTilesX(NumTiles(extent.Diagonal().x, tileSize)),
+          tileSize(tileSize) {}
+
+    void RunChunk(int64_t chunk) {
+        // Compute extent of tile _chunk_ and run the loop iteration
+        Point2i start = extent.pMin + tileSize * Vector2i(chunk % nTilesX,
+                                                          chunk / nTilesX);
+        Bounds2i b = Intersect(Bounds2i(start, start + Vector2i(tileSize, tileSize)),
+                               extent);
+        CHECK(!b.IsEmpty());
+        func(b);
+    }
 
     std::string ToString() const {
-        return StringPrintf("[ ParallelForLoop2D extent: %s nextStart: %s "
-                            "chunkSize: %d ]",
-                            extent, nextStart, chunkSize);
+        return StringPrintf("[ ParallelForLoop2D extent: %s nTilesX: %d "
+                            "tileSize: %d %s ]",
+                            extent, nTilesX, tileSize, BaseToString());
     }
 
   private:
+    static int NumTiles(int extent, int tileSize) {
+        return (extent + tileSize - 1) / tileSize;
+    }
+
     std::function<void(Bounds2i)> func;
     const Bounds2i extent;
-    Point2i nextStart;
-    int chunkSize;
+    int nTilesX;
+    int tileSize;
 };
 
-// ParallelForLoop1D Method Definitions
-void ParallelForLoop1D::RunStep(std::unique_lock<std::mutex> *lock) {
-    // Find the set of loop iterations to run next
-    int64_t indexStart = nextIndex;
-    int64_t indexEnd = std::min(indexStart + chunkSize, maxIndex);
-
-    // Update _loop_ to reflect iterations this thread will run
-    nextIndex = indexEnd;
-
-    if (!HaveWork())
-        threadPool->RemoveFromJobList(this);
-
-    lock->unlock();
-
-    // Run loop indices in _[indexStart, indexEnd)_
-    func(indexStart, indexEnd);
-}
-
-void ParallelForLoop2D::RunStep(std::unique_lock<std::mutex> *lock) {
-    // Compute extent for this step
-    Point2i end = nextStart + Vector2i(chunkSize, chunkSize);
-    Bounds2i b = Intersect(Bounds2i(nextStart, end), extent);
-    CHECK(!b.IsEmpty());
-
-    // Advance to be ready for the next extent.
-    nextStart.x += chunkSize;
-    if (nextStart.x >= extent.pMax.x) {
-        nextStart.x = extent.pMin.x;
-        nextStart.y += chunkSize;
-    }
-
-    if (!HaveWork())
-        threadPool->RemoveFromJobList(this);
-
-    lock->unlock();
-
-    // Run the loop iteration
-    func(b);
-}
-
 // Parallel Function Defintions
 void ParallelFor(int64_t start, int64_t end, std::function<void(int64_t, int64_t)> func) {
     CHECK(threadPool);
@@ -309,13 +451,9 @@ void ParallelFor(int64_t start, int64_t end, std::function<void(int64_t, int64_t
         return;
     }
 
-    // Create and enqueue _ParallelJob_ for this loop
+    // Run _ParallelJob_ for this loop
     ParallelForLoop1D loop(start, end, chunkSize, std::move(func));
-    std::unique_lock<std::mutex> lock = threadPool->AddToJobList(&loop);
-
-    // Help out with parallel loop iterations in the current thread
-    while (!loop.Finished())
-        threadPool->WorkOrWait(&lock);
+    threadPool->Run(&loop);
 }
 
 int MaxThreadIndex() {
@@ -341,11 +479,7 @@ void ParallelFor2D(const Bounds2i &extent, std::function<void(Bounds2i)> func) {
                          1, 32);
 
     ParallelForLoop2D loop(extent, tileSize, std::move(func));
-    std::unique_lock<std::mutex> lock = threadPool->AddToJobList(&loop);
-
-    // Help out with parallel loop iterations in the current thread
-    while (!loop.Finished())
-        threadPool->WorkOrWait(&lock);
+    threadPool->Run(&loop);
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -358,7 +492,7 @@ int RunningThreads() {
     return threadPool ? (1 + threadPool->size()) : 1;
 }
 
-void ParallelInit(int nThreads) {
+void ParallelInit(int nThreads, bool pinThreads) {
     // This is risky: if the caller has allocated per-thread data
     // structures before calling ParallelInit(), then we may end up having
     // them accessed with a higher ThreadIndex than the caller expects.
@@ -367,12 +501,83 @@ void ParallelInit(int nThreads) {
     CHECK(!threadPool);
     if (nThreads <= 0)
         nThreads = AvailableCores();
+
+    numaNodeCores = DetectNumaTopology();
+    LOG_VERBOSE("%s", NumaTopologyString());
+    threadCores.clear();
+    ThreadNumaNode = 0;
+    if (pinThreads) {
+#ifdef PBRT_IS_LINUX
+        // Assign cores to threads round-robin over the NUMA nodes so that
+        // each node gets its share of threads even when there are fewer
+        // threads than cores.
+        std::vector<std::pair<int, int>> interleavedCores;
+        for (size_t i = 0; interleavedCores.size() < size_t(AvailableCores()); ++i) {
+            size_t n = interleavedCores.size();
+            for (size_t node = 0; node < numaNodeCores.size(); ++node)
+                if (i < numaNodeCores[node].size())
+                    interleavedCores.push_back({numaNodeCores[node][i], int(node)});
+            if (interleavedCores.size() == n)
+                break;
+        }
+        for (int i = 0; i < nThreads; ++i)
+            threadCores.push_back(interleavedCores[i % interleavedCores.size()]);
+        PinCurrentThread(0);
+#else
+        Warning("Thread pinning is only supported on Linux.");
+#endif
+    }
     threadPool = std::make_unique<ThreadPool>(nThreads);
 }
 
 void ParallelCleanup() {
     threadPool.reset();
     maxThreadIndexCalled = false;
+#ifdef PBRT_IS_LINUX
+    if (!threadCores.empty()) {
+        // Let the main thread run anywhere again
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (const std::vector<int> &cores : numaNodeCores)
+            for (int core : cores)
+                CPU_SET(core, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+#endif
+    threadCores.clear();
+    ThreadNumaNode = 0;
+}
+
+int NumaNodes() {
+    return std::max<int>(1, numaNodeCores.size());
+}
+
+std::string NumaTopologyString() {
+    std::string s = StringPrintf("NUMA topology: %d node(s)", numaNodeCores.size());
+    for (size_t node = 0; node < numaNodeCores.size(); ++node) {
+        // Print each node's cores as a list of ranges
+        const std::vector<int> &cores = numaNodeCores[node];
+        s += StringPrintf("\n  node %d: %d cores [", node, cores.size());
+        for (size_t i = 0; i < cores.size(); ++i) {
+            size_t j = i;
+            while (j + 1 < cores.size() && cores[j + 1] == cores[j] + 1)
+                ++j;
+            s += (i > 0 ? "," : " ") +
+                 (j > i ? StringPrintf("%d-%d", cores[i], cores[j])
+                        : StringPrintf("%d", cores[i]));
+            i = j;
+        }
+        s += " ]";
+    }
+    if (!threadCores.empty()) {
+        std::vector<int> threadsPerNode(numaNodeCores.size(), 0);
+        for (const std::pair<int, int> &core : threadCores)
+            ++threadsPerNode[core.second];
+        s += "\n  threads pinned per node:";
+        for (int count : threadsPerNode)
+            s += StringPrintf(" %d", count);
+    }
+    return s;
 }
 
 void ForEachThread(std::function<void(void)> func) {
@@ -180,15 +180,21 @@ void ForEachThread(std::function<void(void)> func);
 
 // ThreadIndex Declaration
 extern thread_local int ThreadIndex;
+// NUMA node of the core that the current thread is pinned to; always 0 if
+// threads aren't pinned.
+extern thread_local int ThreadNumaNode;
 
 // ParallelFunction Declarations
-void ParallelInit(int nThreads = -1);
+void ParallelInit(int nThreads = -1, bool pinThreads = false);
 void ParallelCleanup();
 
 int AvailableCores();
 int RunningThreads();
 int MaxThreadIndex();
 
+int NumaNodes();
+std::string NumaTopologyString();
+
 }  // namespace pbrt
 
 #endif  // PBRT_UTIL_PARALLEL_H
@@ -580,6 +580,11 @@ class VarianceEstimator {
     void Merge(const VarianceEstimator &ve) {
         if (ve.n == 0)
             return;
+        if (n == 0) {
+            // Copy _ve_ so that merging into an empty estimator is exact
+            *this = ve;
+            return;
+        }
         S = S + ve.S + Sqr(ve.mean - mean) * n * ve.n / (n + ve.n);
         mean = (n * mean + ve.n * ve.mean) / (n + ve.n);
         n += ve.n;
@@ -5,6 +5,7 @@
 #include <pbrt/util/stats.h>
 
 #include <pbrt/util/check.h>
+#include <pbrt/util/error.h>
 #include <pbrt/util/image.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/parallel.h>
@@ -178,6 +179,7 @@ void PixelStatsAccumulator::ReportRatio(const Point2i &p, int statIndex, const c
 struct StatsAccumulator::Stats {
     std::map<std::string, int64_t> counters;
     std::map<std::string, int64_t> memoryCounters;
+    std::map<std::string, double> timers;
     template <typename T>
     struct Distribution {
         int64_t count = 0;
@@ -216,6 +218,10 @@ void StatsAccumulator::ReportMemoryCounter(const char *name, int64_t val) {
     stats->memoryCounters[name] += val;
 }
 
+void StatsAccumulator::ReportTimer(const char *name, double seconds) {
+    stats->timers[name] += seconds;
+}
+
 void StatsAccumulator::ReportPercentage(const char *name, int64_t num, int64_t denom) {
     stats->percentages[name].first += num;
     stats->percentages[name].second += denom;
@@ -325,6 +331,20 @@ void PrintStats(FILE *dest) {
     statsAccumulator.Print(dest);
 }
 
+bool WriteStatsFile(const std::string &filename) {
+    FILE *f = fopen(filename.c_str(), "w");
+    if (!f) {
+        Error("%s: unable to open statistics file: %s", filename, ErrorString());
+        return false;
+    }
+    statsAccumulator.WriteJSON(f);
+    if (fclose(f) != 0) {
+        Error("%s: error writing statistics file: %s", filename, ErrorString());
+        return false;
+    }
+    return true;
+}
+
 bool PrintCheckRare(FILE *dest) {
     return statsAccumulator.PrintCheckRare(dest);
 }
@@ -387,6 +407,19 @@ void StatsAccumulator::Print(FILE *dest) {
         toPrint["Memory"].push_back(StringPrintf("%-42s                  %s",
                                                  "Unreported / unused",
                                                  printBytes(unreportedBytes)));
+    if (size_t peakBytes = GetPeakRSS(); peakBytes > 0)
+        toPrint["Memory"].push_back(StringPrintf("%-42s                  %s",
+                                                 "Peak resident set size",
+                                                 printBytes(peakBytes)));
+
+    for (auto &timer : stats->timers) {
+        if (timer.second == 0)
+            continue;
+        std::string category, title;
+        getCategoryAndTitle(timer.first, &category, &title);
+        toPrint[category].push_back(
+            StringPrintf("%-42s                  %9.3f s", title, timer.second));
+    }
 
     for (auto &distrib : stats->intDistributions) {
         const std::string &name = distrib.first;
@@ -440,6 +473,69 @@ void StatsAccumulator::Print(FILE *dest) {
     }
 }
 
+// Writes each statistic as a member of an object for its kind, keyed by the
+// name it was registered with; values are in bytes and seconds.
+void StatsAccumulator::WriteJSON(FILE *dest) const {
+    auto quote = [](const std::string &str) {
+        std::string result = "\"";
+        for (char c : str) {
+            if (c == '"' || c == '\\') {
+                result += '\\';
+                result += c;
+            } else if ((unsigned char)c < 0x20)
+                // Control characters must be escaped in JSON strings
+                result += StringPrintf("\\u%04x", int(c));
+            else
+                result += c;
+        }
+        return result + "\"";
+    };
+    auto writeMembers = [&](const char *kind, const auto &values, auto format) {
+        fprintf(dest, ",\n  \"%s\": {", kind);
+        bool first = true;
+        for (const auto &value : values) {
+            fprintf(dest, "%s\n    %s: %s", first ? "" : ",", quote(value.first).c_str(),
+                    format(value.second).c_str());
+            first = false;
+        }
+        fprintf(dest, "%s}", first ? "" : "\n  ");
+    };
+
+    fprintf(dest, "{\n  \"peakRSS\": %zu", GetPeakRSS());
+    auto formatInt = [](int64_t v) { return StringPrintf("%" PRId64, v); };
+    auto formatDouble = [](double v) { return StringPrintf("%.9g", v); };
+    writeMembers("counters", stats->counters, formatInt);
+    writeMembers("memoryCounters", stats->memoryCounters, formatInt);
+    writeMembers("timers", stats->timers, formatDouble);
+
+    // Omit distributions without any values, whose minimum and maximum are
+    // the extreme values of their type.
+    std::map<std::string, std::string> distributions;
+    for (const auto &d : stats->intDistributions)
+        if (d.second.count > 0)
+            distributions[d.first] = StringPrintf(
+                "{ \"sum\": %" PRId64 ", \"count\": %" PRId64 ", \"min\": %" PRId64
+                ", \"max\": %" PRId64 " }",
+                d.second.sum, d.second.count, d.second.min, d.second.max);
+    for (const auto &d : stats->floatDistributions)
+        if (d.second.count > 0)
+            distributions[d.first] = StringPrintf(
+                "{ \"sum\": %.9g, \"count\": %" PRId64 ", \"min\": %.9g, "
+                "\"max\": %.9g }",
+                d.second.sum, d.second.count, d.second.min, d.second.max);
+    writeMembers("distributions", distributions,
+                 [](const std::string &str) { return str; });
+
+    auto formatFraction = [](const std::pair<int64_t, int64_t> &f) {
+        return StringPrintf("{ \"numerator\": %" PRId64 ", \"denominator\": %" PRId64
+                            " }",
+                            f.first, f.second);
+    };
+    writeMembers("percentages", stats->percentages, formatFraction);
+    writeMembers("ratios", stats->ratios, formatFraction);
+    fprintf(dest, "\n}\n");
+}
+
 void StatsWritePixelImages() {
     statsAccumulator.WritePixelImages();
 }
@@ -504,6 +600,7 @@ bool StatsAccumulator::PrintCheckRare(FILE *dest) {
 void StatsAccumulator::Clear() {
     stats->counters.clear();
     stats->memoryCounters.clear();
+    stats->timers.clear();
     stats->intDistributions.clear();
     stats->floatDistributions.clear();
     stats->percentages.clear();
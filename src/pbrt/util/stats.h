@@ -33,6 +33,8 @@ void StatsReportPixelStart(const Point2i &p);
 void StatsReportPixelEnd(const Point2i &p);
 
 void PrintStats(FILE *dest);
+// Writes the statistics to the given file in JSON format.
+bool WriteStatsFile(const std::string &filename);
 void StatsWritePixelImages();
 bool PrintCheckRare(FILE *dest);
 void ClearStats();
@@ -46,6 +48,7 @@ class StatsAccumulator {
 
     void ReportCounter(const char *name, int64_t val);
     void ReportMemoryCounter(const char *name, int64_t val);
+    void ReportTimer(const char *name, double seconds);
     void ReportPercentage(const char *name, int64_t num, int64_t denom);
     void ReportRatio(const char *name, int64_t num, int64_t denom);
     void ReportRareCheck(const char *condition, float maxFrequency, int64_t numTrue,
@@ -60,6 +63,7 @@ class StatsAccumulator {
     void WritePixelImages() const;
 
     void Print(FILE *file);
+    void WriteJSON(FILE *file) const;
     bool PrintCheckRare(FILE *dest);
     void Clear();
 
@@ -115,6 +119,13 @@ class PixelStatsAccumulator {
         var = 0;                                                       \
     });
 
+#define STAT_TIMER(title, var)                                         \
+    static thread_local double var;                                    \
+    static StatRegisterer STATS_REG##var([](StatsAccumulator &accum) { \
+        accum.ReportTimer(title, var);                                 \
+        var = 0;                                                       \
+    });
+
 #define STAT_INT_DISTRIBUTION(title, var)                                             \
     static thread_local int64_t var##sum;                                             \
     static thread_local int64_t var##count;                                           \
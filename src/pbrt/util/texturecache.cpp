@@ -0,0 +1,491 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/util/texturecache.h>
+
+#include <pbrt/util/bits.h>
+#include <pbrt/util/colorspace.h>
+#include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/log.h>
+#include <pbrt/util/print.h>
+#include <pbrt/util/stats.h>
+
+#include <algorithm>
+#include <cstring>
+#ifdef PBRT_IS_WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#ifdef PBRT_HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+namespace pbrt {
+
+STAT_COUNTER("Texture/Tile cache micro-cache hits", tileMicroCacheHits);
+STAT_COUNTER("Texture/Tile cache hits", tileCacheHits);
+STAT_COUNTER("Texture/Tile cache misses", tileCacheMisses);
+STAT_COUNTER("Texture/Tile cache evictions", tileCacheEvictions);
+STAT_MEMORY_COUNTER("Memory/Texture tiles read", tileBytesRead);
+STAT_MEMORY_COUNTER("Memory/Texture tile cache peak", tileCachePeakBytes);
+STAT_MEMORY_COUNTER("Memory/Texture files mapped", textureFileBytesMapped);
+
+// TiledTextureHeader Definition
+// Tiled texture files start with this header, followed by a
+// TiledTextureLevel for each level. Values are stored in the byte order of
+// the machine that wrote the file.
+struct TiledTextureHeader {
+    static constexpr int CurrentVersion = 1;
+    char magic[8];
+    int32_t version, nChannels, format, tileSize, nLevels, wrapMode;
+    // Chromaticities of the color space's primaries and white point
+    float r[2], g[2], b[2], w[2];
+    // Color encoding of 8-bit texels and its gamma for
+    // TiledTextureEncoding::Gamma; zero in files with floating-point texels
+    int32_t encoding;
+    float gamma;
+};
+
+// TiledTextureEncoding Definition
+enum class TiledTextureEncoding { Linear, sRGB, Gamma };
+
+// TiledTextureLevel Definition
+struct TiledTextureLevel {
+    int32_t xResolution, yResolution;
+    // Offset of the level's first tile from the start of the file
+    int64_t offset;
+};
+
+static constexpr char TiledTextureMagic[8] = "pbrtTEX";
+static constexpr size_t TiledTextureHeaderBytes = 128;
+static_assert(sizeof(TiledTextureHeader) <= TiledTextureHeaderBytes,
+              "TiledTextureHeader is too large");
+// Tile data starts at a multiple of this offset
+static constexpr int64_t TiledTextureAlignment = 64;
+
+// Tiled Texture Function Definitions
+bool WriteTiledTexture(const std::string &filename, pstd::span<const Image> pyramid,
+                       const RGBColorSpace *colorSpace, WrapMode wrapMode,
+                       PixelFormat format, int tileSize) {
+    CHECK(!pyramid.empty());
+    CHECK(format == PixelFormat::Float || format == PixelFormat::Half ||
+          format == PixelFormat::U256);
+    CHECK_GT(tileSize, 0);
+    CHECK(colorSpace);
+    int nChannels = pyramid[0].NChannels();
+
+    // Initialize header and level table for tiled texture file
+    TiledTextureHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, TiledTextureMagic, sizeof(header.magic));
+    header.version = TiledTextureHeader::CurrentVersion;
+    header.nChannels = nChannels;
+    header.format = int(format);
+    header.tileSize = tileSize;
+    header.nLevels = pyramid.size();
+    header.wrapMode = int(wrapMode);
+    for (int i = 0; i < 2; ++i) {
+        header.r[i] = colorSpace->r[i];
+        header.g[i] = colorSpace->g[i];
+        header.b[i] = colorSpace->b[i];
+        header.w[i] = colorSpace->w[i];
+    }
+    if (format == PixelFormat::U256) {
+        // Record the color encoding of the 8-bit texels
+        ColorEncodingHandle encoding = pyramid[0].Encoding();
+        if (encoding && encoding.Is<sRGBColorEncoding>())
+            header.encoding = int(TiledTextureEncoding::sRGB);
+        else if (encoding && encoding.Is<GammaColorEncoding>()) {
+            header.encoding = int(TiledTextureEncoding::Gamma);
+            header.gamma = encoding.Cast<GammaColorEncoding>()->Gamma();
+        } else
+            header.encoding = int(TiledTextureEncoding::Linear);
+    }
+    size_t tileBytes = size_t(tileSize) * tileSize * nChannels * TexelBytes(format);
+    std::vector<TiledTextureLevel> levels(pyramid.size());
+    int64_t offset = TiledTextureHeaderBytes + levels.size() * sizeof(TiledTextureLevel);
+    for (size_t i = 0; i < pyramid.size(); ++i) {
+        CHECK_EQ(nChannels, pyramid[i].NChannels());
+        Point2i res = pyramid[i].Resolution();
+        offset = (offset + TiledTextureAlignment - 1) / TiledTextureAlignment *
+                 TiledTextureAlignment;
+        levels[i] = TiledTextureLevel{res.x, res.y, offset};
+        int64_t nTiles = int64_t((res.x + tileSize - 1) / tileSize) *
+                         int64_t((res.y + tileSize - 1) / tileSize);
+        offset += nTiles * tileBytes;
+    }
+
+    // Write to a temporary file and rename it so that readers and concurrent
+    // writers never see a partially-written file
+    std::string tempFilename = UniqueTemporaryFilename(filename);
+    FILE *f = fopen(tempFilename.c_str(), "wb");
+    if (!f) {
+        Error("%s: unable to create tiled texture file: %s", tempFilename,
+              ErrorString());
+        return false;
+    }
+    char headerBytes[TiledTextureHeaderBytes] = {0};
+    std::memcpy(headerBytes, &header, sizeof(header));
+    bool success = fwrite(headerBytes, sizeof(headerBytes), 1, f) == 1 &&
+                   fwrite(levels.data(), sizeof(TiledTextureLevel), levels.size(), f) ==
+                       levels.size();
+    int64_t written = TiledTextureHeaderBytes + levels.size() * sizeof(TiledTextureLevel);
+
+    std::vector<uint8_t> tile(tileBytes);
+    for (size_t i = 0; i < pyramid.size() && success; ++i) {
+        // Pad to the start of the level's tiles
+        std::vector<uint8_t> padding(levels[i].offset - written);
+        success &= fwrite(padding.data(), 1, padding.size(), f) == padding.size();
+        written = levels[i].offset;
+
+        const Image &image = pyramid[i];
+        CHECK(format != PixelFormat::U256 || image.Format() == PixelFormat::U256);
+        Point2i res = image.Resolution();
+        for (int ty = 0; ty < (res.y + tileSize - 1) / tileSize && success; ++ty)
+            for (int tx = 0; tx < (res.x + tileSize - 1) / tileSize; ++tx) {
+                // Convert texels of tile $(tx, ty)$ to the file's format
+                std::fill(tile.begin(), tile.end(), 0);
+                for (int y = 0; y < tileSize; ++y) {
+                    int py = ty * tileSize + y;
+                    for (int x = 0; x < tileSize; ++x) {
+                        int px = tx * tileSize + x;
+                        if (px >= res.x || py >= res.y)
+                            continue;
+                        size_t index = nChannels * (y * tileSize + x);
+                        if (format == PixelFormat::U256) {
+                            // Copy 8-bit texels without decoding them
+                            std::memcpy(&tile[index], image.RawPointer({px, py}),
+                                        nChannels);
+                            continue;
+                        }
+                        for (int c = 0; c < nChannels; ++c) {
+                            Float v = image.GetChannel({px, py}, c);
+                            if (format == PixelFormat::Float)
+                                ((float *)tile.data())[index + c] = v;
+                            else
+                                ((Half *)tile.data())[index + c] = Half(v);
+                        }
+                    }
+                }
+                success &= fwrite(tile.data(), 1, tileBytes, f) == tileBytes;
+                written += tileBytes;
+            }
+    }
+
+    if (fclose(f) != 0 || !success) {
+        Error("%s: error writing tiled texture file: %s", tempFilename, ErrorString());
+        std::remove(tempFilename.c_str());
+        return false;
+    }
+    if (!RenameFile(tempFilename, filename)) {
+        Error("%s: unable to rename tiled texture file: %s", tempFilename,
+              ErrorString());
+        std::remove(tempFilename.c_str());
+        return false;
+    }
+    LOG_VERBOSE("Wrote tiled texture file %s (%d bytes)", filename, written);
+    return true;
+}
+
+// TiledTextureFile Method Definitions
+std::unique_ptr<TiledTextureFile> TiledTextureFile::Open(const std::string &filename,
+                                                         bool removeOnClose) {
+    std::unique_ptr<TiledTextureFile> tf(new TiledTextureFile);
+    tf->filename = filename;
+#ifdef PBRT_IS_WINDOWS
+    // The "D" mode has the file deleted when it is closed, including when
+    // the process exits abnormally
+    tf->file = fopen(filename.c_str(), removeOnClose ? "rbD" : "rb");
+#else
+    tf->file = fopen(filename.c_str(), "rb");
+#endif
+    if (!tf->file)
+        return nullptr;
+
+    // Read and validate tiled texture header
+    TiledTextureHeader header;
+    char headerBytes[TiledTextureHeaderBytes];
+    if (fread(headerBytes, sizeof(headerBytes), 1, tf->file) != 1)
+        return nullptr;
+    std::memcpy(&header, headerBytes, sizeof(header));
+    if (std::memcmp(header.magic, TiledTextureMagic, sizeof(header.magic)) != 0)
+        return nullptr;
+    if (header.version != TiledTextureHeader::CurrentVersion) {
+        Warning("%s: tiled texture file version %d is not supported", filename,
+                header.version);
+        return nullptr;
+    }
+    if ((header.nChannels != 1 && header.nChannels != 3) ||
+        (header.format != int(PixelFormat::Float) &&
+         header.format != int(PixelFormat::Half) &&
+         header.format != int(PixelFormat::U256)) ||
+        header.encoding < 0 || header.encoding > int(TiledTextureEncoding::Gamma) ||
+        (header.encoding == int(TiledTextureEncoding::Gamma) && !(header.gamma > 0)) ||
+        header.tileSize <= 0 || header.nLevels <= 0 || header.nLevels > MaxLevels ||
+        header.wrapMode < 0 || header.wrapMode > int(WrapMode::OctahedralSphere)) {
+        Warning("%s: corrupt tiled texture file header", filename);
+        return nullptr;
+    }
+    tf->nChannels = header.nChannels;
+    tf->format = PixelFormat(header.format);
+    if (header.encoding == int(TiledTextureEncoding::sRGB))
+        tf->encoding = ColorEncodingHandle::sRGB;
+    else if (header.encoding == int(TiledTextureEncoding::Gamma))
+        tf->encoding = ColorEncodingHandle::Get(StringPrintf("gamma %f", header.gamma));
+    else
+        tf->encoding = ColorEncodingHandle::Linear;
+    tf->tileSize = header.tileSize;
+    tf->wrapMode = WrapMode(header.wrapMode);
+    tf->colorSpace = RGBColorSpace::Lookup(
+        Point2f(header.r[0], header.r[1]), Point2f(header.g[0], header.g[1]),
+        Point2f(header.b[0], header.b[1]), Point2f(header.w[0], header.w[1]));
+    if (!tf->colorSpace) {
+        Warning("%s: unknown color space in tiled texture file; using sRGB", filename);
+        tf->colorSpace = RGBColorSpace::sRGB;
+    }
+
+    // Read level table
+    std::vector<TiledTextureLevel> levels(header.nLevels);
+    if (fread(levels.data(), sizeof(TiledTextureLevel), levels.size(), tf->file) !=
+        levels.size())
+        return nullptr;
+#ifdef PBRT_IS_WINDOWS
+    _fseeki64(tf->file, 0, SEEK_END);
+    int64_t fileBytes = _ftelli64(tf->file);
+#else
+    fseeko(tf->file, 0, SEEK_END);
+    int64_t fileBytes = ftello(tf->file);
+#endif
+    for (const TiledTextureLevel &level : levels) {
+        int nTilesX = (level.xResolution + tf->tileSize - 1) / tf->tileSize;
+        int nTilesY = (level.yResolution + tf->tileSize - 1) / tf->tileSize;
+        if (level.xResolution <= 0 || level.yResolution <= 0 || level.offset < 0 ||
+            nTilesX > MaxTilesPerAxis || nTilesY > MaxTilesPerAxis ||
+            level.offset + int64_t(nTilesX) * nTilesY * tf->TileBytes() > fileBytes) {
+            Warning("%s: corrupt or truncated tiled texture file", filename);
+            return nullptr;
+        }
+        tf->levels.push_back(
+            Level{{level.xResolution, level.yResolution}, nTilesX, level.offset});
+    }
+    tf->fileBytes = fileBytes;
+
+#ifndef PBRT_IS_WINDOWS
+    // Use a file descriptor so that tiles can be read concurrently with pread()
+    fclose(tf->file);
+    tf->file = nullptr;
+    tf->fd = open(filename.c_str(), O_RDONLY);
+    if (tf->fd == -1)
+        return nullptr;
+    // Remove the file's name right away; its contents remain accessible
+    // through _fd_, and the system reclaims them once it is closed, even if
+    // pbrt exits without running destructors.
+    if (removeOnClose)
+        std::remove(filename.c_str());
+#endif
+    return tf;
+}
+
+TiledTextureFile::~TiledTextureFile() {
+#ifdef PBRT_HAVE_MMAP
+    if (mapping)
+        munmap((void *)mapping, fileBytes);
+#endif
+    if (file)
+        fclose(file);
+#ifndef PBRT_IS_WINDOWS
+    if (fd != -1)
+        close(fd);
+#endif
+}
+
+bool TiledTextureFile::Map() {
+    if (mapping)
+        return true;
+#ifdef PBRT_HAVE_MMAP
+    void *ptr = mmap(nullptr, fileBytes, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED)
+        return false;
+    mapping = (const uint8_t *)ptr;
+#else
+    // Without _mmap()_, read the entire file into memory
+    contents.reset(new uint8_t[fileBytes]);
+    if (!readBytes(0, fileBytes, contents.get())) {
+        contents.reset();
+        return false;
+    }
+    mapping = contents.get();
+#endif
+    textureFileBytesMapped += fileBytes;
+    return true;
+}
+
+bool TiledTextureFile::ReadTile(int level, Point2i tile, void *buf) const {
+    return readBytes(TileOffset(level, tile), TileBytes(), buf);
+}
+
+bool TiledTextureFile::readBytes(int64_t offset, size_t nBytes, void *buf) const {
+#ifdef PBRT_IS_WINDOWS
+    std::lock_guard<std::mutex> lock(fileMutex);
+    return _fseeki64(file, offset, SEEK_SET) == 0 && fread(buf, nBytes, 1, file) == 1;
+#else
+    size_t nRead = 0;
+    while (nRead < nBytes) {
+        ssize_t n = pread(fd, (uint8_t *)buf + nRead, nBytes - nRead, offset + nRead);
+        if (n <= 0)
+            return false;
+        nRead += n;
+    }
+    return true;
+#endif
+}
+
+std::string TiledTextureFile::ToString() const {
+    return StringPrintf("[ TiledTextureFile filename: %s levels: %d resolution: %s "
+                        "nChannels: %d format: %s tileSize: %d wrapMode: %s ]",
+                        filename, Levels(), LevelResolution(0), nChannels, format,
+                        tileSize, wrapMode);
+}
+
+// TextureTileCache Method Definitions
+TextureTileCache::TextureTileCache(size_t maxBytes)
+    : maxBytes(maxBytes), shards(NShards), microCaches(MaxThreadIndex()) {}
+
+TextureTileCache::~TextureTileCache() = default;
+
+const TiledTextureFile *TextureTileCache::AddFile(
+    std::unique_ptr<TiledTextureFile> file) {
+    std::lock_guard<std::mutex> lock(filesMutex);
+    CHECK_LT(files.size(), 1 << 16);
+    file->cacheId = files.size();
+    files.push_back(std::move(file));
+    return files.back().get();
+}
+
+const TiledTextureFile *TextureTileCache::AddPyramid(pstd::span<const Image> pyramid,
+                                                    const RGBColorSpace *colorSpace,
+                                                    WrapMode wrapMode) {
+    // Store texels in the images' format, so that texel values match those
+    // of the images without taking more space
+    PixelFormat format = pyramid[0].Format();
+    static std::atomic<int> nSpillFiles{0};
+#ifdef PBRT_IS_WINDOWS
+    int pid = GetCurrentProcessId();
+#else
+    int pid = getpid();
+#endif
+    std::string filename =
+        StringPrintf("%s/pbrt-%d-%d.tex", TemporaryDirectory(), pid, nSpillFiles++);
+    if (!WriteTiledTexture(filename, pyramid, colorSpace, wrapMode, format))
+        return nullptr;
+    std::unique_ptr<TiledTextureFile> file = TiledTextureFile::Open(filename, true);
+    if (!file) {
+        std::remove(filename.c_str());
+        return nullptr;
+    }
+    return AddFile(std::move(file));
+}
+
+const void *TextureTileCache::lookupTile(const TiledTextureFile *file, int level,
+                                         Point2i tile, uint64_t key) {
+    CHECK_LT(ThreadIndex, microCaches.size());
+    int shardIndex = MixBits(key) % NShards;
+    Shard &shard = shards[shardIndex];
+    Tile *t = nullptr;
+    // Look for the tile in the cache and pin it if present
+    auto findTile = [&]() {
+        auto iter = shard.tiles.find(key);
+        if (iter == shard.tiles.end())
+            return false;
+        t = &*iter->second;
+        ++t->pinCount;
+        shard.lru.splice(shard.lru.begin(), shard.lru, iter->second);
+        return true;
+    };
+
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    if (findTile())
+        ++tileCacheHits;
+    else {
+        // Read the tile without holding the lock
+        lock.unlock();
+        ++tileCacheMisses;
+        size_t nBytes = file->TileBytes();
+        std::unique_ptr<uint8_t[]> data(new uint8_t[nBytes]);
+        if (!file->ReadTile(level, tile, data.get()))
+            ErrorExit("%s: unable to read texture tile: %s", file->Filename(),
+                      ErrorString());
+        tileBytesRead += nBytes;
+
+        // Add the tile to the cache unless another thread has done so meanwhile
+        lock.lock();
+        if (!findTile()) {
+            shard.lru.emplace_front();
+            t = &shard.lru.front();
+            t->key = key;
+            t->bytes = nBytes;
+            t->pinCount = 1;
+            t->data = std::move(data);
+            shard.tiles[key] = shard.lru.begin();
+
+            size_t resident = residentBytes += nBytes;
+            size_t peak = peakResidentBytes.load();
+            while (resident > peak &&
+                   !peakResidentBytes.compare_exchange_weak(peak, resident))
+                ;
+        }
+        lock.unlock();
+        if (residentBytes.load() > maxBytes)
+            evictTiles(shardIndex);
+    }
+
+    // Replace the thread's least recently added micro-cache entry with the tile
+    MicroCache &mc = microCaches[ThreadIndex];
+    int i = mc.next;
+    mc.next = (mc.next + 1) % MicroCacheSize;
+    if (mc.tiles[i])
+        --mc.tiles[i]->pinCount;
+    mc.keys[i] = key;
+    mc.tiles[i] = t;
+    return t->data.get();
+}
+
+void TextureTileCache::evictTiles(int startShard) {
+    // Evict unpinned tiles, starting with the least recently used ones in
+    // _startShard_ and continuing on to the other shards as needed
+    for (int s = 0; s < NShards && residentBytes.load() > maxBytes; ++s) {
+        Shard &shard = shards[(startShard + s) % NShards];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto iter = shard.lru.end();
+        while (iter != shard.lru.begin() && residentBytes.load() > maxBytes) {
+            --iter;
+            if (iter->pinCount.load() > 0)
+                continue;
+            residentBytes -= iter->bytes;
+            shard.tiles.erase(iter->key);
+            iter = shard.lru.erase(iter);
+            ++tileCacheEvictions;
+        }
+    }
+}
+
+void TextureTileCache::ReportStats() {
+    for (MicroCache &mc : microCaches) {
+        tileMicroCacheHits += mc.hits;
+        mc.hits = 0;
+    }
+    tileCachePeakBytes = std::max<int64_t>(tileCachePeakBytes, peakResidentBytes.load());
+}
+
+std::string TextureTileCache::ToString() const {
+    return StringPrintf("[ TextureTileCache maxBytes: %d residentBytes: %d files: %d ]",
+                        maxBytes, residentBytes.load(), files.size());
+}
+
+}  // namespace pbrt
@@ -0,0 +1,263 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#ifndef PBRT_UTIL_TEXTURECACHE_H
+#define PBRT_UTIL_TEXTURECACHE_H
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/util/check.h>
+#include <pbrt/util/float.h>
+#include <pbrt/util/image.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/pstd.h>
+#include <pbrt/util/vecmath.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace pbrt {
+
+// Tiled texture files store all of the levels of a MIP map, each split into
+// square tiles so that individual tiles can be read on demand. Edge tiles
+// are padded to the full tile size. Texels are stored as 32-bit or 16-bit
+// floats in linear space or as 8-bit values with the images' color encoding.
+
+// Writes the levels of _pyramid_ (as returned by Image::GenerateMIPMap())
+// to a tiled texture file, storing texels using the given format.
+// PixelFormat::U256 may only be used if the images are 8-bit.
+bool WriteTiledTexture(const std::string &filename, pstd::span<const Image> pyramid,
+                       const RGBColorSpace *colorSpace, WrapMode wrapMode,
+                       PixelFormat format = PixelFormat::Float, int tileSize = 64);
+
+// TiledTextureFile Definition
+class TiledTextureFile {
+  public:
+    // Limits of the files that a TextureTileCache can hold tiles of
+    static constexpr int MaxLevels = 64, MaxTilesPerAxis = 1 << 21;
+
+    // TiledTextureFile Public Methods
+    // Returns nullptr if _filename_ isn't a valid tiled texture file. If
+    // _removeOnClose_ is true, the file is deleted once it is closed, also
+    // if pbrt exits abnormally; on POSIX systems, its name is removed as
+    // soon as it has been opened.
+    static std::unique_ptr<TiledTextureFile> Open(const std::string &filename,
+                                                  bool removeOnClose = false);
+    ~TiledTextureFile();
+
+    TiledTextureFile(const TiledTextureFile &) = delete;
+    TiledTextureFile &operator=(const TiledTextureFile &) = delete;
+
+    int Levels() const { return int(levels.size()); }
+    Point2i LevelResolution(int level) const { return levels[level].resolution; }
+    int NChannels() const { return nChannels; }
+    PixelFormat Format() const { return format; }
+    int TileSize() const { return tileSize; }
+    size_t TileBytes() const {
+        return size_t(tileSize) * tileSize * nChannels * TexelBytes(format);
+    }
+    const RGBColorSpace *ColorSpace() const { return colorSpace; }
+    WrapMode GetWrapMode() const { return wrapMode; }
+    const std::string &Filename() const { return filename; }
+
+    // Reads the given tile into _buf_, which must have room for TileBytes() bytes.
+    bool ReadTile(int level, Point2i tile, void *buf) const;
+
+    // Maps the file into memory so that its texels can be accessed directly
+    // with GetMappedTexel(); where mmap() isn't available, the whole file is
+    // read instead.
+    bool Map();
+    bool IsMapped() const { return mapping != nullptr; }
+    void GetMappedTexel(int level, Point2i p, Float *values) const {
+        DCHECK(mapping != nullptr);
+        const uint8_t *tile =
+            mapping + TileOffset(level, Point2i(p.x / tileSize, p.y / tileSize));
+        TileTexel(tile, p, values);
+    }
+
+    // Returns the channels of texel _p_ of a level in _values_, given the
+    // contents of the tile that holds it.
+    void TileTexel(const void *tile, Point2i p, Float *values) const {
+        size_t offset = nChannels * ((p.y % tileSize) * tileSize + p.x % tileSize);
+        if (format == PixelFormat::Float) {
+            const float *texels = (const float *)tile + offset;
+            for (int c = 0; c < nChannels; ++c)
+                values[c] = texels[c];
+        } else if (format == PixelFormat::U256) {
+            const uint8_t *texels = (const uint8_t *)tile + offset;
+            encoding.ToLinear({texels, size_t(nChannels)}, {values, size_t(nChannels)});
+        } else {
+            const Half *texels = (const Half *)tile + offset;
+            for (int c = 0; c < nChannels; ++c)
+                values[c] = Float(texels[c]);
+        }
+    }
+
+    std::string ToString() const;
+
+  private:
+    // TiledTextureFile::Level Definition
+    struct Level {
+        Point2i resolution;
+        int nTilesX;
+        int64_t offset;
+    };
+
+    TiledTextureFile() = default;
+
+    int64_t TileOffset(int level, Point2i tile) const {
+        const Level &l = levels[level];
+        return l.offset + (int64_t(tile.y) * l.nTilesX + tile.x) * int64_t(TileBytes());
+    }
+    bool readBytes(int64_t offset, size_t nBytes, void *buf) const;
+
+    friend class TextureTileCache;
+
+    // TiledTextureFile Private Members
+    std::string filename;
+    // Index of the file in the TextureTileCache that it has been added to
+    int cacheId = -1;
+    // Tiles are read with pread() from _fd_ where it's available, which
+    // doesn't require serializing reads; otherwise _fileMutex_ guards _file_.
+    FILE *file = nullptr;
+    int fd = -1;
+    mutable std::mutex fileMutex;
+    int64_t fileBytes = 0;
+    // Contents of the file once Map() has been called; _contents_ holds them
+    // if the file was read rather than mapped.
+    const uint8_t *mapping = nullptr;
+    std::unique_ptr<uint8_t[]> contents;
+    std::vector<Level> levels;
+    int nChannels = 0, tileSize = 0;
+    PixelFormat format = PixelFormat::Float;
+    // Color encoding of PixelFormat::U256 texels
+    ColorEncodingHandle encoding = nullptr;
+    const RGBColorSpace *colorSpace = nullptr;
+    WrapMode wrapMode = WrapMode::Clamp;
+};
+
+// TextureTileCache Definition
+// Keeps recently-used tiles of tiled texture files in memory, evicting the
+// least recently used ones once the tiles use more than a given amount of
+// memory. Each thread also keeps a handful of its most recently used tiles
+// in a private micro-cache that is accessed without locking; those tiles
+// are pinned and can't be evicted, so the memory limit may be exceeded by
+// up to that many tiles per thread.
+class TextureTileCache {
+  public:
+    // TextureTileCache Public Methods
+    explicit TextureTileCache(size_t maxBytes);
+    ~TextureTileCache();
+
+    TextureTileCache(const TextureTileCache &) = delete;
+    TextureTileCache &operator=(const TextureTileCache &) = delete;
+
+    // Takes ownership of _file_ so that its tiles can be looked up in the cache.
+    const TiledTextureFile *AddFile(std::unique_ptr<TiledTextureFile> file);
+    // Writes _pyramid_ to a temporary tiled texture file that is removed
+    // once the cache is destroyed and adds it to the cache. Returns nullptr
+    // if the file couldn't be written.
+    const TiledTextureFile *AddPyramid(pstd::span<const Image> pyramid,
+                                       const RGBColorSpace *colorSpace,
+                                       WrapMode wrapMode);
+
+    // Returns the values of the channels of texel _p_ in _level_ of the
+    // given file in _values_; _p_ must be inside the level's resolution.
+    void GetTexel(const TiledTextureFile *file, int level, Point2i p, Float *values) {
+        int tileSize = file->TileSize();
+        const void *tile =
+            GetTile(file, level, Point2i(p.x / tileSize, p.y / tileSize));
+        file->TileTexel(tile, p, values);
+    }
+
+    // Returns a pointer to the tile's texels, which stays valid at least
+    // until the calling thread's next call to GetTile().
+    const void *GetTile(const TiledTextureFile *file, int level, Point2i tile) {
+        uint64_t key = TileKey(file->cacheId, level, tile);
+        if (ThreadIndex < int(microCaches.size())) {
+            MicroCache &mc = microCaches[ThreadIndex];
+            for (int i = 0; i < MicroCacheSize; ++i)
+                if (mc.keys[i] == key) {
+                    ++mc.hits;
+                    return mc.tiles[i]->data.get();
+                }
+        }
+        return lookupTile(file, level, tile, key);
+    }
+
+    size_t MaxBytes() const { return maxBytes; }
+    size_t ResidentBytes() const { return residentBytes.load(); }
+
+    // Adds the cache's statistics to pbrt's statistics.
+    void ReportStats();
+
+    std::string ToString() const;
+
+  private:
+    // TextureTileCache Private Members
+    static constexpr int MicroCacheSize = 8;
+    static constexpr int NShards = 64;
+
+    // TextureTileCache::Tile Definition
+    struct Tile {
+        uint64_t key;
+        size_t bytes;
+        std::atomic<int> pinCount{0};
+        std::unique_ptr<uint8_t[]> data;
+    };
+
+    // TextureTileCache::Shard Definition
+    struct alignas(PBRT_L1_CACHE_LINE_SIZE) Shard {
+        std::mutex mutex;
+        // Most recently used tiles are at the front
+        std::list<Tile> lru;
+        std::unordered_map<uint64_t, std::list<Tile>::iterator> tiles;
+    };
+
+    // TextureTileCache::MicroCache Definition
+    struct alignas(PBRT_L1_CACHE_LINE_SIZE) MicroCache {
+        MicroCache() {
+            for (int i = 0; i < MicroCacheSize; ++i)
+                keys[i] = InvalidKey;
+        }
+        uint64_t keys[MicroCacheSize];
+        Tile *tiles[MicroCacheSize] = {};
+        int next = 0;
+        int64_t hits = 0;
+    };
+
+    static constexpr uint64_t InvalidKey = ~uint64_t(0);
+
+    // TextureTileCache Private Methods
+    static uint64_t TileKey(int fileId, int level, Point2i tile) {
+        // Out-of-range values would alias other tiles' keys
+        CHECK(fileId < (1 << 16) && level >= 0 && level < TiledTextureFile::MaxLevels);
+        CHECK(tile.x >= 0 && tile.x < TiledTextureFile::MaxTilesPerAxis && tile.y >= 0 &&
+              tile.y < TiledTextureFile::MaxTilesPerAxis);
+        return (uint64_t(fileId) << 48) | (uint64_t(level) << 42) |
+               (uint64_t(tile.x) << 21) | uint64_t(tile.y);
+    }
+
+    const void *lookupTile(const TiledTextureFile *file, int level, Point2i tile,
+                           uint64_t key);
+    void evictTiles(int startShard);
+
+    size_t maxBytes;
+    std::atomic<size_t> residentBytes{0}, peakResidentBytes{0};
+    std::mutex filesMutex;
+    std::vector<std::unique_ptr<TiledTextureFile>> files;
+    std::vector<Shard> shards;
+    std::vector<MicroCache> microCaches;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_UTIL_TEXTURECACHE_H
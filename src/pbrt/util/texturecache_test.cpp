@@ -0,0 +1,239 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/pbrt.h>
+#include <pbrt/util/color.h>
+#include <pbrt/util/colorspace.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/mipmap.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/rng.h>
+#include <pbrt/util/texturecache.h>
+
+#include <cstdio>
+
+using namespace pbrt;
+
+static Image RandomImage(PixelFormat format, Point2i res, int nChannels, RNG &rng,
+                         ColorEncodingHandle encoding = ColorEncodingHandle::sRGB) {
+    std::vector<std::string> channels =
+        nChannels == 1 ? std::vector<std::string>{"Y"}
+                       : std::vector<std::string>{"R", "G", "B"};
+    Image image(format, res, channels, format == PixelFormat::U256 ? encoding : nullptr);
+    for (int y = 0; y < res.y; ++y)
+        for (int x = 0; x < res.x; ++x)
+            for (int c = 0; c < nChannels; ++c)
+                image.SetChannel({x, y}, c, rng.Uniform<Float>());
+    return image;
+}
+
+TEST(TiledTexture, RoundTrip) {
+    RNG rng;
+    std::string filename = TemporaryDirectory() + "/pbrt-test-roundtrip.tex";
+    for (PixelFormat format : {PixelFormat::U256, PixelFormat::Half}) {
+        for (int nChannels : {1, 3}) {
+            Image image = RandomImage(format, {100, 37}, nChannels, rng);
+            pstd::vector<Image> pyramid =
+                Image::GenerateMIPMap(std::move(image), WrapMode::Repeat);
+            ASSERT_TRUE(WriteTiledTexture(filename, pyramid, RGBColorSpace::ACES2065_1,
+                                          WrapMode::Repeat, format, 16));
+
+            std::unique_ptr<TiledTextureFile> file =
+                TiledTextureFile::Open(filename, true);
+            ASSERT_TRUE(file != nullptr);
+            EXPECT_EQ(pyramid.size(), file->Levels());
+            EXPECT_EQ(nChannels, file->NChannels());
+            EXPECT_EQ(format, file->Format());
+            EXPECT_EQ(RGBColorSpace::ACES2065_1, file->ColorSpace());
+            EXPECT_EQ(WrapMode::Repeat, file->GetWrapMode());
+
+            TextureTileCache cache(1 << 20);
+            const TiledTextureFile *f = cache.AddFile(std::move(file));
+            for (int level = 0; level < f->Levels(); ++level) {
+                Point2i res = pyramid[level].Resolution();
+                EXPECT_EQ(res, f->LevelResolution(level));
+                for (int y = 0; y < res.y; ++y)
+                    for (int x = 0; x < res.x; ++x) {
+                        Float values[3];
+                        cache.GetTexel(f, level, {x, y}, values);
+                        for (int c = 0; c < nChannels; ++c)
+                            EXPECT_EQ(pyramid[level].GetChannel({x, y}, c), values[c]);
+                    }
+            }
+        }
+    }
+    // The file is removed when the cache is destroyed
+    EXPECT_EQ(nullptr, fopen(filename.c_str(), "rb"));
+}
+
+TEST(TiledTexture, EightBitEncodings) {
+    RNG rng;
+    std::string filename = TemporaryDirectory() + "/pbrt-test-encodings.tex";
+    for (ColorEncodingHandle encoding :
+         {ColorEncodingHandle::Linear, ColorEncodingHandle::sRGB,
+          ColorEncodingHandle::Get("gamma 2.2")}) {
+        Image image = RandomImage(PixelFormat::U256, {64, 64}, 3, rng, encoding);
+        pstd::vector<Image> pyramid = Image::GenerateMIPMap(image, WrapMode::Clamp);
+        ASSERT_TRUE(WriteTiledTexture(filename, pyramid, RGBColorSpace::sRGB,
+                                      WrapMode::Clamp, PixelFormat::U256, 16));
+        // 8-bit texels take one byte each in the file
+        std::unique_ptr<TiledTextureFile> file = TiledTextureFile::Open(filename, true);
+        ASSERT_TRUE(file != nullptr);
+        EXPECT_EQ(16 * 16 * 3, file->TileBytes());
+        ASSERT_TRUE(file->Map());
+        for (int level = 0; level < file->Levels(); ++level) {
+            Point2i res = pyramid[level].Resolution();
+            for (int y = 0; y < res.y; ++y)
+                for (int x = 0; x < res.x; ++x) {
+                    Float values[3];
+                    file->GetMappedTexel(level, {x, y}, values);
+                    for (int c = 0; c < 3; ++c)
+                        EXPECT_EQ(pyramid[level].GetChannel({x, y}, c), values[c]);
+                }
+        }
+    }
+}
+
+TEST(TiledTexture, Mapped) {
+    RNG rng;
+    std::string filename = TemporaryDirectory() + "/pbrt-test-mapped.tex";
+    Image image = RandomImage(PixelFormat::Half, {300, 20}, 3, rng);
+    pstd::vector<Image> pyramid = Image::GenerateMIPMap(image, WrapMode::Clamp);
+    ASSERT_TRUE(WriteTiledTexture(filename, pyramid, RGBColorSpace::sRGB,
+                                  WrapMode::Clamp, PixelFormat::Half));
+
+    std::unique_ptr<TiledTextureFile> file = TiledTextureFile::Open(filename, true);
+    ASSERT_TRUE(file != nullptr);
+    EXPECT_FALSE(file->IsMapped());
+    ASSERT_TRUE(file->Map());
+    EXPECT_TRUE(file->IsMapped());
+    for (int level = 0; level < file->Levels(); ++level) {
+        Point2i res = pyramid[level].Resolution();
+        for (int y = 0; y < res.y; ++y)
+            for (int x = 0; x < res.x; ++x) {
+                Float values[3];
+                file->GetMappedTexel(level, {x, y}, values);
+                for (int c = 0; c < 3; ++c)
+                    EXPECT_EQ(pyramid[level].GetChannel({x, y}, c), values[c]);
+            }
+    }
+}
+
+TEST(TiledTexture, Truncated) {
+    RNG rng;
+    std::string filename = TemporaryDirectory() + "/pbrt-test-truncated.tex";
+    Image image = RandomImage(PixelFormat::Float, {64, 64}, 1, rng);
+    pstd::vector<Image> pyramid = Image::GenerateMIPMap(image, WrapMode::Clamp);
+    ASSERT_TRUE(
+        WriteTiledTexture(filename, pyramid, RGBColorSpace::sRGB, WrapMode::Clamp));
+    std::string contents = ReadFileContents(filename);
+    ASSERT_TRUE(WriteFile(filename, contents.substr(0, contents.size() - 1)));
+    EXPECT_TRUE(TiledTextureFile::Open(filename) == nullptr);
+    EXPECT_EQ(0, remove(filename.c_str()));
+}
+
+TEST(TiledTexture, ConcurrentWriters) {
+    RNG rng;
+    std::string filename = TemporaryDirectory() + "/pbrt-test-concurrent.tex";
+    Image image = RandomImage(PixelFormat::Float, {128, 128}, 3, rng);
+    pstd::vector<Image> pyramid = Image::GenerateMIPMap(image, WrapMode::Clamp);
+    // Writers of the same file must not overwrite each other's partial output
+    ParallelFor(0, 8, [&](int64_t) {
+        EXPECT_TRUE(WriteTiledTexture(filename, pyramid, RGBColorSpace::sRGB,
+                                      WrapMode::Clamp, PixelFormat::Float, 16));
+    });
+    EXPECT_EQ(1, MatchingFilenames(filename).size());
+    EXPECT_TRUE(TiledTextureFile::Open(filename) != nullptr);
+    EXPECT_EQ(0, remove(filename.c_str()));
+}
+
+TEST(TiledTexture, NotTiled) {
+    std::string filename = TemporaryDirectory() + "/pbrt-test-nottiled.tex";
+    ASSERT_TRUE(WriteFile(filename, "this is not a tiled texture file"));
+    EXPECT_TRUE(TiledTextureFile::Open(filename) == nullptr);
+    EXPECT_EQ(0, remove(filename.c_str()));
+}
+
+TEST(TextureTileCache, BoundedMemory) {
+    RNG rng;
+    Image image = RandomImage(PixelFormat::Float, {256, 256}, 3, rng);
+    pstd::vector<Image> pyramid = Image::GenerateMIPMap(image, WrapMode::Clamp);
+
+    // Allow four 16x16 tiles of RGB floats in addition to the tiles pinned
+    // by the micro-cache
+    size_t tileBytes = 16 * 16 * 3 * sizeof(float);
+    TextureTileCache cache(4 * tileBytes);
+    std::string filename = TemporaryDirectory() + "/pbrt-test-bounded.tex";
+    ASSERT_TRUE(WriteTiledTexture(filename, pyramid, RGBColorSpace::sRGB,
+                                  WrapMode::Clamp, PixelFormat::Float, 16));
+    std::unique_ptr<TiledTextureFile> file = TiledTextureFile::Open(filename, true);
+    ASSERT_TRUE(file != nullptr);
+    const TiledTextureFile *f = cache.AddFile(std::move(file));
+
+    for (int i = 0; i < 10000; ++i) {
+        Point2i p(rng.Uniform<uint32_t>() % 256, rng.Uniform<uint32_t>() % 256);
+        Float values[3];
+        cache.GetTexel(f, 0, p, values);
+        for (int c = 0; c < 3; ++c)
+            EXPECT_EQ(image.GetChannel(p, c), values[c]);
+        EXPECT_LE(cache.ResidentBytes(), 12 * tileBytes);
+    }
+}
+
+TEST(TextureTileCache, MIPMapLookup) {
+    RNG rng;
+    for (int nChannels : {1, 3}) {
+        for (WrapMode wrapMode : {WrapMode::Repeat, WrapMode::Black}) {
+            // Image::GenerateMIPMap() can't resample images with the black
+            // wrap mode to power-of-two resolutions
+            Point2i res =
+                wrapMode == WrapMode::Black ? Point2i(64, 128) : Point2i(67, 130);
+            Image image = RandomImage(PixelFormat::U256, res, nChannels, rng);
+            pstd::vector<Image> pyramid = Image::GenerateMIPMap(image, wrapMode);
+
+            TextureTileCache cache(1 << 16);
+            const TiledTextureFile *f =
+                cache.AddPyramid(pyramid, RGBColorSpace::sRGB, wrapMode);
+            ASSERT_TRUE(f != nullptr);
+            std::string filename = TemporaryDirectory() + "/pbrt-test-mipmap.tex";
+            ASSERT_TRUE(WriteTiledTexture(filename, pyramid, RGBColorSpace::sRGB,
+                                          wrapMode, PixelFormat::Float, 32));
+
+            for (FilterFunction filter :
+                 {FilterFunction::Point, FilterFunction::Bilinear,
+                  FilterFunction::Trilinear, FilterFunction::EWA}) {
+                MIPMapFilterOptions options;
+                options.filter = filter;
+                MIPMap resident(image, RGBColorSpace::sRGB, wrapMode, Allocator(),
+                                options);
+                MIPMap tiled(f, &cache, wrapMode, options);
+                EXPECT_EQ(resident.Levels(), tiled.Levels());
+                std::unique_ptr<MIPMap> mapped =
+                    MIPMap::CreateFromFile(filename, options, wrapMode,
+                                           ColorEncodingHandle::Linear, Allocator());
+                EXPECT_EQ(resident.Levels(), mapped->Levels());
+
+                for (int i = 0; i < 1000; ++i) {
+                    Point2f st(-0.5f + 2 * rng.Uniform<Float>(),
+                               -0.5f + 2 * rng.Uniform<Float>());
+                    Vector2f dst0(0.1f * rng.Uniform<Float>(), 0),
+                        dst1(0.02f * rng.Uniform<Float>(), 0.1f * rng.Uniform<Float>());
+                    Float v = resident.Lookup<Float>(st, dst0, dst1);
+                    EXPECT_EQ(v, tiled.Lookup<Float>(st, dst0, dst1));
+                    EXPECT_EQ(v, mapped->Lookup<Float>(st, dst0, dst1));
+                    RGB r = resident.Lookup<RGB>(st, dst0, dst1);
+                    RGB t = tiled.Lookup<RGB>(st, dst0, dst1);
+                    RGB m = mapped->Lookup<RGB>(st, dst0, dst1);
+                    for (int c = 0; c < 3; ++c) {
+                        EXPECT_EQ(r[c], t[c]);
+                        EXPECT_EQ(r[c], m[c]);
+                    }
+                }
+            }
+            EXPECT_EQ(0, remove(filename.c_str()));
+        }
+    }
+}
@@ -0,0 +1,148 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/util/trace.h>
+
+#include <pbrt/util/check.h>
+#include <pbrt/util/error.h>
+#include <pbrt/util/log.h>
+#include <pbrt/util/parallel.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace pbrt {
+
+namespace detail {
+
+std::atomic<bool> tracingEnabled{false};
+
+}  // namespace detail
+
+// TraceEvent Definition
+struct TraceEvent {
+    const char *name, *argName;
+    int64_t arg;
+    int64_t startNs, endNs;
+};
+
+// TraceBuffer Definition
+struct TraceBuffer {
+    TraceBuffer(int threadIndex, int capacity)
+        : threadIndex(threadIndex), events(capacity) {}
+
+    int threadIndex;
+    std::vector<TraceEvent> events;
+    // Total number of events recorded; older events are overwritten once
+    // this exceeds the buffer's capacity.
+    int64_t nRecorded = 0;
+};
+
+// Tracing Local Variables
+static std::mutex traceMutex;
+static std::vector<std::unique_ptr<TraceBuffer>> traceBuffers;
+static int traceEventsPerThread;
+static int64_t traceStartNs;
+// Incremented when the buffers are freed so that threads allocate new ones
+static std::atomic<int> traceGeneration{0};
+static thread_local TraceBuffer *threadTraceBuffer;
+static thread_local int threadTraceGeneration = -1;
+
+// Tracing Function Definitions
+void EnableTracing(int eventsPerThread) {
+    CHECK_GT(eventsPerThread, 0);
+    std::lock_guard<std::mutex> lock(traceMutex);
+    if (traceBuffers.empty())
+        traceStartNs = detail::TraceTimeNs();
+    traceEventsPerThread = eventsPerThread;
+    detail::tracingEnabled = true;
+}
+
+void DisableTracing() {
+    detail::tracingEnabled = false;
+}
+
+void ClearTrace() {
+    std::lock_guard<std::mutex> lock(traceMutex);
+    traceBuffers.clear();
+    ++traceGeneration;
+    traceStartNs = detail::TraceTimeNs();
+}
+
+void detail::RecordTraceEvent(const char *name, int64_t startNs, int64_t endNs,
+                              const char *argName, int64_t arg) {
+    if (threadTraceGeneration != traceGeneration.load(std::memory_order_relaxed)) {
+        // Allocate trace buffer for the current thread
+        std::lock_guard<std::mutex> lock(traceMutex);
+        traceBuffers.push_back(
+            std::make_unique<TraceBuffer>(ThreadIndex, traceEventsPerThread));
+        threadTraceBuffer = traceBuffers.back().get();
+        threadTraceGeneration = traceGeneration;
+    }
+
+    TraceBuffer *buffer = threadTraceBuffer;
+    int64_t index = buffer->nRecorded++ % buffer->events.size();
+    buffer->events[index] = TraceEvent{name, argName, arg, startNs, endNs};
+}
+
+bool WriteTrace(const std::string &filename) {
+    std::lock_guard<std::mutex> lock(traceMutex);
+    FILE *f = fopen(filename.c_str(), "w");
+    if (!f) {
+        Error("%s: unable to open trace file: %s", filename, ErrorString());
+        return false;
+    }
+
+    fprintf(f, "{\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,"
+               "\"args\":{\"name\":\"pbrt\"}}");
+    int64_t nDropped = 0, nWritten = 0;
+    for (size_t tid = 0; tid < traceBuffers.size(); ++tid) {
+        const TraceBuffer &buffer = *traceBuffers[tid];
+        fprintf(f,
+                ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%zu,"
+                "\"args\":{\"name\":\"Thread %d\"}}",
+                tid, buffer.threadIndex);
+        fprintf(f,
+                ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":0,"
+                "\"tid\":%zu,\"args\":{\"sort_index\":%d}}",
+                tid, buffer.threadIndex);
+
+        // Write thread's events, oldest first
+        int64_t capacity = buffer.events.size();
+        int64_t first = std::max<int64_t>(0, buffer.nRecorded - capacity);
+        nDropped += first;
+        for (int64_t i = first; i < buffer.nRecorded; ++i) {
+            const TraceEvent &event = buffer.events[i % capacity];
+            fprintf(f,
+                    ",\n{\"name\":\"%s\",\"cat\":\"pbrt\",\"ph\":\"X\",\"pid\":0,"
+                    "\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f",
+                    event.name, tid, (event.startNs - traceStartNs) / 1000.,
+                    (event.endNs - event.startNs) / 1000.);
+            if (event.argName)
+                fprintf(f, ",\"args\":{\"%s\":%lld}", event.argName,
+                        (long long)event.arg);
+            fprintf(f, "}");
+            ++nWritten;
+        }
+    }
+    fprintf(f, "\n],\n\"displayTimeUnit\":\"ms\",\n");
+    fprintf(f, "\"otherData\":{\"droppedEvents\":%lld}}\n", (long long)nDropped);
+
+    if (fclose(f) != 0) {
+        Error("%s: error writing trace file: %s", filename, ErrorString());
+        return false;
+    }
+    LOG_VERBOSE("Wrote %d trace events (%d dropped) to %s", nWritten, nDropped,
+                filename);
+    if (nDropped > 0)
+        Warning("%s: %d of the oldest trace events were dropped.", filename, nDropped);
+    return true;
+}
+
+}  // namespace pbrt
@@ -0,0 +1,78 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#ifndef PBRT_UTIL_TRACE_H
+#define PBRT_UTIL_TRACE_H
+
+#include <pbrt/pbrt.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace pbrt {
+
+// Tracing Function Declarations
+// Trace events are recorded in a fixed-size ring buffer for each thread, so
+// only the most recent _eventsPerThread_ events of each thread are kept.
+void EnableTracing(int eventsPerThread = 1 << 17);
+void DisableTracing();
+// Writes the recorded events in the Chrome JSON trace format, which can be
+// viewed with Perfetto or chrome://tracing.
+bool WriteTrace(const std::string &filename);
+void ClearTrace();
+
+namespace detail {
+
+extern std::atomic<bool> tracingEnabled;
+
+inline int64_t TraceTimeNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void RecordTraceEvent(const char *name, int64_t startNs, int64_t endNs,
+                      const char *argName, int64_t arg);
+
+}  // namespace detail
+
+// TraceScope Definition
+// Records a trace event spanning the TraceScope's lifetime if tracing is
+// enabled. _name_ and _argName_ must remain valid until the trace is
+// written; string literals are expected.
+class TraceScope {
+  public:
+    // TraceScope Public Methods
+    TraceScope(const char *name, const char *argName = nullptr, int64_t arg = 0) {
+        if (!detail::tracingEnabled.load(std::memory_order_relaxed))
+            return;
+        this->name = name;
+        this->argName = argName;
+        this->arg = arg;
+        startNs = detail::TraceTimeNs();
+    }
+    ~TraceScope() {
+        if (name)
+            detail::RecordTraceEvent(name, startNs, detail::TraceTimeNs(), argName, arg);
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+  private:
+    // TraceScope Private Members
+    const char *name = nullptr, *argName = nullptr;
+    int64_t arg = 0, startNs = 0;
+};
+
+#define PBRT_TRACE_CONCAT2(a, b) a##b
+#define PBRT_TRACE_CONCAT(a, b) PBRT_TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(...) \
+    TraceScope PBRT_TRACE_CONCAT(traceScope, __LINE__)(__VA_ARGS__)
+
+}  // namespace pbrt
+
+#endif  // PBRT_UTIL_TRACE_H
@@ -0,0 +1,73 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/pbrt.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/trace.h>
+
+#include <cstdio>
+#include <string>
+
+using namespace pbrt;
+
+static int CountOccurrences(const std::string &str, const std::string &pattern) {
+    int count = 0;
+    for (size_t pos = str.find(pattern); pos != std::string::npos;
+         pos = str.find(pattern, pos + 1))
+        ++count;
+    return count;
+}
+
+TEST(Trace, Disabled) {
+    { TRACE_SCOPE("Not recorded"); }
+
+    std::string filename = TemporaryDirectory() + "/pbrt-test-trace-disabled.json";
+    EXPECT_TRUE(WriteTrace(filename));
+    std::string contents = ReadFileContents(filename);
+    EXPECT_EQ(0, CountOccurrences(contents, "\"ph\":\"X\""));
+    std::remove(filename.c_str());
+}
+
+TEST(Trace, ParallelEvents) {
+    EnableTracing();
+    ParallelFor(0, 100, [](int64_t i) { TRACE_SCOPE("Test event", "index", i); });
+    DisableTracing();
+    { TRACE_SCOPE("Not recorded"); }
+
+    std::string filename = TemporaryDirectory() + "/pbrt-test-trace-parallel.json";
+    EXPECT_TRUE(WriteTrace(filename));
+    ClearTrace();
+    std::string contents = ReadFileContents(filename);
+    std::remove(filename.c_str());
+
+    EXPECT_EQ(100, CountOccurrences(contents, "\"name\":\"Test event\""));
+    EXPECT_EQ(0, CountOccurrences(contents, "Not recorded"));
+    EXPECT_EQ(1, CountOccurrences(contents, "\"args\":{\"index\":42}"));
+    EXPECT_GE(CountOccurrences(contents, "\"name\":\"thread_name\""), 1);
+    EXPECT_EQ(1, CountOccurrences(contents, "\"droppedEvents\":0}"));
+}
+
+TEST(Trace, RingBufferKeepsNewest) {
+    EnableTracing(8);
+    for (int i = 0; i < 20; ++i)
+        TRACE_SCOPE("Event", "index", i);
+    DisableTracing();
+
+    std::string filename = TemporaryDirectory() + "/pbrt-test-trace-ring.json";
+    EXPECT_TRUE(WriteTrace(filename));
+    ClearTrace();
+    std::string contents = ReadFileContents(filename);
+    std::remove(filename.c_str());
+
+    EXPECT_EQ(8, CountOccurrences(contents, "\"name\":\"Event\""));
+    for (int i = 0; i < 20; ++i)
+        EXPECT_EQ(i >= 12 ? 1 : 0,
+                  CountOccurrences(contents,
+                                   "\"args\":{\"index\":" + std::to_string(i) + "}"))
+            << i;
+    EXPECT_EQ(1, CountOccurrences(contents, "\"droppedEvents\":12}"));
+}